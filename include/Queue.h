@@ -34,6 +34,7 @@
                         Added "printqueue" function for debugging purposes.
                         Added "copy" function for MQTT FIFO loading structure pass by value instead of referencing and modifying working structure during publish loop.
                            This allows for a less volatile shared resource and eliminates possible race conditions.
+                        Fixed overwrite-at-capacity and copy so entries always come out in the order they were pushed (needed for spectral analysis).
 */
 
 
@@ -119,10 +120,10 @@ void Queue<T>::push(const T &item)
   //new code to delete oldest entry if queue is full (actually overwrites the entry)
   else if (_count >= _maxitems)
   {
-    //count stays the same
+    //count stays the same, the free slot at _back takes the new item and the oldest item is dropped
 
+    _data[_back++] = item;
     _front++;
-    _back++;
 
     // Check wrap around for front and back
     if (_front > _maxitems)
@@ -130,8 +131,6 @@ void Queue<T>::push(const T &item)
     if (_back > _maxitems)
       _back -= (_maxitems + 1);
 
-    _data[_back] = item;
-
   }
 }
 
@@ -175,12 +174,12 @@ void Queue<T>::clear()
 
 
 
-//Copies self._data into target. T cannot be char* or const char*
+//Copies self._data into target, oldest entry first. T cannot be char* or const char*
 template<class T>
 void Queue<T>::copy(Queue<T>* target){
   target->clear();
   for (int i=0;i<_count;i++)
-    target->push(_data[i]);
+    target->push(_data[(_front + i) % (_maxitems + 1)]);
     
 }
 
@@ -0,0 +1,69 @@
+#ifndef BASELINE_H
+#define BASELINE_H
+
+#include "externals.h"
+
+
+
+////////////////////Baseline Constants////////////////////
+
+#define BASELINE_EWMA_SHIFT 10  //EWMA weight 1/2^10, a time constant of 1024 readings
+#define BASELINE_MEDIAN_WINDOW 15  //Readings the running median is taken over (odd)
+#define BASELINE_DECIMATE 64  //Readings between median window entries, and between refreshes of baselineThresholds
+
+
+
+////////////////////Baseline Externs////////////////////
+
+extern int32_t baselineLimits[CHANNEL_COUNT];  //Raw count each triggering channel has to pass, written by VTC_TASK
+extern float baselineThresholds[CHANNEL_COUNT];  //Same limits in calibrated units, refreshed every BASELINE_DECIMATE readings
+
+
+
+////////////////////Baseline Functions////////////////////
+
+/* FUNCTION NAME: Baseline Init
+ * PURPOSE: Prepares baseline tracking for globalTriggerMode and globalBaselineTracker
+ * ACTION: Converts the channel thresholds (a delta in calibrated units for TRIGGER_DELTA, a fraction of the baseline for
+ *         TRIGGER_RATIO) into an integer gain and offset on raw counts, and forgets the tracked baseline. The first reading
+ *         seeds it. Called from setup() after loadCaptureConfig, and before each trace replay of
+ *         test_replay so it starts from the trace
+ */
+void baselineInit();
+
+/* FUNCTION NAME: Baseline Update
+ * PURPOSE: Tracks the baseline of every channel with one more reading. Called by VTC_TASK outside the override window
+ * ACTION: BASELINE_EWMA: integer EWMA, a subtract, a shift and an add per channel. BASELINE_MEDIAN: median of the last
+ *         BASELINE_MEDIAN_WINDOW readings taken every BASELINE_DECIMATE, kept sorted by insertion, so it ignores
+ *         transients entirely. Either way the raw limits are recomputed with one multiply per triggering channel
+ */
+void baselineUpdate(const uint16_t* values);
+
+/* FUNCTION NAME: Baseline Counts
+ * PURPOSE: Current baseline of every channel in raw counts, stored with each event by captureStep
+ */
+const uint16_t* baselineCounts();
+
+/* FUNCTION NAME: Event Threshold
+ * PURPOSE: Calibrated threshold channel c of an event was triggered against, from the baseline stored with it
+ * ACTION: scale (if not NULL) is set to the size of the threshold used to express severity: the absolute threshold for
+ *         TRIGGER_ABSOLUTE, the delta or the ratio times the baseline otherwise (1 if that is 0)
+ */
+float eventThreshold(const EventBuffer& event, int c, float* scale);
+
+
+/* FUNCTION NAME: Capture Triggered
+ * PURPOSE: Trigger check of captureStep in the configured mode
+ * ACTION: TRIGGER_ABSOLUTE compares calibrated values with globalThresholds, the baseline modes compare raw counts with
+ *         baselineLimits, both unrolled per channel by ChannelSet
+ */
+inline bool captureTriggered(const uint16_t* values)
+{
+  if(globalTriggerMode == TRIGGER_ABSOLUTE)
+    return ChannelSet<CHANNEL_COUNT>::triggered(values);
+  return ChannelSet<CHANNEL_COUNT>::triggeredRaw(values, baselineLimits);
+}
+
+
+
+#endif
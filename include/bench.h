@@ -0,0 +1,38 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "externals.h"
+
+
+
+////////////////////Benchmark Constants////////////////////
+
+#define BENCH_ITERATIONS 1000  //Operations timed per benchmark (after BENCH_ITERATIONS/10 warmup operations)
+#define BENCH_FFT_ITERATIONS 50  //Operations timed per FFT length, each one is a whole event
+#define BENCH_STEPS 10  //benchStep calls a benchmark's timed operations are spread over, the warmup takes one more
+
+
+
+////////////////////Benchmark Functions////////////////////
+
+/* FUNCTION NAME: Bench Start
+ * PURPOSE: Starts timing the firmware's hot functions, ns/op and allocations/op for each. A run already in progress starts over
+ * ACTION: Builds the inputs (a synthetic reading, a full event, a CNFG-sized command) once, outside any timed region. The
+ *         benchmarks never touch the command queue or the sampler's state. Allocation counts need the esp32dev-bench
+ *         environment (BENCH_ENABLED plus the malloc/calloc/realloc linker wraps), otherwise nothing runs and false is
+ *         returned so the command is answered with STATUS "ERROR"
+ */
+bool benchStart(NetworkObject& object);
+
+/* FUNCTION NAME: Bench Step
+ * PURPOSE: Called on every MQTT_TASK iteration, runs a tenth of the current benchmark (or its warmup) so keepalives and
+ *          event publishing carry on between the chunks. Returns true while a run is in progress
+ * ACTION: Each finished benchmark is printed to Serial and published on publishTopicInfo as one JSON object per line, e.g.
+ *         {"BENCH":"capture_push","VERSION":"1.1","ITER":1000,"NS":85,"ALLOCS":0.00}, so runs can be diffed against a
+ *         stored baseline
+ */
+bool benchStep();
+
+
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef BROKER_H
+#define BROKER_H
+
+#include "externals.h"
+
+
+
+////////////////////Broker Constants////////////////////
+
+#define BROKER_MAX 4  //Brokers accepted in the MQTT config key, in order of preference
+#define BROKER_ADDRESS_SIZE 22  //"255.255.255.255:65535" plus terminator
+#define BROKER_LIST_SIZE (BROKER_MAX * BROKER_ADDRESS_SIZE)  //Whole list as published in the ping
+#define BROKER_FAILOVER_MS 10000  //Default FAILOVER: time spent retrying one broker before moving on to the next
+#define BROKER_RETRY_MS 1000  //Pause between connection attempts
+#define BROKER_PROBE_MS 15000  //Interval at which brokers preferred over the active one are probed
+#define BROKER_PROBE_TIMEOUT_S 1  //TCP connect and CONNACK timeout of one probe
+#define BROKER_RECOVER_PROBES 3  //Consecutive good probes before the connection moves back to a preferred broker
+
+
+
+////////////////////Broker Types////////////////////
+
+/* STRUCT NAME: Broker
+ * PURPOSE: One entry of the broker list
+ */
+struct Broker
+{
+  IPAddress address;
+  uint16_t port;  //MQTT_PORT unless the entry gave one
+};
+
+
+/* STRUCT NAME: Broker Stats
+ * PURPOSE: Per-broker counters, since boot
+ */
+struct BrokerStats
+{
+  uint32_t connects;  //Sessions established
+  uint32_t connectFailures;  //Connection attempts that failed
+  uint32_t published;  //Messages published while it was the active broker
+  uint32_t publishFailures;
+  uint8_t goodProbes;  //Consecutive successful probes, written by PROBE_TASK
+  bool up;  //Last known health: connected, or the last probe got a CONNACK
+};
+
+
+/* STRUCT NAME: Failover Stats
+ * PURPOSE: Switches between brokers, since boot
+ */
+struct FailoverStats
+{
+  uint32_t failovers;  //Connections made to another broker than the one that was lost
+  uint32_t recoveries;  //Moves back to a preferred broker after it recovered
+  uint32_t lastMillis;  //Time from losing the connection until connected to another broker, last failover
+  uint32_t maxMillis;  //Same, longest failover
+};
+
+
+extern Broker brokers[BROKER_MAX];
+extern int brokerCount;
+extern BrokerStats brokerStats[BROKER_MAX];
+extern FailoverStats failoverStats;
+
+
+
+////////////////////Broker Functions////////////////////
+
+/* FUNCTION NAME: Broker Parse
+ * PURPOSE: Fills the broker list from the MQTT config value, addresses separated by commas, each optionally followed by
+ *          :port, most preferred first (e.g. "10.0.0.5,10.0.0.6:1884"). Entries past BROKER_MAX are ignored
+ */
+void brokerParse(const char* list);
+
+/* FUNCTION NAME: Broker List
+ * PURPOSE: The reverse of brokerParse, for the ping
+ */
+const char* brokerList(char* buffer, size_t size);
+
+/* FUNCTION NAME: Broker Active Address
+ * PURPOSE: Address and port of the broker in use, for the ping
+ */
+const char* brokerActiveAddress(char* buffer, size_t size);
+
+/* FUNCTION NAME: Broker Connect
+ * PURPOSE: Connection manager, called by reconnect. Blocks until a session is established with one of the brokers
+ * ACTION: Retries the active broker every BROKER_RETRY_MS. Once it has failed for FAILOVER ms the next broker in the list
+ *         is tried, wrapping around to the first. The time from the call to a session with another broker is recorded
+ *         as the time to failover
+ */
+void brokerConnect();
+
+/* FUNCTION NAME: Broker Start
+ * PURPOSE: Starts PROBE_TASK once MQTT_TASK is connected, if more than one broker is configured
+ * ACTION: While a backup broker is active, PROBE_TASK (core 0, priority 0) connects to every broker preferred over it
+ *         every BROKER_PROBE_MS with its own client and client ID (<client ID>-probe) and disconnects on CONNACK, so a
+ *         probe never blocks MQTT_TASK or touches its session
+ */
+void brokerStart();
+
+/* FUNCTION NAME: Broker Step
+ * PURPOSE: Moves back to a preferred broker once it has answered BROKER_RECOVER_PROBES probes in a row. Called by MQTT_TASK
+ * ACTION: Drops the session with the backup, so the next loop reconnects (and resends unacknowledged events) through
+ *         brokerConnect starting at the recovered broker
+ */
+void brokerStep();
+
+/* FUNCTION NAME: Broker Published
+ * PURPOSE: Counts one published message against the active broker
+ */
+void brokerPublished(bool published);
+
+/* FUNCTION NAME: Generate Broker Stats
+ * PURPOSE: Appends "BROKER":<active index>,"BROKERS":[["address",up,connects,connect failures,published,publish failures],..],
+ *          "FAILOVER":[failovers,recoveries,last ms,max ms] to a STATS reply. Returns the new length
+ */
+int generateBrokerStats(char* buffer, int length, size_t size);
+
+
+
+#endif
@@ -0,0 +1,351 @@
+#ifndef CHANNELS_H
+#define CHANNELS_H
+
+#include "config.h"
+
+
+
+////////////////////Channel Types////////////////////
+
+/* ENUM NAME: Trigger Role
+ * PURPOSE: How a channel takes part in excursion detection
+ */
+enum TriggerRole
+{
+  TRIGGER_NONE,  //Recorded only
+  TRIGGER_ABOVE,  //Starts an event when its value rises above its threshold
+  TRIGGER_BELOW  //Starts an event when its value falls below its threshold (sagging rails)
+};
+
+
+/* ENUM NAME: Trigger Mode
+ * PURPOSE: What a channel threshold is measured from, selected with the TRIGMODE config key
+ */
+enum TriggerMode
+{
+  TRIGGER_ABSOLUTE,  //Threshold is an absolute value (default)
+  TRIGGER_DELTA,  //Threshold is a distance from the tracked baseline, in calibrated units
+  TRIGGER_RATIO  //Threshold is a fraction of the tracked baseline, e.g. 0.05 for 5% above (or below) it
+};
+
+
+/* ENUM NAME: Baseline Tracker
+ * PURPOSE: How the baseline of TRIGGER_DELTA/TRIGGER_RATIO is tracked, selected with the BASELINE config key
+ */
+enum BaselineTracker
+{
+  BASELINE_EWMA,  //Integer exponentially weighted moving average (default)
+  BASELINE_MEDIAN  //Running median of decimated readings
+};
+
+
+/* STRUCT NAME: Channel Descriptor
+ * PURPOSE: Compile-time description of one monitored line, listed in CHANNEL_DESCRIPTORS (config.h)
+ */
+struct ChannelDescriptor
+{
+  const char* name;  //JSON key of the value in Data entries
+  const char* field;  //Field name in FORMAT_INFLUX
+  uint8_t pin;  //Analog input
+  float scale;  //Calibration, value = raw * scale + offset
+  float offset;
+  TriggerRole trigger;
+  const char* thresholdKey;  //Config key holding the threshold, NULL for TRIGGER_NONE channels
+  float defaultThreshold;  //Threshold used until the config sets one
+};
+
+
+constexpr ChannelDescriptor CHANNELS[] = { CHANNEL_DESCRIPTORS };
+constexpr int CHANNEL_COUNT = sizeof(CHANNELS) / sizeof(CHANNELS[0]);
+
+extern float globalThresholds[CHANNEL_COUNT];  //Per-channel trigger thresholds in calibrated units, see loadCaptureConfig
+
+
+
+////////////////////Sample////////////////////
+
+/* STRUCT NAME: Sample
+ * PURPOSE: One timestamped raw reading of every channel. Entries are only formatted when they are published
+ */
+struct Sample
+{
+  uint32_t seconds;  //deviceTime() at the time of the reading (device local time)
+  uint64_t micros;  //esp_timer_get_time() at the time of the reading, 64-bit so it never wraps (micros() does every ~71.6 min)
+  uint32_t fraction;  //Microseconds elapsed within `seconds`, used for nanosecond timestamps
+  uint16_t counter;  //globalTimeCounter at the time of the reading
+  uint16_t values[CHANNEL_COUNT];  //Raw ADC counts, in CHANNEL_DESCRIPTORS order
+};
+
+
+
+////////////////////Channel Functions////////////////////
+
+/* FUNCTION NAME: Channel Value
+ * PURPOSE: Applies a channel's calibration to raw ADC counts
+ */
+inline float channelValue(int channel, uint16_t raw)
+{
+  return raw * CHANNELS[channel].scale + CHANNELS[channel].offset;
+}
+
+
+/* STRUCT NAME: Channel Set
+ * PURPOSE: Per-channel sampling and trigger code generated from CHANNEL_DESCRIPTORS
+ * ACTION: ChannelSet<CHANNEL_COUNT> unrolls at compile time into one analogRead per pin and one comparison per triggering
+ *         channel, with pins, roles and calibration as constants. TRIGGER_NONE channels generate no trigger code.
+ *         triggeredRaw() is the same check against per-channel limits in raw counts (baseline-relative triggering), in the
+ *         direction the calibration scale gives. approaching() is true when a triggering channel is within margin (fraction
+ *         of its threshold) of tripping, either now or after `lookahead` more readings at its current slope
+ */
+template<int C>
+struct ChannelSet
+{
+  static inline void read(uint16_t* values)
+  {
+    ChannelSet<C - 1>::read(values);
+    values[C - 1] = analogRead(CHANNELS[C - 1].pin);
+  }
+
+  static inline bool triggered(const uint16_t* values)
+  {
+    constexpr TriggerRole role = CHANNELS[C - 1].trigger;
+
+    if(ChannelSet<C - 1>::triggered(values))
+      return true;
+    if(role == TRIGGER_ABOVE)
+      return channelValue(C - 1, values[C - 1]) > globalThresholds[C - 1];
+    if(role == TRIGGER_BELOW)
+      return channelValue(C - 1, values[C - 1]) < globalThresholds[C - 1];
+    return false;
+  }
+
+  static inline bool triggeredRaw(const uint16_t* values, const int32_t* limits)
+  {
+    constexpr TriggerRole role = CHANNELS[C - 1].trigger;
+    constexpr bool rising = (role == TRIGGER_ABOVE) == (CHANNELS[C - 1].scale > 0);
+
+    if(ChannelSet<C - 1>::triggeredRaw(values, limits))
+      return true;
+    if(role == TRIGGER_NONE)
+      return false;
+    return rising ? values[C - 1] > limits[C - 1] : values[C - 1] < limits[C - 1];
+  }
+
+  static inline bool approaching(const uint16_t* values, const uint16_t* previous, const float* thresholds, float margin, float lookahead)
+  {
+    constexpr TriggerRole role = CHANNELS[C - 1].trigger;
+
+    if(ChannelSet<C - 1>::approaching(values, previous, thresholds, margin, lookahead))
+      return true;
+    if(role == TRIGGER_NONE)
+      return false;
+
+    float value = channelValue(C - 1, values[C - 1]);
+    float projected = value + (value - channelValue(C - 1, previous[C - 1])) * lookahead;
+    float band = fabsf(thresholds[C - 1]) * margin;
+
+    if(role == TRIGGER_ABOVE)
+      return fmaxf(value, projected) > thresholds[C - 1] - band;
+    return fminf(value, projected) < thresholds[C - 1] + band;
+  }
+};
+
+template<>
+struct ChannelSet<0>
+{
+  static inline void read(uint16_t* values) {}
+  static inline bool triggered(const uint16_t* values) { return false; }
+  static inline bool triggeredRaw(const uint16_t* values, const int32_t* limits) { return false; }
+  static inline bool approaching(const uint16_t* values, const uint16_t* previous, const float* thresholds, float margin, float lookahead) { return false; }
+};
+
+
+
+////////////////////Context Snapshot////////////////////
+
+/* STRUCT NAME: Context Snapshot
+ * PURPOSE: Decimated history of the CONTEXT_BUCKETS * CONTEXT_BUCKET_MS before an event: the lowest and highest raw count
+ *          of every channel per bucket, oldest bucket first. The newest bucket is the one the trigger fell in, cut short
+ *          at the trigger. A bucket no reading fell in has min > max
+ */
+template<int N>
+struct ContextSnapshot
+{
+  uint32_t newestStart;  //micros() the newest bucket started at, relates the buckets to the event's sample timestamps
+  uint16_t buckets;  //Buckets in use, fewer than CONTEXT_BUCKETS until the device has run that long
+  uint16_t min[CONTEXT_BUCKETS][N];
+  uint16_t max[CONTEXT_BUCKETS][N];
+};
+
+
+
+////////////////////Event Trace////////////////////
+
+/* STRUCT NAME: Event Trace
+ * PURPOSE: micros() at each stage boundary an event crosses on its way to the broker, filled in by the stage that ends
+ *          there. trigger is 0 for an event that is not traced (later blocks of a long event, resends)
+ */
+struct EventTrace
+{
+  uint32_t trigger;  //Reading that crossed the threshold was taken (SAMPLER_TASK)
+  uint32_t captured;  //Override loop done, about to hand over (VTC_TASK)
+  uint32_t stored;  //Mutex taken, going into the store (VTC_TASK)
+  uint32_t encoded;  //Taken from the store and encoded (ENCODE_TASK)
+  uint8_t injected;  //TRACE run (1-255) whose injection was the triggering reading, 0 for a real transient
+};
+
+
+
+////////////////////Capture Buffer////////////////////
+
+/* CLASS NAME: Capture Buffer
+ * PURPOSE: Fixed-size buffer of readings laid out structure-of-arrays, so scanning one channel (FFT, trigger statistics)
+ *          walks one contiguous array instead of striding over whole readings
+ * ACTION: Used as the rolling capture ring (push overwrites the oldest reading when full) and as the event handed to
+ *         MQTT_TASK. copyTo writes the readings oldest first from index 0, after which channel() is in capture order
+ */
+template<int N, int LENGTH>
+class CaptureBuffer
+{
+  private:
+    int _front, _count;
+    uint16_t _block;
+    uint32_t _sequence;
+    uint16_t _baseline[N];
+    ContextSnapshot<N> _context;
+    EventTrace _trace;
+    uint32_t _seconds[LENGTH];
+    uint64_t _micros[LENGTH];
+    uint32_t _fraction[LENGTH];
+    uint16_t _counter[LENGTH];
+    uint16_t _values[N][LENGTH];
+
+    inline int slot(int i) const { return (_front + i) % LENGTH; }
+    void store(int s, const Sample& sample);
+
+  public:
+    CaptureBuffer() : _front(0), _count(0), _block(0), _sequence(0), _baseline(), _trace() { _context.buckets = 0; }
+
+    inline int count() const { return _count; }
+    inline void clear() { _front = 0; _count = 0; _block = 0; memset(_baseline, 0, sizeof(_baseline)); _context.buckets = 0; _trace = EventTrace(); }
+    inline uint16_t block() const { return _block; }  //Position within a long event, 0 for the block holding the trigger
+    inline void setBlock(uint16_t block) { _block = block; }
+    inline uint32_t sequence() const { return _sequence; }  //Event sequence number, assigned by handOverEvent before the event is queued or fanned out
+    inline void setSequence(uint32_t sequence) { _sequence = sequence; }
+    inline uint16_t baseline(int c) const { return _baseline[c]; }  //Baseline of channel c in raw counts when the event triggered
+    inline void setBaseline(const uint16_t* baseline) { memcpy(_baseline, baseline, sizeof(_baseline)); }
+    inline const ContextSnapshot<N>& context() const { return _context; }  //Decimated readings before the trigger
+    inline ContextSnapshot<N>& context() { return _context; }  //Filled in place by contextSnapshot when the event triggers
+    inline const EventTrace& trace() const { return _trace; }  //Stage timestamps, for the latency counters (trace.h)
+    inline EventTrace& trace() { return _trace; }  //Stamped in place by each stage
+    inline uint32_t seconds(int i) const { return _seconds[slot(i)]; }
+    inline uint64_t micros(int i) const { return _micros[slot(i)]; }
+    inline uint16_t value(int channel, int i) const { return _values[channel][slot(i)]; }
+    inline const uint16_t* channel(int channel) const { return _values[channel]; }  //Capture order only once copied
+
+    void push(const Sample& sample);
+    void set(int i, const Sample& sample);
+    Sample at(int i) const;
+    void copyTo(CaptureBuffer& target) const;
+};
+
+
+
+template<int N, int LENGTH>
+void CaptureBuffer<N, LENGTH>::push(const Sample& sample)
+{
+  int back;
+  if(_count < LENGTH)
+    back = slot(_count++);
+  else
+  {
+    //Full, the oldest reading is overwritten
+    back = _front;
+    _front = (_front + 1) % LENGTH;
+  }
+
+  store(back, sample);
+}
+
+
+
+template<int N, int LENGTH>
+void CaptureBuffer<N, LENGTH>::set(int i, const Sample& sample)
+{
+  store(slot(i), sample);
+}
+
+
+
+template<int N, int LENGTH>
+void CaptureBuffer<N, LENGTH>::store(int s, const Sample& sample)
+{
+  _seconds[s] = sample.seconds;
+  _micros[s] = sample.micros;
+  _fraction[s] = sample.fraction;
+  _counter[s] = sample.counter;
+  for(int c = 0; c < N; c++)
+    _values[c][s] = sample.values[c];
+}
+
+
+
+template<int N, int LENGTH>
+Sample CaptureBuffer<N, LENGTH>::at(int i) const
+{
+  Sample sample;
+  int s = slot(i);
+  sample.seconds = _seconds[s];
+  sample.micros = _micros[s];
+  sample.fraction = _fraction[s];
+  sample.counter = _counter[s];
+  for(int c = 0; c < N; c++)
+    sample.values[c] = _values[c][s];
+  return sample;
+}
+
+
+
+//Copies the readings oldest first into target, starting at index 0
+template<int N, int LENGTH>
+void CaptureBuffer<N, LENGTH>::copyTo(CaptureBuffer& target) const
+{
+  //At most two contiguous runs per array, the tail of the ring and its wrapped head
+  int first = _count < LENGTH - _front ? _count : LENGTH - _front;
+  int second = _count - first;
+
+  memcpy(target._seconds, _seconds + _front, first * sizeof(uint32_t));
+  memcpy(target._seconds + first, _seconds, second * sizeof(uint32_t));
+  memcpy(target._micros, _micros + _front, first * sizeof(uint64_t));
+  memcpy(target._micros + first, _micros, second * sizeof(uint64_t));
+  memcpy(target._fraction, _fraction + _front, first * sizeof(uint32_t));
+  memcpy(target._fraction + first, _fraction, second * sizeof(uint32_t));
+  memcpy(target._counter, _counter + _front, first * sizeof(uint16_t));
+  memcpy(target._counter + first, _counter, second * sizeof(uint16_t));
+  for(int c = 0; c < N; c++)
+  {
+    memcpy(target._values[c], _values[c] + _front, first * sizeof(uint16_t));
+    memcpy(target._values[c] + first, _values[c], second * sizeof(uint16_t));
+  }
+
+  target._front = 0;
+  target._count = _count;
+  target._block = _block;
+  target._sequence = _sequence;
+  memcpy(target._baseline, _baseline, sizeof(_baseline));
+  target._trace = _trace;
+
+  //Only the buckets in use
+  target._context.newestStart = _context.newestStart;
+  target._context.buckets = _context.buckets;
+  memcpy(target._context.min, _context.min, _context.buckets * sizeof(_context.min[0]));
+  memcpy(target._context.max, _context.max, _context.buckets * sizeof(_context.max[0]));
+}
+
+
+
+typedef CaptureBuffer<CHANNEL_COUNT, QUEUE_RANGE> EventBuffer;  //One event (or one block of a long event): the QUEUE_RANGE readings around an excursion
+
+
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef COMMANDS_H
+#define COMMANDS_H
+
+#include "externals.h"
+
+
+
+////////////////////Command Constants////////////////////
+
+#define COMMAND_QUEUE_SIZE 8  //Commands waiting to be executed, further ones are rejected until the queue drains
+#define COMMAND_SIZE PUBLISH_BUFFER_SIZE  //Longest command payload, PubSubClient cannot receive more than its buffer anyway
+#define COMMAND_ID_SIZE 48  //Longest request ID echoed back, as JSON (a string ID includes its quotes)
+
+
+
+////////////////////Command Types////////////////////
+
+/* STRUCT NAME: Command
+ * PURPOSE: Raw command payload copied out of PubSubClient's buffer, parsed only when it is executed
+ */
+struct Command
+{
+  char payload[COMMAND_SIZE];
+  uint16_t length;
+  uint32_t receivedMicros;  //micros() when the message arrived, the reply reports the time spent queued
+};
+
+
+
+////////////////////Command Functions////////////////////
+
+/* FUNCTION NAME: Callback
+ * PURPOSE: Receives all messages from MQTT broker on the subscribe topic
+ * ACTION: Only copies the payload into the command queue, so mqttClient.loop() (keepalives) never waits on a command.
+ *         A message that does not fit, or arrives while the queue is full, is rejected with a BUSY reply
+ */
+void callback(char* topic, byte* payload, unsigned int length);
+
+/* FUNCTION NAME: Command Step
+ * PURPOSE: Executes the oldest queued command. Called by MQTT_TASK between publish batches, one command per call
+ * ACTION: Reconfigures the device, resets the device, replies to a ping/stats request, or starts a benchmark,
+ *         load run, history replay, power-fail simulation or event acknowledgement, depending on CMD. Every command gets a
+ *         {"REPLY":{"ID":..,"CMD":..,"STATUS":"OK"|"ERROR","MSG":..,"WAIT_US":..,"US":..}} on the Info topic, with the
+ *         request ID echoed back as sent and US recorded in the command timer (ACK only replies when it carries an ID).
+ *         Returns false if the queue was empty
+ */
+bool commandStep(NetworkObject& object);
+
+
+
+#endif
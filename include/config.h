@@ -5,6 +5,7 @@
 
 ////////////////////Libraries////////////////////
 
+#ifdef ARDUINO
 #include <WiFiClient.h>
 #include <PubSubClient.h>
 #include <ETH.h>
@@ -12,7 +13,7 @@
 #include "Queue.h"
 #include <string.h>
 
-#include <TimeLib.h>
+#include <time.h>
 #include <WiFiUDP.h>
 
 #include <EEPROM.h>
@@ -20,6 +21,9 @@
 #include <ArduinoJson.h>
 
 #include <pthread.h>
+#else
+#include "native.h"  //Host unit tests (env:native): only the hardware-free modules are built, see test/native
+#endif
 
 
 
@@ -29,6 +33,14 @@
 
 #define QUEUE_RANGE 40  //Length of the rolling queue object aka the max number of measurements the queue can hold
 #define OVERRIDE_RANGE 35  //Number of times the device will push new measurements to the rolling queue after it detects an excursion event. Must be less than QUEUE_RANGE
+#define CONTEXT_BUCKETS 30  //Decimated min/max buckets of context kept before each event, 4 bytes per channel each (see context.h)
+#define CONTEXT_BUCKET_MS 1000  //Time covered by one context bucket, CONTEXT_BUCKETS * CONTEXT_BUCKET_MS is the context span (30 s)
+
+#define SAMPLE_RATE_HZ 2000  //Default sample rate (all channels read per tick) when the config has no SRATE, paced by a hardware timer
+#define SAMPLE_RATE_MIN 100  //Lowest accepted SRATE
+#define SAMPLE_RATE_MAX 10000  //Highest accepted SRATE, each analogRead takes ~10 us so lower it when adding channels
+#define IDLE_RATE_HZ 500  //Default idle rate (IDLERATE config key) while every triggering channel is far from its threshold. 0 samples at SRATE all the time
+#define APPROACH_MARGIN_PERCENT 20  //Default MARGIN config key, the sampler runs at SRATE once a value is within this percentage of its threshold
 
 #define CPIN 14  //Pin on board measuring voltage as a factor of EC20 input current
 #define VPIN 15  //Pin on board measuring voltage as a factor of EC20 input voltage
@@ -37,14 +49,70 @@
 #define NTP_PORT 8888
 #define UDP_PORT 123
 #define NTP_MESSAGE_SIZE 48  //Size of messages being sent back and forth from NTP server
+#define NTP_TIMEOUT_MS 1500  //Wait for an NTP response before the request counts as failed
+#define NTP_SYNC_INTERVAL_S 300  //Re-sync period once the clock is set
+#define NTP_RETRY_S 10  //Next attempt after a failed request, and until the first sync
+#define VALID_TIME_EPOCH 1000000000UL  //deviceTime() values below this (2001) count from boot, i.e. were taken before the first NTP sync
 
 #define MQTT_PORT 1883
 #define MQTT_USERNAME "demoSPOOF"
 #define MQTT_PASSWORD "howdyhowdy69"
 #define ROOT_TOPIC "NARCCCCC!"
  
-#define JSON_BUFFER_CAPACITY JSON_OBJECT_SIZE(2) + JSON_OBJECT_SIZE(9) + 208  //Provides enough buffer room for any possible JSON string formed
-#define PUBLISH_BUFFER_SIZE 300  //Max size of messages sent to MQTT broker
+#define CONFIG_NUMBER_SIZE 16  //Longest numeric config value accepted (SRATE, thresholds, ..), terminator included
+#define CONFIG_WORD_SIZE 12  //Longest keyword config value accepted (FORMAT, SCHEDULE, ..), terminator included
+#define CONFIG_LIST_SIZE 88  //Longest list config value accepted (MQTT broker list, SINKS), terminator included. Four brokers with ports
+#define COMMAND_SLOTS 24  //JSON members and array elements of a command besides the CNFG object: CMD, ID and parameters, or the SEQ numbers of an ACK
+
+//Keys of the config document on EEPROM, with the longest value each accepts. The threshold keys come from CHANNEL_DESCRIPTORS.
+//JSON_BUFFER_CAPACITY (externals.h) is derived from this table, a key added here is accounted for
+#define CONFIG_KEY_DESCRIPTORS \
+  {"IP", IP_STRING_SIZE}, {"DNS", IP_STRING_SIZE}, {"GATEWAY", IP_STRING_SIZE}, {"SUBNET", IP_STRING_SIZE}, \
+  {"MQTT", CONFIG_LIST_SIZE}, {"FAILOVER", CONFIG_NUMBER_SIZE}, {"NTP", IP_STRING_SIZE}, \
+  {"SITE", ID_SIZE}, {"EQUIPMENTID", ID_SIZE}, {"CLIENTID", ID_SIZE}, \
+  {"SRATE", CONFIG_NUMBER_SIZE}, {"IDLERATE", CONFIG_NUMBER_SIZE}, {"MARGIN", CONFIG_NUMBER_SIZE}, \
+  {"TRIGMODE", CONFIG_WORD_SIZE}, {"BASELINE", CONFIG_WORD_SIZE}, {"FORMAT", CONFIG_WORD_SIZE}, {"SCHEDULE", CONFIG_WORD_SIZE}, \
+  {"DELIVERY", CONFIG_WORD_SIZE}, {"STREAM", CONFIG_NUMBER_SIZE}, {"SINKS", CONFIG_LIST_SIZE}, {"POWER", CONFIG_WORD_SIZE}, \
+  {"QUIET", CONFIG_NUMBER_SIZE}
+
+#define PUBLISH_BUFFER_SIZE 1664  //Max size of messages sent to MQTT broker, the STATS reply is the longest
+
+#define TOPIC_SIZE 96  //Max size of a pub/sub topic string
+#define ID_SIZE 32  //Max size of the site, equipment ID and client ID strings (including terminator)
+#define IP_STRING_SIZE 16  //"255.255.255.255" plus terminator
+#define TIME_STRING_SIZE 23  //"YYYY-MM-DD HH:MM:SS NN" plus terminator
+
+#define INFLUX_MEASUREMENT "narc"  //Measurement name of event samples in FORMAT_INFLUX
+#define INFLUX_SPECTRUM_MEASUREMENT "narc_spectrum"  //Measurement name of spectral summaries in FORMAT_INFLUX
+#define INFLUX_EVENT_MEASUREMENT "narc_event"  //Measurement name of per-event sampling metadata in FORMAT_INFLUX
+#define INFLUX_CONTEXT_MEASUREMENT "narc_context"  //Measurement name of the decimated context before an event in FORMAT_INFLUX, one line per bucket
+#define INFLUX_LINE_SIZE (120 + 16 * CHANNEL_COUNT)  //Max size of one line protocol line (tags included)
+#define INFLUX_BATCH_SIZE ((QUEUE_RANGE + CONTEXT_BUCKETS + 4) * INFLUX_LINE_SIZE)  //Max size of a whole event batch, one line per sample and per context bucket plus the event metadata and spectral summary
+#define ENCODED_EVENT_SIZE INFLUX_BATCH_SIZE  //Payload space of one encoded event, also bounds the JSON entries plus CONTEXT, EVENT and SPECTRUM
+#define ENCODED_MAX_MESSAGES (QUEUE_RANGE + 3)  //Messages in one encoded event, one per JSON entry plus CONTEXT, EVENT and SPECTRUM
+#define TRANSMIT_BUDGET_BYTES 4096  //Payload bytes MQTT_TASK sends per loop before it services commands and keepalives again
+
+
+
+////////////////////Channels////////////////////
+
+//One descriptor per monitored line, in sampling order: {JSON key, Influx field, pin, scale, offset, trigger role,
+//threshold config key, default threshold}. Values are raw * scale + offset. TRIGGER_ABOVE/TRIGGER_BELOW channels start an
+//event when their value crosses the threshold held under their config key; TRIGGER_NONE channels are only recorded.
+//Extra rails are added here, e.g. {"Aux24", "aux24", 32, 0.0089f, 0.0f, TRIGGER_BELOW, "AUX24THRESHOLD", 20.0f}
+#define CHANNEL_DESCRIPTORS \
+  {"Voltage", "voltage", VPIN, 1.0f, 0.0f, TRIGGER_ABOVE, "VTHRESHOLD", 0.0f}, \
+  {"Current", "current", CPIN, 1.0f, 0.0f, TRIGGER_NONE, NULL, 0.0f}
+
+
+
+////////////////////Spectral Analysis////////////////////
+
+#define FFT_ENABLED  //Comment out to disable the spectral summary published after each event
+#define FFT_CHANNEL 0  //Index in CHANNEL_DESCRIPTORS of the channel the spectral summary is computed on
+#define FFT_MAX_SIZE 256  //Largest supported transform length, must be a power of 2. Shorter transforms reuse the same twiddle table
+#define FFT_TOP_K 3  //Number of spectral peaks reported per event
+#define FFT_BANDS 4  //Number of equal-width bands the spectrum (DC to Nyquist) is split into for the band energy report
 
 
 
@@ -70,4 +138,14 @@
 
 
 
+///////////////////Power-Fail Configuration//////////////////////////////////////////
+
+#define POWER_SENSE_PIN 4  //Pin sensing the EC20 input supply ahead of the UPS (-1 to disable the power-fail flush)
+#define POWER_SENSE_ACTIVE LOW  //Level of POWER_SENSE_PIN while running on UPS holdup
+#define HOLDUP_BUDGET_US 20000  //Time the UPS is guaranteed to keep the MCU alive after input loss, the flush must finish within it
+#define HOLDUP_PARTITION "holdup"  //Flash data partition (see partitions.csv) kept pre-erased for the power-fail record
+#define SPOOL_PARTITION "spool"  //Flash data partition (see partitions.csv) the SPOOL output sink writes its ring of records to
+
+
+
 #endif
@@ -0,0 +1,39 @@
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include "externals.h"
+
+
+
+////////////////////Context Constants////////////////////
+
+#define CONTEXT_BUCKET_US (CONTEXT_BUCKET_MS * 1000UL)
+#define CONTEXT_EMPTY_MIN 0xFFFF  //min/max of a bucket no reading fell in, min > max marks it
+#define CONTEXT_EMPTY_MAX 0
+
+
+
+////////////////////Context Functions////////////////////
+
+/* FUNCTION NAME: Context Reset
+ * PURPOSE: Forgets the context ring, the next reading starts the first bucket. Called before each trace replay of
+ *          test_replay so it starts from the trace
+ */
+void contextReset();
+
+/* FUNCTION NAME: Context Update
+ * PURPOSE: Adds one reading to the context ring. Called by VTC_TASK for every reading, the ones captured in events as well
+ * ACTION: Widens the min/max of the current bucket, a compare per channel. Once the reading's micros() is past the end of
+ *         the bucket, the ring moves on by as many buckets as have gone by (empty ones marked as such), overwriting the
+ *         oldest
+ */
+void contextUpdate(const Sample& sample);
+
+/* FUNCTION NAME: Context Snapshot
+ * PURPOSE: Copies the ring into an event when it triggers, oldest bucket first, so encoding never reads the live ring
+ */
+void contextSnapshot(ContextSnapshot<CHANNEL_COUNT>& snapshot);
+
+
+
+#endif
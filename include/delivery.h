@@ -0,0 +1,90 @@
+#ifndef DELIVERY_H
+#define DELIVERY_H
+
+#include "externals.h"
+
+
+
+////////////////////Delivery Constants////////////////////
+
+#define SEQUENCE_EEPROM_ADDRESS (4096 - 16)  //Sequence record at the end of EEPROM, clear of the config document at 0
+#define SEQUENCE_MAGIC 0x53455131  //"SEQ1", marks a valid sequence record
+#define SEQUENCE_RESERVE_BLOCK 1024  //Sequence numbers reserved per EEPROM write, a reboot skips what was left of the block
+#define SEQUENCE_DEFER_POLL_MS 5  //How often a held back reservation write checks whether the capture in progress has ended
+#define DELIVERY_WINDOW 16  //Events sent but not yet acknowledged (DELIVERY ACK), further events wait in the store
+#define DELIVERY_TIMEOUT_MS 5000  //An unacknowledged event is sent again after this long
+#define DELIVERY_CHECK_MS 250  //Interval of the timeout scan
+
+
+
+////////////////////Delivery Types////////////////////
+
+/* STRUCT NAME: Sequence Record
+ * PURPOSE: Persistent part of the event sequence, stored at SEQUENCE_EEPROM_ADDRESS
+ */
+struct SequenceRecord
+{
+  uint32_t magic;
+  uint32_t reserved;  //Every sequence number below this may have been used, the next boot starts here
+  uint32_t boots;  //Boot counter, tells a consumer that a jump in SEQ is a reboot and not lost events
+};
+
+
+/* STRUCT NAME: Delivery Stats
+ * PURPOSE: Counters written only by MQTT_TASK
+ */
+struct DeliveryStats
+{
+  uint32_t acked;  //Events removed from the store on acknowledgement
+  uint32_t unknownAcks;  //Acknowledged sequence numbers that were not waiting (duplicates or dropped events)
+  uint32_t resent;  //Events put back in the queue after a timeout or reconnect
+  uint32_t overruns;  //Sequence numbers handed out past the reservation on flash (written by VTC_TASK, since boot), should stay 0
+};
+
+
+extern DeliveryStats deliveryStats;
+extern uint32_t deliveryBoots;  //Boot counter from the sequence record, published as BOOT in EVENT
+
+
+
+////////////////////Delivery Functions////////////////////
+
+/* FUNCTION NAME: Delivery Init
+ * PURPOSE: Restores the event sequence after a reboot
+ * ACTION: Reads the sequence record, continues from its reservation (0 on first boot), counts the boot and reserves the
+ *         next SEQUENCE_RESERVE_BLOCK numbers. Called from setup() after EEPROM.begin and before VTC_TASK starts. Starts
+ *         SEQUENCE_TASK (core 0, priority 1), which extends the reservation when asked by deliveryNextSequence. Its write
+ *         waits while captureActive, and takes eepromMutex like setConfig
+ */
+void deliveryInit();
+
+/* FUNCTION NAME: Delivery Next Sequence
+ * PURPOSE: Hands out the next event sequence number. Called by handOverEvent with mutexHandle held, so every sink sees the same number, never touches EEPROM
+ * ACTION: Once less than half a block of the reservation is left it wakes SEQUENCE_TASK to write the next one, so the
+ *         reservation keeps up even while MQTT_TASK is blocked in brokerConnect
+ */
+uint32_t deliveryNextSequence();
+
+/* FUNCTION NAME: Delivery Step
+ * PURPOSE: Delivery housekeeping, called by MQTT_TASK every loop
+ * ACTION: Every DELIVERY_CHECK_MS, with DELIVERY ACK, puts events unacknowledged for DELIVERY_TIMEOUT_MS back in the queue
+ *         to be sent again
+ */
+void deliveryStep();
+
+/* FUNCTION NAME: Delivery Reconnected
+ * PURPOSE: Called after a broker reconnect. Everything sent but unacknowledged may have died with the old session, so it
+ *          is queued again straight away
+ */
+void deliveryReconnected();
+
+/* FUNCTION NAME: Delivery Ack
+ * PURPOSE: Handles {"CMD":"ACK","SEQ":[..]} (a single number is accepted too)
+ * ACTION: Removes each acknowledged event from the store and wakes ENCODE_TASK if the send window opened. Returns the
+ *         number of events removed
+ */
+int deliveryAck(JsonVariantConst sequences);
+
+
+
+#endif
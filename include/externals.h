@@ -2,6 +2,123 @@
 #define EXTERNALS_H
 
 #include "config.h"
+#include "channels.h"
+#include "stats.h"
+
+
+
+////////////////////Types////////////////////
+
+/* ENUM NAME: Publish Format
+ * PURPOSE: Encoding used for event data on publishTopicData, selected with the FORMAT config key
+ */
+enum PublishFormat
+{
+  FORMAT_JSON,  //One JSON entry per message (default)
+  FORMAT_INFLUX  //Whole event as one multi-line InfluxDB line protocol batch
+};
+
+
+/* ENUM NAME: Schedule Policy
+ * PURPOSE: Order in which queued events are published, selected with the SCHEDULE config key
+ */
+enum SchedulePolicy
+{
+  SCHEDULE_SEVERITY,  //Largest excursion beyond threshold first, oldest first among equals (default)
+  SCHEDULE_NEWEST,  //Most recent first
+  SCHEDULE_FIFO  //Oldest first
+};
+
+
+/* ENUM NAME: Delivery Mode
+ * PURPOSE: When a queued event may leave the store, selected with the DELIVERY config key
+ */
+enum DeliveryMode
+{
+  DELIVERY_BEST_EFFORT,  //Removed once encoded (default)
+  DELIVERY_ACK  //Kept until the consumer acknowledges its sequence number, sent again on timeout or reconnect
+};
+
+
+/* ENUM NAME: Power Policy
+ * PURPOSE: Whether the device may switch to low power by itself, selected with the POWER config key
+ */
+enum PowerPolicy
+{
+  POWER_AUTO,  //Low power on a quiet line and on UPS holdup (default)
+  POWER_OFF  //Always full power
+};
+
+
+/* ENUM NAME: Encode Parts
+ * PURPOSE: Which messages of an event encodeEvent produces
+ */
+enum EncodeParts
+{
+  ENCODE_ALL,  //Entries, then the event metadata and spectral summary
+  ENCODE_SUMMARY,  //Event metadata and spectral summary only, sent ahead of queued waveforms
+  ENCODE_WAVEFORM  //Entries only, for an event whose summary already went out
+};
+
+
+/* STRUCT NAME: Encoded Event
+ * PURPOSE: One event formatted and ready to send, messages stored back to back in data
+ */
+struct EncodedEvent
+{
+  EncodeParts parts;
+  uint16_t messages;  //Number of MQTT messages
+  uint16_t lengths[ENCODED_MAX_MESSAGES];  //Payload length of each message, in order
+  size_t used;  //Bytes of data in use
+  char data[ENCODED_EVENT_SIZE];
+};
+
+
+typedef bool (*SampleSource)(Sample& sample);  //Fills in the next reading, returns false once the source is exhausted
+typedef void (*EventSink)();  //Takes a completed capture out of dataSet
+
+
+
+////////////////////Config Keys////////////////////
+
+/* STRUCT NAME: Config Key
+ * PURPOSE: One key of the config document on EEPROM, listed in CONFIG_KEY_DESCRIPTORS (config.h)
+ */
+struct ConfigKey
+{
+  const char* name;
+  uint8_t valueSize;  //Longest value accepted, terminator included
+};
+
+constexpr ConfigKey CONFIG_KEYS[] = { CONFIG_KEY_DESCRIPTORS };
+constexpr int CONFIG_KEY_COUNT = sizeof(CONFIG_KEYS) / sizeof(CONFIG_KEYS[0]);
+
+//Compile-time sums over the key table and the threshold keys of CHANNEL_DESCRIPTORS
+constexpr size_t configNameSize(const char* name)
+{
+  return *name ? 1 + configNameSize(name + 1) : 1;
+}
+
+constexpr size_t configKeyBytes(int k = 0)
+{
+  return k == CONFIG_KEY_COUNT ? 0 : configNameSize(CONFIG_KEYS[k].name) + CONFIG_KEYS[k].valueSize + configKeyBytes(k + 1);
+}
+
+constexpr int configThresholdKeys(int c = 0)
+{
+  return c == CHANNEL_COUNT ? 0 : (CHANNELS[c].thresholdKey ? 1 : 0) + configThresholdKeys(c + 1);
+}
+
+constexpr size_t configThresholdBytes(int c = 0)
+{
+  return c == CHANNEL_COUNT ? 0 :
+         (CHANNELS[c].thresholdKey ? configNameSize(CHANNELS[c].thresholdKey) + CONFIG_NUMBER_SIZE : 0) + configThresholdBytes(c + 1);
+}
+
+//Arena of every static JSON document and bound of the config text on EEPROM: a command object holding a CNFG object with
+//every key at its longest value, strings copied
+#define JSON_BUFFER_CAPACITY (JSON_OBJECT_SIZE(COMMAND_SLOTS) + JSON_OBJECT_SIZE(CONFIG_KEY_COUNT + configThresholdKeys()) + \
+                              configKeyBytes() + configThresholdBytes())
 
 
 
@@ -11,23 +128,41 @@ extern WiFiClient espClient;  //Used to instantiate PubSubClient object below
 extern PubSubClient mqttClient;  //Used for communication with MQTT broker via MQTT protocol
 extern WiFiUDP ethernetUDP;  //Used for communication with NTP server via UDP protocol
 
-extern bool pingCommandReceived;  //Triggers the sending of a ping message
+extern bool pingCommandReceived;  //Triggers the sending of a ping message (on each new broker connection)
+
+extern TaskHandle_t MQTT_TASK_HANDLE;
+extern TaskHandle_t VTC_TASK_HANDLE;
 
-extern Queue<String> dataSet;  //Primary rolling queue that continuously records measurements off of CPIN and VPIN
-extern Queue<String> softCopy;  //Copy of queue after an excursion event occurs. Resource is shared between both threads 
-extern pthread_mutex_t mutexHandle;  //Mutex to prevent conflicting operations on the shared resource softCopy
+extern EventBuffer dataSet;  //Primary rolling buffer that continuously records measurements off every channel
+extern pthread_mutex_t mutexHandle;  //Mutex to prevent conflicting operations on the event store shared between both threads, see store.h
+extern pthread_mutex_t eepromMutex;  //Held around every EEPROM write and commit: the config (setConfig) and the sequence record (delivery.h)
+extern volatile bool captureActive;  //Set by captureStep from a trigger until its last block is handed over, flash spool writes wait for it
 
-extern String publishTopicData;
-extern String publishTopicInfo;
-extern String subscribeTopic;
+extern char publishTopicData[TOPIC_SIZE];
+extern char publishTopicInfo[TOPIC_SIZE];
+extern char subscribeTopic[TOPIC_SIZE];
 
-extern String globalClientID;
+extern char globalClientID[ID_SIZE];
 extern IPAddress globalNTPAddress;
-extern float globalVoltageThreshold;  //Voltages above this threshold are reported to the broker.
+extern uint32_t globalSampleRate;  //Samples per second, paced by the sampler timer. Also the burst rate of adaptive sampling
+extern uint32_t globalIdleRate;  //Samples per second while no triggering channel is near its threshold, 0 disables adaptive sampling
+extern float globalApproachMargin;  //Fraction of a threshold within which a channel counts as near it
+extern TriggerMode globalTriggerMode;  //Absolute or baseline-relative thresholds, see baseline.h
+extern BaselineTracker globalBaselineTracker;  //Baseline tracking of the relative trigger modes
+extern uint32_t globalStreamBaud;  //Serial baud rate of raw sample streaming, 0 when off, see stream.h
+extern uint8_t globalSinks;  //Output sinks events are written to, one bit per SinkId, see sinks.h
+extern PowerPolicy globalPowerPolicy;  //Automatic low power, see power.h
+extern uint32_t globalQuietSeconds;  //Seconds without a reading near a threshold before low power
+extern uint32_t globalFailoverMs;  //Time spent retrying one broker before failing over to the next in the list
+extern PublishFormat globalPublishFormat;  //Encoding of event data on publishTopicData
+extern SchedulePolicy globalSchedulePolicy;  //Order of queued events, see store.h
+extern DeliveryMode globalDeliveryMode;  //At-least-once delivery of queued events, see delivery.h
 
 extern time_t previousTime;
-extern time_t currentTime;
 extern unsigned short globalTimeCounter;  //Counter to differentiate timestamps that would otherwise be identical. 
+extern volatile bool timeSynced;  //Set once the first NTP response has been received
+extern time_t timeSyncEpoch;  //Time reference delivered by the first NTP response
+extern uint64_t timeSyncMicros;  //esp_timer_get_time() when the first NTP response was received
 
 
 
@@ -44,8 +179,8 @@ class NetworkObject
     IPAddress clientGateway;
     IPAddress clientSubnet;
     IPAddress mqttAddress;
-    String site;
-    String equipmentID;
+    char site[ID_SIZE];
+    char equipmentID[ID_SIZE];
         
   public:
     /* Constructor */
@@ -54,8 +189,8 @@ class NetworkObject
                    IPAddress clientSubnet_,
                    IPAddress clientGateway_,
                    IPAddress mqttAddress_,
-                   String site_,
-                   String equipmentID_
+                   const char* site_,
+                   const char* equipmentID_
                  );
 
     /* Getters */
@@ -64,8 +199,8 @@ class NetworkObject
     IPAddress getClientGateway();
     IPAddress getClientSubnet();
     IPAddress getMQTTAddress();
-    String getSite();
-    String getEquipmentID();
+    const char* getSite();
+    const char* getEquipmentID();
     
     /* FUNCTION NAME: Eth Event
      * PURPOSE: Prints Ethernet status messages to Serial
@@ -87,18 +222,25 @@ class NetworkObject
 
 
 
+/* FUNCTION NAME: Format Topic
+ * PURPOSE: Formats a topic in the ROOT_TOPIC/site/id[/suffix] scheme used by mqttInit into a TOPIC_SIZE buffer
+ */
+void formatTopic(char* buffer, const char* site, const char* id, const char* suffix);
+
+
+
 ////////////////////Network Configuration Functions////////////////////
 
 /* FUNCTION NAME: String to IP
- * PURPOSE: Converts an IP address from a String object to an IPAddress object
+ * PURPOSE: Converts an IP address from a C string to an IPAddress object
  */
-IPAddress stringToIP(String IPString);
+IPAddress stringToIP(const char* IPString);
 
 
 /* FUNCTION NAME: Get Chip ID
- * PURPOSE: Retrieves chip ID from microcontroller
+ * PURPOSE: Retrieves chip ID from microcontroller into buffer (ID_SIZE)
  */
-String getChipID();
+void getChipID(char* buffer);
 
 /* FUNCTION NAME: Load Config
  * PURPOSE: Uses current config information to initiate a new network connection
@@ -106,17 +248,26 @@ String getChipID();
  */
 NetworkObject loadConfig();
 
+/* FUNCTION NAME: Load Capture Config
+ * PURPOSE: Minimal config read done at boot before VTC_TASK starts
+ * ACTION: Retrieves only the capture settings (VTHRESHOLD) from EEPROM. Everything network related is left to loadConfig
+ */
+void loadCaptureConfig();
+
 /* FUNCTION NAME: Doc Inject
  * PURPOSE: Transfers targeted information from a source JsonDocument to a destination JsonDocument
- * ACTION: Transfers an individual piece of config information from sourceDoc to destinationDoc. User interface is provided if connected to Serial
+ * ACTION: Transfers an individual piece of config information from sourceDoc to destinationDoc. User interface is provided if connected to Serial.
+ *         Returns false, writing nothing, for a value of valueSize characters or more
  */
-void docInject(const char* parameter, DynamicJsonDocument& destinationDoc, DynamicJsonDocument& sourceDoc, const char* mode);
+bool docInject(const char* parameter, size_t valueSize, JsonDocument& destinationDoc, JsonDocument& sourceDoc, const char* mode);
 
 /* FUNCTION NAME: Set Config
  * PURPOSE: Loads config information onto EEPROM
- * ACTION: Config information currently on EEPROM gets replaced appropriately with information in configMessage by repeatedly calling docInject
+ * ACTION: Config information currently on EEPROM gets replaced appropriately with information in configMessage by calling docInject for every
+ *         key of CONFIG_KEY_DESCRIPTORS and every threshold key. Returns NULL once committed; otherwise nothing is written and the reason is
+ *         returned (invalid JSON, a document beyond JSON_BUFFER_CAPACITY, a value too long). The caller resets the device to apply it
  */
-void setConfig(const char* configMessage, const char* mode);  //Loads new config information from configMessage onto EEPROM
+const char* setConfig(const char* configMessage, const char* mode);  //Loads new config information from configMessage onto EEPROM
 
 
 
@@ -134,48 +285,182 @@ void reconnect();
 void reset();
 
 /* FUNCTION NAME: IP To String
- * PURPOSE: Converts an IP address from an IPAddress object to a String for ease of display
+ * PURPOSE: Converts an IP address from an IPAddress object to a string (IP_STRING_SIZE buffer) for ease of display
  */
-String ipToString(IPAddress ip);
+char* ipToString(IPAddress ip, char* buffer);
 
 /* FUNCTION NAME: Generate Ping
  * PURPOSE: Formats a ping message to be sent to MQTT broker
- * ACTION: Message contains current timestamp, current program version, and all current device config information
+ * ACTION: Message contains current timestamp, current program version, all current device config information and a heap report
+ *         (free, minimum free since boot and largest free block). Returns the length, 0 if the message did not fit
  */
-String generatePing(NetworkObject object);
+size_t generatePing(NetworkObject& object, char* buffer, size_t size);
+
+
+////////////////////Measurement Functions////////////////////
 
-/* FUNCTION NAME: Callback
- * PURPOSE: Deals with all possible callback messages from MQTT broker
- * ACTION: Reconfigures the device, resets the devices, fulfills a ping request, or  depending on the callback message
+/* FUNCTION NAME: Read Sample
+ * PURPOSE: Reads every channel once (ChannelSet) and timestamps the reading
+ * ACTION: Timestamp fields are filled by stampTime
  */
-static void callback(char* topic, byte* payload, unsigned int length);  //Deals with all callback messages from MQTT broker
+Sample readSample();
 
+/* FUNCTION NAME: Live Source
+ * PURPOSE: SampleSource for normal operation, the next timer-paced reading from the sampler plus the per-reading stats hook.
+ *          Never runs out
+ */
+bool liveSource(Sample& sample);
 
+/* FUNCTION NAME: Hand Over Event
+ * PURPOSE: EventSink for normal operation
+ * ACTION: Locks mutexHandle (waiting if needed) and queues dataSet in the event store for ENCODE_TASK and wakes it
+ */
+void handOverEvent();
+
+/* FUNCTION NAME: Capture Step
+ * PURPOSE: One iteration of the capture pipeline, independent of where readings come from
+ * ACTION: Pushes the next reading into dataSet. If any triggering channel crosses its globalThresholds entry, override occurs: OVERRIDE_RANGE more
+ *         readings are pushed to capture the transient and sink is called. While the excursion lasts, further blocks of
+ *         QUEUE_RANGE fresh readings follow (each sunk with dataSet.block() set), up to storeMaxBlocks() per event.
+ *         captureActive is set from the trigger to the last hand-over. Returns false once source is exhausted
+ */
+bool captureStep(SampleSource source, EventSink sink);
 
-////////////////////Measurement Functions////////////////////
+/* FUNCTION NAME: Device Time
+ * PURPOSE: Current device local time in seconds, from esp_timer_get_time() and the anchor of the last NTP response
+ *          (counts from boot until the first one). Safe from any task
+ */
+time_t deviceTime();
 
-/* FUNCTION NAME: Get Voltage
- * PURPOSE: Gets value of EC20 input voltage
- * ACTION: Performs back calculations on voltage measured off of VPIN to get the original EC20 input voltage value
+/* FUNCTION NAME: Stamp Time
+ * PURPOSE: Fills the timestamp fields of a sample
+ * ACTION: Takes esp_timer_get_time() and adds it to the NTP anchor, which gives the seconds and exact sub-second fraction.
+ *         Also determines the value of globalTimeCounter based on extern previousTime. Never talks to the NTP server,
+ *         re-syncs run in MQTT_TASK (ntpStep)
  */
-String getVoltage();
+void stampTime(Sample& sample);
 
-/* FUNCTION NAME: Get Current
- * PURPOSE: Gets value of EC20 input current
- * ACTION: Performs back calculations on voltage measured off of CPIN to get the original EC20 input current value
+/* FUNCTION NAME: Format Time
+ * PURPOSE: Formats a timestamp as "YYYY-MM-DD HH:MM:SS NN" where NN is the counter, into a TIME_STRING_SIZE buffer
  */
-String getCurrent();
+void formatTime(time_t seconds, unsigned short counter, char* buffer);
 
 /* FUNCTION NAME: Get Time
- * PURPOSE: Formats timestamp for the current time
- * ACTION: Gets current time based on time reference. Also determines the value of globalTimeCounter based on extern previousTime
+ * PURPOSE: Formats timestamp for the current time into a TIME_STRING_SIZE buffer
+ * ACTION: Formats deviceTime() with the sampler's current same-second counter. Unlike stampTime it changes no state, so any task
+ *         may call it
  */
-String getTime();
+void getTime(char* buffer);
 
 /* FUNCTION NAME: Generate Entry
- * PURPOSE: Gets measurements and formats them into appropriate an JSON data string
+ * PURPOSE: Formats a sample into an appropriate JSON data string, one calibrated value per channel under its name
+ * ACTION: SEQ (event sequence number) and I (index within the event) identify the entry to a consumer deduplicating
+ *         resent events. Returns the length written to buffer, 0 if the entry did not fit
+ */
+size_t generateEntry(const Sample& sample, uint32_t sequence, int index, char* buffer, size_t size);
+
+/* FUNCTION NAME: Backdate Sample
+ * PURPOSE: Converts a timestamp taken before the first NTP sync (relative to boot) into NTP time
+ * ACTION: Uses the 64-bit esp_timer_get_time() anchor recorded at the first sync, so a sample any time before the sync is
+ *         back-dated exactly. Samples already on NTP time, or any sample while no sync has happened yet, are left untouched
+ */
+void backdateSample(Sample& sample);
+
+/* FUNCTION NAME: Sample Nanos
+ * PURPOSE: Converts a sample timestamp to nanoseconds since the Unix epoch (UTC)
+ * ACTION: Removes the TIMEZONE offset applied to the NTP time and adds the sub-second fraction
+ */
+uint64_t sampleNanos(const Sample& sample);
+
+/* FUNCTION NAME: Generate Influx Batch
+ * PURPOSE: Formats a whole event as InfluxDB line protocol, one line per sample
+ * ACTION: Writes into buffer (NUL terminated) and returns the number of characters written. Site and equipment ID are tags,
+ *         each channel is a field (plus seq and i, as in generateEntry) and timestamps are in nanoseconds. Lines that do not fit are dropped
  */
-String generateEntry();
+size_t generateInfluxBatch(const char* siteTag, const char* equipmentTag, const EventBuffer& event, char* buffer, size_t size);
+
+
+
+////////////////////Analysis Functions////////////////////
+
+/* FUNCTION NAME: Generate Event Info
+ * PURPOSE: Formats the sampling metadata of a captured event, {"EVENT":{"TIME":t,"SEQ":n,"BOOT":n,"BLOCK":n,"SAMPLES":n,"RATE":hz,"PRE_RATE":hz,"JITTER_US":us,"SEVERITY":s}}
+ * ACTION: RATE and JITTER_US (largest deviation from the mean interval) cover the readings from the trigger on, PRE_RATE the
+ *         readings before it, which differ when adaptive sampling was still at its idle rate. All come from the sample
+ *         timestamps, see eventTiming. TIME (first reading, same format as the entries) ties a summary sent ahead to its
+ *         waveform, SEVERITY is the score used to schedule it (eventSeverity). SEQ and BOOT let a consumer
+ *         tell lost events from numbers skipped by a reboot, see delivery.h. With baseline-relative triggering BASELINE
+ *         holds each channel's baseline when the event triggered. INJECTED (the TRACE run number, see trace.h) is
+ *         only present on a transient injected by a TRACE run. Returns the length written, 0 if it did not fit
+ */
+size_t generateEventInfo(const EventBuffer& event, char* buffer, size_t size);
+
+/* FUNCTION NAME: Generate Event Line
+ * PURPOSE: Same metadata as generateEventInfo, formatted as one line of InfluxDB line protocol stamped with the first sample
+ * ACTION: Appends to buffer at offset used and returns the new length. Nothing is appended if the line does not fit.
+ *         An injected transient carries injected=<run>i like INJECTED in the JSON
+ */
+size_t generateEventLine(const char* siteTag, const char* equipmentTag, const EventBuffer& event, char* buffer, size_t used, size_t size);
+
+/* FUNCTION NAME: Generate Context
+ * PURPOSE: Formats the decimated context before an event (context.h) into a JSON string
+ * ACTION: One [min,max] pair per bucket and channel in calibrated units, oldest first, null for a bucket no reading fell
+ *         in. FROM_MS is the start of the oldest bucket relative to the first reading (TIME), each bucket BUCKET_MS long.
+ *         Returns the length written, 0 if it did not fit or the event has no context (later blocks, load events)
+ */
+size_t generateContext(const EventBuffer& event, char* buffer, size_t size);
+
+/* FUNCTION NAME: Generate Context Lines
+ * PURPOSE: Same context as generateContext, as one line of InfluxDB line protocol per bucket stamped with the bucket start
+ * ACTION: Appends to buffer at offset used and returns the new length. Lines that do not fit are left out
+ */
+size_t generateContextLines(const char* siteTag, const char* equipmentTag, const EventBuffer& event, char* buffer, size_t used, size_t size);
+
+/* FUNCTION NAME: Generate Spectrum
+ * PURPOSE: Formats the spectral summary of a captured event into a JSON string
+ * ACTION: Runs fftSummary over channel FFT_CHANNEL from the trigger on, where the sampling is uniform, at the rate measured there.
+ *         Called from the network task on a private copy of the event so VTC_TASK is never kept waiting on the mutex.
+ *         Returns the length written to buffer, 0 if the message did not fit
+ */
+size_t generateSpectrum(const EventBuffer& event, char* buffer, size_t size);
+
+/* FUNCTION NAME: Generate Spectrum Line
+ * PURPOSE: Same summary as generateSpectrum, formatted as one line of InfluxDB line protocol stamped with the first sample
+ * ACTION: Appends to buffer at offset used and returns the new length. Nothing is appended if the line does not fit
+ */
+size_t generateSpectrumLine(const char* siteTag, const char* equipmentTag, const EventBuffer& event, char* buffer, size_t used, size_t size);
+
+
+////////////////////Publish Functions////////////////////
+
+/* FUNCTION NAME: Encode Event
+ * PURPOSE: Formats the requested parts of one captured event in format (globalPublishFormat for the Data topic, each output
+ *          sink has its own) without touching the network
+ * ACTION: JSON gives one message per entry and the context before the event (waveform), followed by the event metadata
+ *         and spectral summary (summary). INFLUX gives them all as a single multi-line message. Messages that do not fit in ENCODED_EVENT_SIZE are left out. Returns the bytes used
+ */
+size_t encodeEvent(const char* site, const char* equipmentID, const EventBuffer& event, EncodeParts parts, PublishFormat format, EncodedEvent& encoded);
+
+/* FUNCTION NAME: Transmit Encoded
+ * PURPOSE: Publishes the messages of an encoded event on topic
+ * ACTION: Every message is streamed, so the INFLUX batch is not limited by PUBLISH_BUFFER_SIZE. Stops at the first message
+ *         that fails and drops the session, which MQTT_TASK then reconnects. Returns true only if every message went out.
+ *         messages and bytes, if not NULL, are incremented by what was sent
+ */
+bool transmitEncoded(const char* topic, const EncodedEvent& encoded, uint32_t* messages, size_t* bytes);
+
+/* FUNCTION NAME: Publish Event
+ * PURPOSE: Encodes and publishes one event on publishTopicData in one go, for paths already running on MQTT_TASK
+ *         (history, power-fail recovery). Live events go through the encoder pipeline instead, see pipeline.h
+ * ACTION: Returns false if the event did not go out whole, the caller keeps it to send again after the reconnect
+ */
+bool publishEvent(NetworkObject& object, const EventBuffer& event);
+
+/* FUNCTION NAME: Publish Event To
+ * PURPOSE: Same as publishEvent for any device's topic and tags, used by the load generator
+ * ACTION: Returns what transmitEncoded returns. Not reentrant, the encoded event is kept in one static buffer
+ */
+bool publishEventTo(const char* topic, const char* site, const char* equipmentID, const EventBuffer& event, uint32_t* messages, size_t* bytes);
 
 
 
@@ -183,16 +468,24 @@ String generateEntry();
 
 /* FUNCTION NAME: Get Time Benchmark
  * PURPOSE: Gets a time benchmark (or time reference) from NTP server
- * ACTION: Sends a request message to the NTP server and then parses the response message for the time benchmark
+ * ACTION: Sends a request message to the NTP server, waits up to NTP_TIMEOUT_MS for the response and moves the clock
+ *         anchor to it. Returns 0 if none came. Blocking, only run at boot
  */
 time_t getTimeBenchmark();
 
 /* FUNCTION NAME: NTP Init
  * PURPOSE: Initiates connection to NTP server
- * ACTION: Initiates UDP protocol and sets getTimeBenchmark as the sync provider
+ * ACTION: Initiates UDP protocol and makes the first sync with getTimeBenchmark
  */
 void ntpInit();
 
+/* FUNCTION NAME: NTP Step
+ * PURPOSE: Keeps the clock anchor in sync, called by MQTT_TASK on every loop
+ * ACTION: Sends a request every NTP_SYNC_INTERVAL_S (NTP_RETRY_S after a failure or before the first sync) and picks up
+ *         the response on a later loop, so the NTP_TIMEOUT_MS wait never blocks the loop
+ */
+void ntpStep();
+
 
 
 #endif
@@ -0,0 +1,56 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include "config.h"
+
+
+
+////////////////////Spectral Summary////////////////////
+
+/* STRUCT NAME: Spectral Summary
+ * PURPOSE: Compact description of the frequency content of one captured event
+ */
+struct SpectralSummary
+{
+  uint16_t size;  //Transform length used (capture length rounded up to a power of 2)
+  float binHz;  //Width of one frequency bin in Hz, derived from the measured sample rate of the event
+  uint16_t peakBin[FFT_TOP_K];  //Bin index of each peak, strongest first. 0 if fewer than FFT_TOP_K peaks exist
+  uint32_t peakPower[FFT_TOP_K];  //Squared magnitude of each peak in scaled fixed-point units
+  uint32_t bandEnergy[FFT_BANDS];  //Sum of squared magnitudes per band, DC excluded
+  uint32_t elapsedMicros;  //Time spent computing this summary
+};
+
+
+
+////////////////////FFT Functions////////////////////
+
+/* FUNCTION NAME: FFT Init
+ * PURPOSE: Builds the Q15 twiddle table for FFT_MAX_SIZE
+ * ACTION: Only needs to be called once at boot, subsequent calls return immediately
+ */
+void fftInit();
+
+/* FUNCTION NAME: FFT Size For
+ * PURPOSE: Returns the smallest power of 2 transform length that holds count samples, capped at FFT_MAX_SIZE
+ */
+uint16_t fftSizeFor(int count);
+
+/* FUNCTION NAME: FFT Transform
+ * PURPOSE: In-place fixed-point radix-2 decimation-in-time FFT
+ * ACTION: re/im hold n Q15 values (n a power of 2, n <= FFT_MAX_SIZE). Every stage halves its output to prevent overflow,
+ *         so the result is the true transform scaled by 1/n
+ */
+void fftTransform(int16_t* re, int16_t* im, uint16_t n);
+
+/* FUNCTION NAME: FFT Summary
+ * PURPOSE: Computes the top FFT_TOP_K peaks and FFT_BANDS band energies of a raw ADC capture
+ * ACTION: Removes the mean, scales the counts into Q15, zero pads to the next power of 2 and runs fftTransform.
+ *         Peaks are the strongest local maxima of the spectrum, so one tone fills one slot. The scratch arrays are on the
+ *         caller's stack, so every task may call it at the same time (needs ~1 KB of stack). sampleRate (Hz) is only used
+ *         to fill in binHz
+ */
+void fftSummary(const uint16_t* samples, int count, float sampleRate, SpectralSummary* summary);
+
+
+
+#endif
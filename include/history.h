@@ -0,0 +1,72 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include "externals.h"
+
+
+
+////////////////////History Constants////////////////////
+
+#define HISTORY_EVENTS 64  //Events kept for HISTORY queries on boards with PSRAM, the oldest is overwritten (64 x sizeof(EventBuffer), ~75 KB with 2 channels)
+#define HISTORY_SRAM_EVENTS 8  //Events kept in internal heap on boards without PSRAM (~9 KB with 2 channels)
+#define HISTORY_INTERVAL_MS 250  //Minimum time between two replayed events, live events always go first
+#define HISTORY_MAX_SEQUENCE 0xFFFFFFFF  //AFTER value meaning "nothing yet", replays everything kept
+
+
+
+////////////////////History Types////////////////////
+
+/* STRUCT NAME: History Index
+ * PURPOSE: Compact index entry of one stored event, kept separate from the samples so lookups stay in a 768 byte array
+ */
+struct HistoryIndex
+{
+  uint32_t sequence;  //Event sequence number (EventBuffer::sequence), increasing in capture order
+  uint32_t seconds;  //Device local time of the event's first sample
+  uint16_t slot;  //Where its readings are kept
+};
+
+
+
+////////////////////History Functions////////////////////
+
+/* FUNCTION NAME: History Init
+ * PURPOSE: Allocates the stored events
+ * ACTION: Takes HISTORY_EVENTS slots from PSRAM when the board has it, otherwise HISTORY_SRAM_EVENTS from the internal heap.
+ *         If even that fails nothing is kept and HISTORY replays nothing. Called once at boot, before MQTT_TASK starts
+ */
+void historyInit();
+
+/* FUNCTION NAME: History Append
+ * PURPOSE: Keeps a published event for later HISTORY queries
+ * ACTION: Called by MQTT_TASK with the back-dated event as its waveform starts going out. The index is kept in capture
+ *         (sequence) order whatever order the schedule policy sends events in, and an event already kept (a resend
+ *         under DELIVERY_ACK) is not added again, nor is a TRACE run's injected transient. Overwrites the oldest event when full. Returns its sequence number
+ */
+uint32_t historyAppend(const EventBuffer& event);
+
+/* FUNCTION NAME: History Query Time
+ * PURPOSE: Starts replaying every stored event whose first sample lies in [fromUTC, toUTC] (Unix seconds)
+ * ACTION: Binary search of the index for both ends, O(log n). A replay already running is replaced.
+ *         Returns the number of events that will be replayed
+ */
+uint32_t historyQueryTime(uint32_t fromUTC, uint32_t toUTC);
+
+/* FUNCTION NAME: History Query Sequence
+ * PURPOSE: Starts replaying every stored event with a sequence number greater than after
+ * ACTION: Binary search of the index, O(log n). Sequence numbers may have gaps (events dropped from a full store, reboots).
+ *         A replay already running is replaced. Returns the number of events that will be replayed
+ */
+uint32_t historyQuerySequence(uint32_t after);
+
+/* FUNCTION NAME: History Step
+ * PURPOSE: Publishes the next event of a running replay on the Data topic, at most one per HISTORY_INTERVAL_MS
+ * ACTION: Called by MQTT_TASK after the live event of the iteration. Events overwritten since the query are skipped, an
+ *         event whose publish failed is sent again on the next interval after the reconnect
+ *         When the replay ends, {"HISTORY":{"FIRST":seq,"LAST":seq,"EVENTS":n,"SKIPPED":n}} is published on the Info topic
+ */
+void historyStep(NetworkObject& object);
+
+
+
+#endif
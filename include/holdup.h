@@ -0,0 +1,80 @@
+#ifndef HOLDUP_H
+#define HOLDUP_H
+
+#include "externals.h"
+#include <esp_partition.h>
+
+
+
+////////////////////Holdup Constants////////////////////
+
+#define HOLDUP_MAGIC 0x484C4441  //"HLDA", marks a complete power-fail record (events stored as EventBuffer, with block, sequence number, baseline, context and trace)
+#define HOLDUP_MAX_EVENTS 32  //Most events in one record, fewer if the partition is smaller (the 64 KB one in partitions.csv holds them all)
+#define HOLDUP_DATA_OFFSET 256  //Events are written from here, the header at offset 0 is written last
+#define HOLDUP_PARK_TIMEOUT_MS 2  //Longest wait for VTC_TASK to park before its ring is snapshotted anyway (flagged HOLDUP_RING_TORN)
+#define HOLDUP_LOCK_TIMEOUT_MS 2  //Longest wait for the store mutex, the holder inherits FLUSH_TASK's priority meanwhile
+
+#define HOLDUP_STORE_SKIPPED 0x01  //Header flag: the store mutex was not free in time, queued events are not in the record
+#define HOLDUP_RING_TORN 0x02  //Header flag: VTC_TASK had not parked, the live ring may have been written mid-reading
+
+
+
+////////////////////Holdup Types////////////////////
+
+/* STRUCT NAME: Holdup Header
+ * PURPOSE: First bytes of the power-fail record. Only valid when magic == HOLDUP_MAGIC
+ */
+struct HoldupHeader
+{
+  uint32_t magic;
+  uint16_t eventCount;  //Events in the record, stored back to back from HOLDUP_DATA_OFFSET
+  uint16_t channels;  //CHANNEL_COUNT of the firmware that wrote the record, records with another layout are discarded
+  uint32_t flushMicros;  //Time from the power-fail signal until the record was complete
+  uint16_t simulated;  //1 if the record came from the PWRFAIL command
+  uint16_t flags;  //HOLDUP_STORE_SKIPPED, HOLDUP_RING_TORN
+  uint16_t omitted;  //Undelivered events left out of the record, for lack of time (HOLDUP_BUDGET_US) or room
+  uint16_t reserved;
+};
+
+
+extern volatile bool captureFrozen;  //Set on power-fail, captureStep stops at its next reading and VTC_TASK parks itself
+extern volatile bool captureParked;  //Set by VTC_TASK once it has stopped touching dataSet
+
+
+
+////////////////////Holdup Functions////////////////////
+
+/* FUNCTION NAME: Holdup Init
+ * PURPOSE: Arms the power-fail path at boot
+ * ACTION: Finds the HOLDUP_PARTITION flash partition, keeps a record left by the previous boot for holdupPublishRecovered
+ *         (otherwise pre-erases the sectors a record of up to HOLDUP_MAX_EVENTS events can use), starts the flush task and attaches the POWER_SENSE_PIN interrupt. Must be called after
+ *         VTC_TASK has been created. Does nothing if POWER_SENSE_PIN is -1 or the partition is missing
+ */
+void holdupInit();
+
+/* FUNCTION NAME: Holdup Parked
+ * PURPOSE: Called by VTC_TASK when it sees captureFrozen, just before it suspends itself. Sets captureParked and wakes
+ *          FLUSH_TASK, which waits for it (up to HOLDUP_PARK_TIMEOUT_MS) before snapshotting dataSet
+ */
+void holdupParked();
+
+/* FUNCTION NAME: Holdup Simulate
+ * PURPOSE: Raises the same power-fail signal as the supply-sense interrupt, for testing on the bench
+ * ACTION: The flush runs as for a real input loss, reports its timing against HOLDUP_BUDGET_US on Serial and resets the
+ *         device so the recovery path runs on the next boot. Returns false if the path is not armed
+ */
+bool holdupSimulate();
+
+/* FUNCTION NAME: Holdup Publish Recovered
+ * PURPOSE: Publishes events saved by a power-fail flush before anything else after boot
+ * ACTION: Called by MQTT_TASK once connected, and again after every reconnect. Publishes each saved event, then a
+ *         {"POWERFAIL":{...}} report with the flush time, whether it met HOLDUP_BUDGET_US, the events left out and the
+ *         header flags (STORE_SKIPPED, RING_TORN) on publishTopicInfo. Only once all of it went out is the region erased,
+ *         so the path is armed again. A failed publish keeps the record and returns false, the next call resumes with
+ *         the event that failed. Returns true when no record is left
+ */
+bool holdupPublishRecovered(NetworkObject& object);
+
+
+
+#endif
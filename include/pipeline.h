@@ -0,0 +1,84 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "externals.h"
+#include "stats.h"
+
+
+
+////////////////////Pipeline Constants////////////////////
+
+#define ENCODE_SLOTS 4  //Encoded events waiting for MQTT_TASK, the encoder stalls once all are full (4 x ~11 KB with 2 channels)
+
+
+
+////////////////////Pipeline Types////////////////////
+
+/* STRUCT NAME: Pipeline Slot
+ * PURPOSE: One event on its way from ENCODE_TASK to MQTT_TASK. The raw readings travel with the messages so the transmit
+ *          stage can keep its history and depth statistics without formatting anything
+ */
+struct PipelineSlot
+{
+  EventBuffer event;
+  EncodedEvent encoded;
+};
+
+
+/* STRUCT NAME: Pipeline Stats
+ * PURPOSE: Counters written only by ENCODE_TASK, the per-stage backpressure of the encode and transmit stages
+ */
+struct PipelineStats
+{
+  PerfTimer encodeTime;  //Time to back-date and encode one event
+  PerfTimer slotWait;  //Time ENCODE_TASK waited for MQTT_TASK to free a slot (transmit backpressure)
+  uint32_t encoded;  //Events encoded
+  uint32_t maxReady;  //Most encoded events waiting for MQTT_TASK at once
+};
+
+
+extern PipelineStats pipelineStats;
+extern volatile bool pipelineStatsResetRequested;  //Set by statsReset, ENCODE_TASK clears its own counters before its next event
+
+
+
+////////////////////Pipeline Functions////////////////////
+
+/* FUNCTION NAME: Pipeline Start
+ * PURPOSE: Starts the encode stage between capture (VTC_TASK) and transmit (MQTT_TASK)
+ * ACTION: Keeps copies of the site and equipment ID tags and creates ENCODE_TASK on core 1 below SAMPLER_TASK and VTC_TASK,
+ *         so encoding and the spectral summary only use time sampling leaves free and never delay socket I/O on core 0.
+ *         ENCODE_TASK takes events from the store, back-dates and encodes them and queues them for MQTT_TASK. The summary
+ *         of every queued event is encoded ahead of any waveform, so after an outage operators see what happened first
+ */
+void pipelineStart(const char* site, const char* equipmentID);
+
+/* FUNCTION NAME: Pipeline Notify
+ * PURPOSE: Wakes ENCODE_TASK after an event was queued in the store. Safe to call before pipelineStart
+ */
+void pipelineNotify();
+
+/* FUNCTION NAME: Pipeline Transmit
+ * PURPOSE: Transmit stage, run by MQTT_TASK once per loop
+ * ACTION: Sends messages of encoded events in the order ENCODE_TASK queued them until budget payload bytes went out,
+ *         resuming part way through an event on the next call, so draining a backlog never starves commands and
+ *         keepalives. Waveforms are added to the history as they start. A failed publish stops the drain and drops the
+ *         session, the failed message is sent again after reconnect. Returns the payload bytes sent
+ */
+size_t pipelineTransmit(const char* topic, size_t budget);
+
+/* FUNCTION NAME: Pipeline Undelivered
+ * PURPOSE: Waveforms ENCODE_TASK took from the store that MQTT_TASK has not finished publishing, for the power-fail flush
+ * ACTION: Fills events with up to max of them and returns the count. Always 0 under DELIVERY_ACK, where such events stay
+ *         in the store until acknowledged. Caller holds mutexHandle, so ENCODE_TASK cannot take another event meanwhile
+ */
+int pipelineUndelivered(const EventBuffer** events, int max);
+
+/* FUNCTION NAME: Pipeline Ready Count
+ * PURPOSE: Encoded events waiting for MQTT_TASK
+ */
+int pipelineReadyCount();
+
+
+
+#endif
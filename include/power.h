@@ -0,0 +1,107 @@
+#ifndef POWER_H
+#define POWER_H
+
+#include "externals.h"
+#include <esp_pm.h>
+#include <esp_sleep.h>
+
+
+
+////////////////////Power Constants////////////////////
+
+#define POWER_QUIET_S 300  //Default quiet period (QUIET config key) without a triggering channel near its threshold before low power
+#define POWER_FULL_CPU_MHZ 240
+#define POWER_LOW_CPU_MHZ 80  //Lowest clock that keeps the 80 MHz APB, so UART, sample timer and Ethernet timing are unchanged
+#define POWER_PARK_MS 250  //Longest MQTT_TASK sleeps between polls in low power, bounds command latency and keeps keepalives going
+#define POWER_HOLDUP_POLL_MS 10  //Light sleep slices while waiting for the UPS to drain, POWER_SENSE_PIN is checked in between
+
+//Board-level draw used for the current estimate (ESP32 module with the LAN8720 PHY). Replace with bench figures of the board
+#define POWER_FULL_MA 130  //240 MHz, both tasks polling
+#define POWER_LOW_MA 70  //80 MHz, cores idle between readings and network polls
+#define POWER_SLEEP_MA 35  //Light sleep on holdup, mostly the PHY
+
+
+
+////////////////////Power Types////////////////////
+
+/* ENUM NAME: Power State
+ * PURPOSE: Current power mode of the device
+ */
+enum PowerState
+{
+  POWER_STATE_FULL,  //Full clock, timer-paced sampling and a polling network task
+  POWER_STATE_LOW,  //Quiet line: reduced clock, timer-paced sampling at the idle rate, network task parked
+  POWER_STATE_HOLDUP  //On UPS holdup after the power-fail flush: capture stopped, light sleep until the supply drains or returns
+};
+
+
+/* STRUCT NAME: Power Stats
+ * PURPOSE: Time spent in each power state since boot, for the STATS current estimate
+ */
+struct PowerStats
+{
+  uint32_t entries;  //Switches to low power
+  uint32_t exits;  //Switches back, on a reading near a threshold or a command
+  uint32_t lowMillis;  //Time in POWER_STATE_LOW, not counting the current stay
+};
+
+
+extern PowerStats powerStats;
+
+
+
+////////////////////Power Functions////////////////////
+
+/* FUNCTION NAME: Power Init
+ * PURPOSE: Sets up the power manager at boot
+ * ACTION: Low power is off under "POWER":"OFF" and while raw streaming. Otherwise the quiet timer starts, and with
+ *         CONFIG_PM_ENABLE the clock is handed to esp_pm. Called before samplerInit
+ */
+void powerInit();
+
+/* FUNCTION NAME: Power State
+ * PURPOSE: Current power state, read by SAMPLER_TASK on every reading
+ */
+PowerState powerState();
+
+/* FUNCTION NAME: Power Activity
+ * PURPOSE: Restarts the quiet period. Called by MQTT_TASK for every command, SAMPLER_TASK returns to full power on its
+ *          next reading
+ */
+void powerActivity();
+
+/* FUNCTION NAME: Power Step
+ * PURPOSE: Switches between full and low power. Called by SAMPLER_TASK on every reading, the only task that changes state
+ * ACTION: A reading near a threshold restarts the quiet period. Low power starts once the line has been quiet for QUIET
+ *         seconds and ends on the first reading after new activity, which also wakes a parked MQTT_TASK. Returns the
+ *         state after the reading
+ */
+PowerState powerStep(bool near);
+
+/* FUNCTION NAME: Power Park
+ * PURPOSE: In low power MQTT_TASK sleeps here for up to POWER_PARK_MS at the end of a loop that had nothing to do.
+ *          Returns at once at full power
+ */
+void powerPark(bool idle);
+
+/* FUNCTION NAME: Power Holdup
+ * PURPOSE: Cuts draw once the power-fail record is on flash, so the UPS keeps the MCU up longer
+ * ACTION: Called by FLUSH_TASK after the flush. Stops the sample timer and drops to POWER_LOW_CPU_MHZ. Does nothing under
+ *         "POWER":"OFF"
+ */
+void powerHoldup();
+
+/* FUNCTION NAME: Power Holdup Wait
+ * PURPOSE: Waits POWER_HOLDUP_POLL_MS, in light sleep after powerHoldup (network and capture are done with by then)
+ */
+void powerHoldupWait();
+
+/* FUNCTION NAME: Generate Power Stats
+ * PURPOSE: Appends "POWER":{"STATE","MHZ","LOW_PCT","ENTRIES","EXITS","MA","AVG_MA"} to a STATS reply. MA is the
+ *          estimated draw in the current state, AVG_MA the estimate averaged since boot. Returns the new length
+ */
+int generatePowerStats(char* buffer, int length, size_t size);
+
+
+
+#endif
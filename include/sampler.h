@@ -0,0 +1,90 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "externals.h"
+
+
+
+////////////////////Sampler Constants////////////////////
+
+#define SAMPLE_TIMER 0  //Hardware timer (0-3) that paces sampling
+#define SAMPLE_TIMER_DIVIDER 80  //80 MHz APB clock / 80 = 1 us timer ticks
+#define SAMPLE_FIFO_SIZE 64  //Readings buffered between SAMPLER_TASK and VTC_TASK
+#define ADAPT_LOOKAHEAD_US 2000  //Slope projection horizon, a channel heading for its threshold this soon counts as near it
+#define ADAPT_HOLD_SAMPLES (QUEUE_RANGE + OVERRIDE_RANGE)  //Readings kept at SRATE after the last near reading, covers a whole capture
+
+
+
+////////////////////Sampler Types////////////////////
+
+/* STRUCT NAME: Sampler Stats
+ * PURPOSE: Counters written only by SAMPLER_TASK
+ */
+struct SamplerStats
+{
+  uint32_t missedDeadlines;  //Timer ticks that passed without a reading (SAMPLER_TASK was late)
+  uint32_t fifoOverflows;  //Readings discarded because VTC_TASK had not emptied the FIFO
+  uint32_t maxFifoDepth;  //Most readings waiting in the FIFO at once
+  uint32_t readings;  //Readings taken
+  uint32_t burstReadings;  //Readings taken at SRATE while adaptive sampling is on
+  uint32_t bursts;  //Switches from the idle rate to SRATE
+};
+
+
+/* STRUCT NAME: Event Timing
+ * PURPOSE: Sample pacing actually achieved during one event, published with it
+ */
+struct EventTiming
+{
+  float rate;  //Samples per second from the trigger on
+  float preRate;  //Samples per second before the trigger, below rate when adaptive sampling was still idling
+  uint32_t maxJitter;  //Largest deviation of an inter-sample interval from the mean interval from the trigger on, in microseconds
+};
+
+
+extern SamplerStats samplerStats;
+extern volatile bool samplerStatsResetRequested;  //Set by statsReset, SAMPLER_TASK clears its own counters on its next tick
+
+
+
+////////////////////Sampler Functions////////////////////
+
+/* FUNCTION NAME: Sampler Init
+ * PURPOSE: Starts timer-paced sampling, at globalIdleRate when adaptive sampling is on and globalSampleRate otherwise
+ * ACTION: Creates the sample FIFO and SAMPLER_TASK (core 1, above VTC_TASK) and starts the hardware timer. Each timer
+ *         interrupt wakes SAMPLER_TASK, which takes one reading and queues it for VTC_TASK, so sample spacing no longer
+ *         depends on how long trigger handling, or hand-over take. With adaptive sampling SAMPLER_TASK raises the
+ *         timer to globalSampleRate as soon as a triggering channel approaches its threshold (ChannelSet::approaching)
+ *         and drops back to the idle rate ADAPT_HOLD_SAMPLES readings after the last near one. While streaming (stream.h)
+ *         every reading is also handed to streamPush and adaptive sampling stays off. In low power (power.h) the timer
+ *         keeps running at the idle rate on the reduced clock, until a reading near a threshold brings back full power
+ *         at globalSampleRate. Called after streamInit and powerInit
+ */
+void samplerInit();
+
+/* FUNCTION NAME: Sampler Pause
+ * PURPOSE: Stops (true) or restarts (false) the sampling timer. Restarting discards readings
+ *          still in the FIFO
+ */
+void samplerPause(bool pause);
+
+/* FUNCTION NAME: Sampler Read
+ * PURPOSE: Blocks until the next timed reading is available
+ */
+void samplerRead(Sample& sample);
+
+/* FUNCTION NAME: Event Trigger Index
+ * PURPOSE: Position of the triggering reading in an event, OVERRIDE_RANGE readings before its end. 0 for later blocks of a long event
+ */
+int eventTriggerIndex(const EventBuffer& event);
+
+/* FUNCTION NAME: Event Timing
+ * PURPOSE: Computes the achieved rates and maximum jitter of a captured event from its sample timestamps
+ * ACTION: Rate and jitter are measured from the trigger on, which is always sampled at one rate, and the rate before the
+ *         trigger separately
+ */
+EventTiming eventTiming(const EventBuffer& event);
+
+
+
+#endif
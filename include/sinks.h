@@ -0,0 +1,109 @@
+#ifndef SINKS_H
+#define SINKS_H
+
+#include "externals.h"
+
+
+
+////////////////////Sink Constants////////////////////
+
+#define SPOOL_SINK_DEPTH 8  //Events queued for the flash spool
+#define SPOOL_SINK_BATCH 4  //Events written before the partial flash page is committed
+#define SERIAL_SINK_DEPTH 4  //Events queued for Serial
+#define SERIAL_SINK_BATCH 1  //Serial writes each event as it comes, the UART driver buffers it
+#define SINK_SYNC_POLL_MS 50  //How often a sink task waiting for the first NTP sync checks for it and for its queue filling up
+
+
+
+////////////////////Sink Types////////////////////
+
+/* ENUM NAME: Sink ID
+ * PURPOSE: Output sinks completed events fan out to, one bit each in globalSinks
+ */
+enum SinkId
+{
+  SINK_MQTT,  //Event store, ENCODE_TASK and MQTT_TASK (pipeline.h), encoded in FORMAT
+  SINK_SPOOL,  //Ring of records in the "spool" flash partition (spool.h), line protocol
+  SINK_SERIAL,  //One JSON message per line on Serial
+  SINK_COUNT
+};
+
+
+/* STRUCT NAME: Output Sink
+ * PURPOSE: One destination of completed events. Every sink but SINK_MQTT gets its own queue and task, so a slow
+ *          destination only ever fills its own queue
+ */
+struct OutputSink
+{
+  const char* name;  //Token in the SINKS config key, key in STATS
+  PublishFormat format;  //Encoding written to the sink
+  uint8_t depth;  //Events queued for the sink, a full queue drops the new event for this sink only
+  uint8_t batch;  //Most events written between flushes
+  bool (*begin)();  //Prepares the destination, false leaves the sink off
+  void (*write)(const EncodedEvent& encoded);  //Writes every message of one event
+  void (*flush)();  //Ends a batch
+};
+
+
+/* STRUCT NAME: Sink Stats
+ * PURPOSE: Per-sink counters since boot. events/bytes are written by the sink's task, dropped by VTC_TASK
+ */
+struct SinkStats
+{
+  uint32_t events;  //Events written
+  uint32_t bytes;  //Payload bytes written
+  uint32_t dropped;  //Events lost to a full queue
+  uint32_t maxDepth;  //Most events waiting at once
+};
+
+
+extern SinkStats sinkStats[SINK_COUNT];
+
+
+
+////////////////////Sink Functions////////////////////
+
+/* FUNCTION NAME: Sinks Parse
+ * PURPOSE: Converts the SINKS config value (sink names separated by commas, e.g. "MQTT,SPOOL") into a globalSinks mask
+ */
+uint8_t sinksParse(const char* names);
+
+/* FUNCTION NAME: Sinks List
+ * PURPOSE: The reverse of sinksParse, writes the names of the enabled sinks separated by commas (for the ping)
+ */
+const char* sinksList(char* buffer, size_t size);
+
+/* FUNCTION NAME: Sinks Init
+ * PURPOSE: Creates the queue of every enabled sink. Called from setup() before VTC_TASK, after streamInit
+ * ACTION: Events fanned out before sinksStart wait in the queues
+ */
+void sinksInit();
+
+/* FUNCTION NAME: Sinks Start
+ * PURPOSE: Opens every enabled sink and starts its task (core 0, priority 0) with the site and equipment ID tags
+ * ACTION: A sink whose begin() fails is switched off. Called by MQTT_TASK once the config is loaded, before network bring-up.
+ *         Until the first NTP sync a sink task leaves events in its queue, so they are back-dated like the ones ENCODE_TASK
+ *         publishes, and only writes one once a single free slot is left
+ */
+void sinksStart(const char* site, const char* equipmentID);
+
+/* FUNCTION NAME: Sinks Fan Out
+ * PURPOSE: Hands a completed event to every enabled sink but SINK_MQTT. Called by VTC_TASK, never blocks
+ * ACTION: A transient injected by a TRACE run (EventTrace::injected) is left out, it only goes to the broker
+ */
+void sinksFanOut(const EventBuffer& event);
+
+/* FUNCTION NAME: Sink Enabled
+ * PURPOSE: true if the sink is selected in globalSinks (and, after sinksStart, opened successfully)
+ */
+bool sinkEnabled(SinkId sink);
+
+/* FUNCTION NAME: Generate Sink Stats
+ * PURPOSE: Appends "SINKS":{"<name>":[events,bytes/s,dropped,maxDepth],...} for every enabled sink to a STATS reply
+ * ACTION: Bytes per second are averaged over uptime. Returns the new length
+ */
+int generateSinkStats(char* buffer, int length, size_t size);
+
+
+
+#endif
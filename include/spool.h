@@ -0,0 +1,81 @@
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#include "externals.h"
+#include <esp_partition.h>
+
+
+
+////////////////////Spool Constants////////////////////
+
+#define SPOOL_MAGIC 0x53504C31  //"SPL1", marks a sector in use
+#define SPOOL_SECTOR_SIZE 4096  //Flash erase unit, the ring advances a sector at a time
+#define SPOOL_PAGE_SIZE 256  //Flash program unit, bytes are gathered in RAM and programmed a page at a time
+#define SPOOL_NO_RECORD 0xFFFF  //firstRecord of a sector no record starts in (left erased)
+#define SPOOL_DEFER_POLL_MS 5  //How often a held back flash operation checks whether the capture in progress has ended
+
+
+
+////////////////////Spool Types////////////////////
+
+/* STRUCT NAME: Spool Sector Header
+ * PURPOSE: First bytes of every spool sector. The rest of the sector continues one byte stream of records across sectors,
+ *          each record a uint16 length followed by one encoded message
+ */
+struct SpoolSectorHeader
+{
+  uint32_t magic;  //SPOOL_MAGIC
+  uint32_t sequence;  //Sectors are read in increasing sequence, the highest is the newest
+  uint16_t firstRecord;  //Offset in the sector of the first record starting there, SPOOL_NO_RECORD if none does
+  uint16_t reserved;
+};
+
+
+/* STRUCT NAME: Spool Stats
+ * PURPOSE: Flash counters since boot, written only by the SPOOL sink task. An erase or program turns the flash cache off on
+ *          both cores, so its duration is a gap in sampling
+ */
+struct SpoolStats
+{
+  uint32_t flashOps;  //Sector erases (with the header write) and page programs
+  uint32_t deferred;  //Flash operations held back until the capture in progress was handed over
+  uint32_t gaps;  //Flash operations that lasted longer than one SRATE period, each cost at least one reading
+  uint32_t maxGapMicros;  //Longest flash operation
+};
+
+
+extern SpoolStats spoolStats;
+
+
+
+////////////////////Spool Functions////////////////////
+
+/* FUNCTION NAME: Spool Begin
+ * PURPOSE: Opens the SPOOL_PARTITION ring for the SPOOL output sink
+ * ACTION: Finds the newest sector from the headers and continues in the sector after it, so a reboot leaves earlier records
+ *         intact. Returns false if the partition is missing
+ */
+bool spoolBegin();
+
+/* FUNCTION NAME: Spool Write
+ * PURPOSE: Appends every message of an encoded event as one record. Full pages are programmed as they fill, the oldest
+ *          sector is erased as the ring wraps onto it
+ * ACTION: Every flash operation waits while captureActive, so the readings of a capture are never lost to a stalled
+ *         SAMPLER_TASK. Readings before a trigger still can be, spoolStats counts the gaps
+ */
+void spoolWrite(const EncodedEvent& encoded);
+
+/* FUNCTION NAME: Spool Flush
+ * PURPOSE: Programs the partial page, so a batch is on flash once the sink has written it
+ */
+void spoolFlush();
+
+/* FUNCTION NAME: Generate Spool Stats
+ * PURPOSE: Appends "SPOOLFLASH":[flash ops, deferred, gaps, longest gap in us] to a STATS reply when the SPOOL sink is
+ *          on. Returns the new length
+ */
+int generateSpoolStats(char* buffer, int length, size_t size);
+
+
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "config.h"
+
+
+
+////////////////////Performance Counters////////////////////
+
+/* STRUCT NAME: Perf Timer
+ * PURPOSE: Running min/max/avg of a duration in microseconds
+ * ACTION: Each timer has exactly one writing task, so updates need no lock. Readers on the other core may see a
+ *         half-updated timer, which only ever skews a single report
+ */
+struct PerfTimer
+{
+  uint32_t count;
+  uint32_t min;
+  uint32_t max;
+  uint64_t sum;
+};
+
+
+/* STRUCT NAME: VTC Stats
+ * PURPOSE: Counters written only by VTC_TASK
+ */
+struct VtcStats
+{
+  uint32_t samples;  //Readings taken since the last reset
+  uint32_t lastMicros;  //Timestamp of the previous reading, used for the interval timer
+  uint32_t events;  //Excursion events captured
+  uint32_t droppedEvents;  //Events that overwrote one MQTT_TASK had not published yet
+  PerfTimer sampleInterval;  //Time between consecutive readings (loop jitter)
+  PerfTimer mutexWait;  //Time spent waiting on mutexHandle to hand over an event
+};
+
+
+/* STRUCT NAME: MQTT Stats
+ * PURPOSE: Counters written only by MQTT_TASK
+ */
+struct MqttStats
+{
+  uint32_t reconnects;  //Broker connections established, the first one after boot included
+  uint32_t publishFailures;  //mqttClient.publish calls that returned false
+  uint32_t maxQueueDepth;  //Largest event handed over in one go, in entries
+  uint32_t droppedCommands;  //Commands rejected because the command queue was full or the message too long
+  PerfTimer publishLatency;  //Time to format and publish one event
+  PerfTimer commandTime;  //Time to execute one command, replies included
+};
+
+
+extern VtcStats vtcStats;
+extern MqttStats mqttStats;
+extern volatile bool vtcStatsResetRequested;  //Set by MQTT_TASK, VTC_TASK clears its own counters on its next reading
+extern uint32_t statsResetMillis;  //millis() at the last reset
+
+
+
+////////////////////Stats Functions////////////////////
+
+/* FUNCTION NAME: Perf Record
+ * PURPOSE: Adds one duration to a timer
+ */
+inline void perfRecord(PerfTimer& timer, uint32_t value)
+{
+  timer.count++;
+  timer.sum += value;
+  if(value < timer.min)
+    timer.min = value;
+  if(value > timer.max)
+    timer.max = value;
+}
+
+/* FUNCTION NAME: Perf Reset
+ * PURPOSE: Clears a timer
+ */
+inline void perfReset(PerfTimer& timer)
+{
+  timer.count = 0;
+  timer.sum = 0;
+  timer.min = UINT32_MAX;
+  timer.max = 0;
+}
+
+/* FUNCTION NAME: Stats Record Sample
+ * PURPOSE: Per-reading hook for VTC_TASK
+ * ACTION: Counts the reading and records the interval since the previous one. Also services pending reset requests
+ *         so the counters are only ever written from this task
+ */
+inline void statsRecordSample(uint32_t sampleMicros)
+{
+  if(vtcStatsResetRequested)
+  {
+    vtcStats.samples = 0;
+    vtcStats.events = 0;
+    vtcStats.droppedEvents = 0;
+    perfReset(vtcStats.sampleInterval);
+    perfReset(vtcStats.mutexWait);
+    vtcStats.lastMicros = sampleMicros;
+    vtcStatsResetRequested = false;
+  }
+  else if(vtcStats.samples > 0)
+    perfRecord(vtcStats.sampleInterval, sampleMicros - vtcStats.lastMicros);
+
+  vtcStats.lastMicros = sampleMicros;
+  vtcStats.samples++;
+}
+
+/* FUNCTION NAME: Stats Reset
+ * PURPOSE: Clears MQTT_TASK counters and asks VTC_TASK to clear its own. Must be called from MQTT_TASK
+ */
+void statsReset();
+
+/* FUNCTION NAME: Generate Stats
+ * PURPOSE: Formats all counters, task stack high-water marks and heap figures as one compact JSON message
+ * ACTION: Timers are reported as [min,avg,max] in microseconds. Returns the length, 0 if the message did not fit
+ */
+size_t generateStats(char* buffer, size_t size);
+
+
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include "externals.h"
+
+
+
+////////////////////Store Constants////////////////////
+
+#define STORE_PSRAM_EVENTS 1024  //Events queued for ENCODE_TASK on boards with PSRAM (1024 x sizeof(EventBuffer), ~1 MB with 2 channels)
+#define STORE_SRAM_EVENTS 2  //Events queued in internal heap on boards without PSRAM
+#define LONG_EVENT_BLOCKS 500  //Most blocks of QUEUE_RANGE readings per event with PSRAM (20000 readings), 1 without
+
+
+
+////////////////////Store Functions////////////////////
+
+/* FUNCTION NAME: Store Init
+ * PURPOSE: Allocates the queue of completed events waiting for ENCODE_TASK
+ * ACTION: Takes STORE_PSRAM_EVENTS slots from PSRAM when the board has it, otherwise STORE_SRAM_EVENTS from the internal
+ *         heap, falling back to a single static slot if even that fails. Must run before VTC_TASK hands over an event
+ */
+void storeInit();
+
+/* FUNCTION NAME: Store Push
+ * PURPOSE: Queues a completed event, linearized from the capture ring in block copies, and scores its severity
+ * ACTION: Keeps the event's sequence number. When the store is full one event is dropped (the least severe under
+ *         SCHEDULE_SEVERITY, the oldest otherwise, in-flight events last) and false is returned. Caller holds mutexHandle
+ */
+bool storePush(const EventBuffer& event);
+
+/* FUNCTION NAME: Store Take Summary
+ * PURPOSE: Copies the next event (in globalSchedulePolicy order) whose summary has not been encoded yet, and marks it
+ * ACTION: The event stays queued for its waveform. Returns false if every queued event is summarized. Caller holds mutexHandle
+ */
+bool storeTakeSummary(EventBuffer& event);
+
+/* FUNCTION NAME: Store Pop
+ * PURPOSE: Moves the next event in globalSchedulePolicy order into event. Returns false if nothing is queued
+ * ACTION: summarized (if not NULL) tells whether its summary already went out. Under DELIVERY_ACK the event is copied and
+ *         kept, in flight, until storeAck, and nothing is returned while DELIVERY_WINDOW events are in flight. Caller holds mutexHandle
+ */
+bool storePop(EventBuffer& event, bool* summarized);
+
+/* FUNCTION NAME: Store Ack
+ * PURPOSE: Removes the in-flight event with this sequence number. Returns false if there is none (already acknowledged,
+ *          or dropped while full). Caller holds mutexHandle
+ */
+bool storeAck(uint32_t sequence);
+
+/* FUNCTION NAME: Store Requeue
+ * PURPOSE: Returns in-flight events sent at least olderThanMs ago (0 for all) to the queue, summary included, so they are
+ *          sent again in globalSchedulePolicy order. Returns the number requeued. Caller holds mutexHandle
+ */
+int storeRequeue(uint32_t olderThanMs);
+
+/* FUNCTION NAME: Store Next
+ * PURPOSE: Walks every queued event, in flight ones included, in globalSchedulePolicy order: the first for NULL, otherwise
+ *          the one after `after` (a pointer this function returned). NULL at the end. Caller holds mutexHandle throughout
+ */
+const EventBuffer* storeNext(const EventBuffer* after);
+
+/* FUNCTION NAME: Event Severity
+ * PURPOSE: Scheduling score of an event, the largest excursion of any triggering channel beyond its threshold
+ * ACTION: Expressed as a fraction of the threshold (of the delta, or of the ratio times the baseline, with baseline-relative
+ *         triggering, see eventThreshold), absolute excess for a threshold of 0, 0 if nothing crossed
+ */
+float eventSeverity(const EventBuffer& event);
+
+/* FUNCTION NAME: Store Count
+ * PURPOSE: Number of events waiting for ENCODE_TASK or, under DELIVERY_ACK, for their acknowledgement
+ */
+int storeCount();
+
+/* FUNCTION NAME: Store Inflight
+ * PURPOSE: Number of events sent under DELIVERY_ACK and not yet acknowledged
+ */
+int storeInflight();
+
+/* FUNCTION NAME: Store Capacity
+ * PURPOSE: Number of events the store can hold, fixed at boot
+ */
+int storeCapacity();
+
+/* FUNCTION NAME: Store In PSRAM
+ * PURPOSE: true when the store was allocated from PSRAM
+ */
+bool storeInPsram();
+
+/* FUNCTION NAME: Store Max Blocks
+ * PURPOSE: Longest event VTC_TASK may capture, in blocks of QUEUE_RANGE readings. LONG_EVENT_BLOCKS with PSRAM, 1 without
+ */
+int storeMaxBlocks();
+
+
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "externals.h"
+
+
+
+////////////////////Stream Constants////////////////////
+
+#define STREAM_SYNC 0x5AA5  //First two bytes of every frame (A5 5A on the wire), the host resynchronizes on it
+#define STREAM_BAUD_MAX 5000000  //Fastest rate the ESP32 UART runs at, most USB bridges top out at 2000000 or 3000000
+#define STREAM_FIFO_SIZE 512  //Frames buffered between SAMPLER_TASK and STREAM_TASK
+#define STREAM_TX_BUFFER 4096  //UART driver transmit buffer, lets STREAM_TASK hand over a whole batch at once
+#define STREAM_BATCH 32  //Frames written per Serial.write
+#define STREAM_LOG_SIZE 256  //Longest status line streamLog prints
+
+
+
+////////////////////Stream Types////////////////////
+
+/* STRUCT NAME: Stream Frame
+ * PURPOSE: One reading on the wire, little-endian and unpadded (11 + 2 * CHANNEL_COUNT bytes)
+ */
+struct __attribute__((packed)) StreamFrame
+{
+  uint16_t sync;  //STREAM_SYNC
+  uint32_t sequence;  //Reading number since boot, a jump means frames were lost
+  uint32_t micros;  //micros() when the reading was taken
+  uint16_t values[CHANNEL_COUNT];  //Raw counts in CHANNEL_DESCRIPTORS order
+  uint8_t checksum;  //Sum of every byte from sequence to the last value, modulo 256
+};
+
+
+/* STRUCT NAME: Stream Stats
+ * PURPOSE: Counters of the streaming mode
+ */
+struct StreamStats
+{
+  uint32_t frames;  //Frames handed to the UART, written by STREAM_TASK
+  uint32_t dropped;  //Frames lost to a full stream FIFO, written by SAMPLER_TASK
+};
+
+
+extern StreamStats streamStats;
+
+
+
+////////////////////Stream Functions////////////////////
+
+/* FUNCTION NAME: Stream Init
+ * PURPOSE: Starts raw sample streaming when the STREAM config key holds a baud rate (globalStreamBaud > 0)
+ * ACTION: Reopens Serial at that rate with a STREAM_TX_BUFFER transmit buffer, creates the frame FIFO and STREAM_TASK
+ *         (core 0). Called from setup() before samplerInit. Returns false, leaving Serial as it was, when streaming is off
+ */
+bool streamInit();
+
+/* FUNCTION NAME: Stream Push
+ * PURPOSE: Queues one reading for STREAM_TASK. Called by SAMPLER_TASK on every reading, never blocks
+ * ACTION: The sequence number advances even when the FIFO is full, so a lost frame shows as a gap on the host
+ */
+void streamPush(const Sample& sample);
+
+/* FUNCTION NAME: Stream Active
+ * PURPOSE: true when streamInit started streaming
+ */
+bool streamActive();
+
+/* FUNCTION NAME: Stream Log
+ * PURPOSE: printf for status messages on Serial. Dropped while streaming, so no text lands between frames
+ */
+void streamLog(const char* format, ...);
+
+
+
+#endif
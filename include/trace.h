@@ -0,0 +1,101 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "externals.h"
+
+
+
+////////////////////Trace Constants////////////////////
+
+#define TRACE_WINDOW 256  //Latest traced events kept per stage for the percentiles, in the STATS window and in the run window (2 x 5 x 1 KB)
+#define TRACE_INJECT_MAX 1000  //Max transients injected by one TRACE run
+#define TRACE_INJECT_MIN_MS 100  //Shortest spacing between injected transients, leaves room for the override loop of the previous one
+#define TRACE_BUDGET_MS 1000  //Default trigger-to-broker budget (P99) of a TRACE run
+#define TRACE_SETTLE_MS 5000  //Time after the last injection for its event to come through before the run is reported
+#define TRACE_ADC_FULL_SCALE 4095  //Injected reading of a rising channel, 12-bit ADC
+
+
+
+////////////////////Trace Types////////////////////
+
+/* ENUM NAME: Trace Stage
+ * PURPOSE: Stages between the EventTrace timestamps, plus the whole path
+ */
+enum TraceStage
+{
+  TRACE_CAPTURE,  //trigger -> captured: FIFO wait and the override loop
+  TRACE_HANDOVER,  //captured -> stored: mutex wait
+  TRACE_ENCODE,  //stored -> encoded: time in the store, then back-dating and encoding
+  TRACE_TRANSMIT,  //encoded -> published: wait for MQTT_TASK, then the socket writes of the last message
+  TRACE_TOTAL,  //trigger -> published
+  TRACE_STAGES
+};
+
+
+/* STRUCT NAME: Trace Window
+ * PURPOSE: Latest latencies per stage and the counts behind them, written only by MQTT_TASK. One window keeps every traced
+ *          event since boot for STATS, the other only the injected transients of the current TRACE run
+ */
+struct TraceWindow
+{
+  uint32_t traced;  //Events recorded
+  uint64_t bytes;  //Their published payload bytes
+  uint32_t latencies[TRACE_STAGES][TRACE_WINDOW];  //Ring per stage, all written at the same position
+};
+
+
+
+////////////////////Trace Functions////////////////////
+
+/* FUNCTION NAME: Trace Record
+ * PURPOSE: Adds one delivered event to the latency counters. Called by MQTT_TASK when the last message of an event (its
+ *          summary, or the whole event when no summary went ahead) is published. Untraced events are ignored
+ * ACTION: Every traced event goes into the STATS window, a transient injected by the running TRACE run into the run window too
+ */
+void traceRecord(const EventTrace& trace, size_t bytes);
+
+/* FUNCTION NAME: Trace Inject Due
+ * PURPOSE: Called by SAMPLER_TASK on every reading. Returns true at most once per requested injection, the reading is then
+ *          replaced with traceInject
+ */
+bool traceInjectDue();
+
+/* FUNCTION NAME: Trace Inject
+ * PURPOSE: Drives the first triggering channel of a reading to the end of the ADC range that trips it, so the injected
+ *          transient goes through the same FIFO, trigger, hand-over, store, encoder and transmit path as a real one
+ * ACTION: Remembers the reading's timestamp for traceInjection
+ */
+void traceInject(Sample& sample);
+
+/* FUNCTION NAME: Trace Injection
+ * PURPOSE: Called by captureStep with the triggering reading's timestamp. Returns the TRACE run number if that reading was
+ *          the last injected one, 0 for a real transient. Stored as EventTrace::injected
+ */
+uint8_t traceInjection(uint64_t micros);
+
+/* FUNCTION NAME: Trace Start
+ * PURPOSE: Starts a TRACE run: count transients, one every intervalMs, judged against a P99 trigger-to-broker budget and a
+ *          minimum delivered event rate (0 for none). A run already in progress is reported first
+ * ACTION: Clears the run window and numbers the run, so the report covers its own injections only. The STATS window is kept
+ */
+void traceStart(uint32_t count, uint32_t intervalMs, uint32_t budgetMs, float minRate);
+
+/* FUNCTION NAME: Trace Step
+ * PURPOSE: Called on every MQTT_TASK iteration, requests the next injection when one is due
+ * ACTION: Once every injection has been delivered, or TRACE_SETTLE_MS after the last one, publishes the run window (TRACED,
+ *         rates and percentiles count the run's own injected transients, never real events)
+ *         {"TRACE":{"RUN","INJECTED","TRACED","LOST","SECONDS","EVENTS_S","BYTES_S",<stage>:[P50,P90,P99,MAX] in us,..,
+ *         "BUDGET_MS","MIN_RATE","RESULT":"PASS"|"FAIL"}} on publishTopicInfo. PASS needs no lost event, TOTAL P99 within
+ *         the budget and the delivered rate at least MIN_RATE. RUN is the number its events carry as INJECTED
+ */
+void traceStep();
+
+/* FUNCTION NAME: Generate Trace Stats
+ * PURPOSE: Appends "TRACE":{"N":<events in the window>,"CAPTURE":[P50,P90,P99,MAX],..,"TOTAL":[..]} (us) of the STATS window,
+ *          real and injected events since boot, to a STATS reply. Returns the new length
+ */
+int generateTraceStats(char* buffer, int length, size_t size);
+
+
+
+#endif
@@ -1,6 +1,21 @@
 #include "externals.h"
 #include "config.h"
 #include "Queue.h"
+#include "fft.h"
+#include "holdup.h"
+#include "commands.h"
+#include "history.h"
+#include "sampler.h"
+#include "store.h"
+#include "pipeline.h"
+#include "delivery.h"
+#include "stream.h"
+#include "baseline.h"
+#include "sinks.h"
+#include "power.h"
+#include "broker.h"
+#include "trace.h"
+#include "bench.h"
 
 
 
@@ -12,62 +27,111 @@ TaskHandle_t VTC_TASK_HANDLE;
 
 
 /* FUNCTION NAME: MQTT Task
- * PURPOSE: Maintains connection and communication with MQTT broker
- * ACTION: Initiates and maintains connection to broker, publishes data to broker (from shared resource),
+ * PURPOSE: Maintains connection and communication with MQTT broker, the transmit stage of the capture pipeline
+ * ACTION: Initiates and maintains connection to broker, publishes data to broker (encoded by ENCODE_TASK),
  *         publishes information to broker (following a ping request), and listens for callback messages from broker
  */
 void MQTT_TASK(void* pvParameters)
 {
   NetworkObject networkHandler = loadConfig();
+  sinksStart(networkHandler.getSite(), networkHandler.getEquipmentID());  //Spool and Serial sinks do not wait for the network
 
   
-  //Displays config information to Serial
-  Serial.print("\nNetwork Info:");
-  Serial.print("\nClient IP: ");
-  Serial.print(networkHandler.getClientIP());
-  Serial.print("\nClient DNS: ");
-  Serial.print(networkHandler.getClientDNS());
-  Serial.print("\nClient Gateway: ");
-  Serial.print(networkHandler.getClientGateway());
-  Serial.print("\nClient Subnet: ");
-  Serial.print(networkHandler.getClientSubnet());
-  Serial.print("\nMQTT Broker Address: ");
-  Serial.print(networkHandler.getMQTTAddress());
-  Serial.print("\nNTP Server Address: ");
-  Serial.print(globalNTPAddress);
-  Serial.print("\nSite: ");
-  Serial.print(networkHandler.getSite());
-  Serial.print("\nEquipment ID: ");
-  Serial.print(networkHandler.getEquipmentID());
-  Serial.print("\nThreshold Voltage: ");
-  Serial.print(globalVoltageThreshold);
-  Serial.print("\nClient ID: ");
-  Serial.print(globalClientID);
-  Serial.print("\n");
+  //Displays config information to Serial, unless Serial carries stream frames
+  if(!streamActive())
+  {
+    Serial.print("\nNetwork Info:");
+    Serial.print("\nClient IP: ");
+    Serial.print(networkHandler.getClientIP());
+    Serial.print("\nClient DNS: ");
+    Serial.print(networkHandler.getClientDNS());
+    Serial.print("\nClient Gateway: ");
+    Serial.print(networkHandler.getClientGateway());
+    Serial.print("\nClient Subnet: ");
+    Serial.print(networkHandler.getClientSubnet());
+    char brokerString[BROKER_LIST_SIZE];
+    Serial.print("\nMQTT Broker Addresses: ");
+    Serial.print(brokerList(brokerString, sizeof(brokerString)));
+    Serial.print("\nNTP Server Address: ");
+    Serial.print(globalNTPAddress);
+    Serial.print("\nSite: ");
+    Serial.print(networkHandler.getSite());
+    Serial.print("\nEquipment ID: ");
+    Serial.print(networkHandler.getEquipmentID());
+    for(int c = 0; c < CHANNEL_COUNT; c++)
+    {
+      if(!CHANNELS[c].thresholdKey)
+        continue;
+      Serial.print("\nThreshold ");
+      Serial.print(CHANNELS[c].name);
+      Serial.print(": ");
+      Serial.print(globalThresholds[c]);
+    }
+    Serial.print("\nClient ID: ");
+    Serial.print(globalClientID);
+    Serial.print("\n");
+  }
+
+
+  //Events saved on UPS holdup before the last reset go out before anything captured since
+  reconnect();
+  brokerStart();  //Health probes of the preferred brokers, only with a broker list
+  holdupPublishRecovered(networkHandler);
+
+  //Encoding starts after network and NTP bring-up, so back-dating sees the same clock state publishing always did
+  pipelineStart(networkHandler.getSite(), networkHandler.getEquipmentID());
   
   
   
   while (true)
   {
     if(!mqttClient.connected())
-      reconnect();
-    
-    if(pthread_mutex_trylock(&mutexHandle) == 0)  //The mutex attempts to lock the shared resource unless VTC_TASK is already operating on it
     {
-      //Publishes all data in shared resource at once
-      while(softCopy.count()!=0)
-        mqttClient.publish(publishTopicData.c_str(), softCopy.pop().c_str());
-      pthread_mutex_unlock(&mutexHandle);
+      reconnect();
+      deliveryReconnected();  //Anything unacknowledged may have been lost with the old session
+      holdupPublishRecovered(networkHandler);  //Rest of a power-fail record whose publishing was cut off, if any
     }
     
+    //Transmit stage, events arrive from ENCODE_TASK already formatted so this task only does socket I/O.
+    //The byte budget keeps a backlog drain from holding up commands and keepalives
+    bool idle = pipelineTransmit(publishTopicData, TRANSMIT_BUDGET_BYTES) == 0;
+    
     if(pingCommandReceived)
     {
-      String ping = generatePing(networkHandler);
-      mqttClient.publish(publishTopicInfo.c_str(), ping.c_str());
+      static char ping[PUBLISH_BUFFER_SIZE];
+      if(generatePing(networkHandler, ping, sizeof(ping)) > 0)
+        mqttClient.publish(publishTopicInfo, ping);
       pingCommandReceived = false;
     }
 
+    //One queued command between publish batches keeps data latency bounded during bulk reconfiguration.
+    //Commands count as activity, someone is working with the device
+    if(commandStep(networkHandler))
+    {
+      powerActivity();
+      idle = false;
+    }
+
+    //Rate-limited, so a long HISTORY query never delays live events
+    historyStep(networkHandler);
+
+    traceStep();
+
+    //A tenth of a benchmark per pass, so a BENCH run never holds up keepalives or events
+    benchStep();
+
+    deliveryStep();
+
+    //Re-sync runs here, never on SAMPLER_TASK's clock reads
+    ntpStep();
+
+    //Back to a preferred broker once it has recovered, the next loop reconnects
+    brokerStep();
+
     mqttClient.loop();
+
+    //Low power only: nothing was sent or executed, sleep until the next poll or until SAMPLER_TASK leaves low power
+    powerPark(idle);
   }
   
 }
@@ -76,72 +140,62 @@ void MQTT_TASK(void* pvParameters)
 
 /* FUNCTION NAME: VTC Task
  * PURPOSE: Continuously takes in measurements and stores them on SRAM
- * ACTION: Continuously gathers measurements, formats them into JSON data strings, and pushes them into the primary rolling queue.
+ * ACTION: Continuously gathers timestamped raw measurements and pushes them into the primary rolling queue.
  *         When a voltage excursion occurs, override occurs, and the proceeding queue is copied to the shared resource
  */
 void VTC_TASK(void* pvParameters)
 {
   while(true)
   {
-    float testVoltage = getVoltage().toFloat();
-
-    if(testVoltage > globalVoltageThreshold)
+    //Power-fail flush takes over dataSet, nothing more is captured until the device resets
+    if(captureFrozen)
     {
-      //Override occurs, meaning measurements are continuously recorded to capture as much of the transient as needed within the primary queue
-      for(int i = 0; i<OVERRIDE_RANGE; i++)
-      {
-        dataSet.push(generateEntry());
-      }
-
-      if(pthread_mutex_lock(&mutexHandle) == 0)  //The mutex locks the shared resource or waits until the resource is available to lock it
-      {
-        dataSet.copy(&softCopy);  //Copies primary queue to shared resource
-        pthread_mutex_unlock(&mutexHandle);
-      }
+      holdupParked();
+      vTaskSuspend(NULL);
     }
 
-    //At this point, the measurement is considered trivial, but it is still recorded in the case of an excursion later on
-    else
-    {
-      dataSet.push(generateEntry());
-    }
-    
+    captureStep(liveSource, handOverEvent);
   }
   
 }
 
 
 
-////////////////////Start of Program////////////////////
-
-void setup()
+/* FUNCTION NAME: Prompt Task
+ * PURPOSE: Serial config prompt, run in the background so it never delays capture or network bring-up
+ * ACTION: Waits up to 8 seconds for an answer. New config is committed to EEPROM and the device resets to apply it.
+ *         The task deletes itself when done
+ */
+void PROMPT_TASK(void* pvParameters)
 {
-  Serial.begin(115200);  //Serial init
-  Serial.println("Starting...");
-  EEPROM.begin(4096); //Max amount of allocatable EEPROM memory on esp32
-  pthread_mutex_init(&mutexHandle, NULL);  //Mutex handle init
-
-
   Serial.println("Do you want to change any config information? (Y/N)");
   Serial.setTimeout(8000);  //Wait 8 seconds for a response if user is connected to serial
-  String answer = Serial.readStringUntil('\n');
+  char answer[4] = "";
+  answer[Serial.readBytesUntil('\n', answer, sizeof(answer) - 1)] = '\0';
 
   //Serial waits for user to enter a config string (in JSON format) 
-  if(answer == "Y" || answer == "y")
+  if(answer[0] == 'Y' || answer[0] == 'y')
   {
     Serial.println("Enter new config information as needed");
     
-    String configMessage;
+    static char configMessage[JSON_BUFFER_CAPACITY];
     while(true)
     {
       if(Serial.available())
       {
-        configMessage = Serial.readStringUntil('\n');
+        configMessage[Serial.readBytesUntil('\n', configMessage, sizeof(configMessage) - 1)] = '\0';
         break;
       }
+      delay(10);
     }
     
-    setConfig(configMessage.c_str(), "SERIAL");
+    //Nothing was written if the config was refused, setConfig has said why
+    if(setConfig(configMessage, "SERIAL") == NULL)
+    {
+      //The network was already brought up with the old config
+      Serial.println("Resetting to apply new config");
+      reset();
+    }
   }
   
   else
@@ -149,20 +203,35 @@ void setup()
     Serial.println("Ok, nvm\n");
   }
 
+  vTaskDelete(NULL);
+}
+
+
+
+////////////////////Start of Program////////////////////
+
+void setup()
+{
+  Serial.begin(115200);  //Serial init
+  Serial.println("Starting...");
+  EEPROM.begin(4096); //Max amount of allocatable EEPROM memory on esp32
+  pthread_mutex_init(&mutexHandle, NULL);  //Mutex handle init
+  pthread_mutex_init(&eepromMutex, NULL);
+  loadCaptureConfig();  //Only the threshold is needed to start measuring
+  baselineInit();  //Thresholds converted to raw counts once, for baseline-relative triggering
+  storeInit();  //Event backlog goes to PSRAM when the board has it, before VTC_TASK can hand anything over
+  historyInit();  //Same for the events kept for HISTORY
+  deliveryInit();  //Sequence numbers continue from the last boot's reservation
+  bool streaming = streamInit();  //Serial switches to binary frames, before the sampler feeds it
+  sinksInit();  //Queues of the SINKS outputs, before VTC_TASK can hand anything over
+  powerInit();  //Before the sampler, which switches power states from its first reading
 
-  //MQTT task pinned to core 0
-  xTaskCreatePinnedToCore( MQTT_TASK,            //Task function
-                           "MQTT",               //Name of task
-                           30000,                //Stack size of task
-                           NULL,                 //Parameter of the task
-                           0,                    //Priority of the task
-                           &MQTT_TASK_HANDLE,    //Task handle for keeping track of task
-                           0                     //Core that task is pinned to
-                         );
-  delay(500);
 
+  //Sampler timer and task are started before VTC_TASK, which blocks on the readings they produce
+  samplerInit();
 
-  //VTC task pinned to core 1
+  //VTC task pinned to core 1, started first so transients right after power-on are captured.
+  //Samples taken before the first NTP sync are stamped relative to boot and back-dated by MQTT_TASK
   xTaskCreatePinnedToCore( VTC_TASK,            //Task function
                            "VTC",               //Name of task
                            30000,               //Stack size of task
@@ -171,10 +240,46 @@ void setup()
                            &VTC_TASK_HANDLE,    //Task handle for keeping track of task
                            1                    //Core that task is pinned to
                          );
-  delay(500);
+
+  holdupInit();  //Power-fail path needs VTC_TASK's handle to exist
+
+#ifdef FFT_ENABLED
+  fftInit();  //Twiddle table is built once here so the network task never pays for it
+#endif
+
+
+  //MQTT task pinned to core 0, Ethernet/NTP/MQTT bring-up happens inside it
+  xTaskCreatePinnedToCore( MQTT_TASK,            //Task function
+                           "MQTT",               //Name of task
+                           30000,                //Stack size of task
+                           NULL,                 //Parameter of the task
+                           0,                    //Priority of the task
+                           &MQTT_TASK_HANDLE,    //Task handle for keeping track of task
+                           0                     //Core that task is pinned to
+                         );
+
+
+  //Prompt task pinned to core 0 alongside the network task. Not started while streaming, Serial carries binary frames
+  if(!streaming)
+    xTaskCreatePinnedToCore( PROMPT_TASK,         //Task function
+                             "PROMPT",            //Name of task
+                             8000,                //Stack size of task
+                             NULL,                //Parameter of the task
+                             0,                   //Priority of the task
+                             NULL,                //Task deletes itself, no handle kept
+                             0                    //Core that task is pinned to
+                           );
+
+
+  //All static buffers and queues are in place at this point, later reports should show the same figures
+  streamLog("Heap free: %lu, min free: %lu, largest block: %lu\n", (unsigned long)ESP.getFreeHeap(),
+            (unsigned long)ESP.getMinFreeHeap(), (unsigned long)ESP.getMaxAllocHeap());
 }
 
 
 
-//Loop is empty since everything runs between the two tasks
-void loop() {}
+//Everything runs between the tasks. Arduino's loop task would otherwise spin at priority 1 on core 1 and starve ENCODE_TASK
+void loop()
+{
+  vTaskDelete(NULL);
+}
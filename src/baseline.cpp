@@ -0,0 +1,211 @@
+#include "baseline.h"
+
+
+
+////////////////////Baseline Externs////////////////////
+
+int32_t baselineLimits[CHANNEL_COUNT];
+float baselineThresholds[CHANNEL_COUNT];
+
+
+
+////////////////////Baseline State////////////////////
+
+static int32_t gainQ16[CHANNEL_COUNT];  //Limit = baseline * gain / 2^16 + offset, in raw counts
+static int32_t offsetCounts[CHANNEL_COUNT];
+static uint32_t ewma[CHANNEL_COUNT];  //Baseline scaled by 2^BASELINE_EWMA_SHIFT
+static uint16_t baseline[CHANNEL_COUNT];
+static uint16_t window[CHANNEL_COUNT][BASELINE_MEDIAN_WINDOW];  //Median entries in arrival order
+static uint16_t sorted[CHANNEL_COUNT][BASELINE_MEDIAN_WINDOW];  //Same entries in ascending order
+static uint8_t windowCount = 0;
+static uint8_t windowNext = 0;
+static uint32_t readings = 0;
+
+
+
+////////////////////Baseline Functions////////////////////
+
+/**
+ * @brief +1 for channels triggering above the baseline, -1 below, 0 for recorded-only channels
+ * 
+ */
+static int direction(int c)
+{
+  return CHANNELS[c].trigger == TRIGGER_ABOVE ? 1 : CHANNELS[c].trigger == TRIGGER_BELOW ? -1 : 0;
+}
+
+
+/**
+ * @brief Calibrated threshold for a channel at a given baseline
+ * 
+ * @param c Channel
+ * @param counts Baseline in raw counts
+ * @return float 
+ */
+static float thresholdAt(int c, uint16_t counts)
+{
+  float level = channelValue(c, counts);
+  if(globalTriggerMode == TRIGGER_RATIO)
+    return level * (1.0f + direction(c) * globalThresholds[c]);
+  return level + direction(c) * globalThresholds[c];
+}
+
+
+/**
+ * @brief Recomputes the raw limits from the current baseline
+ * 
+ * @param refresh true to also refresh baselineThresholds
+ */
+static void updateLimits(bool refresh)
+{
+  for(int c = 0; c < CHANNEL_COUNT; c++)
+  {
+    if(CHANNELS[c].trigger == TRIGGER_NONE)
+      continue;
+
+    baselineLimits[c] = (int32_t)(((int64_t)baseline[c] * gainQ16[c]) >> 16) + offsetCounts[c];
+    if(refresh)
+      baselineThresholds[c] = thresholdAt(c, baseline[c]);
+  }
+}
+
+
+/**
+ * @brief Converts the thresholds to raw gain and offset and clears the baseline
+ * 
+ */
+void baselineInit()
+{
+  for(int c = 0; c < CHANNEL_COUNT; c++)
+  {
+    float scale = CHANNELS[c].scale != 0 ? CHANNELS[c].scale : 1.0f;
+    float threshold = direction(c) * globalThresholds[c];
+
+    //Worked out from value = raw * scale + offset: a delta moves the raw limit by threshold / scale, a ratio scales the
+    //baseline and, because of the calibration offset, shifts it by offset * threshold / scale
+    if(globalTriggerMode == TRIGGER_RATIO)
+    {
+      gainQ16[c] = lroundf((1.0f + threshold) * 65536.0f);
+      offsetCounts[c] = lroundf(CHANNELS[c].offset * threshold / scale);
+    }
+    else
+    {
+      gainQ16[c] = 65536;
+      offsetCounts[c] = lroundf(threshold / scale);
+    }
+
+    ewma[c] = 0;
+    baseline[c] = 0;
+    baselineThresholds[c] = globalThresholds[c];
+  }
+
+  windowCount = 0;
+  windowNext = 0;
+  readings = 0;
+}
+
+
+/**
+ * @brief Adds one entry to a channel's median window, replacing the oldest once it is full
+ * 
+ * @param c Channel
+ * @param value Raw count
+ */
+static void medianInsert(int c, uint16_t value)
+{
+  uint16_t* order = sorted[c];
+  int count = windowCount;
+
+  if(windowCount == BASELINE_MEDIAN_WINDOW)
+  {
+    //Takes the outgoing entry out of the sorted copy
+    int i = 0;
+    while(order[i] != window[c][windowNext])
+      i++;
+    for(; i < count - 1; i++)
+      order[i] = order[i + 1];
+    count--;
+  }
+
+  int i = count;
+  for(; i > 0 && order[i - 1] > value; i--)
+    order[i] = order[i - 1];
+  order[i] = value;
+
+  window[c][windowNext] = value;
+  baseline[c] = order[count / 2];
+}
+
+
+/**
+ * @brief Tracks the baseline with one more reading
+ * 
+ * @param values Raw counts
+ */
+void baselineUpdate(const uint16_t* values)
+{
+  if(globalTriggerMode == TRIGGER_ABSOLUTE)
+    return;
+
+  bool first = readings++ == 0;
+  bool decimated = first || readings % BASELINE_DECIMATE == 0;
+
+  if(globalBaselineTracker == BASELINE_MEDIAN)
+  {
+    if(!decimated)
+      return;
+
+    for(int c = 0; c < CHANNEL_COUNT; c++)
+      medianInsert(c, values[c]);
+    if(windowCount < BASELINE_MEDIAN_WINDOW)
+      windowCount++;
+    windowNext = (windowNext + 1) % BASELINE_MEDIAN_WINDOW;
+  }
+  else
+  {
+    for(int c = 0; c < CHANNEL_COUNT; c++)
+    {
+      ewma[c] = first ? (uint32_t)values[c] << BASELINE_EWMA_SHIFT : ewma[c] - (ewma[c] >> BASELINE_EWMA_SHIFT) + values[c];
+      baseline[c] = ewma[c] >> BASELINE_EWMA_SHIFT;
+    }
+  }
+
+  updateLimits(decimated);
+}
+
+
+/**
+ * @brief Current baseline
+ * 
+ * @return const uint16_t* Raw counts, CHANNEL_COUNT entries
+ */
+const uint16_t* baselineCounts()
+{
+  return baseline;
+}
+
+
+/**
+ * @brief Threshold an event was triggered against
+ * 
+ * @param event Event readings with their baseline
+ * @param c Channel
+ * @param scale Set to the size of the threshold
+ * @return float Calibrated threshold
+ */
+float eventThreshold(const EventBuffer& event, int c, float* scale)
+{
+  float threshold = globalThresholds[c];
+  float size = fabsf(threshold);
+
+  if(globalTriggerMode != TRIGGER_ABSOLUTE)
+  {
+    threshold = thresholdAt(c, event.baseline(c));
+    if(globalTriggerMode == TRIGGER_RATIO)
+      size *= fabsf(channelValue(c, event.baseline(c)));
+  }
+
+  if(scale)
+    *scale = size != 0 ? size : 1.0f;
+  return threshold;
+}
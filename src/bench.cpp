@@ -0,0 +1,301 @@
+#include "bench.h"
+#include "externals.h"
+#include "fft.h"
+#include "commands.h"
+#include "baseline.h"
+#include "stream.h"
+
+#ifdef BENCH_ENABLED
+
+
+
+////////////////////Allocation Counter////////////////////
+
+static TaskHandle_t benchTask = NULL;  //Only allocations made by the task running the benchmarks are counted
+static volatile uint32_t benchAllocations = 0;
+
+extern "C"
+{
+  void* __real_malloc(size_t size);
+  void* __real_calloc(size_t count, size_t size);
+  void* __real_realloc(void* pointer, size_t size);
+
+  void* __wrap_malloc(size_t size)
+  {
+    if(benchTask != NULL && xTaskGetCurrentTaskHandle() == benchTask)
+      benchAllocations++;
+    return __real_malloc(size);
+  }
+
+  void* __wrap_calloc(size_t count, size_t size)
+  {
+    if(benchTask != NULL && xTaskGetCurrentTaskHandle() == benchTask)
+      benchAllocations++;
+    return __real_calloc(count, size);
+  }
+
+  void* __wrap_realloc(void* pointer, size_t size)
+  {
+    if(benchTask != NULL && xTaskGetCurrentTaskHandle() == benchTask)
+      benchAllocations++;
+    return __real_realloc(pointer, size);
+  }
+}
+
+
+
+////////////////////Benchmark Inputs////////////////////
+
+//Built once by benchStart, outside any timed region
+static NetworkObject* benchObject = NULL;
+static Sample sample;
+static EventBuffer source;
+static EventBuffer target;
+static EncodedEvent encoded;
+static char buffer[PUBLISH_BUFFER_SIZE];
+static uint16_t capture[FFT_MAX_SIZE];
+static SpectralSummary summary;
+
+//A CNFG-sized command, parsed from a private copy into a private document so the real command queue is never touched
+static const char payload[] = "{\"CMD\":\"CNFG\",\"CNFG\":{\"IP\":\"192.168.100.20\",\"MQTT\":\"192.168.100.2\",\"SITE\":\"SITE01\",\"VTHRESHOLD\":\"2400.0\"}}";
+static char payloadCopy[sizeof(payload)];
+static StaticJsonDocument<JSON_BUFFER_CAPACITY> parsed;
+
+
+
+////////////////////Benchmark Operations////////////////////
+
+/**
+ * @brief Makes a result observable, so a pure expression under test is computed on every operation
+ *
+ * @param value Result to keep
+ */
+template<typename T>
+static inline void benchKeep(const T& value)
+{
+  asm volatile("" : : "r"(&value) : "memory");
+}
+
+
+//One operation each, size is the transform length of the FFT benchmarks
+static void benchCapturePush(uint16_t size) { source.push(sample); }
+static void benchCaptureCopy(uint16_t size) { source.copyTo(target); }
+static void benchCaptureAt(uint16_t size) { sample = target.at(QUEUE_RANGE / 2); }
+static void benchCaptureTrigger(uint16_t size) { benchKeep(ChannelSet<CHANNEL_COUNT>::triggered(sample.values)); }
+static void benchCaptureTriggerRaw(uint16_t size) { benchKeep(ChannelSet<CHANNEL_COUNT>::triggeredRaw(sample.values, baselineLimits)); }
+static void benchGenerateEntry(uint16_t size) { benchKeep(generateEntry(sample, 0, QUEUE_RANGE / 2, buffer, sizeof(buffer))); }
+static void benchGetTime(uint16_t size) { getTime(buffer); }
+static void benchGeneratePing(uint16_t size) { benchKeep(generatePing(*benchObject, buffer, sizeof(buffer))); }
+static void benchStringToIP(uint16_t size) { benchKeep(stringToIP("192.168.100.254")); }
+static void benchIPToString(uint16_t size) { benchKeep(ipToString(benchObject->getClientIP(), buffer)); }
+
+static void benchEncodeJson(uint16_t size)
+{
+  benchKeep(encodeEvent(benchObject->getSite(), benchObject->getEquipmentID(), target, ENCODE_ALL, FORMAT_JSON, encoded));
+}
+
+static void benchEncodeInflux(uint16_t size)
+{
+  benchKeep(encodeEvent(benchObject->getSite(), benchObject->getEquipmentID(), target, ENCODE_ALL, FORMAT_INFLUX, encoded));
+}
+
+static void benchCommandParse(uint16_t size)
+{
+  memcpy(payloadCopy, payload, sizeof(payload));
+  benchKeep(deserializeJson(parsed, payloadCopy, sizeof(payload) - 1));
+  benchKeep(parsed["CMD"].as<const char*>());
+}
+
+static void benchFft(uint16_t size)
+{
+  fftSummary(capture, size, 1000.0f, &summary);
+  benchKeep(summary);
+}
+
+
+/* STRUCT NAME: Benchmark
+ * PURPOSE: One timed operation and how many times it is repeated
+ */
+struct Benchmark
+{
+  const char* name;
+  uint32_t iterations;
+  void (*operation)(uint16_t size);
+};
+
+static const Benchmark BENCHMARKS[] = {
+  {"capture_push", BENCH_ITERATIONS, benchCapturePush},
+  {"capture_copy", BENCH_ITERATIONS, benchCaptureCopy},
+  {"capture_at", BENCH_ITERATIONS, benchCaptureAt},
+  {"capture_trigger", BENCH_ITERATIONS, benchCaptureTrigger},
+  {"capture_trigger_raw", BENCH_ITERATIONS, benchCaptureTriggerRaw},
+  {"generate_entry", BENCH_ITERATIONS, benchGenerateEntry},
+  {"get_time", BENCH_ITERATIONS, benchGetTime},
+  {"generate_ping", BENCH_ITERATIONS, benchGeneratePing},
+  {"string_to_ip", BENCH_ITERATIONS, benchStringToIP},
+  {"ip_to_string", BENCH_ITERATIONS, benchIPToString},
+  {"encode_json", BENCH_FFT_ITERATIONS, benchEncodeJson},  //Whole events, as many as the FFT runs
+  {"encode_influx", BENCH_FFT_ITERATIONS, benchEncodeInflux},
+  {"command_parse", BENCH_ITERATIONS, benchCommandParse}
+};
+
+#define BENCH_TABLE_COUNT (sizeof(BENCHMARKS) / sizeof(BENCHMARKS[0]))
+#define BENCH_FFT_MIN_SIZE 32  //Shortest transform timed, then every power of 2 up to FFT_MAX_SIZE
+
+
+
+////////////////////Benchmark Functions////////////////////
+
+static bool benchRunning = false;
+static uint16_t benchIndex = 0;  //BENCHMARKS entry, then one per FFT length past the end of the table
+static uint8_t benchChunk = 0;  //0 is the warmup, 1..BENCH_STEPS the timed chunks
+static uint32_t benchElapsedMicros = 0;
+static uint32_t benchCounted = 0;  //Allocations during the timed chunks
+
+
+/**
+ * @brief Looks up a benchmark by position, the FFT lengths follow the table
+ *
+ * @param index Position in the run
+ * @param bench Filled with the benchmark
+ * @param size Filled with the FFT length, 0 for the table entries
+ * @param name Filled with the name of an FFT benchmark
+ * @return false past the last one
+ */
+static bool benchAt(uint16_t index, Benchmark& bench, uint16_t& size, char (&name)[16])
+{
+  if(index < BENCH_TABLE_COUNT)
+  {
+    bench = BENCHMARKS[index];
+    size = 0;
+    return true;
+  }
+
+  uint32_t length = (uint32_t)BENCH_FFT_MIN_SIZE << (index - BENCH_TABLE_COUNT);
+  if(length > FFT_MAX_SIZE)
+    return false;
+
+  size = length;
+  snprintf(name, sizeof(name), "fft_%u", size);
+  bench = {name, BENCH_FFT_ITERATIONS, benchFft};
+  return true;
+}
+
+
+/**
+ * @brief Prints and publishes one result line
+ *
+ * @param name Benchmark name
+ * @param iterations Operations timed
+ * @param elapsedMicros Total time for all operations
+ * @param allocations Total allocations for all operations
+ */
+static void reportBenchmark(const char* name, uint32_t iterations, uint32_t elapsedMicros, uint32_t allocations)
+{
+  char line[PUBLISH_BUFFER_SIZE];
+
+  snprintf(line, sizeof(line), "{\"BENCH\":\"%s\",\"VERSION\":\"%s\",\"ITER\":%lu,\"NS\":%lu,\"ALLOCS\":%.2f}",
+           name, VERSION, (unsigned long)iterations,
+           (unsigned long)((uint64_t)elapsedMicros * 1000 / iterations), (float)allocations / iterations);
+
+  streamLog("%s\n", line);
+  mqttClient.publish(publishTopicInfo, line);
+}
+
+
+/**
+ * @brief Builds the inputs and starts from the first benchmark
+ *
+ * @param object Network params, used by the ping, address and encode benchmarks
+ * @return true Always, the benchmarks are built in
+ */
+bool benchStart(NetworkObject& object)
+{
+  //Synthetic reading at a fixed time, readSample would touch the sampler's timing state from this core
+  sample = {};
+  sample.seconds = 1681234567;  //2023-04-11 17:36:07
+  sample.micros = 1000000;
+  for(int c = 0; c < CHANNEL_COUNT; c++)
+    sample.values[c] = c % 2 == 0 ? 2048 : 1880;
+
+  source.clear();
+  for(int i = 0; i < QUEUE_RANGE; i++)
+    source.push(sample);
+  source.copyTo(target);
+
+  for(int i = 0; i < FFT_MAX_SIZE; i++)
+    capture[i] = 2048 + (i * 37) % 512;
+
+  benchObject = &object;
+  benchTask = xTaskGetCurrentTaskHandle();
+  benchIndex = 0;
+  benchChunk = 0;
+  benchRunning = true;
+  return true;
+}
+
+
+/**
+ * @brief Runs the warmup or one timed chunk of the current benchmark, reports it after its last chunk
+ *
+ * @return true While a run is in progress
+ */
+bool benchStep()
+{
+  if(!benchRunning)
+    return false;
+
+  Benchmark bench;
+  uint16_t size;
+  char name[16];
+  if(!benchAt(benchIndex, bench, size, name))
+  {
+    benchTask = NULL;
+    benchRunning = false;
+    return false;
+  }
+
+  uint32_t operations = bench.iterations / BENCH_STEPS;  //Last chunk takes the remainder
+  if(benchChunk == BENCH_STEPS)
+    operations = bench.iterations - operations * (BENCH_STEPS - 1);
+
+  if(benchChunk == 0)
+  {
+    for(uint32_t i = 0; i < operations; i++)
+      bench.operation(size);
+    benchElapsedMicros = 0;
+    benchCounted = 0;
+    benchChunk = 1;
+    return true;
+  }
+
+  //The indirect call keeps the compiler from hoisting a loop-invariant operation out of the loop
+  uint32_t allocations = benchAllocations;
+  uint32_t start = micros();
+  for(uint32_t i = 0; i < operations; i++)
+    bench.operation(size);
+  benchElapsedMicros += micros() - start;
+  benchCounted += benchAllocations - allocations;
+
+  if(benchChunk++ < BENCH_STEPS)
+    return true;
+
+  reportBenchmark(bench.name, bench.iterations, benchElapsedMicros, benchCounted);
+  benchIndex++;
+  benchChunk = 0;
+  return true;
+}
+
+#else
+
+bool benchStart(NetworkObject& object)
+{
+  return false;
+}
+
+bool benchStep()
+{
+  return false;
+}
+
+#endif
@@ -0,0 +1,275 @@
+#include "broker.h"
+#include "stream.h"
+
+
+
+////////////////////Broker Externs////////////////////
+
+Broker brokers[BROKER_MAX] = {{IPAddress(), MQTT_PORT}};
+int brokerCount = 1;
+BrokerStats brokerStats[BROKER_MAX];
+FailoverStats failoverStats = {0, 0, 0, 0};
+
+
+
+////////////////////Broker State////////////////////
+
+static volatile int active = 0;  //Index of the broker in use, only MQTT_TASK changes it
+static bool probing = false;
+static WiFiClient probeClient;
+static PubSubClient probeMqtt(probeClient);
+
+
+
+////////////////////Broker Functions////////////////////
+
+/**
+ * @brief Broker list from the MQTT config value
+ *
+ * @param list Addresses separated by commas, each optionally with :port
+ */
+void brokerParse(const char* list)
+{
+  char copy[BROKER_LIST_SIZE];
+  strlcpy(copy, list, sizeof(copy));
+
+  int count = 0;
+  char* save = NULL;
+  for(char* token = strtok_r(copy, ", ", &save); token && count < BROKER_MAX; token = strtok_r(NULL, ", ", &save))
+  {
+    char* port = strchr(token, ':');
+    if(port)
+      *port++ = '\0';
+
+    brokers[count].address = stringToIP(token);
+    brokers[count].port = port ? atoi(port) : MQTT_PORT;
+    count++;
+  }
+
+  if(count > 0)
+    brokerCount = count;
+}
+
+
+/**
+ * @brief Formats one broker as address[:port]
+ *
+ * @param broker Entry
+ * @param buffer Destination
+ * @param size Size of buffer
+ * @return int Length written
+ */
+static int formatBroker(const Broker& broker, char* buffer, size_t size)
+{
+  char ip[IP_STRING_SIZE];
+  if(broker.port == MQTT_PORT)
+    return snprintf(buffer, size, "%s", ipToString(broker.address, ip));
+  return snprintf(buffer, size, "%s:%u", ipToString(broker.address, ip), broker.port);
+}
+
+
+/**
+ * @brief Whole broker list
+ *
+ * @param buffer Filled with the entries separated by commas
+ * @param size Size of buffer
+ * @return const char* buffer
+ */
+const char* brokerList(char* buffer, size_t size)
+{
+  size_t length = 0;
+  buffer[0] = '\0';
+
+  for(int b = 0; b < brokerCount && length + 1 < size; b++)
+  {
+    if(b > 0)
+      buffer[length++] = ',';
+    length += formatBroker(brokers[b], buffer + length, size - length);
+  }
+
+  return buffer;
+}
+
+
+/**
+ * @brief Broker in use
+ *
+ * @param buffer Destination, BROKER_ADDRESS_SIZE
+ * @param size Size of buffer
+ * @return const char* buffer
+ */
+const char* brokerActiveAddress(char* buffer, size_t size)
+{
+  formatBroker(brokers[active], buffer, size);
+  return buffer;
+}
+
+
+/**
+ * @brief Connects to the active broker, failing over down the list
+ *
+ */
+void brokerConnect()
+{
+  int lost = active;
+  uint32_t lostAt = millis();
+  uint32_t attemptStart = lostAt;
+  char address[BROKER_ADDRESS_SIZE];
+
+  while(true)
+  {
+    mqttClient.setServer(brokers[active].address, brokers[active].port);
+    if(mqttClient.connect(globalClientID, MQTT_USERNAME, MQTT_PASSWORD))
+      break;
+
+    brokerStats[active].connectFailures++;
+    brokerStats[active].up = false;
+    streamLog("Broker %s failed, rc=%d\n", brokerActiveAddress(address, sizeof(address)), mqttClient.state());
+
+    if(brokerCount > 1 && millis() - attemptStart >= globalFailoverMs)
+    {
+      active = (active + 1) % brokerCount;
+      brokerStats[active].goodProbes = 0;
+      attemptStart = millis();
+      streamLog("Failing over to %s\n", brokerActiveAddress(address, sizeof(address)));
+    }
+
+    delay(BROKER_RETRY_MS);
+  }
+
+  brokerStats[active].connects++;
+  brokerStats[active].up = true;
+
+  if(active != lost)
+  {
+    uint32_t elapsed = millis() - lostAt;
+    failoverStats.failovers++;
+    failoverStats.lastMillis = elapsed;
+    if(elapsed > failoverStats.maxMillis)
+      failoverStats.maxMillis = elapsed;
+  }
+
+  streamLog("Connected to %s\n", brokerActiveAddress(address, sizeof(address)));
+}
+
+
+/**
+ * @brief Probes the brokers preferred over the active one
+ *
+ */
+static void PROBE_TASK(void* pvParameters)
+{
+  char probeID[ID_SIZE + 8];
+  snprintf(probeID, sizeof(probeID), "%s-probe", globalClientID);
+  probeClient.setTimeout(BROKER_PROBE_TIMEOUT_S);
+  probeMqtt.setSocketTimeout(BROKER_PROBE_TIMEOUT_S);
+
+  while(true)
+  {
+    vTaskDelay(pdMS_TO_TICKS(BROKER_PROBE_MS));
+
+    for(int b = 0; b < active; b++)
+    {
+      probeMqtt.setServer(brokers[b].address, brokers[b].port);
+      bool up = probeMqtt.connect(probeID, MQTT_USERNAME, MQTT_PASSWORD);
+      if(up)
+        probeMqtt.disconnect();
+
+      brokerStats[b].up = up;
+      if(!up)
+        brokerStats[b].goodProbes = 0;
+      else if(brokerStats[b].goodProbes < BROKER_RECOVER_PROBES)
+        brokerStats[b].goodProbes++;
+    }
+  }
+}
+
+
+/**
+ * @brief Starts the health probes
+ *
+ */
+void brokerStart()
+{
+  if(probing || brokerCount < 2)
+    return;
+  probing = true;
+
+  xTaskCreatePinnedToCore( PROBE_TASK,            //Task function
+                           "PROBE",               //Name of task
+                           4000,                  //Stack size of task
+                           NULL,                  //Parameter of the task
+                           0,                     //Priority of the task, same as MQTT_TASK
+                           NULL,                  //Task runs forever, no handle kept
+                           0                      //Core that task is pinned to, capture keeps core 1
+                         );
+}
+
+
+/**
+ * @brief Moves back to a recovered preferred broker
+ *
+ */
+void brokerStep()
+{
+  for(int b = 0; b < active; b++)
+  {
+    if(brokerStats[b].goodProbes < BROKER_RECOVER_PROBES)
+      continue;
+
+    char address[BROKER_ADDRESS_SIZE];
+    formatBroker(brokers[b], address, sizeof(address));
+    streamLog("Broker %s recovered, moving back\n", address);
+    brokerStats[b].goodProbes = 0;
+    failoverStats.recoveries++;
+    active = b;
+    mqttClient.disconnect();  //MQTT_TASK reconnects on its next loop, to the recovered broker first
+    return;
+  }
+}
+
+
+/**
+ * @brief Publish counter of the active broker
+ *
+ * @param published false if the publish failed
+ */
+void brokerPublished(bool published)
+{
+  if(published)
+    brokerStats[active].published++;
+  else
+    brokerStats[active].publishFailures++;
+}
+
+
+/**
+ * @brief Appends the broker counters to a STATS reply
+ *
+ * @param buffer STATS being built
+ * @param length Its current length
+ * @param size Size of buffer
+ * @return int New length
+ */
+int generateBrokerStats(char* buffer, int length, size_t size)
+{
+  if(length < (int)size)
+    length += snprintf(buffer + length, size - length, ",\"BROKER\":%d,\"BROKERS\":[", active);
+
+  for(int b = 0; b < brokerCount && length < (int)size; b++)
+  {
+    char address[BROKER_ADDRESS_SIZE];
+    formatBroker(brokers[b], address, sizeof(address));
+    length += snprintf(buffer + length, size - length, "%s[\"%s\",%d,%lu,%lu,%lu,%lu]", b > 0 ? "," : "", address,
+                       brokerStats[b].up ? 1 : 0, (unsigned long)brokerStats[b].connects,
+                       (unsigned long)brokerStats[b].connectFailures, (unsigned long)brokerStats[b].published,
+                       (unsigned long)brokerStats[b].publishFailures);
+  }
+
+  if(length < (int)size)
+    length += snprintf(buffer + length, size - length, "],\"FAILOVER\":[%lu,%lu,%lu,%lu]",
+                       (unsigned long)failoverStats.failovers, (unsigned long)failoverStats.recoveries,
+                       (unsigned long)failoverStats.lastMillis, (unsigned long)failoverStats.maxMillis);
+
+  return length;
+}
@@ -0,0 +1,202 @@
+#include "commands.h"
+#include "config.h"
+#include "Queue.h"
+#include "bench.h"
+#include "holdup.h"
+#include "history.h"
+#include "delivery.h"
+#include "trace.h"
+
+
+
+////////////////////Command Queue////////////////////
+
+static Queue<Command> commandQueue(COMMAND_QUEUE_SIZE);  //Only touched by MQTT_TASK, callback runs inside mqttClient.loop()
+
+
+
+////////////////////Command Functions////////////////////
+
+/**
+ * @brief Queues MQTT messages for commandStep
+ * 
+ * @param topic 
+ * @param payload 
+ * @param length 
+ */
+void callback(char* topic, byte* payload, unsigned int length)
+{
+  if(length >= COMMAND_SIZE || commandQueue.count() >= COMMAND_QUEUE_SIZE)
+  {
+    mqttStats.droppedCommands++;
+    mqttClient.publish(publishTopicInfo, "{\"REPLY\":{\"ID\":null,\"STATUS\":\"BUSY\",\"MSG\":\"Command queue full or message too long\"}}");
+    return;
+  }
+
+  static Command command;
+  memcpy(command.payload, payload, length);
+  command.payload[length] = '\0';
+  command.length = length;
+  command.receivedMicros = micros();
+  commandQueue.push(command);
+}
+
+
+/**
+ * @brief Publishes the structured reply to a command
+ * 
+ * @param id Request ID as JSON, "null" if none was given
+ * @param cmd Command name as JSON
+ * @param ok Whether the command was carried out
+ * @param message Human readable outcome, must not contain quotes
+ * @param waitMicros Time spent in the queue
+ * @param execMicros Time spent executing
+ */
+static void publishReply(const char* id, const char* cmd, bool ok, const char* message, uint32_t waitMicros, uint32_t execMicros)
+{
+  char reply[PUBLISH_BUFFER_SIZE];
+  snprintf(reply, sizeof(reply), "{\"REPLY\":{\"ID\":%s,\"CMD\":%s,\"STATUS\":\"%s\",\"MSG\":\"%s\",\"WAIT_US\":%lu,\"US\":%lu}}",
+           id, cmd, ok ? "OK" : "ERROR", message, (unsigned long)waitMicros, (unsigned long)execMicros);
+
+  if(!mqttClient.publish(publishTopicInfo, reply))
+    mqttStats.publishFailures++;
+}
+
+
+/**
+ * @brief Parses and carries out the oldest queued command
+ * 
+ * @param object Network params
+ * @return true A command was executed
+ * @return false The queue was empty
+ */
+bool commandStep(NetworkObject& object)
+{
+  if(commandQueue.count() == 0)
+    return false;
+
+  static Command command;
+  command = commandQueue.pop();
+
+  uint32_t startMicros = micros();
+  uint32_t waitMicros = startMicros - command.receivedMicros;
+
+  static StaticJsonDocument<JSON_BUFFER_CAPACITY> root;  //Static arena, commands only ever run on MQTT_TASK
+  DeserializationError error = deserializeJson(root, command.payload, command.length);
+  
+  if(error)
+  {
+    publishReply("null", "null", false, "Message is an invalid JSON string", waitMicros, micros() - startMicros);
+    return true;
+  }
+	
+  const char* CMD = root["CMD"];
+  
+  if(!CMD)
+    return true;
+
+  //ID and CMD are echoed as JSON so any type of request ID comes back unchanged
+  char id[COMMAND_ID_SIZE];
+  char name[COMMAND_ID_SIZE];
+  if(serializeJson(root["ID"], id, sizeof(id)) >= sizeof(id) - 1)
+    strlcpy(id, "null", sizeof(id));
+  if(serializeJson(root["CMD"], name, sizeof(name)) >= sizeof(name) - 1)
+    strlcpy(name, "null", sizeof(name));
+
+  bool ok = true;
+  bool reply = true;
+  bool restart = false;
+  const char* message = "";
+  static char detail[64];
+
+  if (strcmp(CMD, "CNFG") == 0)
+  {
+    static char configMessage[JSON_BUFFER_CAPACITY];
+    const char* failure = "Config string exceeds JSON_BUFFER_CAPACITY";
+    if(measureJson(root["CNFG"]) < sizeof(configMessage))
+    {
+      serializeJson(root["CNFG"], configMessage, sizeof(configMessage));
+      failure = setConfig(configMessage, "MQTT");
+    }
+
+    ok = failure == NULL;
+    message = ok ? "Config committed, resetting device" : failure;
+    restart = ok;
+  }
+  
+  else if (strcmp(CMD, "RST") == 0)
+  {
+    message = "Resetting device";
+    restart = true;
+  }
+  
+  else if (strcmp(CMD, "PNG") == 0)
+  {
+    static char ping[PUBLISH_BUFFER_SIZE];
+    ok = generatePing(object, ping, sizeof(ping)) > 0 && mqttClient.publish(publishTopicInfo, ping);
+  }
+  
+  else if (strcmp(CMD, "STATS") == 0)
+  {
+    static char stats[PUBLISH_BUFFER_SIZE];
+    ok = generateStats(stats, sizeof(stats)) > 0 && mqttClient.publish(publishTopicInfo, stats);
+
+    if(root["RESET"] | false)
+      statsReset();
+  }
+  
+  else if (strcmp(CMD, "BENCH") == 0)
+  {
+    ok = benchStart(object);
+    message = ok ? "Benchmarks started" : "Benchmarks need a BENCH_ENABLED build";
+  }
+  
+  else if (strcmp(CMD, "TRACE") == 0)
+  {
+    traceStart(root["COUNT"] | 20, root["MS"] | 500, root["BUDGET_MS"] | TRACE_BUDGET_MS, root["MIN_RATE"] | 0.0f);
+    message = "Trace run started";
+  }
+  
+  else if (strcmp(CMD, "HISTORY") == 0)
+  {
+    uint32_t events;
+    if(root.containsKey("AFTER"))
+      events = historyQuerySequence(root["AFTER"] | HISTORY_MAX_SEQUENCE);
+    else
+      events = historyQueryTime(root["FROM"] | 0UL, root["TO"] | (uint32_t)UINT32_MAX);
+
+    snprintf(detail, sizeof(detail), "Replaying %lu events", (unsigned long)events);
+    message = detail;
+  }
+  
+  else if (strcmp(CMD, "ACK") == 0)
+  {
+    int removed = deliveryAck(root["SEQ"]);
+    snprintf(detail, sizeof(detail), "%d events acknowledged", removed);
+    message = detail;
+    reply = root.containsKey("ID");  //Acknowledgements arrive at the event rate, a reply to each would double the traffic
+  }
+  
+  else if (strcmp(CMD, "PWRFAIL") == 0)
+  {
+    ok = holdupSimulate();
+    message = ok ? "Simulating power failure" : "Power-fail path is not armed";
+  }
+  
+  else
+  {
+    ok = false;
+    message = "CMD is invalid";
+  }
+
+  uint32_t execMicros = micros() - startMicros;
+  perfRecord(mqttStats.commandTime, execMicros);
+  if(reply)
+    publishReply(id, name, ok, message, waitMicros, execMicros);
+
+  //Config is already on EEPROM, the reset applies it
+  if(restart)
+    reset();
+
+  return true;
+}
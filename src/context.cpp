@@ -0,0 +1,101 @@
+#include "context.h"
+
+
+
+////////////////////Context State////////////////////
+
+//Written only by VTC_TASK
+static uint16_t ringMin[CONTEXT_BUCKETS][CHANNEL_COUNT];
+static uint16_t ringMax[CONTEXT_BUCKETS][CHANNEL_COUNT];
+static int head = 0;  //Bucket being filled
+static int used = 0;  //Buckets in use, head included
+static uint32_t bucketStart = 0;  //micros() the head bucket started at
+
+
+
+////////////////////Context Functions////////////////////
+
+/**
+ * @brief Empties the ring
+ * 
+ */
+void contextReset()
+{
+  head = 0;
+  used = 0;
+}
+
+
+/**
+ * @brief Opens the next bucket, overwriting the oldest once the ring is full
+ * 
+ */
+static void contextAdvance()
+{
+  head = (head + 1) % CONTEXT_BUCKETS;
+  if(used < CONTEXT_BUCKETS)
+    used++;
+
+  for(int c = 0; c < CHANNEL_COUNT; c++)
+  {
+    ringMin[head][c] = CONTEXT_EMPTY_MIN;
+    ringMax[head][c] = CONTEXT_EMPTY_MAX;
+  }
+}
+
+
+/**
+ * @brief Min/max of one more reading
+ * 
+ * @param sample Reading just taken
+ */
+void contextUpdate(const Sample& sample)
+{
+  if(used == 0)
+  {
+    head = CONTEXT_BUCKETS - 1;
+    contextAdvance();
+    bucketStart = (uint32_t)sample.micros;
+  }
+
+  uint32_t elapsed = (uint32_t)sample.micros - bucketStart;
+  if(elapsed >= CONTEXT_BUCKET_US)
+  {
+    //After a long gap every bucket is empty, no need to step through more than the ring holds
+    uint32_t steps = elapsed / CONTEXT_BUCKET_US;
+    for(uint32_t s = 0; s < steps && s < CONTEXT_BUCKETS; s++)
+      contextAdvance();
+    bucketStart += steps * CONTEXT_BUCKET_US;
+  }
+
+  for(int c = 0; c < CHANNEL_COUNT; c++)
+  {
+    uint16_t value = sample.values[c];
+    if(value < ringMin[head][c])
+      ringMin[head][c] = value;
+    if(value > ringMax[head][c])
+      ringMax[head][c] = value;
+  }
+}
+
+
+/**
+ * @brief Linearizes the ring into an event
+ * 
+ * @param snapshot Event's context, filled oldest bucket first
+ */
+void contextSnapshot(ContextSnapshot<CHANNEL_COUNT>& snapshot)
+{
+  //At most two block copies, like CaptureBuffer::copyTo
+  int oldest = (head - used + 1 + CONTEXT_BUCKETS) % CONTEXT_BUCKETS;
+  int first = used < CONTEXT_BUCKETS - oldest ? used : CONTEXT_BUCKETS - oldest;
+  int second = used - first;
+
+  memcpy(snapshot.min, ringMin[oldest], first * sizeof(ringMin[0]));
+  memcpy(snapshot.min + first, ringMin[0], second * sizeof(ringMin[0]));
+  memcpy(snapshot.max, ringMax[oldest], first * sizeof(ringMax[0]));
+  memcpy(snapshot.max + first, ringMax[0], second * sizeof(ringMax[0]));
+
+  snapshot.buckets = used;
+  snapshot.newestStart = bucketStart;
+}
@@ -0,0 +1,200 @@
+#include "delivery.h"
+#include "store.h"
+#include "pipeline.h"
+
+
+
+////////////////////Delivery Externs////////////////////
+
+DeliveryStats deliveryStats = {0, 0, 0, 0};
+uint32_t deliveryBoots = 0;
+
+
+
+////////////////////Delivery State////////////////////
+
+static volatile uint32_t nextSequence = 0;  //Written by VTC_TASK under mutexHandle
+static volatile uint32_t reservedSequence = 0;  //Only SEQUENCE_TASK (and setup) writes the record
+static volatile bool commitPending = false;  //Set by VTC_TASK, cleared by SEQUENCE_TASK once the record is written
+static TaskHandle_t SEQUENCE_TASK_HANDLE = NULL;
+static uint32_t lastCheckMillis = 0;
+
+
+
+////////////////////Delivery Functions////////////////////
+
+/**
+ * @brief Writes the sequence record
+ * 
+ * @param reserved Reservation to store
+ */
+static void deliveryCommit(uint32_t reserved)
+{
+  SequenceRecord record = {SEQUENCE_MAGIC, reserved, deliveryBoots};
+
+  //setConfig commits the same EEPROM from MQTT_TASK or PROMPT_TASK
+  pthread_mutex_lock(&eepromMutex);
+  EEPROM.put(SEQUENCE_EEPROM_ADDRESS, record);
+  EEPROM.commit();
+  pthread_mutex_unlock(&eepromMutex);
+}
+
+
+/**
+ * @brief Extends the reservation whenever VTC_TASK asks for it, whatever MQTT_TASK is blocked on
+ * 
+ */
+static void SEQUENCE_TASK(void* pvParameters)
+{
+  while(true)
+  {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    //A flash write stalls core 1 as well, so it waits for the capture in progress to be handed over, the way spool
+    //writes do. The half block of headroom covers the wait, once only a quarter is left the write goes ahead regardless
+    while(captureActive && reservedSequence - nextSequence > SEQUENCE_RESERVE_BLOCK / 4)
+      vTaskDelay(pdMS_TO_TICKS(SEQUENCE_DEFER_POLL_MS));
+
+    //The record is written before the new limit is published, so no number above what is on flash is ever handed out
+    uint32_t reserved = nextSequence + SEQUENCE_RESERVE_BLOCK;
+    deliveryCommit(reserved);
+
+    reservedSequence = reserved;
+    commitPending = false;
+  }
+}
+
+
+/**
+ * @brief Restores the sequence and reserves the first block
+ * 
+ */
+void deliveryInit()
+{
+  SequenceRecord record;
+  EEPROM.get(SEQUENCE_EEPROM_ADDRESS, record);
+
+  if(record.magic == SEQUENCE_MAGIC)
+  {
+    nextSequence = record.reserved;
+    deliveryBoots = record.boots + 1;
+  }
+
+  reservedSequence = nextSequence + SEQUENCE_RESERVE_BLOCK;
+  deliveryCommit(reservedSequence);
+
+  xTaskCreatePinnedToCore( SEQUENCE_TASK,         //Task function
+                           "SEQUENCE",            //Name of task
+                           3000,                  //Stack size of task
+                           NULL,                  //Parameter of the task
+                           1,                     //Priority of the task, ahead of MQTT_TASK so a broker outage never delays it
+                           &SEQUENCE_TASK_HANDLE, //Task handle for keeping track of task
+                           0                      //Core that task is pinned to, capture keeps core 1
+                         );
+}
+
+
+/**
+ * @brief Next event sequence number
+ * 
+ * @return uint32_t 
+ */
+uint32_t deliveryNextSequence()
+{
+  //Half a block of headroom covers the EEPROM write, the reservation no longer waits for MQTT_TASK's loop
+  if(!commitPending && reservedSequence - nextSequence < SEQUENCE_RESERVE_BLOCK / 2)
+  {
+    commitPending = true;
+    if(SEQUENCE_TASK_HANDLE)
+      xTaskNotifyGive(SEQUENCE_TASK_HANDLE);
+  }
+
+  if(nextSequence >= reservedSequence)
+    deliveryStats.overruns++;  //Only if a whole half block went by during one EEPROM write
+
+  return nextSequence++;
+}
+
+
+/**
+ * @brief Timeout housekeeping
+ * 
+ */
+void deliveryStep()
+{
+  if(millis() - lastCheckMillis < DELIVERY_CHECK_MS)
+    return;
+  lastCheckMillis = millis();
+
+  if(globalDeliveryMode != DELIVERY_ACK)
+    return;
+
+  int resent = 0;
+  if(pthread_mutex_lock(&mutexHandle) == 0)
+  {
+    resent = storeRequeue(DELIVERY_TIMEOUT_MS);
+    pthread_mutex_unlock(&mutexHandle);
+  }
+
+  if(resent > 0)
+  {
+    deliveryStats.resent += resent;
+    pipelineNotify();
+  }
+}
+
+
+/**
+ * @brief Queues every unacknowledged event again
+ * 
+ */
+void deliveryReconnected()
+{
+  if(globalDeliveryMode != DELIVERY_ACK)
+    return;
+
+  int resent = 0;
+  if(pthread_mutex_lock(&mutexHandle) == 0)
+  {
+    resent = storeRequeue(0);
+    pthread_mutex_unlock(&mutexHandle);
+  }
+
+  if(resent > 0)
+  {
+    deliveryStats.resent += resent;
+    pipelineNotify();
+  }
+}
+
+
+/**
+ * @brief Removes acknowledged events
+ * 
+ * @param sequences Array of sequence numbers, or one number
+ * @return int Events removed
+ */
+int deliveryAck(JsonVariantConst sequences)
+{
+  int removed = 0;
+  int unknown = 0;
+
+  if(pthread_mutex_lock(&mutexHandle) == 0)
+  {
+    if(sequences.is<JsonArrayConst>())
+    {
+      for(JsonVariantConst sequence : sequences.as<JsonArrayConst>())
+        storeAck(sequence.as<uint32_t>()) ? removed++ : unknown++;
+    }
+    else if(!sequences.isNull())
+      storeAck(sequences.as<uint32_t>()) ? removed++ : unknown++;
+
+    pthread_mutex_unlock(&mutexHandle);
+  }
+
+  deliveryStats.acked += removed;
+  deliveryStats.unknownAcks += unknown;
+  if(removed > 0)
+    pipelineNotify();
+  return removed;
+}
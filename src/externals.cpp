@@ -1,6 +1,20 @@
 #include "externals.h"
 #include "config.h"
 #include "Queue.h"
+#include "fft.h"
+#include "commands.h"
+#include "sampler.h"
+#include "store.h"
+#include "holdup.h"
+#include "pipeline.h"
+#include "delivery.h"
+#include "stream.h"
+#include "baseline.h"
+#include "sinks.h"
+#include "power.h"
+#include "context.h"
+#include "broker.h"
+#include "trace.h"
 
 
 
@@ -12,21 +26,44 @@ WiFiUDP ethernetUDP;
 
 bool pingCommandReceived = false;
 
-Queue<String> dataSet(QUEUE_RANGE);
-Queue<String> softCopy(QUEUE_RANGE);
+EventBuffer dataSet;
 pthread_mutex_t mutexHandle;
+pthread_mutex_t eepromMutex;
+volatile bool captureActive = false;
 
-String publishTopicData = "";
-String publishTopicInfo = "";
-String subscribeTopic = "";
+char publishTopicData[TOPIC_SIZE] = "";
+char publishTopicInfo[TOPIC_SIZE] = "";
+char subscribeTopic[TOPIC_SIZE] = "";
 
-String globalClientID = "";
+char globalClientID[ID_SIZE] = "";
 IPAddress globalNTPAddress;
-float globalVoltageThreshold;
+float globalThresholds[CHANNEL_COUNT];
+uint32_t globalSampleRate = SAMPLE_RATE_HZ;
+uint32_t globalIdleRate = IDLE_RATE_HZ;
+float globalApproachMargin = APPROACH_MARGIN_PERCENT / 100.0f;
+PublishFormat globalPublishFormat = FORMAT_JSON;
+SchedulePolicy globalSchedulePolicy = SCHEDULE_SEVERITY;
+DeliveryMode globalDeliveryMode = DELIVERY_BEST_EFFORT;
+uint32_t globalStreamBaud = 0;
+uint8_t globalSinks = 1 << SINK_MQTT;
+PowerPolicy globalPowerPolicy = POWER_AUTO;
+uint32_t globalQuietSeconds = POWER_QUIET_S;
+uint32_t globalFailoverMs = BROKER_FAILOVER_MS;
+TriggerMode globalTriggerMode = TRIGGER_ABSOLUTE;
+BaselineTracker globalBaselineTracker = BASELINE_EWMA;
 
 time_t previousTime = 0;
-time_t currentTime = 0;
 unsigned short globalTimeCounter = 0;
+volatile bool timeSynced = false;
+time_t timeSyncEpoch = 0;
+uint64_t timeSyncMicros = 0;
+
+static portMUX_TYPE timeAnchorLock = portMUX_INITIALIZER_UNLOCKED;  //Written by MQTT_TASK on a sync, read by stampTime on core 1
+static time_t timeAnchorEpoch = 0;  //Device local time of the last NTP response, 0 until the first so the clock counts from boot
+static uint64_t timeAnchorMicros = 0;  //esp_timer_get_time() when it was received
+static bool configNoMemory = false;  //The config document on EEPROM did not fit JSON_BUFFER_CAPACITY, reported as CONFIG in the ping
+
+static_assert(JSON_BUFFER_CAPACITY <= SEQUENCE_EEPROM_ADDRESS, "The config document would overlap the sequence record on EEPROM");
 
 
 
@@ -34,7 +71,7 @@ unsigned short globalTimeCounter = 0;
 
 //Constructor
 NetworkObject::NetworkObject(IPAddress clientIP_,IPAddress clientDNS_,IPAddress clientGateway_,
-                             IPAddress clientSubnet_,IPAddress mqttAddress_,String site_,String equipmentID_)
+                             IPAddress clientSubnet_,IPAddress mqttAddress_,const char* site_,const char* equipmentID_)
 {
   pingCommandReceived = false;
     
@@ -44,8 +81,8 @@ NetworkObject::NetworkObject(IPAddress clientIP_,IPAddress clientDNS_,IPAddress
   this->clientSubnet = clientSubnet_;
 
   this->mqttAddress = mqttAddress_;
-  this->site = site_;
-  this->equipmentID = equipmentID_;
+  strlcpy(this->site, site_, ID_SIZE);
+  strlcpy(this->equipmentID, equipmentID_, ID_SIZE);
 
   ethernetInit();
   ntpInit();
@@ -61,8 +98,8 @@ IPAddress NetworkObject::getClientGateway() { return this->clientGateway; }
 IPAddress NetworkObject::getClientSubnet() { return this->clientSubnet; }
 
 IPAddress NetworkObject::getMQTTAddress() { return this->mqttAddress; }
-String NetworkObject::getSite() { return this->site; }
-String NetworkObject::getEquipmentID() { return this->equipmentID; }
+const char* NetworkObject::getSite() { return this->site; }
+const char* NetworkObject::getEquipmentID() { return this->equipmentID; }
 
 
 
@@ -76,28 +113,21 @@ void NetworkObject::ethEvent(WiFiEvent_t event)
   switch (event)
   {
     case ARDUINO_EVENT_ETH_START:
-      Serial.println("ETH Started");
+      streamLog("ETH Started\n");
       ETH.setHostname("esp32-ethernet"); //Set Eth hostname here
       break;
     
     case ARDUINO_EVENT_ETH_CONNECTED:
-      Serial.println("ETH Connected");
+      streamLog("ETH Connected\n");
       break;
     
     case ARDUINO_EVENT_ETH_GOT_IP:
-      Serial.print("ETH MAC: ");
-      Serial.print(ETH.macAddress());
-      Serial.print(", IPv4: ");
-      Serial.print(ETH.localIP());
-      
-      if (ETH.fullDuplex())
-        Serial.print(", FULL_DUPLEX");
-
-      Serial.print(", ");
-      Serial.print(ETH.linkSpeed());
-      Serial.println("Mbps");
-      
+    {
+      char ip[IP_STRING_SIZE];
+      streamLog("ETH MAC: %s, IPv4: %s%s, %dMbps\n", ETH.macAddress().c_str(), ipToString(ETH.localIP(), ip),
+                ETH.fullDuplex() ? ", FULL_DUPLEX" : "", ETH.linkSpeed());
       break;
+    }
     
     return;
   }
@@ -126,9 +156,27 @@ void NetworkObject::mqttInit()
   mqttClient.setCallback(callback);
   mqttClient.setBufferSize(PUBLISH_BUFFER_SIZE);
   
-  publishTopicData = String(ROOT_TOPIC) + "/" + getSite() + "/" + getEquipmentID() + "/Data";
-  publishTopicInfo = String(ROOT_TOPIC) + "/" + getSite() + "/" + getEquipmentID() +  "/Info";
-  subscribeTopic = String(ROOT_TOPIC) + "/" + getSite() + "/" + globalClientID;
+  formatTopic(publishTopicData, getSite(), getEquipmentID(), "Data");
+  formatTopic(publishTopicInfo, getSite(), getEquipmentID(), "Info");
+  formatTopic(subscribeTopic, getSite(), globalClientID, NULL);
+}
+
+
+
+/**
+ * @brief Formats a topic in the ROOT_TOPIC/site/id[/suffix] scheme
+ * 
+ * @param buffer Destination, at least TOPIC_SIZE long
+ * @param site Site name
+ * @param id Equipment ID (pub topics) or client ID (sub topic)
+ * @param suffix "Data", "Info" or NULL for none
+ */
+void formatTopic(char* buffer, const char* site, const char* id, const char* suffix)
+{
+  if(suffix)
+    snprintf(buffer, TOPIC_SIZE, "%s/%s/%s/%s", ROOT_TOPIC, site, id, suffix);
+  else
+    snprintf(buffer, TOPIC_SIZE, "%s/%s/%s", ROOT_TOPIC, site, id);
 }
 
 
@@ -137,31 +185,22 @@ void NetworkObject::mqttInit()
 
 /**
  * @brief Takes a string argument and convert to IP address object for network function utility
- * While strange for true embedded development, I opted to work with strings here as the standard intermediary value as it was easy to work with the EEPROM (dynamic reconfig) and allowed easy conversion to IP address and ArduinoJSON objects
+ * Strings are still the standard intermediary value as it is easy to work with the EEPROM (dynamic reconfig) and ArduinoJSON objects,
+ * but octets are accumulated in place so no heap allocation takes place
  * @param IPString 
  * @return IPAddress 
  */
-IPAddress stringToIP(String IPString)
+IPAddress stringToIP(const char* IPString)
 {
-  int addr[4];
+  int addr[4] = {0, 0, 0, 0};
   int commaCount = 0;
-  String entry;
-
-  IPString += "."; //Ensures the fourth octet in IP gets added to addr array
 
-  for( int i = 0; i < IPString.length(); i++) 
+  for(const char* c = IPString; *c && commaCount < 4; c++)
   {
-    if(IPString[i] != '.')
-    {
-      entry += IPString[i];
-    }
+    if(*c != '.')
+      addr[commaCount] = addr[commaCount] * 10 + (*c - '0');
     else
-    {
-      addr[commaCount] = entry.toInt();
       commaCount += 1;
-      entry = "";
-    }
-
   }
 
   IPAddress newIP(addr[0], addr[1], addr[2], addr[3]);
@@ -172,19 +211,41 @@ IPAddress stringToIP(String IPString)
 /**
  * @brief Get the Chip ID object
  * 
- * @return String 
+ * @param buffer Destination, at least ID_SIZE long
  */
-String getChipID()
+void getChipID(char* buffer)
 {
   uint32_t chipID = 0;
   
   for(int i=0; i<17; i=i+8)
 	  chipID |= ((ESP.getEfuseMac() >> (40 - i)) & 0xff) << i;
   
-  return String(chipID);
+  snprintf(buffer, ID_SIZE, "%lu", (unsigned long)chipID);
 }
   
 
+/**
+ * @brief Reads the config document stored on the system's EEPROM. A document too large for JSON_BUFFER_CAPACITY is
+ * reported on Serial and in the ping, the keys that could not be read keep their defaults
+ * 
+ * @param configDoc Filled with the document
+ * @return DeserializationError EmptyInput/InvalidInput for a blank EEPROM
+ */
+static DeserializationError readConfig(JsonDocument& configDoc)
+{
+  EepromStream streamFromEEPROM(0, JSON_BUFFER_CAPACITY);
+  DeserializationError error = deserializeJson(configDoc, streamFromEEPROM);
+
+  if(error == DeserializationError::NoMemory)
+  {
+    configNoMemory = true;
+    streamLog("Config on EEPROM exceeds JSON_BUFFER_CAPACITY, keys not read keep their defaults\n");
+  }
+
+  return error;
+}
+
+
 /**
  * @brief Instantiates a NetworkObject from the JSON document stored on the system's EEPROM
  * 
@@ -197,74 +258,74 @@ NetworkObject loadConfig()
   IPAddress clientGateway_;
   IPAddress clientSubnet_;
   IPAddress mqttAddress_;
-  String site_;
-  String equipmentID_;
+  const char* site_ = "";
+  const char* equipmentID_ = "";
 
 
-  DynamicJsonDocument configDoc(JSON_BUFFER_CAPACITY);
-  EepromStream streamFromEEPROM(0,JSON_BUFFER_CAPACITY);
-  deserializeJson(configDoc, streamFromEEPROM);
+  StaticJsonDocument<JSON_BUFFER_CAPACITY> configDoc;
+  readConfig(configDoc);
 
  
-  if(configDoc["IP"]){
-    String ipString = configDoc["IP"];
-    clientIP_ = stringToIP(ipString);
-  }
+  if(configDoc["IP"])
+    clientIP_ = stringToIP(configDoc["IP"]);
 
 
-  if(configDoc["DNS"]){
-    String dnsString = configDoc["DNS"];
-    clientDNS_ = stringToIP(dnsString) ;
-  }
+  if(configDoc["DNS"])
+    clientDNS_ = stringToIP(configDoc["DNS"]);
 
 
-  if(configDoc["SUBNET"]){
-    String subnetString = configDoc["SUBNET"];
-    clientSubnet_ = stringToIP(subnetString) ;
-  }
+  if(configDoc["SUBNET"])
+    clientSubnet_ = stringToIP(configDoc["SUBNET"]);
 
 
-  if(configDoc["GATEWAY"]){
-    String gatewayString = configDoc["GATEWAY"];
-    clientGateway_ = stringToIP(gatewayString) ;
-  }
+  if(configDoc["GATEWAY"])
+    clientGateway_ = stringToIP(configDoc["GATEWAY"]);
 
 
-  if(configDoc["MQTT"]){
-    String mqttString = configDoc["MQTT"];
-    mqttAddress_ = stringToIP(mqttString) ;
+  //Ordered broker list, the first entry is the preferred broker and stays the NetworkObject's address
+  if(configDoc["MQTT"])
+  {
+    brokerParse(configDoc["MQTT"]);
+    mqttAddress_ = brokers[0].address;
   }
 
+  if(configDoc["FAILOVER"])
+    globalFailoverMs = max(atol(configDoc["FAILOVER"]), (long)BROKER_RETRY_MS);
 
-  if(configDoc["NTP"]){
-    String ntpString = configDoc["NTP"];
-    globalNTPAddress = stringToIP(ntpString) ;
-  }
 
+  if(configDoc["NTP"])
+    globalNTPAddress = stringToIP(configDoc["NTP"]);
 
-  if(configDoc["SITE"]){
-    String siteString = configDoc["SITE"];
-    site_ = siteString;
-  }
+
+  if(configDoc["SITE"])
+    site_ = configDoc["SITE"];
   
 
-  if(configDoc["EQUIPMENTID"]){
-    String eqpString = configDoc["EQUIPMENTID"];
-    equipmentID_ = eqpString;
-  }
+  if(configDoc["EQUIPMENTID"])
+    equipmentID_ = configDoc["EQUIPMENTID"];
 
 
-  if(configDoc["CLIENTID"]){
-    String idString = configDoc["CLIENTID"];
-    globalClientID = idString;
-  }
-  else globalClientID = getChipID();
+  if(configDoc["CLIENTID"])
+    strlcpy(globalClientID, configDoc["CLIENTID"], ID_SIZE);
+  else getChipID(globalClientID);
 
-  
-  if(configDoc["VTHRESHOLD"]){
-    String vString = configDoc["VTHRESHOLD"];
-    globalVoltageThreshold = vString.toFloat();
+
+
+  if(configDoc["FORMAT"])
+    globalPublishFormat = (strcmp(configDoc["FORMAT"], "INFLUX") == 0) ? FORMAT_INFLUX : FORMAT_JSON;
+
+  if(configDoc["SCHEDULE"])
+  {
+    if(strcmp(configDoc["SCHEDULE"], "FIFO") == 0)
+      globalSchedulePolicy = SCHEDULE_FIFO;
+    else if(strcmp(configDoc["SCHEDULE"], "NEWEST") == 0)
+      globalSchedulePolicy = SCHEDULE_NEWEST;
+    else
+      globalSchedulePolicy = SCHEDULE_SEVERITY;
   }
+
+  if(configDoc["DELIVERY"])
+    globalDeliveryMode = (strcmp(configDoc["DELIVERY"], "ACK") == 0) ? DELIVERY_ACK : DELIVERY_BEST_EFFORT;
   
   
   NetworkObject networkHandler(clientIP_, clientDNS_, clientGateway_, clientSubnet_, mqttAddress_, site_, equipmentID_);
@@ -274,18 +335,88 @@ NetworkObject loadConfig()
 }
 
 
+/**
+ * @brief Reads only what the capture pipeline needs from the JSON document stored on the system's EEPROM,
+ * so VTC_TASK can start before any network bring-up
+ * 
+ */
+void loadCaptureConfig()
+{
+  StaticJsonDocument<JSON_BUFFER_CAPACITY> configDoc;
+  readConfig(configDoc);
+
+
+  for(int c = 0; c < CHANNEL_COUNT; c++)
+  {
+    globalThresholds[c] = CHANNELS[c].defaultThreshold;
+    if(CHANNELS[c].thresholdKey && configDoc[CHANNELS[c].thresholdKey])
+      globalThresholds[c] = atof(configDoc[CHANNELS[c].thresholdKey]);
+  }
+
+  if(configDoc["SRATE"])
+    globalSampleRate = constrain(atol(configDoc["SRATE"]), SAMPLE_RATE_MIN, SAMPLE_RATE_MAX);
+
+  //An idle rate of 0, or one not below SRATE, turns adaptive sampling off
+  if(configDoc["IDLERATE"])
+  {
+    globalIdleRate = atol(configDoc["IDLERATE"]);
+    if(globalIdleRate > 0)
+      globalIdleRate = constrain(globalIdleRate, SAMPLE_RATE_MIN, SAMPLE_RATE_MAX);
+  }
+
+  if(configDoc["MARGIN"])
+    globalApproachMargin = constrain(atof(configDoc["MARGIN"]), 0.0f, 100.0f) / 100.0f;
+
+  if(configDoc["TRIGMODE"])
+  {
+    if(strcmp(configDoc["TRIGMODE"], "DELTA") == 0)
+      globalTriggerMode = TRIGGER_DELTA;
+    else if(strcmp(configDoc["TRIGMODE"], "RATIO") == 0)
+      globalTriggerMode = TRIGGER_RATIO;
+    else
+      globalTriggerMode = TRIGGER_ABSOLUTE;
+  }
+
+  if(configDoc["BASELINE"])
+    globalBaselineTracker = (strcmp(configDoc["BASELINE"], "MEDIAN") == 0) ? BASELINE_MEDIAN : BASELINE_EWMA;
+
+  //Streaming replaces the boot prompt on Serial, so it has to be known before the tasks start
+  if(configDoc["STREAM"])
+    globalStreamBaud = constrain(atol(configDoc["STREAM"]), 0, STREAM_BAUD_MAX);
+
+  //Sink queues are created at boot, before VTC_TASK hands anything over. An empty or unknown list keeps MQTT
+  if(configDoc["SINKS"])
+  {
+    globalSinks = sinksParse(configDoc["SINKS"]);
+    if(globalSinks == 0)
+      globalSinks = 1 << SINK_MQTT;
+  }
+
+  if(configDoc["POWER"])
+    globalPowerPolicy = (strcmp(configDoc["POWER"], "OFF") == 0) ? POWER_OFF : POWER_AUTO;
+
+  if(configDoc["QUIET"])
+    globalQuietSeconds = atol(configDoc["QUIET"]);
+}
+
+
 /**
  * @brief Writes contents of source document into destination document
  * 
  * @param parameter JSON subcontent accessor string
+ * @param valueSize Longest value accepted for it, terminator included
  * @param destinationDoc 
  * @param sourceDoc 
  * @param mode Mode dictating whether system reconfiguration is being performed via SPI or MQTT
+ * @return false if the value is too long, nothing is written
  */
-void docInject(const char* parameter, DynamicJsonDocument& destinationDoc, DynamicJsonDocument& sourceDoc, const char* mode)
+bool docInject(const char* parameter, size_t valueSize, JsonDocument& destinationDoc, JsonDocument& sourceDoc, const char* mode)
 {
   const char* value = sourceDoc[parameter];
   
+  if(value && strlen(value) >= valueSize)
+    return false;
+
   if(value)
   {
     if(strcmp(mode, "SERIAL") == 0)
@@ -296,17 +427,18 @@ void docInject(const char* parameter, DynamicJsonDocument& destinationDoc, Dynam
       Serial.print(value);
       Serial.print("\n(Y/N)\n");
     
-      String answer;
+      char answer = '\0';
       while(true)
       {
         if(Serial.available())
         {
-          answer = Serial.readStringUntil('\n');
+          answer = Serial.read();
+          while(Serial.available() && Serial.read() != '\n');  //Discards the rest of the line
           break;
         }
       }
 
-    if(answer == "Y" || answer == "y")
+    if(answer == 'Y' || answer == 'y')
       destinationDoc[parameter] = value;
     }
     
@@ -316,6 +448,8 @@ void docInject(const char* parameter, DynamicJsonDocument& destinationDoc, Dynam
     }
    
   }
+
+  return true;
 }
 
 
@@ -324,46 +458,54 @@ void docInject(const char* parameter, DynamicJsonDocument& destinationDoc, Dynam
  * 
  * @param configMessage Reconfiguration data
  * @param mode Dictates whether message should be handled as an SPI or MQTT based config message
+ * @return const char* NULL once committed, otherwise why nothing was written
  */
-void setConfig(const char* configMessage, const char* mode)
+const char* setConfig(const char* configMessage, const char* mode)
 {
-  DynamicJsonDocument currentDoc(JSON_BUFFER_CAPACITY);
-  EepromStream streamFromEEPROM(0, JSON_BUFFER_CAPACITY);
-  deserializeJson(currentDoc, streamFromEEPROM);
-	
-	
-  DynamicJsonDocument configDoc(JSON_BUFFER_CAPACITY);
+  static char failure[64];
+  failure[0] = '\0';
+
+  StaticJsonDocument<JSON_BUFFER_CAPACITY> currentDoc;
+  StaticJsonDocument<JSON_BUFFER_CAPACITY> configDoc;
   DeserializationError error = deserializeJson(configDoc, configMessage);
-  
-  if(error)
+
+  //A stored document that did not fit would be written back without the keys that were cut off
+  if(readConfig(currentDoc) == DeserializationError::NoMemory)
+    strlcpy(failure, "Config on EEPROM exceeds JSON_BUFFER_CAPACITY", sizeof(failure));
+  else if(error == DeserializationError::NoMemory)
+    strlcpy(failure, "Config string exceeds JSON_BUFFER_CAPACITY", sizeof(failure));
+  else if(error)
+    strlcpy(failure, "Config string is an invalid JSON string", sizeof(failure));
+
+  //Every key at its longest value fits in JSON_BUFFER_CAPACITY, longer values are refused
+  for(int k = 0; k < CONFIG_KEY_COUNT && !failure[0]; k++)
+    if(!docInject(CONFIG_KEYS[k].name, CONFIG_KEYS[k].valueSize, currentDoc, configDoc, mode))
+      snprintf(failure, sizeof(failure), "%s value is too long", CONFIG_KEYS[k].name);
+
+  for(int c = 0; c < CHANNEL_COUNT && !failure[0]; c++)
+    if(CHANNELS[c].thresholdKey && !docInject(CHANNELS[c].thresholdKey, CONFIG_NUMBER_SIZE, currentDoc, configDoc, mode))
+      snprintf(failure, sizeof(failure), "%s value is too long", CHANNELS[c].thresholdKey);
+
+  if(!failure[0] && currentDoc.overflowed())
+    strlcpy(failure, "Config exceeds JSON_BUFFER_CAPACITY", sizeof(failure));
+
+  if(failure[0])
   {
     if(strcmp(mode, "SERIAL") == 0)
-      Serial.println("Error: Config string is an invalid JSON string");
+      Serial.printf("Error: %s\n", failure);
 
-    return;
+    return failure;
   }
 
 
-  docInject("IP", currentDoc, configDoc, mode);
-  docInject("DNS", currentDoc, configDoc, mode);
-  docInject("GATEWAY", currentDoc, configDoc, mode);
-  docInject("SUBNET", currentDoc, configDoc, mode);
-  docInject("MQTT", currentDoc, configDoc, mode);
-  docInject("NTP", currentDoc, configDoc, mode);
-  docInject("SITE", currentDoc, configDoc, mode);
-  docInject("EQUIPMENTID", currentDoc, configDoc, mode);
-  docInject("CLIENTID", currentDoc, configDoc, mode);
-  docInject("VTHRESHOLD", currentDoc, configDoc, mode);
-
-
+  //SEQUENCE_TASK commits the sequence record on its own schedule
+  pthread_mutex_lock(&eepromMutex);
   EepromStream streamToEEPROM(0, JSON_BUFFER_CAPACITY);
   serializeJson(currentDoc, streamToEEPROM);
   EEPROM.commit();
-  Serial.println("Committed new config information to EEPROM");
-	
-	
-  if( strcmp(mode, "MQTT") == 0)
-    reset();
+  pthread_mutex_unlock(&eepromMutex);
+  streamLog("Committed new config information to EEPROM\n");
+  return NULL;
 }
 
 
@@ -371,32 +513,17 @@ void setConfig(const char* configMessage, const char* mode)
 ////////////////////Interrupt Functions////////////////////
 
 /**
- * @brief Function to attempt reconnect to MQTT broker
+ * @brief Function to attempt reconnect to MQTT broker, failing over down the broker list
  * 
  */
 void reconnect()
 {
-  Serial.println("Attempting MQTT connection...");
+  streamLog("Attempting MQTT connection...\n");
 
-  while(!mqttClient.connected())
-  {
-    if(mqttClient.connect(globalClientID.c_str()))
-    {
-      if (mqttClient.connect(globalClientID.c_str(), MQTT_USERNAME, MQTT_PASSWORD))
-      { 
-        Serial.println("Connected");	
-        mqttClient.subscribe(subscribeTopic.c_str());
-	pingCommandReceived = true; //Ensures init ping is sent to broker now that a new connection has been established
-      } 
-      else
-      {
-        Serial.print("Failed, rc=");
-        Serial.print(mqttClient.state());
-        Serial.println("Trying again in 5 seconds");
-        delay(5000);
-      }
-    }
-  }
+  brokerConnect();
+  mqttStats.reconnects++;
+  mqttClient.subscribe(subscribeTopic);
+  pingCommandReceived = true; //Ensures init ping is sent to broker now that a new connection has been established
 }
 
 
@@ -413,9 +540,17 @@ void reset()
 
 
 
-String ipToString(IPAddress ip)
+/**
+ * @brief Formats an IP address as dotted decimal
+ * 
+ * @param ip Address to format
+ * @param buffer Destination, at least IP_STRING_SIZE long
+ * @return char* buffer, for use inline in format calls
+ */
+char* ipToString(IPAddress ip, char* buffer)
 {
-  return String(ip[0]) + "." + String(ip[1]) + "." + String(ip[2]) + "." + String(ip[3]);
+  snprintf(buffer, IP_STRING_SIZE, "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+  return buffer;
 }
 
 
@@ -423,117 +558,245 @@ String ipToString(IPAddress ip)
  * @brief Builds sytem diagnostic ping message to send over MQTT when prompted
  * 
  * @param object Network params
- * @return String of diagnostic info
+ * @param buffer Destination
+ * @param size Size of buffer
+ * @return size_t Length of the message
  */
-String generatePing(NetworkObject object)
+size_t generatePing(NetworkObject& object, char* buffer, size_t size)
 {
-  String pingMessage = "{\"TIME\":\"" + getTime() + "\"," +
-                        "\"VERSION\":\"" + VERSION + "\"," +
-                        "\"IP\":\"" + ipToString(object.getClientIP()) + "\"," +
-                        "\"DNS\":\"" + ipToString(object.getClientDNS()) + "\"," +
-                        "\"GATEWAY\":\"" + ipToString(object.getClientGateway()) + "\"," +
-                        "\"SUBNET\":\"" + ipToString(object.getClientSubnet()) + "\"," +
-	  		"\"MQTT\":\"" + ipToString(object.getMQTTAddress()) + "\"," +
-	  		"\"NTP\":\"" + ipToString(globalNTPAddress) + "\"," +
-                        "\"SITE\":\"" + object.getSite() + "\"," +
-                        "\"EQUIPMENTID\":\"" + object.getEquipmentID() + "\"," +
-                        "\"CLIENTID\":\"" + globalClientID + "\"," +
-                        "\"VTHRESHOLD\":\"" + String(globalVoltageThreshold,1) + "\"}";
-  return pingMessage;
+  char timeString[TIME_STRING_SIZE];
+  char ip[IP_STRING_SIZE], dns[IP_STRING_SIZE], gateway[IP_STRING_SIZE], subnet[IP_STRING_SIZE], ntp[IP_STRING_SIZE];
+  char mqtt[BROKER_LIST_SIZE], broker[BROKER_ADDRESS_SIZE];
+  char sinks[24];
+
+  getTime(timeString);
+
+  int length = snprintf(buffer, size,
+                        "{\"TIME\":\"%s\",\"VERSION\":\"%s\",\"IP\":\"%s\",\"DNS\":\"%s\",\"GATEWAY\":\"%s\",\"SUBNET\":\"%s\","
+                        "\"MQTT\":\"%s\",\"BROKER\":\"%s\",\"FAILOVER\":\"%lu\",\"NTP\":\"%s\",\"SITE\":\"%s\",\"EQUIPMENTID\":\"%s\",\"CLIENTID\":\"%s\",",
+                        timeString, VERSION,
+                        ipToString(object.getClientIP(), ip), ipToString(object.getClientDNS(), dns),
+                        ipToString(object.getClientGateway(), gateway), ipToString(object.getClientSubnet(), subnet),
+                        brokerList(mqtt, sizeof(mqtt)), brokerActiveAddress(broker, sizeof(broker)),
+                        (unsigned long)globalFailoverMs, ipToString(globalNTPAddress, ntp),
+                        object.getSite(), object.getEquipmentID(), globalClientID);
+
+  //One threshold per triggering channel, under its config key
+  for(int c = 0; c < CHANNEL_COUNT && length > 0 && (size_t)length < size; c++)
+    if(CHANNELS[c].thresholdKey)
+      length += snprintf(buffer + length, size - length, globalTriggerMode == TRIGGER_RATIO ? "\"%s\":\"%.3f\"," : "\"%s\":\"%.1f\",",
+                         CHANNELS[c].thresholdKey, globalThresholds[c]);
+
+  if(length > 0 && (size_t)length < size)
+    length += snprintf(buffer + length, size - length,
+                       "\"SRATE\":\"%lu\",\"IDLERATE\":\"%lu\",\"MARGIN\":\"%.0f\",\"TRIGMODE\":\"%s\",\"BASELINE\":\"%s\",\"FORMAT\":\"%s\",\"SCHEDULE\":\"%s\","
+                       "\"DELIVERY\":\"%s\",\"BOOT\":%lu,\"STREAM\":\"%lu\",\"SINKS\":\"%s\",\"POWER\":\"%s\",\"QUIET\":\"%lu\",\"CONFIG\":\"%s\",\"HEAP\":{\"FREE\":%lu,\"MIN\":%lu,\"MAXBLOCK\":%lu}}",
+                       (unsigned long)globalSampleRate, (unsigned long)globalIdleRate, globalApproachMargin * 100.0f,
+                       globalTriggerMode == TRIGGER_DELTA ? "DELTA" : globalTriggerMode == TRIGGER_RATIO ? "RATIO" : "ABS",
+                       globalBaselineTracker == BASELINE_MEDIAN ? "MEDIAN" : "EWMA",
+                       globalPublishFormat == FORMAT_INFLUX ? "INFLUX" : "JSON",
+                       globalSchedulePolicy == SCHEDULE_FIFO ? "FIFO" : globalSchedulePolicy == SCHEDULE_NEWEST ? "NEWEST" : "SEVERITY",
+                       globalDeliveryMode == DELIVERY_ACK ? "ACK" : "BEST", (unsigned long)deliveryBoots,
+                       (unsigned long)globalStreamBaud, sinksList(sinks, sizeof(sinks)),
+                       globalPowerPolicy == POWER_OFF ? "OFF" : "AUTO", (unsigned long)globalQuietSeconds,
+                       configNoMemory ? "NOMEMORY" : "OK",
+                       (unsigned long)ESP.getFreeHeap(), (unsigned long)ESP.getMinFreeHeap(), (unsigned long)ESP.getMaxAllocHeap());
+
+  return (length > 0 && (size_t)length < size) ? length : 0;
 }
 
 
+
+////////////////////Measurement Functions////////////////////
+
 /**
- * @brief Parses MQTT messages and determines appropraite callback response
+ * @brief Reads every channel back to back
  * 
- * @param topic 
- * @param payload 
- * @param length 
+ * @return Sample 
  */
-static void callback(char* topic, byte* payload, unsigned int length)
+Sample readSample()
 {
-  DynamicJsonDocument root(JSON_BUFFER_CAPACITY);
-  DeserializationError error = deserializeJson(root, (const char*)payload, length);
-  
-  if(error)
+  Sample sample;
+  stampTime(sample);
+  ChannelSet<CHANNEL_COUNT>::read(sample.values);
+  return sample;
+}
+
+
+/**
+ * @brief Sample source used by VTC_TASK in normal operation
+ * 
+ * @param sample Filled with a fresh reading
+ * @return true Always
+ */
+bool liveSource(Sample& sample)
+{
+  samplerRead(sample);
+  statsRecordSample((uint32_t)sample.micros);
+  return true;
+}
+
+
+/**
+ * @brief Event sink used by VTC_TASK in normal operation
+ * 
+ */
+void handOverEvent()
+{
+  uint32_t waitStart = micros();
+  if(pthread_mutex_lock(&mutexHandle) == 0)  //The mutex locks the shared resource or waits until the resource is available to lock it
   {
-    mqtt.publish(publishTopicInfo.c_str(), "Error: Message is an invalid JSON string");
-    return;
+    perfRecord(vtcStats.mutexWait, micros() - waitStart);
+    dataSet.trace().stored = micros();
+    vtcStats.events++;
+    dataSet.setSequence(deliveryNextSequence());
+
+    if(sinkEnabled(SINK_MQTT))
+    {
+      if(!storePush(dataSet))  //Store was full, the oldest event was never picked up by ENCODE_TASK and is dropped
+      {
+        vtcStats.droppedEvents++;
+        sinkStats[SINK_MQTT].dropped++;
+      }
+      if((uint32_t)storeCount() > sinkStats[SINK_MQTT].maxDepth)
+        sinkStats[SINK_MQTT].maxDepth = storeCount();
+    }
+
+    //The other sinks take their copy under the same lock, dataSet is only stable while it is held
+    sinksFanOut(dataSet);
+
+    pthread_mutex_unlock(&mutexHandle);
+    pipelineNotify();
   }
-	
-  const char* CMD = root["CMD"];
-    
-  if(CMD)
+}
+
+
+/**
+ * @brief Trigger/override logic shared by live capture and trace replay (test_replay)
+ * 
+ * @param source Where readings come from
+ * @param sink What happens to a completed capture
+ * @return false if source ran out
+ */
+bool captureStep(SampleSource source, EventSink sink)
+{
+  //Every measurement is recorded in the case of an excursion later on, including the one that triggers it
+  Sample sample;
+  if(!source(sample))
+    return false;
+  dataSet.push(sample);
+  contextUpdate(sample);
+  baselineUpdate(sample.values);  //Before the check, so the very first reading seeds the baseline
+
+  if(captureTriggered(sample.values))
   {
-    if (strcmp(CMD, "CNFG") == 0)
+    captureActive = true;
+    dataSet.setBaseline(baselineCounts());
+    contextSnapshot(dataSet.context());  //The seconds leading up to the trigger, at CONTEXT_BUCKET_MS resolution
+    dataSet.trace().trigger = (uint32_t)sample.micros;  //Same low 32 bits as micros(), which the later stages stamp
+    dataSet.trace().injected = traceInjection(sample.micros);  //Only injected transients count in a TRACE run
+
+    //Override occurs, meaning measurements are continuously recorded to capture as much of the transient as needed within the primary queue
+    bool exhausted = false;
+    bool sustained = false;
+    for(int i = 0; i<OVERRIDE_RANGE && !exhausted && !captureFrozen; i++)
     {
-      mqttClient.publish(publishTopicInfo.c_str(), "Reconfiguring device");
-      
-      String configMessage;
-      serializeJson(root["CNFG"], configMessage);
-	    
-      setConfig(configMessage.c_str(), "MQTT");
+      exhausted = !source(sample);
+      if(!exhausted)
+      {
+        dataSet.push(sample);
+        contextUpdate(sample);
+        sustained |= captureTriggered(sample.values);  //The baseline is held while the transient is captured
+      }
     }
-    
-    else if (strcmp(CMD, "RST") == 0)
+
+    //On power-fail the ring is left as it is, FLUSH_TASK saves it once VTC_TASK has parked
+    if(captureFrozen)
     {
-      mqttClient.publish(publishTopicInfo.c_str(), "Resetting device");
-      
-      reset();
+      captureActive = false;
+      return true;
     }
-    
-    else if (strcmp(CMD, "PNG") == 0)
-    {      
-      pingCommandReceived = true;
+
+    dataSet.trace().captured = micros();
+    sink();
+    uint8_t injected = dataSet.trace().injected;
+    dataSet.trace() = EventTrace();  //Latency is traced for the block holding the trigger only
+    dataSet.trace().injected = injected;  //Later blocks of an injected transient stay marked
+
+    //Long event: the ring is refilled with fresh readings and handed over again for as long as the excursion lasts
+    for(int block = 1; block < storeMaxBlocks() && sustained && !exhausted && !captureFrozen; block++)
+    {
+      sustained = false;
+      dataSet.setBlock(block);
+      for(int i = 0; i < QUEUE_RANGE && !exhausted && !captureFrozen; i++)
+      {
+        exhausted = !source(sample);
+        if(!exhausted)
+        {
+          dataSet.push(sample);
+          contextUpdate(sample);
+          baselineUpdate(sample.values);  //A lasting shift in level is absorbed into the baseline and ends the event
+          sustained |= captureTriggered(sample.values);
+        }
+      }
+
+      if(!captureFrozen)
+        sink();
     }
-    
-    else
+    if(!captureFrozen)
     {
-      mqttClient.publish(publishTopicInfo.c_str(), "Error: CMD is invalid");
+      dataSet.setBlock(0);  //Kept on power-fail, the saved ring is a later block of its event
+      dataSet.trace() = EventTrace();
     }
-  }	
-}
 
+    captureActive = false;
+    return !exhausted;
+  }
 
+  return true;
+}
 
-////////////////////Measurement Functions////////////////////
 
 /**
- * @brief Get the Voltage reading off analog I/O
+ * @brief Device local time of an esp_timer_get_time() reading, counted from the last NTP anchor
  * 
- * @return String 
+ * @param micros esp_timer_get_time() value
+ * @return int64_t Microseconds since the epoch
  */
-String getVoltage()
+static int64_t clockMicros(uint64_t micros)
 {
-  float rawVoltage = analogRead(VPIN);
-  float voltage = rawVoltage;//(0.0409)*rawVoltage-71.336; //Function to be changed
-  return String(voltage,1);
+  portENTER_CRITICAL(&timeAnchorLock);
+  time_t epoch = timeAnchorEpoch;
+  uint64_t anchor = timeAnchorMicros;
+  portEXIT_CRITICAL(&timeAnchorLock);
+
+  //Signed, a sync landing between the reading and the anchor copy puts the anchor just after it
+  return (int64_t)epoch * 1000000 + (int64_t)(micros - anchor);
 }
 
 
 /**
- * @brief Get the Current reading off analog I/O
+ * @brief Current device local time
  * 
- * @return String 
+ * @return time_t 
  */
-String getCurrent()
+time_t deviceTime()
 {
-  float rawCurrent = analogRead(CPIN);
-  float current = rawCurrent;//(0.0173)*rawCurrent - 29.195 + 0.75; //Function to be changed
-  return String(current,1);
+  return clockMicros(esp_timer_get_time()) / 1000000;
 }
 
 
 /**
- * @brief Get the Time object via NTP
+ * @brief Timestamps a sample from esp_timer_get_time() and the last NTP anchor, so the fraction is exact and
+ * SAMPLER_TASK never waits on a sync
  * 
- * @return String 
+ * @param sample Sample to stamp
  */
-String getTime()
+void stampTime(Sample& sample)
 {
-  char bufferT[23];
-
-  time_t currentTime = now();
+  sample.micros = esp_timer_get_time();
+  int64_t clock = clockMicros(sample.micros);
+  time_t currentTime = clock / 1000000;
 
   //Record "milliseconds" according to whether or not this measurement occurs in the same second as the previous one
   if(currentTime == previousTime)
@@ -543,37 +806,616 @@ String getTime()
   
   previousTime = currentTime;
 
-  snprintf(bufferT, sizeof(bufferT), "%4hu-%02hu-%02hu %02hu:%02hu:%02hu %02hu\0",
-	   year(currentTime), month(currentTime), day(currentTime),
-	   hour(currentTime), minute(currentTime), second(currentTime), globalTimeCounter);
+  sample.seconds = currentTime;
+  sample.fraction = clock % 1000000;
+  sample.counter = globalTimeCounter;
+}
+
 
-  return String(bufferT);
+/**
+ * @brief Formats a timestamp the way the Data topic has always carried it
+ * 
+ * @param seconds Time reference value
+ * @param counter Same-second counter
+ * @param buffer Destination, at least TIME_STRING_SIZE long
+ */
+void formatTime(time_t seconds, unsigned short counter, char* buffer)
+{
+  //seconds is local time already. gmtime_r fills the caller's struct, ENCODE_TASK and MQTT_TASK format at the same time
+  struct tm parts;
+  gmtime_r(&seconds, &parts);
+
+  snprintf(buffer, TIME_STRING_SIZE, "%4d-%02d-%02d %02d:%02d:%02d %02hu",
+	   parts.tm_year + 1900, parts.tm_mon + 1, parts.tm_mday,
+	   parts.tm_hour, parts.tm_min, parts.tm_sec, counter);
 }
 
 
 /**
- * @brief Builds measurement string to add to circular queue event capture object
+ * @brief Get the Time object via NTP
  * 
- * @return String 
+ * @param buffer Destination, at least TIME_STRING_SIZE long
  */
-String generateEntry()
+void getTime(char* buffer)
 {
-  return "{\"Time\":\"" + getTime() + "\",\"Voltage\":" + getVoltage() + ",\"Current\":" + getCurrent() + "}";
+  //Read only, stampTime's same-second state belongs to SAMPLER_TASK on core 1
+  time_t current = deviceTime();
+  formatTime(current, current == previousTime ? globalTimeCounter : 0, buffer);
 }
 
 
+/**
+ * @brief Builds measurement string for one entry of a captured event
+ * e.g. {"Time":"2023-04-11 17:02:47 12","SEQ":1042,"I":7,"Voltage":2051.0}
+ * 
+ * @param sample Reading to format
+ * @param sequence Sequence number of the event the reading belongs to
+ * @param index Position of the reading within the event
+ * @param buffer Destination
+ * @param size Size of buffer
+ * @return size_t Length of the entry
+ */
+size_t generateEntry(const Sample& sample, uint32_t sequence, int index, char* buffer, size_t size)
+{
+  char timeString[TIME_STRING_SIZE];
+  formatTime(sample.seconds, sample.counter, timeString);
+
+  int length = snprintf(buffer, size, "{\"Time\":\"%s\",\"SEQ\":%lu,\"I\":%d", timeString, (unsigned long)sequence, index);
+
+  for(int c = 0; c < CHANNEL_COUNT && length > 0 && (size_t)length < size; c++)
+    length += snprintf(buffer + length, size - length, ",\"%s\":%.1f", CHANNELS[c].name, channelValue(c, sample.values[c]));
+
+  if(length > 0 && (size_t)length < size)
+    length += snprintf(buffer + length, size - length, "}");
+
+  return (length > 0 && (size_t)length < size) ? length : 0;
+}
 
-////////////////////NTP Functions////////////////////
 
 /**
- * @brief Gets benchmark time during system boot/reboot
+ * @brief Moves a boot-relative timestamp onto the NTP timeline. The clock counts from 0 at boot until the first sync,
+ * so any time before VALID_TIME_EPOCH was taken before it
  * 
- * @return time_t 
+ * @param sample Sample to fix up
  */
-time_t getTimeBenchmark()
+void backdateSample(Sample& sample)
+{
+  if(!timeSynced || sample.seconds >= VALID_TIME_EPOCH)
+    return;
+
+  int64_t offset = (int64_t)sample.micros - (int64_t)timeSyncMicros;  //Negative, the sample predates the sync
+  int64_t stamp = (int64_t)timeSyncEpoch * 1000000 + offset;
+
+  sample.seconds = stamp / 1000000;
+  sample.fraction = stamp % 1000000;
+}
+
+
+/**
+ * @brief Nanoseconds since the Unix epoch for a sample
+ * 
+ * @param sample Stamped sample
+ * @return uint64_t 
+ */
+uint64_t sampleNanos(const Sample& sample)
+{
+  int64_t utcSeconds = (int64_t)sample.seconds - (TIMEZONE*3600);
+  return (uint64_t)utcSeconds * 1000000000ULL + (uint64_t)sample.fraction * 1000ULL;
+}
+
+
+/**
+ * @brief Escapes a tag value for line protocol (commas, equals signs and spaces need a backslash)
+ * 
+ * @param value Tag value
+ * @param out Destination buffer
+ * @param size Size of out
+ */
+static void escapeTag(const char* value, char* out, size_t size)
+{
+  size_t j = 0;
+  for(; *value && j + 2 < size; value++)
+  {
+    char c = *value;
+    if(c == ',' || c == '=' || c == ' ')
+      out[j++] = '\\';
+    out[j++] = c;
+  }
+  out[j] = '\0';
+}
+
+
+/**
+ * @brief Builds the line protocol batch for an event
+ * e.g. narc,site=A,equipmentID=B voltage=2051.0,current=1880.0,seq=1042i,i=7i 1681234567123456000
+ * 
+ * @param siteTag Site the event belongs to
+ * @param equipmentTag Equipment ID the event belongs to
+ * @param event Event readings in capture order
+ * @param buffer Destination buffer
+ * @param size Size of buffer
+ * @return size_t Length of the batch
+ */
+size_t generateInfluxBatch(const char* siteTag, const char* equipmentTag, const EventBuffer& event, char* buffer, size_t size)
 {
-  time_t timeValue = 0;
+  char site[INFLUX_LINE_SIZE / 4];
+  char equipmentID[INFLUX_LINE_SIZE / 4];
+  escapeTag(siteTag, site, sizeof(site));
+  escapeTag(equipmentTag, equipmentID, sizeof(equipmentID));
+
+  size_t used = 0;
+  buffer[0] = '\0';
+
+  for(int i = 0; i < event.count(); i++)
+  {
+    Sample sample = event.at(i);
+    int written = snprintf(buffer + used, size - used, "%s%s,site=%s,equipmentID=%s ",
+                           used > 0 ? "\n" : "", INFLUX_MEASUREMENT, site, equipmentID);
 
+    for(int c = 0; c < CHANNEL_COUNT && written >= 0 && (size_t)written < size - used; c++)
+      written += snprintf(buffer + used + written, size - used - written, "%s%s=%.1f",
+                          c > 0 ? "," : "", CHANNELS[c].field, channelValue(c, sample.values[c]));
+
+    if(written >= 0 && (size_t)written < size - used)
+      written += snprintf(buffer + used + written, size - used - written, ",seq=%lui,i=%di %llu",
+                          (unsigned long)event.sequence(), i, (unsigned long long)sampleNanos(sample));
+
+    if(written < 0 || (size_t)written >= size - used)
+    {
+      buffer[used] = '\0';  //Drops the partial line
+      break;
+    }
+    used += written;
+  }
+
+  return used;
+}
+
+
+
+////////////////////Analysis Functions////////////////////
+
+/**
+ * @brief Builds the sampling metadata message for one event
+ * e.g. {"EVENT":{"TIME":"2023-04-11 17:02:47 12","SEQ":1042,"BOOT":3,"BLOCK":0,"SAMPLES":40,"RATE":2000.0,"PRE_RATE":500.0,"JITTER_US":12,"SEVERITY":0.250,"BASELINE":[2051.0,1880.0],"INJECTED":4}}
+ * 
+ * @param event Event readings in capture order
+ * @param buffer Destination
+ * @param size Size of buffer
+ * @return size_t Length of the message, 0 if it did not fit
+ */
+size_t generateEventInfo(const EventBuffer& event, char* buffer, size_t size)
+{
+  EventTiming timing = eventTiming(event);
+
+  char timeString[TIME_STRING_SIZE] = "";
+  if(event.count() > 0)
+    formatTime(event.seconds(0), event.at(0).counter, timeString);
+
+  int length = snprintf(buffer, size,
+                        "{\"EVENT\":{\"TIME\":\"%s\",\"SEQ\":%lu,\"BOOT\":%lu,\"BLOCK\":%u,\"SAMPLES\":%d,\"RATE\":%.1f,\"PRE_RATE\":%.1f,\"JITTER_US\":%lu,\"SEVERITY\":%.3f",
+                        timeString, (unsigned long)event.sequence(), (unsigned long)deliveryBoots, event.block(), event.count(), timing.rate, timing.preRate, (unsigned long)timing.maxJitter,
+                        eventSeverity(event));
+
+  //Baseline-relative triggering, the level each channel was measured from
+  for(int c = 0; c < CHANNEL_COUNT && globalTriggerMode != TRIGGER_ABSOLUTE && length > 0 && (size_t)length < size; c++)
+    length += snprintf(buffer + length, size - length, "%s%.1f", c > 0 ? "," : ",\"BASELINE\":[", channelValue(c, event.baseline(c)));
+  if(globalTriggerMode != TRIGGER_ABSOLUTE && length > 0 && (size_t)length < size)
+    length += snprintf(buffer + length, size - length, "]");
+
+  //A TRACE run's fake transient, consumers keep it out of the real event record
+  if(event.trace().injected && length > 0 && (size_t)length < size)
+    length += snprintf(buffer + length, size - length, ",\"INJECTED\":%u", event.trace().injected);
+
+  if(length > 0 && (size_t)length < size)
+    length += snprintf(buffer + length, size - length, "}}");
+
+  return (length > 0 && (size_t)length < size) ? length : 0;
+}
+
+
+/**
+ * @brief Builds the sampling metadata line for one event
+ * e.g. narc_event,site=A,equipmentID=B seq=1042i,boot=3i,block=0i,samples=40i,rate=2000.0,preRate=500.0,jitterUs=12i,severity=0.250,voltageBaseline=2051.0,injected=4i 1681234567123456000
+ * 
+ * @param siteTag Site the event belongs to
+ * @param equipmentTag Equipment ID the event belongs to
+ * @param event Event readings in capture order
+ * @param buffer Batch being built
+ * @param used Current length of the batch
+ * @param size Size of buffer
+ * @return size_t New length of the batch
+ */
+size_t generateEventLine(const char* siteTag, const char* equipmentTag, const EventBuffer& event, char* buffer, size_t used, size_t size)
+{
+  if(event.count() < 1)
+    return used;
+
+  EventTiming timing = eventTiming(event);
+
+  char site[INFLUX_LINE_SIZE / 4];
+  char equipmentID[INFLUX_LINE_SIZE / 4];
+  escapeTag(siteTag, site, sizeof(site));
+  escapeTag(equipmentTag, equipmentID, sizeof(equipmentID));
+
+  int length = snprintf(buffer + used, size - used, "%s%s,site=%s,equipmentID=%s seq=%lui,boot=%lui,block=%ui,samples=%di,rate=%.1f,preRate=%.1f,jitterUs=%lui,severity=%.3f",
+                        used > 0 ? "\n" : "", INFLUX_EVENT_MEASUREMENT, site, equipmentID, (unsigned long)event.sequence(),
+                        (unsigned long)deliveryBoots, event.block(), event.count(), timing.rate,
+                        timing.preRate, (unsigned long)timing.maxJitter, eventSeverity(event));
+
+  for(int c = 0; c < CHANNEL_COUNT && globalTriggerMode != TRIGGER_ABSOLUTE && length >= 0 && (size_t)length < size - used; c++)
+    length += snprintf(buffer + used + length, size - used - length, ",%sBaseline=%.1f", CHANNELS[c].field, channelValue(c, event.baseline(c)));
+
+  if(event.trace().injected && length >= 0 && (size_t)length < size - used)
+    length += snprintf(buffer + used + length, size - used - length, ",injected=%ui", event.trace().injected);
+
+  if(length >= 0 && (size_t)length < size - used)
+    length += snprintf(buffer + used + length, size - used - length, " %llu", (unsigned long long)sampleNanos(event.at(0)));
+
+  if(length < 0 || (size_t)length >= size - used)
+  {
+    buffer[used] = '\0';  //Drops the partial line
+    return used;
+  }
+  return used + length;
+}
+
+
+/**
+ * @brief Builds the context message for one event
+ * e.g. {"CONTEXT":{"SEQ":1042,"BUCKET_MS":1000,"FROM_MS":-29412,"Voltage":[[2040.0,2061.0],...,null],"Current":[...]}}
+ * 
+ * @param event Event readings in capture order
+ * @param buffer Destination
+ * @param size Size of buffer
+ * @return size_t Length of the message, 0 if it did not fit or there is no context
+ */
+size_t generateContext(const EventBuffer& event, char* buffer, size_t size)
+{
+  const ContextSnapshot<CHANNEL_COUNT>& context = event.context();
+  if(context.buckets == 0 || event.block() > 0 || event.count() < 1)
+    return 0;
+
+  int32_t fromMicros = (int32_t)(context.newestStart - (context.buckets - 1) * CONTEXT_BUCKET_US - (uint32_t)event.micros(0));
+  int length = snprintf(buffer, size, "{\"CONTEXT\":{\"SEQ\":%lu,\"BUCKET_MS\":%d,\"FROM_MS\":%ld",
+                        (unsigned long)event.sequence(), CONTEXT_BUCKET_MS, (long)(fromMicros / 1000));
+
+  for(int c = 0; c < CHANNEL_COUNT && length < (int)size; c++)
+  {
+    length += snprintf(buffer + length, size - length, ",\"%s\":[", CHANNELS[c].name);
+    for(int b = 0; b < context.buckets && length < (int)size; b++)
+    {
+      if(context.min[b][c] > context.max[b][c])
+        length += snprintf(buffer + length, size - length, "%snull", b > 0 ? "," : "");
+      else
+        length += snprintf(buffer + length, size - length, "%s[%.1f,%.1f]", b > 0 ? "," : "",
+                           channelValue(c, context.min[b][c]), channelValue(c, context.max[b][c]));
+    }
+    if(length < (int)size)
+      length += snprintf(buffer + length, size - length, "]");
+  }
+
+  if(length < (int)size)
+    length += snprintf(buffer + length, size - length, "}}");
+
+  return length < (int)size ? length : 0;
+}
+
+
+/**
+ * @brief Builds the context lines for one event
+ * e.g. narc_context,site=A,equipmentID=B seq=1042i,bucket=0i,voltageMin=2040.0,voltageMax=2061.0,currentMin=1870.0,currentMax=1895.0 1681234537711456000
+ * 
+ * @param siteTag Site the event belongs to
+ * @param equipmentTag Equipment ID the event belongs to
+ * @param event Event readings in capture order
+ * @param buffer Batch being built
+ * @param used Current length of the batch
+ * @param size Size of buffer
+ * @return size_t New length of the batch
+ */
+size_t generateContextLines(const char* siteTag, const char* equipmentTag, const EventBuffer& event, char* buffer, size_t used, size_t size)
+{
+  const ContextSnapshot<CHANNEL_COUNT>& context = event.context();
+  if(context.buckets == 0 || event.block() > 0 || event.count() < 1)
+    return used;
+
+  char site[INFLUX_LINE_SIZE / 4];
+  char equipmentID[INFLUX_LINE_SIZE / 4];
+  escapeTag(siteTag, site, sizeof(site));
+  escapeTag(equipmentTag, equipmentID, sizeof(equipmentID));
+
+  //Bucket starts are micros() values, placed on the event's timeline through its first reading
+  int64_t firstNanos = (int64_t)sampleNanos(event.at(0));
+  uint32_t firstMicros = (uint32_t)event.micros(0);  //Bucket starts keep the low 32 bits
+
+  char line[INFLUX_LINE_SIZE * 2];
+  for(int b = 0; b < context.buckets; b++)
+  {
+    if(context.min[b][0] > context.max[b][0])
+      continue;  //Nothing was read in this bucket
+
+    uint32_t start = context.newestStart - (context.buckets - 1 - b) * CONTEXT_BUCKET_US;
+    int length = snprintf(line, sizeof(line), "%s%s,site=%s,equipmentID=%s seq=%lui,bucket=%di",
+                          used > 0 ? "\n" : "", INFLUX_CONTEXT_MEASUREMENT, site, equipmentID, (unsigned long)event.sequence(), b);
+
+    for(int c = 0; c < CHANNEL_COUNT && length < (int)sizeof(line); c++)
+      length += snprintf(line + length, sizeof(line) - length, ",%sMin=%.1f,%sMax=%.1f", CHANNELS[c].field,
+                         channelValue(c, context.min[b][c]), CHANNELS[c].field, channelValue(c, context.max[b][c]));
+
+    if(length < (int)sizeof(line))
+      length += snprintf(line + length, sizeof(line) - length, " %lld",
+                         (long long)(firstNanos + (int64_t)(int32_t)(start - firstMicros) * 1000));
+
+    if(length >= (int)sizeof(line) || used + length >= size)
+      break;
+
+    memcpy(buffer + used, line, length + 1);
+    used += length;
+  }
+
+  return used;
+}
+
+
+/**
+ * @brief Runs the FFT over channel FFT_CHANNEL of an event
+ * 
+ * @param event Event readings in capture order, as copied out of the ring
+ * @param summary Result
+ */
+static void summarizeEvent(const EventBuffer& event, SpectralSummary* summary)
+{
+  //Readings before the trigger may have been taken at the idle rate, the transform needs evenly spaced ones
+  int trigger = eventTriggerIndex(event);
+  fftSummary(event.channel(FFT_CHANNEL) + trigger, event.count() - trigger, eventTiming(event).rate, summary);
+}
+
+
+/**
+ * @brief Builds the spectral summary message for one event
+ * e.g. {"SPECTRUM":{"SEQ":1042,"N":64,"BINHZ":312.5,"PEAKS":[[3,937.5,1200],...],"BANDS":[...],"US":410}}
+ * 
+ * @param event Event readings in capture order
+ * @param buffer Destination
+ * @param size Size of buffer
+ * @return size_t Length of the message, 0 if it did not fit
+ */
+size_t generateSpectrum(const EventBuffer& event, char* buffer, size_t size)
+{
+  SpectralSummary summary;
+  summarizeEvent(event, &summary);
+
+  int length = snprintf(buffer, size, "{\"SPECTRUM\":{\"SEQ\":%lu,\"N\":%u,\"BINHZ\":%.1f,\"PEAKS\":[",
+                        (unsigned long)event.sequence(), summary.size, summary.binHz);
+
+  for(int k = 0; k < FFT_TOP_K && length < (int)size; k++)
+    length += snprintf(buffer + length, size - length, "%s[%u,%.1f,%lu]", k > 0 ? "," : "",
+                       summary.peakBin[k], summary.peakBin[k] * summary.binHz, (unsigned long)summary.peakPower[k]);
+
+  if(length < (int)size)
+    length += snprintf(buffer + length, size - length, "],\"BANDS\":[");
+
+  for(int b = 0; b < FFT_BANDS && length < (int)size; b++)
+    length += snprintf(buffer + length, size - length, "%s%lu", b > 0 ? "," : "", (unsigned long)summary.bandEnergy[b]);
+
+  if(length < (int)size)
+    length += snprintf(buffer + length, size - length, "],\"US\":%lu}}", (unsigned long)summary.elapsedMicros);
+
+  return length < (int)size ? length : 0;
+}
+
+
+/**
+ * @brief Builds the spectral summary line for one event
+ * e.g. narc_spectrum,site=A,equipmentID=B seq=1042i,n=64i,binHz=312.5,peak0Hz=937.5,peak0Power=1200i,...,band0=88i,...,us=410i 1681234567123456000
+ * 
+ * @param siteTag Site the event belongs to
+ * @param equipmentTag Equipment ID the event belongs to
+ * @param event Event readings in capture order
+ * @param buffer Batch being built
+ * @param used Current length of the batch
+ * @param size Size of buffer
+ * @return size_t New length of the batch
+ */
+size_t generateSpectrumLine(const char* siteTag, const char* equipmentTag, const EventBuffer& event, char* buffer, size_t used, size_t size)
+{
+  SpectralSummary summary;
+  summarizeEvent(event, &summary);
+
+  char site[INFLUX_LINE_SIZE / 4];
+  char equipmentID[INFLUX_LINE_SIZE / 4];
+  escapeTag(siteTag, site, sizeof(site));
+  escapeTag(equipmentTag, equipmentID, sizeof(equipmentID));
+
+  char line[INFLUX_LINE_SIZE * 2];
+  int length = snprintf(line, sizeof(line), "%s%s,site=%s,equipmentID=%s seq=%lui,n=%ui,binHz=%.1f",
+                        used > 0 ? "\n" : "", INFLUX_SPECTRUM_MEASUREMENT, site, equipmentID, (unsigned long)event.sequence(),
+                        summary.size, summary.binHz);
+
+  for(int k = 0; k < FFT_TOP_K && length < (int)sizeof(line); k++)
+    length += snprintf(line + length, sizeof(line) - length, ",peak%dHz=%.1f,peak%dPower=%lui",
+                       k, summary.peakBin[k] * summary.binHz, k, (unsigned long)summary.peakPower[k]);
+
+  for(int b = 0; b < FFT_BANDS && length < (int)sizeof(line); b++)
+    length += snprintf(line + length, sizeof(line) - length, ",band%d=%lui", b, (unsigned long)summary.bandEnergy[b]);
+
+  if(length < (int)sizeof(line))
+    length += snprintf(line + length, sizeof(line) - length, ",us=%lui %llu",
+                       (unsigned long)summary.elapsedMicros, (unsigned long long)sampleNanos(event.at(0)));
+
+  if(length >= (int)sizeof(line) || used + length >= size)
+    return used;
+
+  memcpy(buffer + used, line, length + 1);
+  return used + length;
+}
+
+
+
+////////////////////Publish Functions////////////////////
+
+/**
+ * @brief Appends one message to an encoded event
+ * 
+ * @param encoded Event being built
+ * @param length Length of the message just written at encoded.data + encoded.used
+ */
+static void encodeAppend(EncodedEvent& encoded, size_t length)
+{
+  if(length == 0 || encoded.messages >= ENCODED_MAX_MESSAGES)
+    return;
+
+  encoded.lengths[encoded.messages++] = length;
+  encoded.used += length;
+}
+
+
+/**
+ * @brief Formats a captured event in the configured format
+ * 
+ * @param site Site tag
+ * @param equipmentID Equipment ID tag
+ * @param event Event readings in capture order
+ * @param parts Waveform, summary or both
+ * @param format Encoding, globalPublishFormat on the Data topic
+ * @param encoded Filled with the messages
+ * @return size_t Bytes used
+ */
+size_t encodeEvent(const char* site, const char* equipmentID, const EventBuffer& event, EncodeParts parts, PublishFormat format, EncodedEvent& encoded)
+{
+  encoded.parts = parts;
+  encoded.messages = 0;
+  encoded.used = 0;
+
+  bool waveform = parts != ENCODE_SUMMARY;
+  bool summary = parts != ENCODE_WAVEFORM;
+
+  if(format == FORMAT_INFLUX)
+  {
+    size_t length = 0;
+    if(waveform)
+    {
+      length = generateInfluxBatch(site, equipmentID, event, encoded.data, sizeof(encoded.data));
+      length = generateContextLines(site, equipmentID, event, encoded.data, length, sizeof(encoded.data));
+    }
+    if(summary)
+      length = generateEventLine(site, equipmentID, event, encoded.data, length, sizeof(encoded.data));
+#ifdef FFT_ENABLED
+    if(summary && event.count() > 1)
+      length = generateSpectrumLine(site, equipmentID, event, encoded.data, length, sizeof(encoded.data));
+#endif
+    encodeAppend(encoded, length);
+    return encoded.used;
+  }
+
+  //Each generator writes straight into the free space, anything that does not fit returns 0 and is left out
+  for(int i = 0; waveform && i < event.count(); i++)
+    encodeAppend(encoded, generateEntry(event.at(i), event.sequence(), i, encoded.data + encoded.used, sizeof(encoded.data) - encoded.used));
+
+  if(waveform)
+    encodeAppend(encoded, generateContext(event, encoded.data + encoded.used, sizeof(encoded.data) - encoded.used));
+
+  if(summary)
+    encodeAppend(encoded, generateEventInfo(event, encoded.data + encoded.used, sizeof(encoded.data) - encoded.used));
+
+#ifdef FFT_ENABLED
+  if(summary && event.count() > 1)
+    encodeAppend(encoded, generateSpectrum(event, encoded.data + encoded.used, sizeof(encoded.data) - encoded.used));
+#endif
+
+  return encoded.used;
+}
+
+
+/**
+ * @brief Publishes an encoded event, stopping at the first message that fails
+ * 
+ * @param topic Data topic
+ * @param encoded Messages to send
+ * @param messages If not NULL, incremented by the number of messages sent
+ * @param bytes If not NULL, incremented by the payload bytes sent
+ * @return true Every message went out
+ */
+bool transmitEncoded(const char* topic, const EncodedEvent& encoded, uint32_t* messages, size_t* bytes)
+{
+  size_t offset = 0;
+
+  for(int m = 0; m < encoded.messages; m++)
+  {
+    size_t length = encoded.lengths[m];
+
+    //Streamed publish, messages are not NUL terminated and the INFLUX batch is larger than the PubSubClient buffer
+    bool published = mqttClient.beginPublish(topic, length, false);
+    if(published)
+    {
+      mqttClient.write((const uint8_t*)encoded.data + offset, length);
+      published = mqttClient.endPublish();
+    }
+
+    brokerPublished(published);
+    if(!published)
+    {
+      //A half-written message leaves the session unusable, MQTT_TASK reconnects on its next loop (as pipelineTransmit)
+      mqttStats.publishFailures++;
+      if(mqttClient.connected())
+        mqttClient.disconnect();
+      return false;
+    }
+
+    if(messages)
+      (*messages)++;
+    if(bytes)
+      *bytes += length;
+    offset += length;
+  }
+
+  return true;
+}
+
+
+/**
+ * @brief Publishes a captured event in the configured format
+ * 
+ * @param object Network params
+ * @param event Event readings in capture order
+ * @return true Every message of the event went out
+ */
+bool publishEvent(NetworkObject& object, const EventBuffer& event)
+{
+  return publishEventTo(publishTopicData, object.getSite(), object.getEquipmentID(), event, NULL, NULL);
+}
+
+
+/**
+ * @brief Publishes an event on any device's Data topic in the configured format
+ * 
+ * @param topic Data topic
+ * @param site Site tag
+ * @param equipmentID Equipment ID tag
+ * @param event Event readings in capture order
+ * @param messages If not NULL, incremented by the number of messages sent
+ * @param bytes If not NULL, incremented by the payload bytes sent
+ * @return true Every message of the event went out
+ */
+bool publishEventTo(const char* topic, const char* site, const char* equipmentID, const EventBuffer& event, uint32_t* messages, size_t* bytes)
+{
+  static EncodedEvent encoded;  //Static so a whole event never lands on the task stack
+
+  encodeEvent(site, equipmentID, event, ENCODE_ALL, globalPublishFormat, encoded);
+  return transmitEncoded(topic, encoded, messages, bytes);
+}
+
+
+
+////////////////////NTP Functions////////////////////
+
+/**
+ * @brief Sends an NTP request, dropping any late answer to an earlier one first
+ * 
+ */
+static void ntpRequest()
+{
   byte ntpMessageBuffer[NTP_MESSAGE_SIZE]; //Holds incoming/outgoing NTP messages. NTP time message is 48 bytes long
 
   memset(ntpMessageBuffer, 0, NTP_MESSAGE_SIZE); //Set all bytes in timeMessageBuffer to 0
@@ -589,29 +1431,84 @@ time_t getTimeBenchmark()
   ntpMessageBuffer[14] = 49;
   ntpMessageBuffer[15] = 52;
 
+  while(ethernetUDP.parsePacket() > 0);  //Each call drops the previous datagram
+
   //Send timeMessageBuffer to NTP server via UDP at port 123
   ethernetUDP.beginPacket(globalNTPAddress, UDP_PORT); //getNTP is a method of the NetworkObject class
   ethernetUDP.write(ntpMessageBuffer, NTP_MESSAGE_SIZE);
   ethernetUDP.endPacket();
+}
+
+
+/**
+ * @brief Reads an NTP response if one has arrived
+ * 
+ * @return time_t Device local time it carries, 0 if none is waiting
+ */
+static time_t ntpResponse()
+{
+  byte ntpMessageBuffer[NTP_MESSAGE_SIZE];
+
+  if(ethernetUDP.parsePacket() < NTP_MESSAGE_SIZE)
+    return 0;
+
+  ethernetUDP.read(ntpMessageBuffer, NTP_MESSAGE_SIZE);
+    
+  unsigned long highWord = word(ntpMessageBuffer[40], ntpMessageBuffer[41]);
+  unsigned long lowWord = word(ntpMessageBuffer[42], ntpMessageBuffer[43]);
+    
+  unsigned long secsSince1900 = highWord << 16 | lowWord;
+        
+  return secsSince1900 - 2208988800UL + (TIMEZONE*3600);
+}
+
+
+/**
+ * @brief Moves the clock anchor to an NTP response just received
+ * 
+ * @param timeValue Device local time of the response
+ */
+static void ntpApply(time_t timeValue)
+{
+  uint64_t micros = esp_timer_get_time();
+
+  portENTER_CRITICAL(&timeAnchorLock);
+  timeAnchorEpoch = timeValue;
+  timeAnchorMicros = micros;
+  portEXIT_CRITICAL(&timeAnchorLock);
+
+  //First sync anchors boot-relative timestamps taken before it
+  if(!timeSynced)
+  {
+    timeSyncEpoch = timeValue;
+    timeSyncMicros = micros;
+    timeSynced = true;
+  }
+}
+
+
+/**
+ * @brief Gets benchmark time during system boot/reboot
+ * 
+ * @return time_t 
+ */
+time_t getTimeBenchmark()
+{
+  ntpRequest();
 
   uint32_t beginWait = millis(); //Wait for response
 
-  while (millis() - beginWait < 1500)
+  while (millis() - beginWait < NTP_TIMEOUT_MS)
   {
-    if(ethernetUDP.parsePacket() >= NTP_MESSAGE_SIZE)
+    time_t timeValue = ntpResponse();
+    if(timeValue)
     {
-      ethernetUDP.read(ntpMessageBuffer, NTP_MESSAGE_SIZE);
-        
-      unsigned long highWord = word(ntpMessageBuffer[40], ntpMessageBuffer[41]);
-      unsigned long lowWord = word(ntpMessageBuffer[42], ntpMessageBuffer[43]);
-        
-      unsigned long secsSince1900 = highWord << 16 | lowWord;
-            
-      timeValue = secsSince1900 - 2208988800UL + (TIMEZONE*3600);
+      ntpApply(timeValue);
+      return timeValue;
     }
   }
     
-  return timeValue; 
+  return 0; 
 }
 
 
@@ -622,5 +1519,39 @@ time_t getTimeBenchmark()
 void ntpInit()
 {
   ethernetUDP.begin(UDP_PORT);
-  setSyncProvider(getTimeBenchmark);
+  getTimeBenchmark();
+}
+
+
+/**
+ * @brief Periodic re-sync, run by MQTT_TASK on every loop
+ * 
+ */
+void ntpStep()
+{
+  static uint32_t requestedAt = 0;
+  static bool waiting = false;
+  static bool failed = false;  //Last request timed out, retry sooner
+  uint32_t now = millis();
+
+  if(waiting)
+  {
+    time_t timeValue = ntpResponse();
+    if(timeValue)
+      ntpApply(timeValue);
+    else if(now - requestedAt < NTP_TIMEOUT_MS)
+      return;
+
+    waiting = false;
+    failed = timeValue == 0;
+    return;
+  }
+
+  bool retry = failed || !timeSynced;
+  if(now - requestedAt < (retry ? NTP_RETRY_S : NTP_SYNC_INTERVAL_S) * 1000UL)
+    return;
+
+  ntpRequest();
+  requestedAt = now;
+  waiting = true;
 }
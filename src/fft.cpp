@@ -0,0 +1,194 @@
+#include "fft.h"
+
+
+
+////////////////////Twiddle Table////////////////////
+
+static int16_t cosTable[FFT_MAX_SIZE / 2];
+static int16_t sinTable[FFT_MAX_SIZE / 2];
+static bool tableReady = false;
+
+
+
+////////////////////FFT Functions////////////////////
+
+/**
+ * @brief Fills the Q15 twiddle table. Float math is only used here, once, at boot
+ *
+ */
+void fftInit()
+{
+  if(tableReady)
+    return;
+
+  for(int k = 0; k < FFT_MAX_SIZE / 2; k++)
+  {
+    float angle = 2.0f * PI * k / FFT_MAX_SIZE;
+    cosTable[k] = (int16_t)lroundf(cosf(angle) * 32767.0f);
+    sinTable[k] = (int16_t)lroundf(sinf(angle) * 32767.0f);
+  }
+
+  tableReady = true;
+}
+
+
+/**
+ * @brief Smallest power of 2 >= count, capped at FFT_MAX_SIZE
+ *
+ * @param count Number of captured samples
+ * @return uint16_t
+ */
+uint16_t fftSizeFor(int count)
+{
+  uint16_t n = 2;
+  while(n < count && n < FFT_MAX_SIZE)
+    n <<= 1;
+  return n;
+}
+
+
+/**
+ * @brief Radix-2 DIT butterfly network on Q15 data, scaled by 1/2 per stage
+ *
+ * @param re Real parts, replaced by the real parts of the transform
+ * @param im Imaginary parts, replaced by the imaginary parts of the transform
+ * @param n Transform length
+ */
+void fftTransform(int16_t* re, int16_t* im, uint16_t n)
+{
+  //Bit reversal permutation
+  for(uint16_t i = 1, j = 0; i < n; i++)
+  {
+    uint16_t bit = n >> 1;
+    for(; j & bit; bit >>= 1)
+      j ^= bit;
+    j ^= bit;
+
+    if(i < j)
+    {
+      int16_t t = re[i]; re[i] = re[j]; re[j] = t;
+      t = im[i]; im[i] = im[j]; im[j] = t;
+    }
+  }
+
+  for(uint16_t len = 2; len <= n; len <<= 1)
+  {
+    uint16_t half = len >> 1;
+    uint16_t stride = FFT_MAX_SIZE / len;
+
+    for(uint16_t i = 0; i < n; i += len)
+    {
+      for(uint16_t j = 0; j < half; j++)
+      {
+        int32_t wr = cosTable[j * stride];
+        int32_t wi = -sinTable[j * stride];
+        uint16_t a = i + j;
+        uint16_t b = a + half;
+
+        int32_t tr = (wr * re[b] - wi * im[b]) >> 15;
+        int32_t ti = (wr * im[b] + wi * re[b]) >> 15;
+
+        re[b] = (int16_t)((re[a] - tr) >> 1);
+        im[b] = (int16_t)((im[a] - ti) >> 1);
+        re[a] = (int16_t)((re[a] + tr) >> 1);
+        im[a] = (int16_t)((im[a] + ti) >> 1);
+      }
+    }
+  }
+}
+
+
+/**
+ * @brief Squared magnitude of one bin
+ *
+ * @param re Real parts of the transform
+ * @param im Imaginary parts of the transform
+ * @param bin Bin index
+ * @return uint32_t
+ */
+static inline uint32_t binPower(const int16_t* re, const int16_t* im, uint16_t bin)
+{
+  return (uint32_t)(re[bin] * re[bin]) + (uint32_t)(im[bin] * im[bin]);
+}
+
+
+/**
+ * @brief Builds the spectral summary published alongside an event
+ *
+ * @param samples Raw ADC counts in capture order
+ * @param count Number of samples
+ * @param sampleRate Measured sample rate of the capture in Hz
+ * @param summary Filled with peaks, band energies and compute time
+ */
+void fftSummary(const uint16_t* samples, int count, float sampleRate, SpectralSummary* summary)
+{
+  uint32_t startMicros = micros();
+
+  //Scratch on the caller's stack (1 KB), ENCODE_TASK, the sink tasks, and MQTT_TASK all run this concurrently
+  int16_t re[FFT_MAX_SIZE];
+  int16_t im[FFT_MAX_SIZE];
+
+  uint16_t n = fftSizeFor(count);
+  if(count > n)
+    count = n;
+
+  int32_t sum = 0;
+  for(int i = 0; i < count; i++)
+    sum += samples[i];
+  int32_t mean = count > 0 ? sum / count : 0;
+
+  //12 bit counts with the mean removed fit in +/-4095, shifting by 3 uses the full Q15 range
+  for(int i = 0; i < n; i++)
+  {
+    re[i] = i < count ? (int16_t)((samples[i] - mean) << 3) : 0;
+    im[i] = 0;
+  }
+
+  fftTransform(re, im, n);
+
+  memset(summary, 0, sizeof(SpectralSummary));
+  summary->size = n;
+  summary->binHz = sampleRate / n;
+
+  uint16_t binsPerBand = (n / 2) / FFT_BANDS;
+  if(binsPerBand == 0)
+    binsPerBand = 1;
+
+  uint32_t previous = 0;  //Power of bin - 1, DC counts as 0 since the mean was removed
+  uint32_t power = binPower(re, im, 1);
+  for(uint16_t bin = 1; bin < n / 2; bin++)
+  {
+    uint32_t next = bin + 1 < n / 2 ? binPower(re, im, bin + 1) : 0;
+
+    uint16_t band = bin / binsPerBand;
+    if(band >= FFT_BANDS)
+      band = FFT_BANDS - 1;
+    summary->bandEnergy[band] += power;
+
+    //Only local maxima are peaks, otherwise the leakage lobe of one strong tone would fill every slot
+    bool peak = power > previous && power >= next;
+    previous = power;
+    uint32_t current = power;
+    power = next;
+    if(!peak)
+      continue;
+
+    //Insertion into the top-k list, strongest first
+    for(int k = 0; k < FFT_TOP_K; k++)
+    {
+      if(current > summary->peakPower[k])
+      {
+        for(int m = FFT_TOP_K - 1; m > k; m--)
+        {
+          summary->peakPower[m] = summary->peakPower[m - 1];
+          summary->peakBin[m] = summary->peakBin[m - 1];
+        }
+        summary->peakPower[k] = current;
+        summary->peakBin[k] = bin;
+        break;
+      }
+    }
+  }
+
+  summary->elapsedMicros = micros() - startMicros;
+}
@@ -0,0 +1,234 @@
+#include "history.h"
+
+
+
+////////////////////History Storage////////////////////
+
+static HistoryIndex historyIndex[HISTORY_EVENTS];  //Sorted by sequence number, which is capture order
+static EventBuffer* historyEvents = NULL;  //Indexed by HistoryIndex::slot, in PSRAM when the board has it
+static uint16_t historyCapacity = 0;
+static uint16_t historyStored = 0;
+
+//Running replay, by sequence number so overwritten events are detected
+static bool replayActive = false;
+static uint32_t replayNext = 0;
+static uint32_t replayLast = 0;
+static uint32_t replayFirst = 0;
+static uint32_t replaySent = 0;
+static uint32_t replaySkipped = 0;
+static uint32_t replayMillis = 0;
+
+
+
+////////////////////History Functions////////////////////
+
+/**
+ * @brief Allocates the event slots, PSRAM first
+ * 
+ */
+void historyInit()
+{
+  if(psramFound())
+  {
+    historyEvents = (EventBuffer*)ps_malloc(HISTORY_EVENTS * sizeof(EventBuffer));
+    historyCapacity = historyEvents ? HISTORY_EVENTS : 0;
+  }
+
+  if(!historyEvents)
+  {
+    historyEvents = (EventBuffer*)malloc(HISTORY_SRAM_EVENTS * sizeof(EventBuffer));
+    historyCapacity = historyEvents ? HISTORY_SRAM_EVENTS : 0;
+  }
+
+  //EventBuffer only holds plain arrays, constructing in place just sets it empty
+  for(int i = 0; i < historyCapacity; i++)
+    new (&historyEvents[i]) EventBuffer();
+}
+
+
+/**
+ * @brief First position whose sequence number is at least sequence (historyStored if none)
+ * 
+ * @param sequence Event sequence number
+ * @return uint32_t 
+ */
+static uint32_t historySequenceBound(uint32_t sequence)
+{
+  uint32_t low = 0;
+  uint32_t high = historyStored;
+
+  while(low < high)
+  {
+    uint32_t middle = (low + high) / 2;
+    if(historyIndex[middle].sequence < sequence)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+
+  return low;
+}
+
+
+/**
+ * @brief Stores an event in capture order, overwriting the oldest one when full. A resend of an event already kept,
+ * or a transient injected by a TRACE run, is ignored
+ * 
+ * @param event Event readings in capture order
+ * @return uint32_t Sequence number of the event
+ */
+uint32_t historyAppend(const EventBuffer& event)
+{
+  uint32_t sequence = event.sequence();
+  if(event.trace().injected)
+    return sequence;  //A TRACE run's fake transient is never replayed
+
+  uint32_t position = historySequenceBound(sequence);
+  if(position < historyStored && historyIndex[position].sequence == sequence)
+    return sequence;
+
+  uint16_t slot;
+  if(historyStored < historyCapacity)
+    slot = historyStored++;
+  else
+  {
+    //Older than everything kept, it would be the one overwritten (or nothing can be kept at all)
+    if(position == 0)
+      return sequence;
+
+    //The oldest event makes room, a replay still due to send it counts it as skipped
+    HistoryIndex evicted = historyIndex[0];
+    if(replayActive && evicted.sequence >= replayNext && evicted.sequence <= replayLast)
+      replaySkipped++;
+    slot = evicted.slot;
+    memmove(historyIndex, historyIndex + 1, (historyCapacity - 1) * sizeof(HistoryIndex));
+    position--;
+  }
+
+  //Usually the newest, so the shift is empty. Waveforms sent out of capture order (SCHEDULE_SEVERITY, SCHEDULE_NEWEST)
+  //land in their place, which keeps the seconds ordered for historyQueryTime
+  memmove(historyIndex + position + 1, historyIndex + position, (historyStored - 1 - position) * sizeof(HistoryIndex));
+  event.copyTo(historyEvents[slot]);
+  historyIndex[position].sequence = sequence;
+  historyIndex[position].seconds = event.count() > 0 ? event.seconds(0) : 0;
+  historyIndex[position].slot = slot;
+
+  return sequence;
+}
+
+
+/**
+ * @brief First position whose event starts at or after seconds (historyStored if none)
+ * 
+ * @param seconds Device local time
+ * @return uint32_t 
+ */
+static uint32_t historyLowerBound(int64_t seconds)
+{
+  uint32_t low = 0;
+  uint32_t high = historyStored;
+
+  while(low < high)
+  {
+    uint32_t middle = (low + high) / 2;
+    if((int64_t)historyIndex[middle].seconds < seconds)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+
+  return low;
+}
+
+
+/**
+ * @brief Sets up a replay of positions [first, end)
+ * 
+ * @return uint32_t Number of events to replay
+ */
+static uint32_t historyStart(uint32_t first, uint32_t end)
+{
+  replaySent = 0;
+  replaySkipped = 0;
+  replayMillis = millis() - HISTORY_INTERVAL_MS;
+  replayActive = first < end;
+
+  if(!replayActive)
+    return 0;
+
+  replayFirst = replayNext = historyIndex[first].sequence;
+  replayLast = historyIndex[end - 1].sequence;
+  return end - first;
+}
+
+
+/**
+ * @brief Starts a replay of a UTC time range
+ * 
+ * @param fromUTC Unix seconds, inclusive
+ * @param toUTC Unix seconds, inclusive
+ * @return uint32_t Number of events to replay
+ */
+uint32_t historyQueryTime(uint32_t fromUTC, uint32_t toUTC)
+{
+  //The index holds device local time, as stamped
+  int64_t from = (int64_t)fromUTC + (TIMEZONE*3600);
+  int64_t to = (int64_t)toUTC + (TIMEZONE*3600);
+
+  if(to < from)
+    return historyStart(0, 0);
+
+  return historyStart(historyLowerBound(from), historyLowerBound(to + 1));
+}
+
+
+/**
+ * @brief Starts a replay of everything after a sequence number
+ * 
+ * @param after Last sequence number the client has, HISTORY_MAX_SEQUENCE for none
+ * @return uint32_t Number of events to replay
+ */
+uint32_t historyQuerySequence(uint32_t after)
+{
+  if(after == HISTORY_MAX_SEQUENCE)
+    return historyStart(0, historyStored);
+
+  return historyStart(historySequenceBound(after + 1), historyStored);
+}
+
+
+/**
+ * @brief Publishes the next replayed event once the interval has passed
+ * 
+ * @param object Network params
+ */
+void historyStep(NetworkObject& object)
+{
+  if(!replayActive || millis() - replayMillis < HISTORY_INTERVAL_MS)
+    return;
+
+  //Positions move as events are added, the replay goes by sequence number. Sequence numbers are not consecutive
+  //(events dropped from the store, reboots), overwritten ones were counted as skipped when they went
+  uint32_t position = historySequenceBound(replayNext);
+  bool done = true;
+  if(position < historyStored && historyIndex[position].sequence <= replayLast)
+  {
+    //A failed publish dropped the session, the same event goes again once MQTT_TASK has reconnected
+    replayMillis = millis();
+    if(!publishEvent(object, historyEvents[historyIndex[position].slot]))
+      return;
+
+    replaySent++;
+    done = historyIndex[position].sequence == replayLast;
+    replayNext = historyIndex[position].sequence + 1;
+  }
+
+  if(done)
+  {
+    char report[PUBLISH_BUFFER_SIZE];
+    snprintf(report, sizeof(report), "{\"HISTORY\":{\"FIRST\":%lu,\"LAST\":%lu,\"EVENTS\":%lu,\"SKIPPED\":%lu}}",
+             (unsigned long)replayFirst, (unsigned long)replayLast, (unsigned long)replaySent, (unsigned long)replaySkipped);
+    mqttClient.publish(publishTopicInfo, report);
+    replayActive = false;
+  }
+}
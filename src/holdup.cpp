@@ -0,0 +1,293 @@
+#include "holdup.h"
+#include "store.h"
+#include "power.h"
+#include "pipeline.h"
+#include "stream.h"
+
+
+
+////////////////////Holdup Externs////////////////////
+
+volatile bool captureFrozen = false;
+volatile bool captureParked = false;
+
+
+
+////////////////////Holdup State////////////////////
+
+static const esp_partition_t* holdupPartition = NULL;
+static TaskHandle_t FLUSH_TASK_HANDLE = NULL;
+static volatile bool holdupArmed = false;  //Region is erased and a flush may be written
+static volatile bool holdupSimulated = false;
+static volatile uint32_t powerFailMicros = 0;
+static bool holdupRecovered = false;  //A record from the previous boot is waiting to be published
+static int holdupCapacity = 0;  //Events a record holds, HOLDUP_MAX_EVENTS or what the partition has room for
+static size_t holdupEraseSize = 0;  //Whole 4 KB flash sectors a full record uses, kept pre-erased
+static int holdupPublished = 0;  //Recovered events already sent, a publish that fails resumes from here after the reconnect
+
+
+
+////////////////////Holdup Functions////////////////////
+
+/**
+ * @brief Supply-sense interrupt. Freezes capture and wakes the flush task, everything else happens there
+ * 
+ */
+static void IRAM_ATTR powerFailISR()
+{
+  if(!holdupArmed || captureFrozen)
+    return;
+
+  powerFailMicros = micros();
+  captureFrozen = true;
+
+  BaseType_t woken = pdFALSE;
+  vTaskNotifyGiveFromISR(FLUSH_TASK_HANDLE, &woken);
+  if(woken)
+    portYIELD_FROM_ISR();
+}
+
+
+/**
+ * @brief Whether one more event fits in the record and in the holdup time
+ * 
+ * @param header Record being built
+ * @param slowest Longest event write so far, the next one is assumed to take as long
+ * @return true if it does
+ */
+static bool holdupRoom(const HoldupHeader& header, uint32_t slowest)
+{
+  return header.eventCount < holdupCapacity && micros() - powerFailMicros + slowest <= HOLDUP_BUDGET_US;
+}
+
+
+/**
+ * @brief Writes one event after the ones already in the record
+ * 
+ * @param event Event in internal RAM, the flash write cannot read PSRAM
+ * @param header Record being built, eventCount is advanced
+ * @param slowest Longest write so far, updated
+ */
+static void holdupWrite(const EventBuffer& event, HoldupHeader& header, uint32_t& slowest)
+{
+  uint32_t start = micros();
+  esp_partition_write(holdupPartition, HOLDUP_DATA_OFFSET + header.eventCount * sizeof(EventBuffer), &event, sizeof(EventBuffer));
+  uint32_t elapsed = micros() - start;
+  if(elapsed > slowest)
+    slowest = elapsed;
+
+  header.eventCount++;
+}
+
+
+/**
+ * @brief Writes pending events to the pre-erased region, header last so a partial write is never recovered
+ * 
+ */
+static void holdupFlush()
+{
+  static EventBuffer event;
+  static const EventBuffer* encoding[ENCODE_SLOTS];
+  HoldupHeader header;
+  memset(&header, 0, sizeof(header));
+  uint32_t slowest = 0;
+  int omitted = 0;
+
+  //VTC_TASK runs on the other core, it finishes the reading it is on and notifies once parked
+  if(!captureParked)
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(HOLDUP_PARK_TIMEOUT_MS) + 1);
+  if(!captureParked)
+    header.flags |= HOLDUP_RING_TORN;
+
+  //Live ring first, it usually holds the transient that came with the supply loss
+  if(dataSet.count() > 0)
+  {
+    dataSet.copyTo(event);
+    holdupWrite(event, header, slowest);
+  }
+
+  //Bounded wait, a holder preempted by this task gets its priority and releases the store quickly
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_nsec += HOLDUP_LOCK_TIMEOUT_MS * 1000000L;
+  deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+  deadline.tv_nsec %= 1000000000L;
+
+  if(pthread_mutex_timedlock(&mutexHandle, &deadline) != 0)
+  {
+    header.flags |= HOLDUP_STORE_SKIPPED;
+    omitted += storeCount();
+  }
+  else
+  {
+    //Waveforms already out of the store on their way to the broker, then everything queued in globalSchedulePolicy
+    //order. Each is copied to internal RAM first, store slots may be in PSRAM
+    int pending = pipelineUndelivered(encoding, ENCODE_SLOTS);
+    int written = 0;
+    for(; written < pending && holdupRoom(header, slowest); written++)
+    {
+      encoding[written]->copyTo(event);
+      holdupWrite(event, header, slowest);
+    }
+    omitted += pending - written;
+
+    //Once out of time or room the rest are only counted
+    written = 0;
+    for(const EventBuffer* queued = storeNext(NULL); queued && holdupRoom(header, slowest); queued = storeNext(queued), written++)
+    {
+      queued->copyTo(event);
+      holdupWrite(event, header, slowest);
+    }
+    omitted += storeCount() - written;
+    pthread_mutex_unlock(&mutexHandle);
+  }
+
+  header.channels = CHANNEL_COUNT;
+  header.magic = HOLDUP_MAGIC;
+  header.simulated = holdupSimulated;
+  header.omitted = omitted < 0xFFFF ? omitted : 0xFFFF;
+  header.flushMicros = micros() - powerFailMicros;
+  esp_partition_write(holdupPartition, 0, &header, sizeof(header));
+  holdupArmed = false;
+
+  streamLog("Power-fail flush: %u events (%u left out) in %lu us (budget %lu us), flags 0x%02x\n", header.eventCount,
+            header.omitted, (unsigned long)header.flushMicros, (unsigned long)HOLDUP_BUDGET_US, header.flags);
+}
+
+
+/**
+ * @brief VTC_TASK has stopped touching dataSet
+ * 
+ */
+void holdupParked()
+{
+  captureParked = true;
+  if(FLUSH_TASK_HANDLE)
+    xTaskNotifyGive(FLUSH_TASK_HANDLE);
+}
+
+
+/**
+ * @brief High priority task that waits for the power-fail signal
+ * 
+ */
+static void FLUSH_TASK(void* pvParameters)
+{
+  while(true)
+  {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    holdupFlush();
+
+    //Either the capacitor drains while we wait here, or power came back / this was a test and we restart clean.
+    //The record is safe, so the rest of the holdup runs at low power to stretch it
+    if(!holdupSimulated)
+      powerHoldup();
+    while(!holdupSimulated && digitalRead(POWER_SENSE_PIN) == POWER_SENSE_ACTIVE)
+      powerHoldupWait();
+    reset();
+  }
+}
+
+
+/**
+ * @brief Arms the power-fail path
+ * 
+ */
+void holdupInit()
+{
+#if POWER_SENSE_PIN >= 0
+  holdupPartition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, HOLDUP_PARTITION);
+  if(holdupPartition == NULL || holdupPartition->size < HOLDUP_DATA_OFFSET + sizeof(EventBuffer))
+  {
+    streamLog("Power-fail flush disabled: no " HOLDUP_PARTITION " partition\n");
+    return;
+  }
+
+  holdupCapacity = min((size_t)HOLDUP_MAX_EVENTS, (holdupPartition->size - HOLDUP_DATA_OFFSET) / sizeof(EventBuffer));
+  holdupEraseSize = (HOLDUP_DATA_OFFSET + holdupCapacity * sizeof(EventBuffer) + 4095) & ~(size_t)4095;
+
+  HoldupHeader header;
+  esp_partition_read(holdupPartition, 0, &header, sizeof(header));
+  holdupRecovered = header.magic == HOLDUP_MAGIC && header.channels == CHANNEL_COUNT;
+
+  if(!holdupRecovered)
+  {
+    esp_partition_erase_range(holdupPartition, 0, holdupEraseSize);
+    holdupArmed = true;
+  }
+
+  xTaskCreatePinnedToCore( FLUSH_TASK,           //Task function
+                           "FLUSH",              //Name of task
+                           4000,                 //Stack size of task
+                           NULL,                 //Parameter of the task
+                           configMAX_PRIORITIES - 1,  //Priority of the task, preempts MQTT_TASK and the sinks
+                           &FLUSH_TASK_HANDLE,   //Task handle for keeping track of task
+                           0                     //Core that task is pinned to, VTC_TASK keeps core 1 to reach its park point
+                         );
+
+  pinMode(POWER_SENSE_PIN, INPUT);
+  attachInterrupt(digitalPinToInterrupt(POWER_SENSE_PIN), powerFailISR, POWER_SENSE_ACTIVE == LOW ? FALLING : RISING);
+#endif
+}
+
+
+/**
+ * @brief Simulated power-fail signal
+ * 
+ * @return true The flush task was woken
+ * @return false The power-fail path is not armed
+ */
+bool holdupSimulate()
+{
+  if(!holdupArmed || captureFrozen)
+    return false;
+
+  holdupSimulated = true;
+  powerFailMicros = micros();
+  captureFrozen = true;
+  xTaskNotifyGive(FLUSH_TASK_HANDLE);
+  return true;
+}
+
+
+/**
+ * @brief Publishes the record left by the previous boot, then re-arms
+ * 
+ * @param object Network params
+ * @return true No record is left to publish
+ */
+bool holdupPublishRecovered(NetworkObject& object)
+{
+  if(!holdupRecovered)
+    return true;
+
+  static EventBuffer event;
+  HoldupHeader header;
+  esp_partition_read(holdupPartition, 0, &header, sizeof(header));
+
+  for(; holdupPublished < header.eventCount && holdupPublished < holdupCapacity; holdupPublished++)
+  {
+    esp_partition_read(holdupPartition, HOLDUP_DATA_OFFSET + holdupPublished * sizeof(EventBuffer), &event, sizeof(EventBuffer));
+
+    //The failed publish dropped the session. The record stays on flash and the rest goes out after the reconnect
+    if(!publishEvent(object, event))
+      return false;
+    mqttClient.loop();
+  }
+
+  char report[PUBLISH_BUFFER_SIZE];
+  snprintf(report, sizeof(report), "{\"POWERFAIL\":{\"EVENTS\":%u,\"OMITTED\":%u,\"FLUSH_US\":%lu,\"BUDGET_US\":%lu,\"WITHIN_BUDGET\":%s,\"SIMULATED\":%s,"
+           "\"STORE_SKIPPED\":%s,\"RING_TORN\":%s}}",
+           header.eventCount, header.omitted, (unsigned long)header.flushMicros, (unsigned long)HOLDUP_BUDGET_US,
+           header.flushMicros <= HOLDUP_BUDGET_US ? "true" : "false", header.simulated ? "true" : "false",
+           (header.flags & HOLDUP_STORE_SKIPPED) ? "true" : "false", (header.flags & HOLDUP_RING_TORN) ? "true" : "false");
+  if(!mqttClient.publish(publishTopicInfo, report))
+    return false;
+
+  //Only now is every event of the record with the broker
+  esp_partition_erase_range(holdupPartition, 0, holdupEraseSize);
+  holdupPublished = 0;
+  holdupRecovered = false;
+  holdupArmed = true;
+  return true;
+}
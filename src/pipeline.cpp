@@ -0,0 +1,262 @@
+#include "pipeline.h"
+#include "store.h"
+#include "history.h"
+#include "sinks.h"
+#include "broker.h"
+#include "trace.h"
+
+
+
+////////////////////Pipeline Externs////////////////////
+
+PipelineStats pipelineStats;
+volatile bool pipelineStatsResetRequested = false;
+
+
+
+////////////////////Pipeline State////////////////////
+
+static PipelineSlot slots[ENCODE_SLOTS];
+static QueueHandle_t freeSlots = NULL;  //Slot indices ENCODE_TASK may fill
+static QueueHandle_t readySlots = NULL;  //Slot indices waiting for MQTT_TASK, in encoding order
+static TaskHandle_t ENCODE_TASK_HANDLE = NULL;
+static volatile bool undelivered[ENCODE_SLOTS];  //Slot holds a waveform taken from the store and not fully published
+static PipelineSlot* sending = NULL;  //Slot MQTT_TASK is part way through
+static uint16_t sendMessage = 0;  //Next message of sending
+static size_t sendOffset = 0;  //Its offset in sending->encoded.data
+static char siteTag[ID_SIZE];
+static char equipmentTag[ID_SIZE];
+
+
+
+////////////////////Pipeline Functions////////////////////
+
+/**
+ * @brief Encode stage, one event from the store per free slot
+ * 
+ */
+static void ENCODE_TASK(void* pvParameters)
+{
+  while(true)
+  {
+    if(pipelineStatsResetRequested)
+    {
+      perfReset(pipelineStats.encodeTime);
+      perfReset(pipelineStats.slotWait);
+      pipelineStats.encoded = 0;
+      pipelineStats.maxReady = 0;
+      pipelineStatsResetRequested = false;
+    }
+
+    //Blocks while MQTT_TASK is behind, events then wait in the store where the oldest are dropped first
+    uint8_t index;
+    uint32_t waitStart = micros();
+    xQueueReceive(freeSlots, &index, portMAX_DELAY);
+    perfRecord(pipelineStats.slotWait, micros() - waitStart);
+    PipelineSlot& slot = slots[index];
+
+    //Summaries of every queued event go out ahead of any waveform, then waveforms follow in globalSchedulePolicy order.
+    //A notification given between a failed take and the wait is kept, so no hand-over is missed
+    EncodeParts parts = ENCODE_ALL;
+    bool taken = false;
+    while(!taken)
+    {
+      if(pthread_mutex_lock(&mutexHandle) == 0)
+      {
+        bool summarized = false;
+        if(storeTakeSummary(slot.event))
+        {
+          parts = ENCODE_SUMMARY;
+          taken = true;
+        }
+        else if(storePop(slot.event, &summarized))
+        {
+          parts = summarized ? ENCODE_WAVEFORM : ENCODE_ALL;
+          taken = true;
+          undelivered[index] = true;  //Under the mutex, so the power-fail flush never misses it between store and slot
+        }
+        pthread_mutex_unlock(&mutexHandle);
+      }
+      if(!taken)
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+
+    uint32_t encodeStart = micros();
+
+    //Events captured before the first NTP sync carry boot-relative timestamps
+    for(int i = 0; i < slot.event.count(); i++)
+    {
+      Sample sample = slot.event.at(i);
+      backdateSample(sample);
+      slot.event.set(i, sample);
+    }
+
+    encodeEvent(siteTag, equipmentTag, slot.event, parts, globalPublishFormat, slot.encoded);
+    perfRecord(pipelineStats.encodeTime, micros() - encodeStart);
+    slot.event.trace().encoded = micros();
+    pipelineStats.encoded++;
+
+    xQueueSend(readySlots, &index, portMAX_DELAY);  //Never blocks, there are only ENCODE_SLOTS indices
+
+    uint32_t ready = uxQueueMessagesWaiting(readySlots);
+    if(ready > pipelineStats.maxReady)
+      pipelineStats.maxReady = ready;
+  }
+}
+
+
+/**
+ * @brief Starts ENCODE_TASK
+ * 
+ * @param site Site tag
+ * @param equipmentID Equipment ID tag
+ */
+void pipelineStart(const char* site, const char* equipmentID)
+{
+  strlcpy(siteTag, site, sizeof(siteTag));
+  strlcpy(equipmentTag, equipmentID, sizeof(equipmentTag));
+
+  perfReset(pipelineStats.encodeTime);
+  perfReset(pipelineStats.slotWait);
+
+  freeSlots = xQueueCreate(ENCODE_SLOTS, sizeof(uint8_t));
+  readySlots = xQueueCreate(ENCODE_SLOTS, sizeof(uint8_t));
+  for(uint8_t i = 0; i < ENCODE_SLOTS; i++)
+    xQueueSend(freeSlots, &i, 0);
+
+  xTaskCreatePinnedToCore( ENCODE_TASK,          //Task function
+                           "ENCODE",             //Name of task
+                           8000,                 //Stack size of task
+                           NULL,                 //Parameter of the task
+                           0,                    //Priority of the task, below VTC_TASK so it only runs between readings
+                           &ENCODE_TASK_HANDLE,  //Task handle for keeping track of task
+                           1                     //Core that task is pinned to, away from the TCP stack
+                         );
+}
+
+
+/**
+ * @brief Wakes ENCODE_TASK
+ * 
+ */
+void pipelineNotify()
+{
+  if(ENCODE_TASK_HANDLE)
+    xTaskNotifyGive(ENCODE_TASK_HANDLE);
+}
+
+
+/**
+ * @brief Transmit stage, sends encoded events up to a byte budget
+ * 
+ * @param topic Data topic
+ * @param budget Payload bytes allowed this cycle
+ * @return size_t Payload bytes sent
+ */
+size_t pipelineTransmit(const char* topic, size_t budget)
+{
+  size_t sent = 0;
+
+  while(sent < budget)
+  {
+    if(!sending)
+    {
+      uint8_t index;
+      if(!readySlots || xQueueReceive(readySlots, &index, 0) != pdTRUE)
+        break;
+
+      sending = &slots[index];
+      sendMessage = 0;
+      sendOffset = 0;
+
+      //Waveforms carry the readings, summaries would only store them twice
+      if(sending->encoded.parts != ENCODE_SUMMARY)
+      {
+        if((uint32_t)sending->event.count() > mqttStats.maxQueueDepth)
+          mqttStats.maxQueueDepth = sending->event.count();
+        historyAppend(sending->event);
+      }
+    }
+
+    //Whole messages only, so one message may overrun the budget
+    const EncodedEvent& encoded = sending->encoded;
+    uint32_t publishStart = micros();
+    bool failed = false;
+    while(sendMessage < encoded.messages && sent < budget)
+    {
+      size_t length = encoded.lengths[sendMessage];
+      bool published = mqttClient.beginPublish(topic, length, false);
+      if(published)
+      {
+        mqttClient.write((const uint8_t*)encoded.data + sendOffset, length);
+        published = mqttClient.endPublish();
+      }
+
+      brokerPublished(published);
+      if(!published)
+      {
+        failed = true;
+        break;
+      }
+      sinkStats[SINK_MQTT].bytes += length;
+      sent += length;
+      sendOffset += length;
+      sendMessage++;
+    }
+    perfRecord(mqttStats.publishLatency, micros() - publishStart);
+
+    //The slot and message stay where they are and the same message is retried once MQTT_TASK has reconnected. A
+    //half-written message leaves the session unusable, so it is dropped here rather than waiting for a timeout
+    if(failed)
+    {
+      mqttStats.publishFailures++;
+      if(mqttClient.connected())
+        mqttClient.disconnect();
+      break;
+    }
+
+    if(sendMessage >= encoded.messages)
+    {
+      if(encoded.parts != ENCODE_SUMMARY)
+        sinkStats[SINK_MQTT].events++;
+      traceRecord(sending->event.trace(), sendOffset);  //Trigger to broker, for the first part of a traced event
+      uint8_t index = sending - slots;
+      undelivered[index] = false;
+      xQueueSend(freeSlots, &index, 0);
+      sending = NULL;
+    }
+  }
+
+  return sent;
+}
+
+
+/**
+ * @brief Waveforms out of the store and not yet published
+ * 
+ * @param events Filled with pointers to them
+ * @param max Size of events
+ * @return int Number filled in
+ */
+int pipelineUndelivered(const EventBuffer** events, int max)
+{
+  if(globalDeliveryMode == DELIVERY_ACK)
+    return 0;
+
+  int count = 0;
+  for(int i = 0; i < ENCODE_SLOTS && count < max; i++)
+    if(undelivered[i])
+      events[count++] = &slots[i].event;
+  return count;
+}
+
+
+/**
+ * @brief Encoded events waiting
+ * 
+ * @return int 
+ */
+int pipelineReadyCount()
+{
+  return readySlots ? uxQueueMessagesWaiting(readySlots) : 0;
+}
@@ -0,0 +1,213 @@
+#include "power.h"
+#include "sampler.h"
+#include "stream.h"
+
+
+
+////////////////////Power Externs////////////////////
+
+PowerStats powerStats = {0, 0, 0};
+
+
+
+////////////////////Power State////////////////////
+
+static volatile PowerState state = POWER_STATE_FULL;
+static bool enabled = false;  //Fixed at boot, like the rest of the capture config
+static bool pmReady = false;  //esp_pm owns the clock, setCpuFrequencyMhz would fight it
+static volatile uint32_t lastActivity = 0;  //millis() of the last reading near a threshold or command
+static uint32_t stateSince = 0;  //millis() of the last state change
+
+
+
+////////////////////Power Functions////////////////////
+
+/**
+ * @brief Sets the clock
+ *
+ * @param low true for low power
+ */
+static void applyClock(bool low)
+{
+  int mhz = low ? POWER_LOW_CPU_MHZ : POWER_FULL_CPU_MHZ;
+
+#if CONFIG_PM_ENABLE
+  //No automatic light sleep: the sample timer keeps running in low power and cannot wake the chip from it
+  esp_pm_config_esp32_t pm = {mhz, mhz, false};
+  if(pmReady && esp_pm_configure(&pm) == ESP_OK)
+    return;
+#endif
+
+  setCpuFrequencyMhz(mhz);
+}
+
+
+/**
+ * @brief Power manager setup
+ *
+ */
+void powerInit()
+{
+  enabled = globalPowerPolicy == POWER_AUTO && !streamActive();  //A characterization stream wants every reading at SRATE
+  lastActivity = millis();
+  stateSince = lastActivity;
+
+#if CONFIG_PM_ENABLE
+  esp_pm_config_esp32_t pm = {POWER_FULL_CPU_MHZ, POWER_FULL_CPU_MHZ, false};
+  pmReady = enabled && esp_pm_configure(&pm) == ESP_OK;
+#endif
+}
+
+
+/**
+ * @brief Current state
+ *
+ * @return PowerState
+ */
+PowerState powerState()
+{
+  return state;
+}
+
+
+/**
+ * @brief Changes state and keeps the time spent in low power
+ *
+ * @param next New state
+ */
+static void changeState(PowerState next)
+{
+  uint32_t now = millis();
+  if(state == POWER_STATE_LOW)
+    powerStats.lowMillis += now - stateSince;
+
+  state = next;
+  stateSince = now;
+}
+
+
+/**
+ * @brief Restarts the quiet period
+ *
+ */
+void powerActivity()
+{
+  lastActivity = millis();
+}
+
+
+/**
+ * @brief Low/full power switching, run by SAMPLER_TASK on every reading
+ *
+ * @param near true if the reading is near a threshold
+ * @return PowerState State after this reading
+ */
+PowerState powerStep(bool near)
+{
+  uint32_t now = millis();
+  if(near)
+    lastActivity = now;
+
+  if(!enabled || state == POWER_STATE_HOLDUP)
+    return state;
+
+  bool quiet = now - lastActivity >= globalQuietSeconds * 1000UL;
+
+  if(state == POWER_STATE_FULL && quiet)
+  {
+    applyClock(true);
+    changeState(POWER_STATE_LOW);
+    powerStats.entries++;
+  }
+  else if(state == POWER_STATE_LOW && !quiet)
+  {
+    applyClock(false);
+    changeState(POWER_STATE_FULL);
+    powerStats.exits++;
+
+    //Whatever woke us probably has something to send
+    if(MQTT_TASK_HANDLE)
+      xTaskNotifyGive(MQTT_TASK_HANDLE);
+  }
+
+  return state;
+}
+
+
+/**
+ * @brief Parks MQTT_TASK in low power
+ *
+ * @param idle true if the loop had nothing to send or execute
+ */
+void powerPark(bool idle)
+{
+  if(state != POWER_STATE_LOW || !idle)
+    return;
+
+  //powerStep gives the notification, so a reading near a threshold ends the wait early
+  ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(POWER_PARK_MS));
+}
+
+
+/**
+ * @brief Low power for the rest of a holdup
+ *
+ */
+void powerHoldup()
+{
+  if(globalPowerPolicy == POWER_OFF)
+    return;
+
+  samplerPause(true);  //Capture is frozen, readings would only overflow the FIFO
+  applyClock(true);
+  changeState(POWER_STATE_HOLDUP);
+}
+
+
+/**
+ * @brief One wait slice on holdup
+ *
+ */
+void powerHoldupWait()
+{
+  if(state != POWER_STATE_HOLDUP)
+  {
+    delay(POWER_HOLDUP_POLL_MS);
+    return;
+  }
+
+  //Forced light sleep stops both cores and the network, nothing is left to do but wait for the supply
+  esp_sleep_enable_timer_wakeup(POWER_HOLDUP_POLL_MS * 1000ULL);
+  esp_light_sleep_start();
+}
+
+
+/**
+ * @brief Appends the power counters to a STATS reply
+ *
+ * @param buffer STATS being built
+ * @param length Its current length
+ * @param size Size of buffer
+ * @return int New length
+ */
+int generatePowerStats(char* buffer, int length, size_t size)
+{
+  if(length >= (int)size)
+    return length;
+
+  uint32_t now = millis();
+  PowerState current = state;
+  uint32_t lowMillis = powerStats.lowMillis + (current == POWER_STATE_LOW ? now - stateSince : 0);
+  uint32_t fullMillis = now - lowMillis;
+
+  float lowPercent = now > 0 ? lowMillis * 100.0f / now : 0;
+  float averageMa = now > 0 ? ((float)fullMillis * POWER_FULL_MA + (float)lowMillis * POWER_LOW_MA) / now : POWER_FULL_MA;
+  int currentMa = current == POWER_STATE_FULL ? POWER_FULL_MA : current == POWER_STATE_LOW ? POWER_LOW_MA : POWER_SLEEP_MA;
+
+  return length + snprintf(buffer + length, size - length,
+                           ",\"POWER\":{\"STATE\":\"%s\",\"MHZ\":%lu,\"LOW_PCT\":%.1f,\"ENTRIES\":%lu,\"EXITS\":%lu,"
+                           "\"MA\":%d,\"AVG_MA\":%.0f}",
+                           current == POWER_STATE_FULL ? "FULL" : current == POWER_STATE_LOW ? "LOW" : "HOLDUP",
+                           (unsigned long)getCpuFrequencyMhz(), lowPercent, (unsigned long)powerStats.entries,
+                           (unsigned long)powerStats.exits, currentMa, averageMa);
+}
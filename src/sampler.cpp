@@ -0,0 +1,295 @@
+#include "sampler.h"
+#include "stream.h"
+#include "baseline.h"
+#include "power.h"
+#include "trace.h"
+
+
+
+////////////////////Sampler Externs////////////////////
+
+SamplerStats samplerStats = {0, 0, 0, 0, 0, 0};
+volatile bool samplerStatsResetRequested = false;
+
+
+
+////////////////////Sampler State////////////////////
+
+static hw_timer_t* sampleTimer = NULL;
+static QueueHandle_t sampleFifo = NULL;
+static TaskHandle_t SAMPLER_TASK_HANDLE = NULL;
+static bool adaptive = false;  //Fixed at boot, the config only changes through a reset
+static bool streaming = false;  //Same, every reading also goes out on Serial
+static bool powerManaged = false;  //Same, low power may switch in (power.h)
+static uint32_t samplePeriod = 0;  //Current timer period in microseconds
+static uint32_t burstHold = 0;  //Readings left at SRATE, 0 while idling
+
+
+
+////////////////////Sampler Functions////////////////////
+
+/**
+ * @brief Timer interrupt, only wakes SAMPLER_TASK since analogRead is not interrupt safe
+ * 
+ */
+static void IRAM_ATTR onSampleTimer()
+{
+  BaseType_t woken = pdFALSE;
+  vTaskNotifyGiveFromISR(SAMPLER_TASK_HANDLE, &woken);
+  if(woken)
+    portYIELD_FROM_ISR();
+}
+
+
+/**
+ * @brief Reprograms the timer period without stopping it
+ * 
+ * @param rate Samples per second
+ */
+static void setSampleRate(uint32_t rate)
+{
+  samplePeriod = 1000000UL / rate;
+  timerWrite(sampleTimer, 0);  //An alarm below the current count would only fire once the 64 bit counter wrapped
+  timerAlarmWrite(sampleTimer, samplePeriod, true);
+}
+
+
+/**
+ * @brief Whether a triggering channel is near its threshold, run on every reading
+ * 
+ * @param values Raw counts of the reading just taken
+ * @return true 
+ */
+static bool nearThreshold(const uint16_t* values)
+{
+  static uint16_t previous[CHANNEL_COUNT];
+  static bool primed = false;
+
+  if(!primed)
+  {
+    memcpy(previous, values, sizeof(previous));
+    primed = true;
+  }
+
+  //The slope is per reading, so the horizon in readings shrinks as the rate rises
+  float lookahead = (float)ADAPT_LOOKAHEAD_US / samplePeriod;
+  const float* thresholds = globalTriggerMode == TRIGGER_ABSOLUTE ? globalThresholds : baselineThresholds;
+  bool near = ChannelSet<CHANNEL_COUNT>::approaching(values, previous, thresholds, globalApproachMargin, lookahead);
+  memcpy(previous, values, sizeof(previous));
+  return near;
+}
+
+
+/**
+ * @brief Adaptive rate scheduling, run on every reading at full power
+ * 
+ * @param near Result of nearThreshold for the reading just taken
+ */
+static void adaptRate(bool near)
+{
+  if(near)
+  {
+    if(burstHold == 0)
+    {
+      setSampleRate(globalSampleRate);
+      samplerStats.bursts++;
+    }
+    burstHold = ADAPT_HOLD_SAMPLES;
+  }
+  else if(burstHold > 0 && --burstHold == 0)
+    setSampleRate(globalIdleRate);
+}
+
+
+/**
+ * @brief Takes one reading, queues it for VTC_TASK and switches power state and rate
+ * 
+ * @param ticks Timer ticks since the last reading
+ */
+static void takeReading(uint32_t ticks)
+{
+  if(samplerStatsResetRequested)
+  {
+    samplerStats.missedDeadlines = 0;
+    samplerStats.fifoOverflows = 0;
+    samplerStats.maxFifoDepth = 0;
+    samplerStats.readings = 0;
+    samplerStats.burstReadings = 0;
+    samplerStats.bursts = 0;
+    samplerStatsResetRequested = false;
+  }
+
+  if(ticks > 1)
+    samplerStats.missedDeadlines += ticks - 1;
+
+  Sample sample = readSample();
+  if(traceInjectDue())
+    traceInject(sample);  //TRACE run: this reading becomes the transient
+  if(xQueueSend(sampleFifo, &sample, 0) != pdTRUE)
+    samplerStats.fifoOverflows++;
+
+  if(streaming)
+    streamPush(sample);
+
+  samplerStats.readings++;
+  bool near = (adaptive || powerManaged) && nearThreshold(sample.values);
+
+  PowerState before = powerState();
+  PowerState after = powerStep(near);
+  if(before == POWER_STATE_FULL && after == POWER_STATE_LOW)
+  {
+    //The timer keeps running at the idle rate, only the clock drops, so no crossing falls between readings
+    burstHold = 0;
+    setSampleRate(adaptive ? globalIdleRate : globalSampleRate);
+  }
+  else if(before == POWER_STATE_LOW && after == POWER_STATE_FULL)
+  {
+    //Whatever woke us is likely the start of an event, capture it at SRATE
+    setSampleRate(globalSampleRate);
+    if(adaptive)
+    {
+      burstHold = ADAPT_HOLD_SAMPLES;
+      samplerStats.bursts++;
+    }
+  }
+  else if(adaptive && after == POWER_STATE_FULL)
+  {
+    if(burstHold > 0)
+      samplerStats.burstReadings++;
+    adaptRate(near);
+  }
+
+  uint32_t depth = uxQueueMessagesWaiting(sampleFifo);
+  if(depth > samplerStats.maxFifoDepth)
+    samplerStats.maxFifoDepth = depth;
+}
+
+
+/**
+ * @brief Takes one reading per timer tick and queues it for VTC_TASK
+ * 
+ */
+static void SAMPLER_TASK(void* pvParameters)
+{
+  while(true)
+  {
+    //Notifications accumulate, more than one means ticks went by without a reading
+    uint32_t ticks = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    if(powerState() == POWER_STATE_HOLDUP)
+      continue;
+
+    takeReading(ticks);
+  }
+}
+
+
+/**
+ * @brief Starts timer-paced sampling
+ * 
+ */
+void samplerInit()
+{
+  sampleFifo = xQueueCreate(SAMPLE_FIFO_SIZE, sizeof(Sample));
+  streaming = streamActive();
+  adaptive = globalIdleRate > 0 && globalIdleRate < globalSampleRate && !streaming;  //A characterization stream wants one steady rate
+  powerManaged = globalPowerPolicy == POWER_AUTO && !streaming;
+
+  xTaskCreatePinnedToCore( SAMPLER_TASK,         //Task function
+                           "SAMPLER",            //Name of task
+                           4000,                 //Stack size of task
+                           NULL,                 //Parameter of the task
+                           2,                    //Priority of the task, above VTC_TASK so readings are taken on time
+                           &SAMPLER_TASK_HANDLE, //Task handle for keeping track of task
+                           1                     //Core that task is pinned to
+                         );
+
+  sampleTimer = timerBegin(SAMPLE_TIMER, SAMPLE_TIMER_DIVIDER, true);
+  timerAttachInterrupt(sampleTimer, onSampleTimer, true);
+  setSampleRate(adaptive ? globalIdleRate : globalSampleRate);
+  timerAlarmEnable(sampleTimer);
+}
+
+
+/**
+ * @brief Stops or restarts the sampling timer
+ * 
+ * @param pause true to stop
+ */
+void samplerPause(bool pause)
+{
+  if(pause)
+    timerAlarmDisable(sampleTimer);
+  else
+  {
+    xQueueReset(sampleFifo);
+    timerAlarmEnable(sampleTimer);
+  }
+}
+
+
+/**
+ * @brief Next reading from the FIFO
+ * 
+ * @param sample Filled with the reading
+ */
+void samplerRead(Sample& sample)
+{
+  xQueueReceive(sampleFifo, &sample, portMAX_DELAY);
+}
+
+
+/**
+ * @brief Index of the triggering reading
+ * 
+ * @param event Event readings in capture order
+ * @return int 
+ */
+int eventTriggerIndex(const EventBuffer& event)
+{
+  //Later blocks of a long event are all readings after the trigger
+  if(event.block() > 0)
+    return 0;
+
+  int trigger = event.count() - OVERRIDE_RANGE - 1;
+  return trigger > 0 ? trigger : 0;
+}
+
+
+/**
+ * @brief Achieved rates and jitter of an event
+ * 
+ * @param event Event readings in capture order
+ * @return EventTiming 
+ */
+EventTiming eventTiming(const EventBuffer& event)
+{
+  EventTiming timing = {0, 0, 0};
+  int count = event.count();
+  int trigger = eventTriggerIndex(event);
+
+  if(trigger > 0)
+  {
+    uint32_t preSpan = event.micros(trigger) - event.micros(0);
+    if(preSpan > 0)
+      timing.preRate = trigger * 1000000.0f / preSpan;
+  }
+
+  if(count - trigger < 2)
+    return timing;
+
+  uint32_t span = event.micros(count - 1) - event.micros(trigger);
+  if(span == 0)
+    return timing;
+
+  timing.rate = (count - 1 - trigger) * 1000000.0f / span;
+  float meanInterval = (float)span / (count - 1 - trigger);
+
+  for(int i = trigger + 1; i < count; i++)
+  {
+    float deviation = fabsf((float)(event.micros(i) - event.micros(i - 1)) - meanInterval);
+    if(deviation > timing.maxJitter)
+      timing.maxJitter = (uint32_t)(deviation + 0.5f);
+  }
+
+  return timing;
+}
@@ -0,0 +1,293 @@
+#include "sinks.h"
+#include "spool.h"
+#include "stream.h"
+
+
+
+////////////////////Sink Externs////////////////////
+
+SinkStats sinkStats[SINK_COUNT];
+
+
+
+////////////////////Serial Sink////////////////////
+
+/**
+ * @brief Serial is free unless raw streaming owns it
+ * 
+ */
+static bool serialBegin()
+{
+  return !streamActive();
+}
+
+
+/**
+ * @brief One JSON message per line
+ * 
+ * @param encoded Event messages
+ */
+static void serialWrite(const EncodedEvent& encoded)
+{
+  size_t offset = 0;
+  for(int m = 0; m < encoded.messages; m++)
+  {
+    Serial.write((const uint8_t*)encoded.data + offset, encoded.lengths[m]);
+    Serial.write('\n');
+    offset += encoded.lengths[m];
+  }
+}
+
+
+static void serialFlush() {}
+
+
+
+////////////////////Sink Table////////////////////
+
+static const OutputSink SINKS[SINK_COUNT] =
+{
+  {"MQTT", FORMAT_JSON, 0, 0, NULL, NULL, NULL},  //Queue, format and batching are the store, FORMAT and TRANSMIT_BUDGET_BYTES
+  {"SPOOL", FORMAT_INFLUX, SPOOL_SINK_DEPTH, SPOOL_SINK_BATCH, spoolBegin, spoolWrite, spoolFlush},
+  {"SERIAL", FORMAT_JSON, SERIAL_SINK_DEPTH, SERIAL_SINK_BATCH, serialBegin, serialWrite, serialFlush}
+};
+
+
+/* STRUCT NAME: Sink State
+ * PURPOSE: Working copies of one sink task, allocated once at boot and only for enabled sinks
+ */
+struct SinkState
+{
+  EventBuffer event;
+  EncodedEvent encoded;
+};
+
+static QueueHandle_t sinkQueues[SINK_COUNT];
+static SinkState* sinkStates[SINK_COUNT];
+static volatile uint8_t openSinks = 0;  //Enabled sinks that opened, VTC_TASK only fans out to these once started
+static bool sinksStarted = false;
+static char siteTag[ID_SIZE];
+static char equipmentTag[ID_SIZE];
+
+
+
+////////////////////Sink Functions////////////////////
+
+/**
+ * @brief Drains one sink's queue in batches
+ * 
+ * @param pvParameters SinkId
+ */
+static void SINK_TASK(void* pvParameters)
+{
+  int id = (int)(intptr_t)pvParameters;
+  const OutputSink& sink = SINKS[id];
+  SinkState& state = *sinkStates[id];
+
+  while(true)
+  {
+    //Records written before the first NTP sync could not be back-dated. Events wait for it in the queue, as long as it
+    //has room for the next one
+    while(!timeSynced && uxQueueSpacesAvailable(sinkQueues[id]) > 1)
+      vTaskDelay(pdMS_TO_TICKS(SINK_SYNC_POLL_MS));
+
+    //Blocks for the first event of a batch, then takes only what is already waiting. One at a time before the sync
+    int batch = timeSynced ? sink.batch : 1;
+    for(int written = 0; written < batch; written++)
+    {
+      if(xQueueReceive(sinkQueues[id], &state.event, written == 0 ? portMAX_DELAY : 0) != pdTRUE)
+        break;
+
+      for(int i = 0; i < state.event.count(); i++)
+      {
+        Sample sample = state.event.at(i);
+        backdateSample(sample);
+        state.event.set(i, sample);
+      }
+
+      encodeEvent(siteTag, equipmentTag, state.event, ENCODE_ALL, sink.format, state.encoded);
+      sink.write(state.encoded);
+      sinkStats[id].events++;
+      sinkStats[id].bytes += state.encoded.used;
+    }
+
+    sink.flush();
+  }
+}
+
+
+/**
+ * @brief SINKS config value to mask
+ * 
+ * @param names Comma separated sink names
+ * @return uint8_t 
+ */
+uint8_t sinksParse(const char* names)
+{
+  uint8_t mask = 0;
+  char list[48];
+  strlcpy(list, names, sizeof(list));
+
+  char* save = NULL;
+  for(char* token = strtok_r(list, ", ", &save); token; token = strtok_r(NULL, ", ", &save))
+    for(int s = 0; s < SINK_COUNT; s++)
+      if(strcasecmp(token, SINKS[s].name) == 0)
+        mask |= 1 << s;
+
+  return mask;
+}
+
+
+/**
+ * @brief Enabled sink names
+ * 
+ * @param buffer Filled with the names separated by commas
+ * @param size Size of buffer
+ * @return const char* buffer
+ */
+const char* sinksList(char* buffer, size_t size)
+{
+  size_t length = 0;
+  buffer[0] = '\0';
+
+  for(int s = 0; s < SINK_COUNT && length < size; s++)
+    if(sinkEnabled((SinkId)s))
+      length += snprintf(buffer + length, size - length, "%s%s", length ? "," : "", SINKS[s].name);
+
+  return buffer;
+}
+
+
+/**
+ * @brief Creates the queues of the enabled sinks
+ * 
+ */
+void sinksInit()
+{
+  for(int s = 0; s < SINK_COUNT; s++)
+  {
+    sinkStats[s] = {0, 0, 0, 0};
+    if(s == SINK_MQTT || !(globalSinks & (1 << s)))
+      continue;
+
+    sinkQueues[s] = xQueueCreate(SINKS[s].depth, sizeof(EventBuffer));
+    sinkStates[s] = (SinkState*)malloc(sizeof(SinkState));
+    if(!sinkQueues[s] || !sinkStates[s])
+    {
+      streamLog("Sink %s: out of memory\n", SINKS[s].name);
+      globalSinks &= ~(1 << s);
+      continue;
+    }
+    new (sinkStates[s]) SinkState();
+  }
+
+  openSinks = globalSinks;
+}
+
+
+/**
+ * @brief Opens the enabled sinks and starts their tasks
+ * 
+ * @param site Site tag
+ * @param equipmentID Equipment ID tag
+ */
+void sinksStart(const char* site, const char* equipmentID)
+{
+  if(sinksStarted)
+    return;
+  sinksStarted = true;
+
+  strlcpy(siteTag, site, sizeof(siteTag));
+  strlcpy(equipmentTag, equipmentID, sizeof(equipmentTag));
+
+  for(int s = 0; s < SINK_COUNT; s++)
+  {
+    if(s == SINK_MQTT || !(openSinks & (1 << s)))
+      continue;
+
+    if(!SINKS[s].begin())
+    {
+      streamLog("Sink %s: unavailable, switched off\n", SINKS[s].name);
+      openSinks &= ~(1 << s);
+      continue;
+    }
+
+    xTaskCreatePinnedToCore( SINK_TASK,             //Task function
+                             SINKS[s].name,         //Name of task
+                             6000,                  //Stack size of task
+                             (void*)(intptr_t)s,    //Parameter of the task, the sink it drains
+                             0,                     //Priority of the task, same as MQTT_TASK
+                             NULL,                  //Task runs forever, no handle kept
+                             0                      //Core that task is pinned to, capture keeps core 1
+                           );
+  }
+}
+
+
+/**
+ * @brief Copies an event into every extra sink's queue
+ * 
+ * @param event Completed capture
+ */
+void sinksFanOut(const EventBuffer& event)
+{
+  //A TRACE run's fake transient only tests the path to the broker, it is not written to the record on flash or Serial
+  if(event.trace().injected)
+    return;
+
+  for(int s = 0; s < SINK_COUNT; s++)
+  {
+    if(s == SINK_MQTT || !(openSinks & (1 << s)))
+      continue;
+
+    if(xQueueSend(sinkQueues[s], &event, 0) != pdTRUE)
+      sinkStats[s].dropped++;
+
+    uint32_t depth = uxQueueMessagesWaiting(sinkQueues[s]);
+    if(depth > sinkStats[s].maxDepth)
+      sinkStats[s].maxDepth = depth;
+  }
+}
+
+
+/**
+ * @brief Whether a sink is on
+ * 
+ * @param sink Sink
+ * @return true 
+ */
+bool sinkEnabled(SinkId sink)
+{
+  return openSinks & (1 << sink);
+}
+
+
+/**
+ * @brief Appends the per-sink counters to a STATS reply
+ * 
+ * @param buffer STATS being built
+ * @param length Its current length
+ * @param size Size of buffer
+ * @return int New length
+ */
+int generateSinkStats(char* buffer, int length, size_t size)
+{
+  float seconds = millis() / 1000.0f;
+  bool first = true;
+
+  for(int s = 0; s < SINK_COUNT && length < (int)size; s++)
+  {
+    if(!sinkEnabled((SinkId)s))
+      continue;
+
+    length += snprintf(buffer + length, size - length, "%s\"%s\":[%lu,%.0f,%lu,%lu]", first ? ",\"SINKS\":{" : ",",
+                       SINKS[s].name, (unsigned long)sinkStats[s].events, seconds > 0 ? sinkStats[s].bytes / seconds : 0.0f,
+                       (unsigned long)sinkStats[s].dropped, (unsigned long)sinkStats[s].maxDepth);
+    first = false;
+  }
+
+  if(!first && length < (int)size)
+    length += snprintf(buffer + length, size - length, "}");
+
+  return length;
+}
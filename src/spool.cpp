@@ -0,0 +1,222 @@
+#include "spool.h"
+#include "stream.h"
+#include "sinks.h"
+
+
+
+////////////////////Spool Externs////////////////////
+
+SpoolStats spoolStats = {0, 0, 0, 0};
+
+
+
+////////////////////Spool State////////////////////
+
+static const esp_partition_t* spoolPartition = NULL;
+static uint32_t sectorCount = 0;
+static uint32_t sector = 0;  //Sector being written
+static uint32_t sectorUsed = 0;  //Bytes of it in use, pending ones included. 0 until the sector is opened
+static uint32_t nextSequence = 0;
+static bool recordStarted = false;  //A record starts in the sector, firstRecord is programmed
+static uint8_t pending[SPOOL_PAGE_SIZE];  //Bytes not programmed yet, the last pendingLength of sectorUsed
+static uint32_t pendingLength = 0;
+static uint32_t flashStart = 0;  //micros() when the current flash operation began
+
+
+
+////////////////////Spool Functions////////////////////
+
+/**
+ * @brief Finds the newest sector and starts after it
+ * 
+ * @return true if the partition exists
+ */
+bool spoolBegin()
+{
+  spoolPartition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, SPOOL_PARTITION);
+  if(spoolPartition == NULL || spoolPartition->size < 2 * SPOOL_SECTOR_SIZE)
+    return false;
+
+  sectorCount = spoolPartition->size / SPOOL_SECTOR_SIZE;
+
+  int newest = -1;
+  for(uint32_t s = 0; s < sectorCount; s++)
+  {
+    SpoolSectorHeader header;
+    esp_partition_read(spoolPartition, s * SPOOL_SECTOR_SIZE, &header, sizeof(header));
+    if(header.magic == SPOOL_MAGIC && (newest < 0 || header.sequence >= nextSequence))
+    {
+      newest = s;
+      nextSequence = header.sequence + 1;
+    }
+  }
+
+  sector = newest < 0 ? 0 : (newest + 1) % sectorCount;
+  sectorUsed = 0;
+  streamLog("Spool: %lu sectors, continuing at %lu\n", (unsigned long)sectorCount, (unsigned long)sector);
+  return true;
+}
+
+
+/**
+ * @brief Holds a flash operation back until no capture is in progress
+ * 
+ */
+static void spoolFlashBegin()
+{
+  if(captureActive)
+  {
+    spoolStats.deferred++;
+    while(captureActive)
+      vTaskDelay(pdMS_TO_TICKS(SPOOL_DEFER_POLL_MS));
+  }
+
+  flashStart = micros();
+}
+
+
+/**
+ * @brief Counts the sampling gap a flash operation caused
+ * 
+ */
+static void spoolFlashEnd()
+{
+  uint32_t elapsed = micros() - flashStart;
+
+  spoolStats.flashOps++;
+  if((uint64_t)elapsed * globalSampleRate > 1000000)
+    spoolStats.gaps++;
+  if(elapsed > spoolStats.maxGapMicros)
+    spoolStats.maxGapMicros = elapsed;
+}
+
+
+/**
+ * @brief Programs the pending bytes
+ * 
+ */
+static void spoolProgram()
+{
+  if(pendingLength == 0)
+    return;
+
+  spoolFlashBegin();
+  esp_partition_write(spoolPartition, sector * SPOOL_SECTOR_SIZE + sectorUsed - pendingLength, pending, pendingLength);
+  spoolFlashEnd();
+  pendingLength = 0;
+}
+
+
+/**
+ * @brief Erases the current sector and writes its header, firstRecord left erased
+ * 
+ */
+static void spoolOpenSector()
+{
+  uint32_t base = sector * SPOOL_SECTOR_SIZE;
+  spoolFlashBegin();
+  esp_partition_erase_range(spoolPartition, base, SPOOL_SECTOR_SIZE);
+
+  SpoolSectorHeader header = {SPOOL_MAGIC, nextSequence++, SPOOL_NO_RECORD, 0xFFFF};
+  esp_partition_write(spoolPartition, base, &header, offsetof(SpoolSectorHeader, firstRecord));
+  spoolFlashEnd();
+
+  sectorUsed = sizeof(SpoolSectorHeader);
+  recordStarted = false;
+}
+
+
+/**
+ * @brief Appends bytes to the record stream
+ * 
+ * @param bytes Data
+ * @param length Size of data
+ * @param recordStart true if a record starts with these bytes
+ */
+static void spoolAppend(const uint8_t* bytes, size_t length, bool recordStart)
+{
+  while(length > 0)
+  {
+    if(sectorUsed == 0)
+      spoolOpenSector();
+
+    if(recordStart && !recordStarted)
+    {
+      uint16_t offset = sectorUsed;
+      spoolFlashBegin();
+      esp_partition_write(spoolPartition, sector * SPOOL_SECTOR_SIZE + offsetof(SpoolSectorHeader, firstRecord), &offset, sizeof(offset));
+      spoolFlashEnd();
+      recordStarted = true;
+    }
+    recordStart = false;
+
+    size_t chunk = length;
+    if(chunk > SPOOL_SECTOR_SIZE - sectorUsed)
+      chunk = SPOOL_SECTOR_SIZE - sectorUsed;
+    if(chunk > SPOOL_PAGE_SIZE - pendingLength)
+      chunk = SPOOL_PAGE_SIZE - pendingLength;
+
+    memcpy(pending + pendingLength, bytes, chunk);
+    pendingLength += chunk;
+    sectorUsed += chunk;
+    bytes += chunk;
+    length -= chunk;
+
+    if(pendingLength == SPOOL_PAGE_SIZE || sectorUsed == SPOOL_SECTOR_SIZE)
+      spoolProgram();
+
+    //Sector full, the next byte opens (and erases) the following one
+    if(sectorUsed == SPOOL_SECTOR_SIZE)
+    {
+      sector = (sector + 1) % sectorCount;
+      sectorUsed = 0;
+    }
+  }
+}
+
+
+/**
+ * @brief One record per message
+ * 
+ * @param encoded Event messages
+ */
+void spoolWrite(const EncodedEvent& encoded)
+{
+  size_t offset = 0;
+  for(int m = 0; m < encoded.messages; m++)
+  {
+    uint16_t length = encoded.lengths[m];
+    spoolAppend((const uint8_t*)&length, sizeof(length), true);
+    spoolAppend((const uint8_t*)encoded.data + offset, length, false);
+    offset += length;
+  }
+}
+
+
+/**
+ * @brief Commits the partial page
+ * 
+ */
+void spoolFlush()
+{
+  spoolProgram();
+}
+
+
+/**
+ * @brief Appends the flash counters to a STATS reply
+ * 
+ * @param buffer STATS being built
+ * @param length Its current length
+ * @param size Size of buffer
+ * @return int New length
+ */
+int generateSpoolStats(char* buffer, int length, size_t size)
+{
+  if(!sinkEnabled(SINK_SPOOL) || length >= (int)size)
+    return length;
+
+  return length + snprintf(buffer + length, size - length, ",\"SPOOLFLASH\":[%lu,%lu,%lu,%lu]",
+                           (unsigned long)spoolStats.flashOps, (unsigned long)spoolStats.deferred,
+                           (unsigned long)spoolStats.gaps, (unsigned long)spoolStats.maxGapMicros);
+}
@@ -0,0 +1,164 @@
+#include "stats.h"
+#include "externals.h"
+#include "sampler.h"
+#include "store.h"
+#include "pipeline.h"
+#include "delivery.h"
+#include "stream.h"
+#include "sinks.h"
+#include "spool.h"
+#include "power.h"
+#include "broker.h"
+#include "trace.h"
+
+
+
+////////////////////Externs////////////////////
+
+VtcStats vtcStats = {0, 0, 0, 0, {0, UINT32_MAX, 0, 0}, {0, UINT32_MAX, 0, 0}};
+MqttStats mqttStats = {0, 0, 0, 0, {0, UINT32_MAX, 0, 0}, {0, UINT32_MAX, 0, 0}};
+volatile bool vtcStatsResetRequested = false;
+uint32_t statsResetMillis = 0;
+
+
+
+////////////////////Stats Functions////////////////////
+
+/**
+ * @brief Clears the network-side counters and flags the sampling-side ones for VTC_TASK
+ * 
+ */
+void statsReset()
+{
+  mqttStats.reconnects = 0;
+  mqttStats.publishFailures = 0;
+  mqttStats.maxQueueDepth = 0;
+  mqttStats.droppedCommands = 0;
+  perfReset(mqttStats.publishLatency);
+  perfReset(mqttStats.commandTime);
+  deliveryStats = {0, 0, 0, deliveryStats.overruns};  //VTC_TASK writes overruns, it is kept since boot
+
+  vtcStatsResetRequested = true;
+  samplerStatsResetRequested = true;
+  pipelineStatsResetRequested = true;
+  statsResetMillis = millis();
+}
+
+
+/**
+ * @brief Appends one timer as [min,avg,max]
+ * 
+ * @param timer Timer to format
+ * @param buffer Message being built
+ * @param length Current length
+ * @param size Size of buffer
+ * @return int New length
+ */
+static int appendTimer(const PerfTimer& timer, char* buffer, int length, size_t size)
+{
+  if(length >= (int)size)
+    return length;
+
+  if(timer.count == 0)
+    return length + snprintf(buffer + length, size - length, "[0,0,0]");
+
+  return length + snprintf(buffer + length, size - length, "[%lu,%lu,%lu]", (unsigned long)timer.min,
+                           (unsigned long)(timer.sum / timer.count), (unsigned long)timer.max);
+}
+
+
+/**
+ * @brief Builds the STATS reply
+ * e.g. {"STATS":{"UP":120,"SAMPLES":..,"RATE":..,"INTERVAL":[..],"SRATE":..,"IDLERATE":..,"BURSTS":..,"BURST_PCT":..,"MISSED":..,"OVERFLOW":..,"FIFO":..,"STREAMED":..,"STREAMDROP":..,"MUTEX":[..],"EVENTS":..,"DROPPED":..,"DEPTH":..,"STORECAP":..,"PSRAM":..,"MAXDEPTH":..,
+ *       "PUBLISH":[..],"ENCODE":[..],"SLOTWAIT":[..],"ENCODED":..,"READY":..,"MAXREADY":..,"INFLIGHT":..,"ACKED":..,"RESENT":..,"BADACK":..,"SEQOVERRUN":..,"SINKS":{"MQTT":[..],..},"POWER":{"STATE":..,"MHZ":..,"LOW_PCT":..,"ENTRIES":..,"EXITS":..,"MA":..,"AVG_MA":..},"BROKER":..,"BROKERS":[..],"FAILOVER":[..],"TRACE":{"N":..,"CAPTURE":[..],..},"COMMAND":[..],"CMDDROP":..,"PUBFAIL":..,"RECONNECTS":..,"STACK":{"MQTT":..,"VTC":..},"HEAP":{"FREE":..,"MIN":..,"MAXBLOCK":..}}}
+ * 
+ * @param buffer Destination
+ * @param size Size of buffer
+ * @return size_t Length of the message
+ */
+size_t generateStats(char* buffer, size_t size)
+{
+  uint32_t elapsed = millis() - statsResetMillis;
+  float rate = elapsed > 0 ? vtcStats.samples * 1000.0f / elapsed : 0;
+
+  int length = snprintf(buffer, size, "{\"STATS\":{\"UP\":%lu,\"SAMPLES\":%lu,\"RATE\":%.1f,\"INTERVAL\":",
+                        (unsigned long)(elapsed / 1000), (unsigned long)vtcStats.samples, rate);
+  length = appendTimer(vtcStats.sampleInterval, buffer, length, size);
+
+  //Share of readings taken at SRATE, always 100 with adaptive sampling off
+  float burstPercent = samplerStats.readings > 0 ? samplerStats.burstReadings * 100.0f / samplerStats.readings : 0;
+  if(globalIdleRate == 0 || globalIdleRate >= globalSampleRate || streamActive())
+    burstPercent = 100.0f;
+
+  if(length < (int)size)
+    length += snprintf(buffer + length, size - length,
+                       ",\"SRATE\":%lu,\"IDLERATE\":%lu,\"BURSTS\":%lu,\"BURST_PCT\":%.1f,\"MISSED\":%lu,\"OVERFLOW\":%lu,\"FIFO\":%lu",
+                       (unsigned long)globalSampleRate, (unsigned long)globalIdleRate, (unsigned long)samplerStats.bursts,
+                       burstPercent, (unsigned long)samplerStats.missedDeadlines,
+                       (unsigned long)samplerStats.fifoOverflows, (unsigned long)samplerStats.maxFifoDepth);
+
+  //Only while streaming, since boot (two writing tasks, so STATS RESET leaves them alone)
+  if(streamActive() && length < (int)size)
+    length += snprintf(buffer + length, size - length, ",\"STREAMED\":%lu,\"STREAMDROP\":%lu",
+                       (unsigned long)streamStats.frames, (unsigned long)streamStats.dropped);
+
+  if(length < (int)size)
+    length += snprintf(buffer + length, size - length, ",\"MUTEX\":");
+  length = appendTimer(vtcStats.mutexWait, buffer, length, size);
+
+  if(length < (int)size)
+    length += snprintf(buffer + length, size - length,
+                       ",\"EVENTS\":%lu,\"DROPPED\":%lu,\"DEPTH\":%d,\"STORECAP\":%d,\"PSRAM\":%s,\"MAXDEPTH\":%lu,\"PUBLISH\":",
+                       (unsigned long)vtcStats.events, (unsigned long)vtcStats.droppedEvents, storeCount(), storeCapacity(),
+                       storeInPsram() ? "true" : "false", (unsigned long)mqttStats.maxQueueDepth);
+  length = appendTimer(mqttStats.publishLatency, buffer, length, size);
+
+  //Encode stage: its own time per event, how long it was held up by the transmit stage and the queue between them
+  if(length < (int)size)
+    length += snprintf(buffer + length, size - length, ",\"ENCODE\":");
+  length = appendTimer(pipelineStats.encodeTime, buffer, length, size);
+
+  if(length < (int)size)
+    length += snprintf(buffer + length, size - length, ",\"SLOTWAIT\":");
+  length = appendTimer(pipelineStats.slotWait, buffer, length, size);
+
+  if(length < (int)size)
+    length += snprintf(buffer + length, size - length, ",\"ENCODED\":%lu,\"READY\":%d,\"MAXREADY\":%lu",
+                       (unsigned long)pipelineStats.encoded, pipelineReadyCount(), (unsigned long)pipelineStats.maxReady);
+
+  if(length < (int)size)
+    length += snprintf(buffer + length, size - length, ",\"INFLIGHT\":%d,\"ACKED\":%lu,\"RESENT\":%lu,\"BADACK\":%lu,\"SEQOVERRUN\":%lu",
+                       storeInflight(), (unsigned long)deliveryStats.acked, (unsigned long)deliveryStats.resent,
+                       (unsigned long)deliveryStats.unknownAcks, (unsigned long)deliveryStats.overruns);
+
+  //Events, bytes per second, drops and deepest queue of every enabled sink, since boot
+  length = generateSinkStats(buffer, length, size);
+
+  //Flash operations of the spool and the sampling gaps they caused, since boot
+  length = generateSpoolStats(buffer, length, size);
+
+  //Power state and estimated draw, since boot
+  length = generatePowerStats(buffer, length, size);
+
+  //Active broker, per-broker health and publish counters, failovers since boot
+  length = generateBrokerStats(buffer, length, size);
+
+  //Trigger-to-broker latency per stage over the latest traced events
+  length = generateTraceStats(buffer, length, size);
+
+  if(length < (int)size)
+    length += snprintf(buffer + length, size - length, ",\"COMMAND\":");
+  length = appendTimer(mqttStats.commandTime, buffer, length, size);
+
+  if(length < (int)size)
+    length += snprintf(buffer + length, size - length,
+                       ",\"CMDDROP\":%lu,\"PUBFAIL\":%lu,\"RECONNECTS\":%lu,\"STACK\":{\"MQTT\":%lu,\"VTC\":%lu},"
+                       "\"HEAP\":{\"FREE\":%lu,\"MIN\":%lu,\"MAXBLOCK\":%lu}}}",
+                       (unsigned long)mqttStats.droppedCommands,
+                       (unsigned long)mqttStats.publishFailures, (unsigned long)mqttStats.reconnects,
+                       (unsigned long)uxTaskGetStackHighWaterMark(MQTT_TASK_HANDLE),
+                       (unsigned long)uxTaskGetStackHighWaterMark(VTC_TASK_HANDLE),
+                       (unsigned long)ESP.getFreeHeap(), (unsigned long)ESP.getMinFreeHeap(), (unsigned long)ESP.getMaxAllocHeap());
+
+  return length < (int)size ? length : 0;
+}
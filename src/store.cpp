@@ -0,0 +1,404 @@
+#include "store.h"
+#include "delivery.h"
+#include "baseline.h"
+
+
+
+////////////////////Store State////////////////////
+
+/* STRUCT NAME: Store Entry
+ * PURPOSE: Scheduling metadata of one slot, kept in internal RAM so selecting an event never scans PSRAM
+ */
+struct StoreEntry
+{
+  uint32_t order;  //Hand-over order, larger is newer
+  float severity;  //eventSeverity at hand-over
+  bool used;
+  bool summarized;  //Summary already encoded, only the waveform is left
+  bool inflight;  //Sent under DELIVERY_ACK, waiting for its acknowledgement
+  uint32_t sequence;  //Copy of the event's sequence number, so an ACK never scans PSRAM
+  uint32_t sentMillis;  //millis() when the waveform was taken for encoding
+};
+
+static EventBuffer fallbackSlot;  //Used only when the heap allocation fails
+static StoreEntry fallbackEntry;
+static EventBuffer* slots = NULL;
+static StoreEntry* entries = NULL;
+static int capacity = 0;
+static int stored = 0;
+static int inflight = 0;
+static uint32_t nextOrder = 0;
+static bool inPsram = false;
+
+
+
+////////////////////Store Functions////////////////////
+
+/**
+ * @brief Allocates the event slots, PSRAM first
+ * 
+ */
+void storeInit()
+{
+  if(psramFound())
+  {
+    slots = (EventBuffer*)ps_malloc(STORE_PSRAM_EVENTS * sizeof(EventBuffer));
+    entries = (StoreEntry*)malloc(STORE_PSRAM_EVENTS * sizeof(StoreEntry));
+    if(slots && entries)
+    {
+      capacity = STORE_PSRAM_EVENTS;
+      inPsram = true;
+    }
+    else
+    {
+      free(slots);
+      free(entries);
+      slots = NULL;
+      entries = NULL;
+    }
+  }
+
+  if(!slots)
+  {
+    slots = (EventBuffer*)malloc(STORE_SRAM_EVENTS * sizeof(EventBuffer));
+    entries = (StoreEntry*)malloc(STORE_SRAM_EVENTS * sizeof(StoreEntry));
+    capacity = STORE_SRAM_EVENTS;
+  }
+
+  if(!slots || !entries)
+  {
+    free(slots);
+    free(entries);
+    slots = &fallbackSlot;
+    entries = &fallbackEntry;
+    capacity = 1;
+  }
+
+  //EventBuffer only holds plain arrays, constructing in place just sets it empty
+  for(int i = 0; i < capacity; i++)
+  {
+    new (&slots[i]) EventBuffer();
+    entries[i].used = false;
+  }
+
+  Serial.printf("Event store: %d events in %s\n", capacity, inPsram ? "PSRAM" : "internal RAM");
+}
+
+
+/**
+ * @brief Largest excursion beyond threshold over the triggering channels
+ * 
+ * @param event Event readings
+ * @return float Fraction of the threshold (absolute excess if the threshold is 0), 0 if nothing crossed
+ */
+float eventSeverity(const EventBuffer& event)
+{
+  float severity = 0;
+
+  for(int c = 0; c < CHANNEL_COUNT; c++)
+  {
+    if(CHANNELS[c].trigger == TRIGGER_NONE)
+      continue;
+
+    float scale;
+    float threshold = eventThreshold(event, c, &scale);
+
+    for(int i = 0; i < event.count(); i++)
+    {
+      float value = channelValue(c, event.value(c, i));
+      float excess = CHANNELS[c].trigger == TRIGGER_ABOVE ? value - threshold : threshold - value;
+      if(excess / scale > severity)
+        severity = excess / scale;
+    }
+  }
+
+  return severity;
+}
+
+
+/**
+ * @brief Whether entry a goes out before entry b under the configured policy
+ * 
+ */
+static bool scheduledBefore(const StoreEntry& a, const StoreEntry& b)
+{
+  switch(globalSchedulePolicy)
+  {
+    case SCHEDULE_NEWEST:
+      return a.order > b.order;
+    case SCHEDULE_SEVERITY:
+      if(a.severity != b.severity)
+        return a.severity > b.severity;
+      return a.order < b.order;
+    default:
+      return a.order < b.order;
+  }
+}
+
+
+/**
+ * @brief Slot the policy sends next
+ * 
+ * @param summary true to only consider events whose summary has not been encoded
+ * @param sent true to consider events in flight as well
+ * @return int Slot index, -1 if there is none
+ */
+static int storeSelect(bool summary, bool sent)
+{
+  int best = -1;
+  for(int i = 0; i < capacity; i++)
+  {
+    if(!entries[i].used || (entries[i].inflight && !sent) || (summary && entries[i].summarized))
+      continue;
+    if(best < 0 || scheduledBefore(entries[i], entries[best]))
+      best = i;
+  }
+  return best;
+}
+
+
+/**
+ * @brief Slot given up when the store is full: the least severe under SCHEDULE_SEVERITY, the oldest otherwise.
+ * Events in flight are only given up when nothing else is queued
+ * 
+ * @return int Slot index
+ */
+static int storeVictim()
+{
+  int victim = -1;
+  for(int i = 0; i < capacity; i++)
+  {
+    if(!entries[i].used)
+      continue;
+
+    bool worse;
+    if(victim < 0)
+      worse = true;
+    else if(entries[i].inflight != entries[victim].inflight)
+      worse = !entries[i].inflight;
+    else if(globalSchedulePolicy == SCHEDULE_SEVERITY && entries[i].severity != entries[victim].severity)
+      worse = entries[i].severity < entries[victim].severity;
+    else
+      worse = entries[i].order < entries[victim].order;
+
+    if(worse)
+      victim = i;
+  }
+  return victim;
+}
+
+
+/**
+ * @brief Queues an event, dropping one when full
+ * 
+ * @param event Event readings, in ring order
+ * @return false if an older event was dropped to make room
+ */
+bool storePush(const EventBuffer& event)
+{
+  bool room = stored < capacity;
+  int slot = -1;
+
+  if(room)
+  {
+    for(slot = 0; entries[slot].used; slot++);
+    stored++;
+  }
+  else
+  {
+    slot = storeVictim();  //Never picked up by ENCODE_TASK, or never acknowledged
+    if(entries[slot].inflight)
+      inflight--;
+  }
+
+  event.copyTo(slots[slot]);
+  entries[slot].order = nextOrder++;
+  entries[slot].severity = eventSeverity(slots[slot]);
+  entries[slot].sequence = slots[slot].sequence();
+  entries[slot].summarized = false;
+  entries[slot].inflight = false;
+  entries[slot].used = true;
+  return room;
+}
+
+
+/**
+ * @brief Copies the next event whose summary is still due and marks it summarized
+ * 
+ * @param event Destination
+ * @return true if there was one
+ */
+bool storeTakeSummary(EventBuffer& event)
+{
+  int slot = storeSelect(true, false);
+  if(slot < 0)
+    return false;
+
+  slots[slot].copyTo(event);
+  slots[slot].trace().trigger = 0;  //Traced up to its first part, the waveform and any resend are not
+  entries[slot].summarized = true;
+  return true;
+}
+
+
+/**
+ * @brief Takes the next event under the policy. Under DELIVERY_ACK it stays queued, in flight, until acknowledged
+ * 
+ * @param event Destination
+ * @param summarized Set to whether its summary already went out
+ * @return true if an event was queued (and, under DELIVERY_ACK, the send window has room)
+ */
+bool storePop(EventBuffer& event, bool* summarized)
+{
+  bool acked = globalDeliveryMode == DELIVERY_ACK;
+  if(acked && inflight >= DELIVERY_WINDOW)
+    return false;
+
+  int slot = storeSelect(false, false);
+  if(slot < 0)
+    return false;
+
+  slots[slot].copyTo(event);
+  slots[slot].trace().trigger = 0;  //A resend is not traced again
+  if(summarized)
+    *summarized = entries[slot].summarized;
+
+  if(acked)
+  {
+    entries[slot].inflight = true;
+    entries[slot].sentMillis = millis();
+    inflight++;
+  }
+  else
+  {
+    entries[slot].used = false;
+    stored--;
+  }
+  return true;
+}
+
+
+/**
+ * @brief Removes an acknowledged event
+ * 
+ * @param sequence Sequence number from the ACK command
+ * @return true if it was in flight
+ */
+bool storeAck(uint32_t sequence)
+{
+  for(int i = 0; i < capacity; i++)
+  {
+    if(!entries[i].used || !entries[i].inflight || entries[i].sequence != sequence)
+      continue;
+
+    entries[i].used = false;
+    entries[i].inflight = false;
+    inflight--;
+    stored--;
+    return true;
+  }
+  return false;
+}
+
+
+/**
+ * @brief Puts unacknowledged events back in the queue
+ * 
+ * @param olderThanMs Only events sent at least this long ago, 0 for all
+ * @return int Events requeued
+ */
+int storeRequeue(uint32_t olderThanMs)
+{
+  int requeued = 0;
+  uint32_t current = millis();
+
+  for(int i = 0; i < capacity; i++)
+  {
+    if(!entries[i].used || !entries[i].inflight || current - entries[i].sentMillis < olderThanMs)
+      continue;
+
+    //The whole event goes again, summary first, since the consumer may have lost either part
+    entries[i].inflight = false;
+    entries[i].summarized = false;
+    inflight--;
+    requeued++;
+  }
+  return requeued;
+}
+
+
+/**
+ * @brief Walks the queue in policy order, for the power-fail flush
+ * 
+ * @param after Event returned by the previous call, NULL to start
+ * @return const EventBuffer* Next event, NULL once all were returned
+ */
+const EventBuffer* storeNext(const EventBuffer* after)
+{
+  //scheduledBefore is a strict order (ties fall back to the unique hand-over order), so each step is one scan
+  int previous = after ? after - slots : -1;
+  int best = -1;
+  for(int i = 0; i < capacity; i++)
+  {
+    if(!entries[i].used || (previous >= 0 && !scheduledBefore(entries[previous], entries[i])))
+      continue;
+    if(best < 0 || scheduledBefore(entries[i], entries[best]))
+      best = i;
+  }
+  return best >= 0 ? &slots[best] : NULL;
+}
+
+
+/**
+ * @brief Events waiting, in flight ones included
+ * 
+ * @return int 
+ */
+int storeCount()
+{
+  return stored;
+}
+
+
+/**
+ * @brief Events sent and not yet acknowledged
+ * 
+ * @return int 
+ */
+int storeInflight()
+{
+  return inflight;
+}
+
+
+/**
+ * @brief Slots allocated at boot
+ * 
+ * @return int 
+ */
+int storeCapacity()
+{
+  return capacity;
+}
+
+
+/**
+ * @brief Whether the slots are in PSRAM
+ * 
+ * @return true PSRAM board
+ */
+bool storeInPsram()
+{
+  return inPsram;
+}
+
+
+/**
+ * @brief Longest event in blocks
+ * 
+ * @return int 
+ */
+int storeMaxBlocks()
+{
+  return inPsram ? LONG_EVENT_BLOCKS : 1;
+}
@@ -0,0 +1,127 @@
+#include "stream.h"
+#include <stdarg.h>
+
+
+
+////////////////////Stream Externs////////////////////
+
+StreamStats streamStats = {0, 0};
+
+
+
+////////////////////Stream State////////////////////
+
+static QueueHandle_t streamFifo = NULL;
+static uint32_t streamSequence = 0;  //Only SAMPLER_TASK writes it
+
+
+
+////////////////////Stream Functions////////////////////
+
+/**
+ * @brief Writes frames to the UART in batches, so the driver is entered once per STREAM_BATCH readings
+ * 
+ */
+static void STREAM_TASK(void* pvParameters)
+{
+  static StreamFrame batch[STREAM_BATCH];
+
+  while(true)
+  {
+    //Blocks for the first frame, then takes whatever else is already waiting
+    int count = 0;
+    if(xQueueReceive(streamFifo, &batch[count], portMAX_DELAY) == pdTRUE)
+      count++;
+    while(count < STREAM_BATCH && xQueueReceive(streamFifo, &batch[count], 0) == pdTRUE)
+      count++;
+
+    Serial.write((const uint8_t*)batch, count * sizeof(StreamFrame));
+    streamStats.frames += count;
+  }
+}
+
+
+/**
+ * @brief Starts streaming if configured
+ * 
+ * @return true if streaming is on
+ */
+bool streamInit()
+{
+  if(globalStreamBaud == 0)
+    return false;
+
+  Serial.printf("Streaming raw samples at %lu baud\n", (unsigned long)globalStreamBaud);
+  Serial.flush();
+
+  //The transmit buffer can only be sized while the port is closed
+  Serial.end();
+  Serial.setTxBufferSize(STREAM_TX_BUFFER);
+  Serial.begin(globalStreamBaud);
+
+  streamFifo = xQueueCreate(STREAM_FIFO_SIZE, sizeof(StreamFrame));
+
+  xTaskCreatePinnedToCore( STREAM_TASK,          //Task function
+                           "STREAM",             //Name of task
+                           3000,                 //Stack size of task
+                           NULL,                 //Parameter of the task
+                           1,                    //Priority of the task, above MQTT_TASK so the UART never runs dry
+                           NULL,                 //Task runs forever, no handle kept
+                           0                     //Core that task is pinned to, sampling keeps core 1 to itself
+                         );
+  return true;
+}
+
+
+/**
+ * @brief Queues one reading as a frame
+ * 
+ * @param sample Reading just taken
+ */
+void streamPush(const Sample& sample)
+{
+  StreamFrame frame;
+  frame.sync = STREAM_SYNC;
+  frame.sequence = streamSequence++;
+  frame.micros = (uint32_t)sample.micros;
+  memcpy(frame.values, sample.values, sizeof(frame.values));
+
+  uint8_t checksum = 0;
+  const uint8_t* bytes = (const uint8_t*)&frame + offsetof(StreamFrame, sequence);
+  for(size_t i = 0; i < offsetof(StreamFrame, checksum) - offsetof(StreamFrame, sequence); i++)
+    checksum += bytes[i];
+  frame.checksum = checksum;
+
+  if(xQueueSend(streamFifo, &frame, 0) != pdTRUE)
+    streamStats.dropped++;
+}
+
+
+/**
+ * @brief Whether streaming is on
+ * 
+ * @return true 
+ */
+bool streamActive()
+{
+  return streamFifo != NULL;
+}
+
+
+/**
+ * @brief Status message on Serial, unless Serial carries frames
+ * 
+ * @param format printf format
+ */
+void streamLog(const char* format, ...)
+{
+  if(streamActive())
+    return;
+
+  char line[STREAM_LOG_SIZE];
+  va_list arguments;
+  va_start(arguments, format);
+  vsnprintf(line, sizeof(line), format, arguments);
+  va_end(arguments);
+  Serial.print(line);
+}
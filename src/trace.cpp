@@ -0,0 +1,280 @@
+#include "trace.h"
+#include "stream.h"
+
+
+
+////////////////////Trace State////////////////////
+
+static const char* const STAGE_NAMES[TRACE_STAGES] = {"CAPTURE", "HANDOVER", "ENCODE", "TRANSMIT", "TOTAL"};
+
+static TraceWindow statsWindow;  //Every traced event since boot, for STATS
+static TraceWindow runWindow;  //Injected transients of the current run, for its report
+static uint32_t sorted[TRACE_WINDOW];  //Scratch copy for the percentiles
+static volatile bool injectRequested = false;  //Set by MQTT_TASK, cleared by SAMPLER_TASK
+static volatile uint8_t traceRun = 0;  //Number of the current run, 1-255, set by MQTT_TASK
+static volatile uint64_t injectedMicros = UINT64_MAX;  //Timestamp of the last injected reading, set by SAMPLER_TASK
+static volatile uint8_t injectedRun = 0;  //Run it was injected for
+
+static bool traceRunning = false;
+static uint32_t traceCount = 0;
+static uint32_t traceIntervalMs = 0;
+static uint32_t traceBudgetMs = TRACE_BUDGET_MS;
+static float traceMinRate = 0;
+static uint32_t traceInjected = 0;
+static uint32_t traceStartMillis = 0;
+static uint32_t traceNextMillis = 0;
+static uint32_t traceLastMillis = 0;  //Last injection
+
+
+
+////////////////////Trace Functions////////////////////
+
+/**
+ * @brief Adds one event to a window
+ *
+ * @param window STATS or run window
+ * @param trace Its stage timestamps
+ * @param published micros() when it was published
+ * @param bytes Payload bytes it was published with
+ */
+static void windowRecord(TraceWindow& window, const EventTrace& trace, uint32_t published, size_t bytes)
+{
+  uint32_t position = window.traced % TRACE_WINDOW;
+
+  window.latencies[TRACE_CAPTURE][position] = trace.captured - trace.trigger;
+  window.latencies[TRACE_HANDOVER][position] = trace.stored - trace.captured;
+  window.latencies[TRACE_ENCODE][position] = trace.encoded - trace.stored;
+  window.latencies[TRACE_TRANSMIT][position] = published - trace.encoded;
+  window.latencies[TRACE_TOTAL][position] = published - trace.trigger;
+
+  window.traced++;
+  window.bytes += bytes;
+}
+
+
+/**
+ * @brief Latency counters of one delivered event
+ *
+ * @param trace Its stage timestamps
+ * @param bytes Payload bytes it was published with
+ */
+void traceRecord(const EventTrace& trace, size_t bytes)
+{
+  if(trace.trigger == 0)
+    return;
+
+  uint32_t published = micros();
+  windowRecord(statsWindow, trace, published, bytes);
+
+  //A real transient, or a late one of an earlier run, is not part of the run being judged
+  if(traceRunning && trace.injected == traceRun)
+    windowRecord(runWindow, trace, published, bytes);
+}
+
+
+/**
+ * @brief Hands a pending injection to SAMPLER_TASK
+ *
+ * @return true if this reading is to be replaced
+ */
+bool traceInjectDue()
+{
+  if(!injectRequested)
+    return false;
+
+  injectRequested = false;
+  return true;
+}
+
+
+/**
+ * @brief Turns a reading into a transient
+ *
+ * @param sample Reading, its first triggering channel is replaced
+ */
+void traceInject(Sample& sample)
+{
+  for(int c = 0; c < CHANNEL_COUNT; c++)
+  {
+    if(CHANNELS[c].trigger == TRIGGER_NONE)
+      continue;
+
+    //Same direction rule as ChannelSet::triggeredRaw
+    bool rising = (CHANNELS[c].trigger == TRIGGER_ABOVE) == (CHANNELS[c].scale > 0);
+    sample.values[c] = rising ? TRACE_ADC_FULL_SCALE : 0;
+    break;
+  }
+
+  //Written before the reading is queued, VTC_TASK only looks once it has taken it from the FIFO
+  injectedRun = traceRun;
+  injectedMicros = sample.micros;
+}
+
+
+/**
+ * @brief Whether a triggering reading was injected
+ *
+ * @param micros Timestamp of the triggering reading
+ * @return uint8_t Run it was injected for, 0 for a real transient
+ */
+uint8_t traceInjection(uint64_t micros)
+{
+  return micros == injectedMicros ? injectedRun : 0;
+}
+
+
+/**
+ * @brief qsort comparator for the percentiles
+ *
+ */
+static int compareLatency(const void* a, const void* b)
+{
+  uint32_t left = *(const uint32_t*)a;
+  uint32_t right = *(const uint32_t*)b;
+  return (left > right) - (left < right);
+}
+
+
+/**
+ * @brief Appends "<stage>":[P50,P90,P99,MAX] of the events in a window
+ *
+ * @param window STATS or run window
+ * @param stage Stage
+ * @param buffer Message being built
+ * @param length Current length
+ * @param size Size of buffer
+ * @param p99 Set to the P99, if not NULL
+ * @return int New length
+ */
+static int appendPercentiles(const TraceWindow& window, int stage, char* buffer, int length, size_t size, uint32_t* p99)
+{
+  uint32_t kept = window.traced < TRACE_WINDOW ? window.traced : TRACE_WINDOW;
+
+  memcpy(sorted, window.latencies[stage], kept * sizeof(uint32_t));
+  qsort(sorted, kept, sizeof(uint32_t), compareLatency);
+
+  if(p99)
+    *p99 = kept ? sorted[kept * 99 / 100] : 0;
+
+  if(length >= (int)size)
+    return length;
+
+  return length + snprintf(buffer + length, size - length, ",\"%s\":[%lu,%lu,%lu,%lu]", STAGE_NAMES[stage],
+                           (unsigned long)(kept ? sorted[kept * 50 / 100] : 0),
+                           (unsigned long)(kept ? sorted[kept * 90 / 100] : 0),
+                           (unsigned long)(kept ? sorted[kept * 99 / 100] : 0),
+                           (unsigned long)(kept ? sorted[kept - 1] : 0));
+}
+
+
+/**
+ * @brief Publishes the report of the run that just ended
+ *
+ */
+static void traceReport()
+{
+  float seconds = (millis() - traceStartMillis) / 1000.0f;
+  float rate = seconds > 0 ? runWindow.traced / seconds : 0;
+  uint32_t lost = traceInjected > runWindow.traced ? traceInjected - runWindow.traced : 0;
+
+  char report[PUBLISH_BUFFER_SIZE];
+  int length = snprintf(report, sizeof(report),
+                        "{\"TRACE\":{\"RUN\":%u,\"INJECTED\":%lu,\"TRACED\":%lu,\"LOST\":%lu,\"SECONDS\":%.1f,\"EVENTS_S\":%.2f,\"BYTES_S\":%.1f",
+                        traceRun, (unsigned long)traceInjected, (unsigned long)runWindow.traced, (unsigned long)lost, seconds,
+                        rate, seconds > 0 ? runWindow.bytes / seconds : 0);
+
+  uint32_t p99 = 0;
+  for(int stage = 0; stage < TRACE_STAGES; stage++)
+    length = appendPercentiles(runWindow, stage, report, length, sizeof(report), stage == TRACE_TOTAL ? &p99 : NULL);
+
+  bool pass = lost == 0 && p99 <= traceBudgetMs * 1000UL && rate >= traceMinRate;
+  if(length < (int)sizeof(report))
+    snprintf(report + length, sizeof(report) - length, ",\"BUDGET_MS\":%lu,\"MIN_RATE\":%.2f,\"RESULT\":\"%s\"}}",
+             (unsigned long)traceBudgetMs, traceMinRate, pass ? "PASS" : "FAIL");
+
+  streamLog("%s\n", report);
+  mqttClient.publish(publishTopicInfo, report);
+  traceRunning = false;
+  injectRequested = false;  //A run that stalled leaves its last request pending, it must not fire after the run
+}
+
+
+/**
+ * @brief Starts a run
+ *
+ * @param count Transients to inject
+ * @param intervalMs Spacing between them
+ * @param budgetMs P99 trigger-to-broker budget
+ * @param minRate Minimum delivered events per second
+ */
+void traceStart(uint32_t count, uint32_t intervalMs, uint32_t budgetMs, float minRate)
+{
+  if(traceRunning)
+    traceReport();
+
+  traceCount = constrain(count, 1, TRACE_INJECT_MAX);
+  traceIntervalMs = max(intervalMs, (uint32_t)TRACE_INJECT_MIN_MS);
+  traceBudgetMs = budgetMs;
+  traceMinRate = minRate;
+
+  traceRun = traceRun == 255 ? 1 : traceRun + 1;
+  runWindow.traced = 0;
+  runWindow.bytes = 0;
+  traceInjected = 0;
+  traceStartMillis = millis();
+  traceNextMillis = traceStartMillis;
+  traceRunning = true;
+}
+
+
+/**
+ * @brief Paces the injections and ends the run
+ *
+ */
+void traceStep()
+{
+  if(!traceRunning)
+    return;
+
+  //An injection SAMPLER_TASK never took (capture paused) counts as lost once the run has settled
+  uint32_t current = millis();
+  bool stalled = injectRequested && current - traceLastMillis >= TRACE_SETTLE_MS;
+  if(traceInjected >= traceCount || stalled)
+  {
+    if(runWindow.traced >= traceInjected || current - traceLastMillis >= TRACE_SETTLE_MS)
+      traceReport();
+    return;
+  }
+
+  if((int32_t)(current - traceNextMillis) < 0 || injectRequested)
+    return;
+
+  injectRequested = true;  //Taken by SAMPLER_TASK on its next reading
+  traceInjected++;
+  traceLastMillis = current;
+  traceNextMillis += traceIntervalMs;
+}
+
+
+/**
+ * @brief Appends the latency percentiles to a STATS reply
+ *
+ * @param buffer STATS being built
+ * @param length Its current length
+ * @param size Size of buffer
+ * @return int New length
+ */
+int generateTraceStats(char* buffer, int length, size_t size)
+{
+  if(length < (int)size)
+    length += snprintf(buffer + length, size - length, ",\"TRACE\":{\"N\":%lu",
+                       (unsigned long)(statsWindow.traced < TRACE_WINDOW ? statsWindow.traced : TRACE_WINDOW));
+
+  for(int stage = 0; stage < TRACE_STAGES; stage++)
+    length = appendPercentiles(statsWindow, stage, buffer, length, size, NULL);
+
+  if(length < (int)size)
+    length += snprintf(buffer + length, size - length, "}");
+
+  return length;
+}
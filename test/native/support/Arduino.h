@@ -0,0 +1,8 @@
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+//Queue.h includes the Arduino core by name, on the host that is native.h
+
+#include "native.h"
+
+#endif
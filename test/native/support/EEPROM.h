@@ -0,0 +1,30 @@
+#ifndef EEPROM_H
+#define EEPROM_H
+
+//EEPROM in RAM for the host unit tests, blank (0xFF) until written. commits counts EEPROM.commit() calls
+
+#include <stdint.h>
+#include <string.h>
+
+class EEPROMClass
+{
+  public:
+    EEPROMClass() { memset(bytes, 0xFF, sizeof(bytes)); }
+    bool begin(size_t size) { return size <= sizeof(bytes); }
+    uint8_t read(int address) { return bytes[address]; }
+    void write(int address, uint8_t value) { bytes[address] = value; }
+    bool commit() { commits++; return true; }
+    size_t length() { return sizeof(bytes); }
+
+    template<typename T> T& get(int address, T& value) { memcpy(&value, bytes + address, sizeof(T)); return value; }
+    template<typename T> const T& put(int address, const T& value) { memcpy(bytes + address, &value, sizeof(T)); return value; }
+
+    int commits = 0;
+
+  private:
+    uint8_t bytes[4096];
+};
+
+inline EEPROMClass EEPROM;
+
+#endif
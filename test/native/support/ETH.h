@@ -0,0 +1,69 @@
+#ifndef ETH_H
+#define ETH_H
+
+//Ethernet and the WiFi event hook for the host unit tests: the link never comes up, events never fire
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+class IPAddress
+{
+  public:
+    IPAddress() : address(0) {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : address(a | b << 8 | c << 16 | (uint32_t)d << 24) {}
+    IPAddress(uint32_t address_) : address(address_) {}
+    uint8_t operator[](int index) const { return address >> (8 * index); }
+    bool operator==(const IPAddress& other) const { return address == other.address; }
+    bool operator!=(const IPAddress& other) const { return address != other.address; }
+    operator uint32_t() const { return address; }
+    bool fromString(const char* text)
+    {
+      unsigned a, b, c, d;
+      if(sscanf(text, "%u.%u.%u.%u", &a, &b, &c, &d) != 4 || a > 255 || b > 255 || c > 255 || d > 255)
+        return false;
+      address = a | b << 8 | c << 16 | (uint32_t)d << 24;
+      return true;
+    }
+
+  private:
+    uint32_t address;
+};
+
+
+typedef int WiFiEvent_t;
+
+#define ARDUINO_EVENT_ETH_START 18
+#define ARDUINO_EVENT_ETH_STOP 19
+#define ARDUINO_EVENT_ETH_CONNECTED 20
+#define ARDUINO_EVENT_ETH_DISCONNECTED 21
+#define ARDUINO_EVENT_ETH_GOT_IP 22
+
+enum eth_phy_type_t { ETH_PHY_LAN8720, ETH_PHY_TLK110 };
+enum eth_clock_mode_t { ETH_CLOCK_GPIO0_IN, ETH_CLOCK_GPIO0_OUT, ETH_CLOCK_GPIO16_OUT, ETH_CLOCK_GPIO17_OUT };
+
+
+class ETHClass
+{
+  public:
+    bool begin(uint8_t address, int power, int mdc, int mdio, eth_phy_type_t type, eth_clock_mode_t clock) { return true; }
+    bool config(IPAddress local, IPAddress gateway, IPAddress subnet, IPAddress dns) { return true; }
+    bool setHostname(const char* hostname) { return true; }
+    IPAddress localIP() { return IPAddress(); }
+    std::string macAddress() { return "00:00:00:00:00:00"; }
+    bool fullDuplex() { return true; }
+    uint8_t linkSpeed() { return 100; }
+};
+
+inline ETHClass ETH;
+
+
+class WiFiClass
+{
+  public:
+    int onEvent(void (*handler)(WiFiEvent_t)) { return 0; }
+};
+
+inline WiFiClass WiFi;
+
+#endif
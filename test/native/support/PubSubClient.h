@@ -0,0 +1,110 @@
+#ifndef PUBSUBCLIENT_H
+#define PUBSUBCLIENT_H
+
+//Scripted MQTT client for the host unit tests: nothing goes on the wire, the test decides whether a connect or a publish
+//succeeds and reads back what was sent
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#define MQTT_CONNECTED 0
+#define MQTT_CONNECT_FAILED -2
+#define MQTT_DISCONNECTED -1
+
+class WiFiClient
+{
+  public:
+    void setTimeout(uint16_t seconds) {}
+};
+
+struct NativeMessage
+{
+  std::string topic;
+  std::string payload;
+};
+
+
+class PubSubClient
+{
+  public:
+    PubSubClient() {}
+    PubSubClient(WiFiClient& client) {}
+
+    //Script
+    bool acceptConnect = true;  //Outcome of every connect()
+    int refuseNext = 0;  //connect() calls that fail before acceptConnect applies again
+    std::vector<uint32_t> refused;  //Server addresses that refuse every connect(), brokers that are down
+    int failPublishAt = -1;  //Publish that fails and drops the connection, counted from 0, -1 for none
+    std::vector<NativeMessage> messages;  //Everything published, in order
+    int published = 0;  //Publishes that succeeded
+    int connects = 0;  //connect() calls
+    int loops = 0;
+    uint32_t serverAddress = 0;  //Last setServer()
+    uint16_t serverPort = 0;
+
+    PubSubClient& setServer(uint32_t address, uint16_t port) { serverAddress = address; serverPort = port; return *this; }
+    PubSubClient& setCallback(void (*callback)(char*, uint8_t*, unsigned int)) { return *this; }
+    bool setBufferSize(uint16_t size) { return true; }
+    PubSubClient& setKeepAlive(uint16_t seconds) { return *this; }
+    PubSubClient& setSocketTimeout(uint16_t seconds) { return *this; }
+
+    bool connect(const char* id)
+    {
+      connects++;
+      bool down = std::find(refused.begin(), refused.end(), serverAddress) != refused.end();
+      linked = acceptConnect && !down && refuseNext <= 0;
+      if(refuseNext > 0)
+        refuseNext--;
+      return linked;
+    }
+
+    bool connect(const char* id, const char* user, const char* password) { return connect(id); }
+    bool connect(const char* id, const char* willTopic, uint8_t willQos, bool willRetain, const char* willMessage) { return connect(id); }
+    bool connected() { return linked; }
+    void disconnect() { linked = false; }
+    int state() { return linked ? MQTT_CONNECTED : MQTT_DISCONNECTED; }
+    bool loop() { loops++; return linked; }
+    bool subscribe(const char* topic) { return linked; }
+
+    bool publish(const char* topic, const char* payload) { return publish(topic, (const uint8_t*)payload, strlen(payload)); }
+    bool publish(const char* topic, const uint8_t* payload, size_t length)
+    {
+      return beginPublish(topic, length, false) && write(payload, length) == length && endPublish();
+    }
+
+    bool beginPublish(const char* topic, size_t length, bool retained)
+    {
+      pending = NativeMessage{topic, ""};
+      return linked;
+    }
+
+    size_t write(const uint8_t* data, size_t length)
+    {
+      pending.payload.append((const char*)data, length);
+      return linked ? length : 0;
+    }
+
+    int endPublish()
+    {
+      if(!linked)
+        return 0;
+      if((int)messages.size() == failPublishAt)
+      {
+        linked = false;
+        return 0;
+      }
+      messages.push_back(pending);
+      published++;
+      return 1;
+    }
+
+  private:
+    bool linked = false;
+    NativeMessage pending;
+};
+
+#endif
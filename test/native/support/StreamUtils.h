@@ -0,0 +1,42 @@
+#ifndef STREAMUTILS_H
+#define STREAMUTILS_H
+
+//EepromStream over the RAM EEPROM of EEPROM.h, read and written by ArduinoJson as a custom reader/writer
+
+#include "EEPROM.h"
+
+class EepromStream
+{
+  public:
+    EepromStream(size_t address_, size_t size_) : address(address_), end(address_ + size_) {}
+
+    int read() { return address < end ? EEPROM.read(address++) : -1; }
+    size_t readBytes(char* buffer, size_t length)
+    {
+      size_t count = 0;
+      for(int c; count < length && (c = read()) >= 0; count++)
+        buffer[count] = c;
+      return count;
+    }
+
+    size_t write(uint8_t c)
+    {
+      if(address >= end)
+        return 0;
+      EEPROM.write(address++, c);
+      return 1;
+    }
+    size_t write(const uint8_t* buffer, size_t length)
+    {
+      size_t count = 0;
+      while(count < length && write(buffer[count]))
+        count++;
+      return count;
+    }
+
+  private:
+    size_t address;
+    size_t end;
+};
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef ESP_PARTITION_H
+#define ESP_PARTITION_H
+
+//In-memory flash partition for the host unit tests: writes can only clear bits, erases set whole sectors back to 0xFF,
+//and every write takes writeMicros of the native clock
+
+#include "native.h"
+#include <vector>
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_ERR_INVALID_SIZE 0x104
+
+enum esp_partition_type_t { ESP_PARTITION_TYPE_APP = 0x00, ESP_PARTITION_TYPE_DATA = 0x01 };
+enum esp_partition_subtype_t { ESP_PARTITION_SUBTYPE_ANY = 0xFF };
+
+struct esp_partition_t
+{
+  esp_partition_type_t type;
+  uint32_t address;
+  uint32_t size;
+  char label[17];
+};
+
+
+struct NativePartition
+{
+  esp_partition_t partition;
+  std::vector<uint8_t> flash;
+  uint32_t writeMicros = 0;  //Native clock advance per write, stands in for the flash program time
+  int writes = 0;
+  int erases = 0;
+  uint32_t lastWriteOffset = 0;
+};
+
+inline NativePartition nativePartition;
+
+
+//Blank partition of the given size, size 0 for none
+inline void nativePartitionReset(uint32_t size)
+{
+  nativePartition.partition = esp_partition_t{ESP_PARTITION_TYPE_DATA, 0x3E0000, size, ""};
+  nativePartition.flash.assign(size, 0xFF);
+  nativePartition.writes = 0;
+  nativePartition.erases = 0;
+  nativePartition.lastWriteOffset = 0;
+}
+
+
+inline const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char* label)
+{
+  return nativePartition.partition.size > 0 ? &nativePartition.partition : NULL;
+}
+
+inline esp_err_t esp_partition_read(const esp_partition_t* partition, size_t offset, void* destination, size_t size)
+{
+  if(offset + size > partition->size)
+    return ESP_ERR_INVALID_SIZE;
+  memcpy(destination, &nativePartition.flash[offset], size);
+  return ESP_OK;
+}
+
+inline esp_err_t esp_partition_write(const esp_partition_t* partition, size_t offset, const void* source, size_t size)
+{
+  if(offset + size > partition->size)
+    return ESP_ERR_INVALID_SIZE;
+  for(size_t i = 0; i < size; i++)
+    nativePartition.flash[offset + i] &= ((const uint8_t*)source)[i];
+  nativePartition.writes++;
+  nativePartition.lastWriteOffset = offset;
+  nativeAdvanceMicros(nativePartition.writeMicros);
+  return ESP_OK;
+}
+
+inline esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size)
+{
+  if(offset % 4096 || size % 4096 || offset + size > partition->size)
+    return ESP_ERR_INVALID_SIZE;
+  memset(&nativePartition.flash[offset], 0xFF, size);
+  nativePartition.erases++;
+  return ESP_OK;
+}
+
+#endif
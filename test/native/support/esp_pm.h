@@ -0,0 +1,6 @@
+#ifndef ESP_PM_H
+#define ESP_PM_H
+
+//Empty on the host: power.h includes it for power.cpp, which the host unit tests do not build
+
+#endif
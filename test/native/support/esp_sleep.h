@@ -0,0 +1,6 @@
+#ifndef ESP_SLEEP_H
+#define ESP_SLEEP_H
+
+//Empty on the host: power.h includes it for power.cpp, which the host unit tests do not build
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef FIRMWARE_H
+#define FIRMWARE_H
+
+//Capture and encode path of the firmware for a suite: captureStep, encodeEvent and the modules they compute with
+//(baseline, context, FFT, sampler timing, store). What the path only notifies or counts in the other modules is a no-op
+//below, so the suite sees exactly the readings and messages the device would produce
+
+#include "../../../src/externals.cpp"
+#include "../../../src/baseline.cpp"
+#include "../../../src/context.cpp"
+#include "../../../src/fft.cpp"
+#include "../../../src/sampler.cpp"
+#include "../../../src/store.cpp"
+
+
+
+////////////////////Stubbed Modules////////////////////
+
+volatile bool captureFrozen = false;
+volatile bool captureParked = false;
+
+MqttStats mqttStats;
+VtcStats vtcStats;
+volatile bool vtcStatsResetRequested = false;
+SinkStats sinkStats[SINK_COUNT];
+Broker brokers[BROKER_MAX];
+uint32_t deliveryBoots = 0;
+
+void callback(char* topic, byte* payload, unsigned int length) {}
+void streamLog(const char* format, ...) {}
+bool streamActive() { return false; }
+void streamPush(const Sample& sample) {}
+
+void brokerParse(const char* list) {}
+const char* brokerList(char* buffer, size_t size) { return strlcpy(buffer, "", size), buffer; }
+const char* brokerActiveAddress(char* buffer, size_t size) { return strlcpy(buffer, "", size), buffer; }
+void brokerConnect() {}
+void brokerPublished(bool published) {}
+
+uint32_t deliveryNextSequence() { static uint32_t sequence = 0; return sequence++; }
+void pipelineNotify() {}
+bool sinkEnabled(SinkId sink) { return sink == SINK_MQTT; }
+void sinksFanOut(const EventBuffer& event) {}
+uint8_t sinksParse(const char* names) { return 1 << SINK_MQTT; }
+const char* sinksList(char* buffer, size_t size) { return strlcpy(buffer, "MQTT", size), buffer; }
+
+PowerState powerState() { return POWER_STATE_FULL; }
+PowerState powerStep(bool near) { return POWER_STATE_FULL; }
+
+bool traceInjectDue() { return false; }
+void traceInject(Sample& sample) {}
+uint8_t traceInjection(uint64_t micros) { return 0; }
+
+#endif
@@ -0,0 +1,245 @@
+#ifndef NATIVE_H
+#define NATIVE_H
+
+//Stand-ins for the Arduino, FreeRTOS and network definitions the modules under test use, for the host unit tests
+//(env:native). Tasks are never started, pins read as idle and nothing reaches a network, the tests drive the module
+//functions directly
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <chrono>
+#include <algorithm>
+#include <string>
+#include <deque>
+#include <vector>
+
+#include <ArduinoJson.h>
+#include <PubSubClient.h>
+#include <ETH.h>
+#include <EEPROM.h>
+#include <StreamUtils.h>
+
+#ifndef PI
+#define PI 3.1415926535897932384626433832795
+#endif
+
+
+
+////////////////////Arduino////////////////////
+
+#define IRAM_ATTR
+#define INPUT 0x01
+#define LOW 0x0
+#define HIGH 0x1
+#define RISING 0x01
+#define FALLING 0x02
+
+typedef uint8_t byte;
+
+using std::min;
+using std::max;
+
+#define constrain(value, low, high) ((value) < (low) ? (low) : ((value) > (high) ? (high) : (value)))
+
+inline uint16_t word(uint8_t high, uint8_t low)
+{
+  return high << 8 | low;
+}
+
+#if defined(__GLIBC__) && __GLIBC__ == 2 && __GLIBC_MINOR__ < 38
+inline size_t strlcpy(char* destination, const char* source, size_t size)
+{
+  size_t length = strlen(source);
+  if(size > 0)
+  {
+    size_t copied = length < size - 1 ? length : size - 1;
+    memcpy(destination, source, copied);
+    destination[copied] = '\0';
+  }
+  return length;
+}
+#endif
+
+inline uint64_t nativeMicrosOffset = 0;  //Time the tests added with nativeAdvanceMicros
+
+//Moves every clock forward, for code that measures itself against a time budget or runs on a simulated one
+inline void nativeAdvanceMicros(uint64_t us)
+{
+  nativeMicrosOffset += us;
+}
+
+inline int64_t esp_timer_get_time()
+{
+  using namespace std::chrono;
+  static const steady_clock::time_point boot = steady_clock::now();
+  return duration_cast<microseconds>(steady_clock::now() - boot).count() + nativeMicrosOffset;
+}
+
+inline uint32_t micros()
+{
+  return (uint32_t)esp_timer_get_time();
+}
+
+inline uint32_t millis()
+{
+  return esp_timer_get_time() / 1000;
+}
+
+inline void delay(uint32_t ms) { nativeAdvanceMicros(ms * 1000ULL); }  //Waits pass on the simulated clock at once
+inline uint16_t analogRead(uint8_t pin) { return 0; }
+inline int digitalRead(uint8_t pin) { return HIGH; }
+inline void pinMode(uint8_t pin, uint8_t mode) {}
+inline int digitalPinToInterrupt(uint8_t pin) { return pin; }
+inline void attachInterrupt(int interrupt, void (*handler)(), int mode) {}
+
+inline bool psramFound() { return false; }
+inline void* ps_malloc(size_t size) { return malloc(size); }
+
+//The sample timer never fires
+struct hw_timer_t {};
+inline hw_timer_t* timerBegin(uint8_t timer, uint16_t divider, bool countUp) { static hw_timer_t timers[4]; return &timers[timer]; }
+inline void timerAttachInterrupt(hw_timer_t* timer, void (*handler)(), bool edge) {}
+inline void timerAlarmWrite(hw_timer_t* timer, uint64_t alarm, bool reload) {}
+inline void timerAlarmEnable(hw_timer_t* timer) {}
+inline void timerAlarmDisable(hw_timer_t* timer) {}
+inline void timerWrite(hw_timer_t* timer, uint64_t value) {}
+
+
+//Serial output is dropped and input is always empty
+class HardwareSerial
+{
+  public:
+    void begin(unsigned long baud) {}
+    void end() {}
+    void flush() {}
+    void setTimeout(unsigned long ms) {}
+    int available() { return 0; }
+    int read() { return -1; }
+    size_t readBytes(uint8_t* buffer, size_t length) { return 0; }
+    size_t readBytesUntil(char terminator, char* buffer, size_t length) { return 0; }
+    size_t write(uint8_t byte) { return 1; }
+    size_t write(const uint8_t* buffer, size_t length) { return length; }
+    template<typename T> size_t print(const T& value) { return 0; }
+    template<typename T> size_t println(const T& value) { return 0; }
+    size_t println() { return 0; }
+    size_t printf(const char* format, ...) { return 0; }
+    operator bool() { return true; }
+};
+
+inline HardwareSerial Serial;
+
+
+class EspClass
+{
+  public:
+    uint64_t getEfuseMac() { return 0x0000A1B2C3D4E5F6ULL; }
+    uint32_t getFreeHeap() { return 200000; }
+    uint32_t getMinFreeHeap() { return 180000; }
+    uint32_t getMaxAllocHeap() { return 110000; }
+    void restart() {}
+};
+
+inline EspClass ESP;
+
+
+
+////////////////////FreeRTOS////////////////////
+
+typedef void* TaskHandle_t;
+typedef int BaseType_t;
+typedef uint32_t TickType_t;
+typedef int portMUX_TYPE;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define portMAX_DELAY 0xFFFFFFFF
+#define configMAX_PRIORITIES 25
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define portYIELD_FROM_ISR()
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+
+//No task ever runs, so a wait times out at once and a notification goes nowhere
+inline uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks) { return 0; }
+inline void xTaskNotifyGive(TaskHandle_t task) {}
+inline void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* woken) {}
+inline void vTaskDelay(TickType_t ticks) {}
+inline void vTaskDelete(TaskHandle_t task) {}
+inline void vTaskSuspend(TaskHandle_t task) {}
+inline TaskHandle_t xTaskGetCurrentTaskHandle() { static int task; return &task; }  //The one host thread
+inline uint32_t uxTaskGetStackHighWaterMark(TaskHandle_t task) { return 0; }
+
+inline BaseType_t xTaskCreatePinnedToCore(void (*task)(void*), const char* name, uint32_t stack, void* parameter,
+                                          int priority, TaskHandle_t* handle, int core)
+{
+  static int tasks = 0;
+  if(handle)
+    *handle = &tasks;
+  tasks++;
+  return pdTRUE;
+}
+
+
+//Queues work within one thread: a send that finds it full and a receive that finds it empty fail at once
+struct NativeQueue
+{
+  size_t length;
+  size_t itemSize;
+  std::deque<std::vector<uint8_t>> items;
+};
+
+typedef NativeQueue* QueueHandle_t;
+
+inline QueueHandle_t xQueueCreate(size_t length, size_t itemSize)
+{
+  return new NativeQueue{length, itemSize, {}};
+}
+
+inline BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticks)
+{
+  if(queue->items.size() >= queue->length)
+    return pdFALSE;
+  queue->items.emplace_back((const uint8_t*)item, (const uint8_t*)item + queue->itemSize);
+  return pdTRUE;
+}
+
+inline BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t ticks)
+{
+  if(queue->items.empty())
+    return pdFALSE;
+  memcpy(item, queue->items.front().data(), queue->itemSize);
+  queue->items.pop_front();
+  return pdTRUE;
+}
+
+inline uint32_t uxQueueMessagesWaiting(QueueHandle_t queue) { return queue->items.size(); }
+inline uint32_t uxQueueSpacesAvailable(QueueHandle_t queue) { return queue->length - queue->items.size(); }
+inline BaseType_t xQueueReset(QueueHandle_t queue) { queue->items.clear(); return pdTRUE; }
+
+
+
+////////////////////Network////////////////////
+
+//NTP never answers
+class WiFiUDP
+{
+  public:
+    uint8_t begin(uint16_t port) { return 1; }
+    int parsePacket() { return 0; }
+    int beginPacket(IPAddress address, uint16_t port) { return 1; }
+    size_t write(const uint8_t* buffer, size_t length) { return length; }
+    int endPacket() { return 1; }
+    int read(uint8_t* buffer, size_t length) { return 0; }
+};
+
+#include "Queue.h"  //Last, it uses Serial and delay
+
+#endif
@@ -0,0 +1,89 @@
+#include <unity.h>
+#include "firmware.h"
+#include "../../../src/bench.cpp"
+
+
+
+////////////////////Host Benchmarks////////////////////
+
+//The BENCH run on the host (env:native-bench): the same benchmarks, steps and result lines as on the device, published
+//to the scripted client and printed here, so the hardware-independent ones (encode, FFT, command parse, ..) can be
+//compared between builds without a board. Allocations are counted through the same linker wraps
+
+static NetworkObject benchNetwork(IPAddress(192, 168, 100, 20), IPAddress(192, 168, 100, 1), IPAddress(255, 255, 255, 0),
+                                  IPAddress(192, 168, 100, 1), IPAddress(192, 168, 100, 2), "SITE01", "EQ1");
+
+static int benchSteps = 0;
+
+
+/**
+ * @brief Result line of a benchmark from the last run
+ *
+ * @param name Benchmark name
+ * @return const char* NULL if it did not report
+ */
+static const char* benchLine(const char* name)
+{
+  char prefix[48];
+  snprintf(prefix, sizeof(prefix), "{\"BENCH\":\"%s\",", name);
+  for(const NativeMessage& message : mqttClient.messages)
+    if(message.payload.compare(0, strlen(prefix), prefix) == 0)
+      return message.payload.c_str();
+  return NULL;
+}
+
+
+
+////////////////////Tests////////////////////
+
+void setUp() {}
+void tearDown() {}
+
+
+//Every benchmark reports once, each spread over its warmup and BENCH_STEPS timed steps
+void test_run_reports_every_benchmark()
+{
+  mqttClient = PubSubClient();
+  mqttClient.connect("NARC");
+  strlcpy(publishTopicInfo, "NARCCCCC!/SITE01/EQ1/Info", sizeof(publishTopicInfo));
+
+  TEST_ASSERT_TRUE(benchStart(benchNetwork));
+  for(benchSteps = 0; benchStep() && benchSteps < 10000; benchSteps++) {}
+
+  int ffts = 0;
+  for(uint16_t n = BENCH_FFT_MIN_SIZE; n <= FFT_MAX_SIZE; n <<= 1)
+    ffts++;
+  int reported = BENCH_TABLE_COUNT + ffts;
+
+  TEST_ASSERT_EQUAL_INT(reported, mqttClient.published);
+  TEST_ASSERT_EQUAL_INT(reported * (BENCH_STEPS + 1), benchSteps);
+  TEST_ASSERT_FALSE(benchStep());
+
+  for(const NativeMessage& message : mqttClient.messages)
+  {
+    TEST_ASSERT_EQUAL_STRING(publishTopicInfo, message.topic.c_str());
+    printf("%s\n", message.payload.c_str());
+  }
+}
+
+
+//Capturing and the spectral summary never allocate
+void test_capture_path_does_not_allocate()
+{
+  for(const char* name : {"capture_push", "capture_copy", "capture_at", "capture_trigger", "capture_trigger_raw",
+                          "fft_32", "fft_256"})
+  {
+    const char* line = benchLine(name);
+    TEST_ASSERT_NOT_NULL_MESSAGE(line, name);
+    TEST_ASSERT_NOT_NULL_MESSAGE(strstr(line, "\"ALLOCS\":0.00}"), line);
+  }
+}
+
+
+int main(int argc, char** argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_run_reports_every_benchmark);
+  RUN_TEST(test_capture_path_does_not_allocate);
+  return UNITY_END();
+}
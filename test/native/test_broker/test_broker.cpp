@@ -0,0 +1,211 @@
+#include <unity.h>
+#include "../../../src/broker.cpp"
+
+
+
+////////////////////Stand-ins////////////////////
+
+//The connection manager against the scripted client (support/PubSubClient.h): a broker is down while its address is in
+//mqttClient.refused. delay() moves the simulated clock, so FAILOVER and BROKER_RETRY_MS pass without waiting
+PubSubClient mqttClient;
+char globalClientID[ID_SIZE] = "NARC_A1B2C3D4E5F6";
+uint32_t globalFailoverMs = 3000;
+
+IPAddress stringToIP(const char* IPString)
+{
+  IPAddress address;
+  address.fromString(IPString);
+  return address;
+}
+
+char* ipToString(IPAddress ip, char* buffer)
+{
+  snprintf(buffer, IP_STRING_SIZE, "%u.%u.%u.%u", ip & 0xFF, (ip >> 8) & 0xFF, (ip >> 16) & 0xFF, ip >> 24);
+  return buffer;
+}
+
+void streamLog(const char* format, ...) {}
+
+
+static void brokerDown(const char* address)
+{
+  mqttClient.refused.push_back(stringToIP(address));
+}
+
+
+static void brokerUp(const char* address)
+{
+  mqttClient.refused.erase(std::remove(mqttClient.refused.begin(), mqttClient.refused.end(), (uint32_t)stringToIP(address)),
+                           mqttClient.refused.end());
+}
+
+
+static const char* activeAddress()
+{
+  static char address[BROKER_ADDRESS_SIZE];
+  return brokerActiveAddress(address, sizeof(address));
+}
+
+
+
+////////////////////Tests////////////////////
+
+void setUp()
+{
+  mqttClient = PubSubClient();
+  memset(brokerStats, 0, sizeof(brokerStats));
+  failoverStats = {0, 0, 0, 0};
+  globalFailoverMs = 3000;
+  active = 0;
+  brokerParse("10.0.0.5,10.0.0.6:1884,10.0.0.7");
+}
+
+void tearDown() {}
+
+
+void test_parse_and_list()
+{
+  char list[BROKER_LIST_SIZE];
+  TEST_ASSERT_EQUAL_INT(3, brokerCount);
+  TEST_ASSERT_EQUAL_UINT16(MQTT_PORT, brokers[0].port);
+  TEST_ASSERT_EQUAL_UINT16(1884, brokers[1].port);
+  TEST_ASSERT_EQUAL_STRING("10.0.0.5,10.0.0.6:1884,10.0.0.7", brokerList(list, sizeof(list)));
+
+  brokerParse("10.0.0.1,10.0.0.2,10.0.0.3,10.0.0.4,10.0.0.9");  //Past BROKER_MAX
+  TEST_ASSERT_EQUAL_INT(BROKER_MAX, brokerCount);
+  TEST_ASSERT_EQUAL_STRING("10.0.0.1,10.0.0.2,10.0.0.3,10.0.0.4", brokerList(list, sizeof(list)));
+}
+
+
+void test_connects_to_the_preferred_broker()
+{
+  brokerConnect();
+
+  TEST_ASSERT_TRUE(mqttClient.connected());
+  TEST_ASSERT_EQUAL_UINT32((uint32_t)brokers[0].address, mqttClient.serverAddress);
+  TEST_ASSERT_EQUAL_STRING("10.0.0.5", activeAddress());
+  TEST_ASSERT_EQUAL_UINT32(1, brokerStats[0].connects);
+  TEST_ASSERT_TRUE(brokerStats[0].up);
+  TEST_ASSERT_EQUAL_UINT32(0, failoverStats.failovers);
+}
+
+
+//Retried every BROKER_RETRY_MS until FAILOVER ms have passed, then the next one: tries at 0, 1, 2 and 3 s, connected at 4 s
+void test_fails_over_after_the_failover_time()
+{
+  brokerDown("10.0.0.5");
+  brokerConnect();
+
+  TEST_ASSERT_TRUE(mqttClient.connected());
+  TEST_ASSERT_EQUAL_STRING("10.0.0.6:1884", activeAddress());
+  TEST_ASSERT_EQUAL_UINT16(1884, mqttClient.serverPort);
+  TEST_ASSERT_EQUAL_UINT32(4, brokerStats[0].connectFailures);
+  TEST_ASSERT_FALSE(brokerStats[0].up);
+  TEST_ASSERT_EQUAL_UINT32(1, brokerStats[1].connects);
+  TEST_ASSERT_EQUAL_UINT32(1, failoverStats.failovers);
+  TEST_ASSERT_UINT32_WITHIN(50, 4000, failoverStats.lastMillis);
+  TEST_ASSERT_EQUAL_UINT32(failoverStats.lastMillis, failoverStats.maxMillis);
+}
+
+
+//Down the list and back around to the first. The next broker is tried BROKER_RETRY_MS after the switch: 1 at 0..3 s,
+//2 at 4..6 s, 0 at 7 s
+void test_failover_wraps_around()
+{
+  brokerDown("10.0.0.6");
+  brokerDown("10.0.0.7");
+  active = 1;
+  brokerConnect();
+
+  TEST_ASSERT_EQUAL_STRING("10.0.0.5", activeAddress());
+  TEST_ASSERT_EQUAL_UINT32(4, brokerStats[1].connectFailures);
+  TEST_ASSERT_EQUAL_UINT32(3, brokerStats[2].connectFailures);
+  TEST_ASSERT_EQUAL_UINT32(1, failoverStats.failovers);  //One loss, one failover, however many brokers were skipped
+  TEST_ASSERT_UINT32_WITHIN(50, 7000, failoverStats.lastMillis);
+}
+
+
+//A single broker is retried for as long as it takes
+void test_single_broker_never_fails_over()
+{
+  brokerParse("10.0.0.5");
+  mqttClient.refuseNext = 10;
+  brokerConnect();
+
+  TEST_ASSERT_TRUE(mqttClient.connected());
+  TEST_ASSERT_EQUAL_STRING("10.0.0.5", activeAddress());
+  TEST_ASSERT_EQUAL_UINT32(10, brokerStats[0].connectFailures);
+  TEST_ASSERT_EQUAL_UINT32(0, failoverStats.failovers);
+}
+
+
+//Back to the preferred broker only after BROKER_RECOVER_PROBES good probes in a row, then a plain reconnect
+void test_moves_back_once_recovered()
+{
+  brokerDown("10.0.0.5");
+  brokerConnect();
+  TEST_ASSERT_EQUAL_STRING("10.0.0.6:1884", activeAddress());
+  brokerUp("10.0.0.5");
+
+  brokerStats[0].goodProbes = BROKER_RECOVER_PROBES - 1;  //What PROBE_TASK counts
+  brokerStep();
+  TEST_ASSERT_TRUE(mqttClient.connected());
+  TEST_ASSERT_EQUAL_STRING("10.0.0.6:1884", activeAddress());
+
+  brokerStats[0].goodProbes = BROKER_RECOVER_PROBES;
+  brokerStep();
+  TEST_ASSERT_FALSE(mqttClient.connected());  //MQTT_TASK reconnects on its next loop
+  TEST_ASSERT_EQUAL_STRING("10.0.0.5", activeAddress());
+  TEST_ASSERT_EQUAL_UINT8(0, brokerStats[0].goodProbes);
+  TEST_ASSERT_EQUAL_UINT32(1, failoverStats.recoveries);
+
+  brokerConnect();
+  TEST_ASSERT_TRUE(mqttClient.connected());
+  TEST_ASSERT_EQUAL_UINT32((uint32_t)brokers[0].address, mqttClient.serverAddress);
+  TEST_ASSERT_EQUAL_UINT32(1, failoverStats.failovers);  //A recovery is not a failover
+}
+
+
+//Brokers after the active one are never probed or moved to by brokerStep
+void test_step_ignores_less_preferred_brokers()
+{
+  brokerConnect();
+  brokerStats[1].goodProbes = BROKER_RECOVER_PROBES;
+  brokerStep();
+
+  TEST_ASSERT_TRUE(mqttClient.connected());
+  TEST_ASSERT_EQUAL_STRING("10.0.0.5", activeAddress());
+  TEST_ASSERT_EQUAL_UINT32(0, failoverStats.recoveries);
+}
+
+
+void test_stats()
+{
+  brokerDown("10.0.0.5");
+  brokerConnect();
+  brokerPublished(true);
+  brokerPublished(false);
+
+  char stats[256];
+  generateBrokerStats(stats, 0, sizeof(stats));
+  char expected[256];
+  snprintf(expected, sizeof(expected),
+           ",\"BROKER\":1,\"BROKERS\":[[\"10.0.0.5\",0,0,4,0,0],[\"10.0.0.6:1884\",1,1,0,1,1],[\"10.0.0.7\",0,0,0,0,0]],"
+           "\"FAILOVER\":[1,0,%lu,%lu]", (unsigned long)failoverStats.lastMillis, (unsigned long)failoverStats.maxMillis);
+  TEST_ASSERT_EQUAL_STRING(expected, stats);
+}
+
+
+int main(int argc, char** argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_parse_and_list);
+  RUN_TEST(test_connects_to_the_preferred_broker);
+  RUN_TEST(test_fails_over_after_the_failover_time);
+  RUN_TEST(test_failover_wraps_around);
+  RUN_TEST(test_single_broker_never_fails_over);
+  RUN_TEST(test_moves_back_once_recovered);
+  RUN_TEST(test_step_ignores_less_preferred_brokers);
+  RUN_TEST(test_stats);
+  return UNITY_END();
+}
@@ -0,0 +1,192 @@
+#include <unity.h>
+#include "../../../src/fft.cpp"
+
+
+
+////////////////////Reference////////////////////
+
+//Float DFT of the same input, scaled by 1/n like fftTransform
+static void referenceDft(const int16_t* input, int n, double* re, double* im)
+{
+  for(int k = 0; k < n; k++)
+  {
+    re[k] = 0;
+    im[k] = 0;
+    for(int t = 0; t < n; t++)
+    {
+      double angle = -2.0 * M_PI * k * t / n;
+      re[k] += input[t] * cos(angle);
+      im[k] += input[t] * sin(angle);
+    }
+    re[k] /= n;
+    im[k] /= n;
+  }
+}
+
+
+//Raw ADC capture of tones around a 12 bit mid-scale, frequencies in bins of an n point transform
+static void synthesize(uint16_t* samples, int count, int n, const double* bins, const double* amplitudes, int tones)
+{
+  for(int i = 0; i < count; i++)
+  {
+    double value = 2048;
+    for(int t = 0; t < tones; t++)
+      value += amplitudes[t] * sin(2.0 * M_PI * bins[t] * i / n);
+    samples[i] = (uint16_t)lround(value);
+  }
+}
+
+
+
+////////////////////Tests////////////////////
+
+void setUp()
+{
+  fftInit();
+}
+
+void tearDown() {}
+
+
+void test_size_for()
+{
+  TEST_ASSERT_EQUAL_UINT16(2, fftSizeFor(1));
+  TEST_ASSERT_EQUAL_UINT16(64, fftSizeFor(40));
+  TEST_ASSERT_EQUAL_UINT16(64, fftSizeFor(64));
+  TEST_ASSERT_EQUAL_UINT16(FFT_MAX_SIZE, fftSizeFor(FFT_MAX_SIZE + 100));
+}
+
+
+//Every length matches the float DFT within the rounding of one halving per stage
+void test_transform_matches_dft()
+{
+  static int16_t input[FFT_MAX_SIZE];
+  static int16_t re[FFT_MAX_SIZE], im[FFT_MAX_SIZE];
+  static double refRe[FFT_MAX_SIZE], refIm[FFT_MAX_SIZE];
+
+  srand(1);
+  for(int n = 2; n <= FFT_MAX_SIZE; n <<= 1)
+  {
+    for(int i = 0; i < n; i++)
+    {
+      input[i] = (int16_t)((rand() % 65536) - 32768);
+      re[i] = input[i];
+      im[i] = 0;
+    }
+
+    fftTransform(re, im, n);
+    referenceDft(input, n, refRe, refIm);
+
+    int stages = 0;
+    for(int m = n; m > 1; m >>= 1)
+      stages++;
+    double tolerance = 1.5 * stages + 1;  //LSBs, each stage truncates once
+
+    for(int k = 0; k < n; k++)
+    {
+      TEST_ASSERT_DOUBLE_WITHIN(tolerance, refRe[k], re[k]);
+      TEST_ASSERT_DOUBLE_WITHIN(tolerance, refIm[k], im[k]);
+    }
+  }
+}
+
+
+//A tone between bins leaks into its neighbours, they must not take the other peak slots
+void test_summary_one_tone_one_peak()
+{
+  static uint16_t samples[FFT_MAX_SIZE];
+  const double bins[] = {20.4};
+  const double amplitudes[] = {1500};
+  synthesize(samples, 128, 128, bins, amplitudes, 1);
+
+  SpectralSummary summary;
+  fftSummary(samples, 128, 1280.0f, &summary);
+
+  TEST_ASSERT_EQUAL_UINT16(128, summary.size);
+  TEST_ASSERT_EQUAL_FLOAT(10.0f, summary.binHz);
+  TEST_ASSERT_EQUAL_UINT16(20, summary.peakBin[0]);
+  for(int k = 1; k < FFT_TOP_K; k++)
+    if(summary.peakPower[k] > 0)
+      TEST_ASSERT_TRUE(abs((int)summary.peakBin[k] - 20) > 1);
+}
+
+
+//Separate tones come out strongest first
+void test_summary_peaks_ordered()
+{
+  static uint16_t samples[FFT_MAX_SIZE];
+  const double bins[] = {10, 30, 50};
+  const double amplitudes[] = {400, 1200, 800};
+  synthesize(samples, 128, 128, bins, amplitudes, 3);
+
+  SpectralSummary summary;
+  fftSummary(samples, 128, 1000.0f, &summary);
+
+  TEST_ASSERT_EQUAL_UINT16(30, summary.peakBin[0]);
+  TEST_ASSERT_EQUAL_UINT16(50, summary.peakBin[1]);
+  TEST_ASSERT_EQUAL_UINT16(10, summary.peakBin[2]);
+  TEST_ASSERT_TRUE(summary.peakPower[0] > summary.peakPower[1]);
+  TEST_ASSERT_TRUE(summary.peakPower[1] > summary.peakPower[2]);
+}
+
+
+//Band energies are the reference power summed per band, within fixed-point rounding
+void test_summary_band_energy_matches_dft()
+{
+  static uint16_t samples[FFT_MAX_SIZE];
+  static int16_t scaled[FFT_MAX_SIZE];
+  static double refRe[FFT_MAX_SIZE], refIm[FFT_MAX_SIZE];
+  const double bins[] = {5.3, 40.7, 90.1};
+  const double amplitudes[] = {900, 600, 300};
+  int n = FFT_MAX_SIZE;
+  synthesize(samples, n, n, bins, amplitudes, 3);
+
+  SpectralSummary summary;
+  fftSummary(samples, n, 1000.0f, &summary);
+
+  //Same preprocessing as fftSummary: integer mean removed, Q15 by shifting 3
+  int32_t sum = 0;
+  for(int i = 0; i < n; i++)
+    sum += samples[i];
+  for(int i = 0; i < n; i++)
+    scaled[i] = (int16_t)((samples[i] - sum / n) << 3);
+  referenceDft(scaled, n, refRe, refIm);
+
+  double bands[FFT_BANDS] = {0};
+  int binsPerBand = (n / 2) / FFT_BANDS;
+  for(int bin = 1; bin < n / 2; bin++)
+    bands[bin / binsPerBand < FFT_BANDS ? bin / binsPerBand : FFT_BANDS - 1] += refRe[bin] * refRe[bin] + refIm[bin] * refIm[bin];
+
+  for(int b = 0; b < FFT_BANDS; b++)
+    TEST_ASSERT_DOUBLE_WITHIN(bands[b] * 0.05 + 64, bands[b], summary.bandEnergy[b]);
+}
+
+
+//A flat capture has no spectrum
+void test_summary_flat()
+{
+  static uint16_t samples[64];
+  for(int i = 0; i < 64; i++)
+    samples[i] = 1234;
+
+  SpectralSummary summary;
+  fftSummary(samples, 64, 1000.0f, &summary);
+
+  for(int k = 0; k < FFT_TOP_K; k++)
+    TEST_ASSERT_EQUAL_UINT32(0, summary.peakPower[k]);
+  for(int b = 0; b < FFT_BANDS; b++)
+    TEST_ASSERT_EQUAL_UINT32(0, summary.bandEnergy[b]);
+}
+
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_size_for);
+  RUN_TEST(test_transform_matches_dft);
+  RUN_TEST(test_summary_one_tone_one_peak);
+  RUN_TEST(test_summary_peaks_ordered);
+  RUN_TEST(test_summary_band_energy_matches_dft);
+  RUN_TEST(test_summary_flat);
+  return UNITY_END();
+}
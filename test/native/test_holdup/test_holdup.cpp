@@ -0,0 +1,286 @@
+#include <unity.h>
+#include "../../../src/holdup.cpp"
+
+
+
+////////////////////Stand-ins////////////////////
+
+//Modules the flush and the recovery use, driven by the tests. The partition writer is support/esp_partition.h
+EventBuffer dataSet;
+pthread_mutex_t mutexHandle = PTHREAD_MUTEX_INITIALIZER;
+PubSubClient mqttClient;
+char publishTopicInfo[TOPIC_SIZE] = "NARCCCCC!/SITE01/EQ1/Info";
+
+static EventBuffer queued[48];  //Events in the store, oldest first
+static int queuedCount = 0;
+static uint32_t publishedSequences[64];  //Events publishEvent was handed, failed ones included
+static int publishedCount = 0;
+static int publishFailAt = -1;  //Call that fails, -1 for none
+
+const EventBuffer* storeNext(const EventBuffer* after)
+{
+  int next = after ? (int)(after - queued) + 1 : 0;
+  return next < queuedCount ? &queued[next] : NULL;
+}
+
+int storeCount() { return queuedCount; }
+int pipelineUndelivered(const EventBuffer** events, int max) { return 0; }
+bool publishEvent(NetworkObject& object, const EventBuffer& event)
+{
+  bool published = publishedCount != publishFailAt;
+  publishedSequences[publishedCount++] = event.sequence();
+  return published;
+}
+void powerHoldup() {}
+void powerHoldupWait() {}
+void reset() {}
+void streamLog(const char* format, ...) {}
+
+
+static void fillEvent(EventBuffer& event, uint32_t sequence)
+{
+  Sample sample = {};
+  event.clear();
+  for(int i = 0; i < QUEUE_RANGE; i++)
+  {
+    sample.micros = i;
+    sample.values[0] = (uint16_t)(sequence + i);
+    event.push(sample);
+  }
+  event.setSequence(sequence);
+}
+
+
+static void queueEvents(int count)
+{
+  for(int i = 0; i < count; i++)
+    fillEvent(queued[i], 100 + i);
+  queuedCount = count;
+}
+
+
+static HoldupHeader recordHeader()
+{
+  HoldupHeader header;
+  esp_partition_read(holdupPartition, 0, &header, sizeof(header));
+  return header;
+}
+
+
+static uint32_t recordSequence(int index)
+{
+  static EventBuffer event;
+  esp_partition_read(holdupPartition, HOLDUP_DATA_OFFSET + index * sizeof(EventBuffer), &event, sizeof(EventBuffer));
+  return event.sequence();
+}
+
+
+//A power-fail signal at this moment, the way powerFailISR raises it
+static void powerFail()
+{
+  powerFailMicros = micros();
+  captureFrozen = true;
+}
+
+
+static NetworkObject& network()
+{
+  //Never dereferenced, publishEvent above only looks at the event
+  alignas(NetworkObject) static uint8_t storage[sizeof(NetworkObject)];
+  return *reinterpret_cast<NetworkObject*>(storage);
+}
+
+
+
+////////////////////Tests////////////////////
+
+void setUp()
+{
+  nativePartitionReset(0x10000);  //Size of "holdup" in partitions.csv
+  nativePartition.writeMicros = 0;
+  captureFrozen = false;
+  captureParked = true;
+  holdupPublished = 0;
+  fillEvent(dataSet, 99);
+  queueEvents(0);
+  publishedCount = 0;
+  publishFailAt = -1;
+  mqttClient = PubSubClient();
+  mqttClient.connect("NARC");
+  holdupInit();
+}
+
+void tearDown() {}
+
+
+void test_init_arms_a_blank_partition()
+{
+  TEST_ASSERT_TRUE(holdupArmed);
+  TEST_ASSERT_FALSE(holdupRecovered);
+  TEST_ASSERT_EQUAL_INT(HOLDUP_MAX_EVENTS, holdupCapacity);
+  TEST_ASSERT_EQUAL_UINT32(0, holdupEraseSize % 4096);
+  TEST_ASSERT_GREATER_OR_EQUAL(HOLDUP_DATA_OFFSET + HOLDUP_MAX_EVENTS * sizeof(EventBuffer), holdupEraseSize);
+}
+
+
+void test_room_counts_events_and_budget()
+{
+  HoldupHeader header = {};
+  powerFail();
+
+  TEST_ASSERT_TRUE(holdupRoom(header, 0));
+  TEST_ASSERT_TRUE(holdupRoom(header, HOLDUP_BUDGET_US / 2));
+  TEST_ASSERT_FALSE(holdupRoom(header, HOLDUP_BUDGET_US + 1));
+
+  header.eventCount = holdupCapacity - 1;
+  TEST_ASSERT_TRUE(holdupRoom(header, 0));
+  header.eventCount = holdupCapacity;
+  TEST_ASSERT_FALSE(holdupRoom(header, 0));
+
+  //Time already spent since the signal counts against the budget
+  header.eventCount = 0;
+  nativeAdvanceMicros(HOLDUP_BUDGET_US - 1000);
+  TEST_ASSERT_TRUE(holdupRoom(header, 500));
+  TEST_ASSERT_FALSE(holdupRoom(header, 2000));
+}
+
+
+//Live ring first, then the store oldest first, back to back from HOLDUP_DATA_OFFSET, header at 0 written last
+void test_record_layout()
+{
+  queueEvents(3);
+  powerFail();
+  holdupFlush();
+
+  HoldupHeader header = recordHeader();
+  TEST_ASSERT_EQUAL_UINT32(HOLDUP_MAGIC, header.magic);
+  TEST_ASSERT_EQUAL_UINT16(CHANNEL_COUNT, header.channels);
+  TEST_ASSERT_EQUAL_UINT16(4, header.eventCount);
+  TEST_ASSERT_EQUAL_UINT16(0, header.omitted);
+  TEST_ASSERT_EQUAL_UINT16(0, header.flags);
+  TEST_ASSERT_EQUAL_UINT16(0, header.simulated);
+
+  TEST_ASSERT_EQUAL_UINT32(99, recordSequence(0));
+  for(int i = 0; i < 3; i++)
+    TEST_ASSERT_EQUAL_UINT32(100 + i, recordSequence(i + 1));
+
+  TEST_ASSERT_EQUAL_INT(5, nativePartition.writes);
+  TEST_ASSERT_EQUAL_UINT32(0, nativePartition.lastWriteOffset);
+  TEST_ASSERT_FALSE(holdupArmed);
+}
+
+
+//With every write taking 6 ms of a 20 ms budget, the fourth would overrun it: three are written, the rest counted
+void test_budget_stops_the_flush()
+{
+  queueEvents(5);
+  nativePartition.writeMicros = 6000;
+  powerFail();
+  holdupFlush();
+
+  HoldupHeader header = recordHeader();
+  TEST_ASSERT_EQUAL_UINT16(3, header.eventCount);
+  TEST_ASSERT_EQUAL_UINT16(3, header.omitted);
+  TEST_ASSERT_GREATER_OR_EQUAL(18000, header.flushMicros);
+  TEST_ASSERT_LESS_OR_EQUAL(HOLDUP_BUDGET_US, header.flushMicros);
+}
+
+
+void test_capacity_stops_the_flush()
+{
+  queueEvents(HOLDUP_MAX_EVENTS + 4);
+  powerFail();
+  holdupFlush();
+
+  HoldupHeader header = recordHeader();
+  TEST_ASSERT_EQUAL_UINT16(HOLDUP_MAX_EVENTS, header.eventCount);
+  TEST_ASSERT_EQUAL_UINT16(5, header.omitted);  //Live ring took one slot
+}
+
+
+void test_busy_store_is_skipped_and_flagged()
+{
+  queueEvents(2);
+  captureParked = false;  //VTC_TASK never parks either
+  pthread_mutex_lock(&mutexHandle);
+  powerFail();
+  holdupFlush();
+  pthread_mutex_unlock(&mutexHandle);
+
+  HoldupHeader header = recordHeader();
+  TEST_ASSERT_EQUAL_UINT16(1, header.eventCount);
+  TEST_ASSERT_EQUAL_UINT16(2, header.omitted);
+  TEST_ASSERT_EQUAL_UINT16(HOLDUP_STORE_SKIPPED | HOLDUP_RING_TORN, header.flags);
+}
+
+
+//A publish that fails keeps the record on flash, the next call resumes with that event and only then erases
+void test_recovery_erases_only_after_everything_went_out()
+{
+  queueEvents(2);
+  powerFail();
+  holdupFlush();
+  holdupInit();  //Next boot finds the record
+  TEST_ASSERT_TRUE(holdupRecovered);
+  TEST_ASSERT_FALSE(holdupArmed);
+
+  int erases = nativePartition.erases;
+  publishFailAt = 1;
+  TEST_ASSERT_FALSE(holdupPublishRecovered(network()));
+  TEST_ASSERT_EQUAL_INT(erases, nativePartition.erases);
+  TEST_ASSERT_EQUAL_UINT32(HOLDUP_MAGIC, recordHeader().magic);
+  TEST_ASSERT_FALSE(holdupArmed);
+
+  TEST_ASSERT_TRUE(holdupPublishRecovered(network()));
+  TEST_ASSERT_EQUAL_INT(4, publishedCount);
+  TEST_ASSERT_EQUAL_UINT32(99, publishedSequences[0]);
+  TEST_ASSERT_EQUAL_UINT32(100, publishedSequences[1]);  //Failed
+  TEST_ASSERT_EQUAL_UINT32(100, publishedSequences[2]);
+  TEST_ASSERT_EQUAL_UINT32(101, publishedSequences[3]);
+  TEST_ASSERT_EQUAL_INT(1, mqttClient.published);
+  TEST_ASSERT_EQUAL_STRING(publishTopicInfo, mqttClient.messages[0].topic.c_str());
+  TEST_ASSERT_NOT_NULL(strstr(mqttClient.messages[0].payload.c_str(), "{\"POWERFAIL\":{\"EVENTS\":3,\"OMITTED\":0,"));
+  TEST_ASSERT_EQUAL_INT(erases + 1, nativePartition.erases);
+  TEST_ASSERT_TRUE(holdupArmed);
+  TEST_ASSERT_FALSE(holdupRecovered);
+
+  TEST_ASSERT_TRUE(holdupPublishRecovered(network()));
+  TEST_ASSERT_EQUAL_INT(4, publishedCount);
+}
+
+
+//The report is part of the record too: while it has not gone out nothing is erased
+void test_recovery_keeps_the_record_until_the_report_is_out()
+{
+  powerFail();
+  holdupFlush();
+  holdupInit();
+
+  int erases = nativePartition.erases;
+  mqttClient.failPublishAt = 0;
+  TEST_ASSERT_FALSE(holdupPublishRecovered(network()));
+  TEST_ASSERT_EQUAL_INT(erases, nativePartition.erases);
+  TEST_ASSERT_FALSE(holdupArmed);
+
+  mqttClient.failPublishAt = -1;
+  mqttClient.connect("NARC");
+  TEST_ASSERT_TRUE(holdupPublishRecovered(network()));
+  TEST_ASSERT_EQUAL_INT(1, publishedCount);  //The event is not sent twice
+  TEST_ASSERT_EQUAL_INT(erases + 1, nativePartition.erases);
+  TEST_ASSERT_TRUE(holdupArmed);
+}
+
+
+int main(int argc, char** argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_init_arms_a_blank_partition);
+  RUN_TEST(test_room_counts_events_and_budget);
+  RUN_TEST(test_record_layout);
+  RUN_TEST(test_budget_stops_the_flush);
+  RUN_TEST(test_capacity_stops_the_flush);
+  RUN_TEST(test_busy_store_is_skipped_and_flagged);
+  RUN_TEST(test_recovery_erases_only_after_everything_went_out);
+  RUN_TEST(test_recovery_keeps_the_record_until_the_report_is_out);
+  return UNITY_END();
+}
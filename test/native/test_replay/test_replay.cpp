@@ -0,0 +1,326 @@
+#include <unity.h>
+#include "firmware.h"
+#include <fstream>
+
+
+
+////////////////////Replay////////////////////
+
+//Recorded V/I traces run through captureStep under a clock driven by the trace, every event encoded the way the Data topic
+//carries it and compared line by line with the golden output of a known-good build. Traces, next to this file:
+//  trace.csv: one "micros,ch0,ch1,..." line per reading (raw counts in CHANNEL_DESCRIPTORS order, micros since the start
+//             of the trace), then "END". Missing columns read as 0
+//  trace.bin: the same readings as little-endian records {uint32 micros, uint16 raw count per channel}, ended by
+//             micros = REPLAY_END_MICROS
+//Run with NARC_GOLDEN_UPDATE=1 in the environment to rewrite the golden files from this build instead of checking them
+
+#define REPLAY_EPOCH 1681234567UL  //Device local time the simulated clock starts at (2023-04-11)
+#define REPLAY_THRESHOLD 2500.0f  //VTHRESHOLD of the runs, the traces swell past it three times
+#define REPLAY_LINE_SIZE 48  //Longest CSV trace line
+#define REPLAY_END_MICROS 0xFFFFFFFF  //micros value of the record that ends a binary trace
+
+static FILE* traceFile = NULL;
+static bool traceBinary = false;
+
+static uint64_t replayElapsedMicros = 0;  //Simulated time since the start of the trace
+static uint32_t replayLastMicros = 0;
+static uint32_t replayPreviousSecond = 0;
+static uint16_t replayCounter = 0;
+static uint32_t replaySamples = 0;
+static uint32_t replayEvents = 0;
+static uint32_t replayIOMicros = 0;  //Time spent reading the trace and keeping the output, excluded from the pipeline cost
+
+static std::vector<std::string> replayOutput;  //Output lines, {"EVENT":n} then the Data topic messages of each event
+
+
+/**
+ * @brief Output line with the wall-clock fields zeroed, the spectral summary reports how long its FFT took
+ *
+ * @param line Encoded line
+ * @return std::string 
+ */
+static std::string replayLine(std::string line)
+{
+  for(const char* field : {"\"US\":", ",us="})
+  {
+    size_t start = line.find(field);
+    if(start == std::string::npos)
+      continue;
+    start += strlen(field);
+    size_t end = line.find_first_not_of("0123456789", start);
+    line.replace(start, end - start, "0");
+  }
+  return line;
+}
+
+
+static std::string replayPath(const char* name)
+{
+  return std::string(NATIVE_TEST_DIR "/test_replay/") + name;
+}
+
+
+/**
+ * @brief Reads the next reading of the trace
+ *
+ * @param traceMicros Trace timestamp
+ * @param values Raw counts, one per channel
+ * @return false at the end of the trace
+ */
+static bool readTraceRecord(uint32_t& traceMicros, uint16_t* values)
+{
+  if(traceBinary)
+  {
+    uint8_t record[4 + 2 * CHANNEL_COUNT];
+    if(fread(record, 1, sizeof(record), traceFile) != sizeof(record))
+      return false;
+
+    traceMicros = record[0] | (record[1] << 8) | (record[2] << 16) | ((uint32_t)record[3] << 24);
+    for(int c = 0; c < CHANNEL_COUNT; c++)
+      values[c] = record[4 + 2 * c] | (record[5 + 2 * c] << 8);
+    return traceMicros != REPLAY_END_MICROS;
+  }
+
+  char line[REPLAY_LINE_SIZE];
+  if(!fgets(line, sizeof(line), traceFile) || strncmp(line, "END", 3) == 0)
+    return false;
+
+  char* field = line;
+  traceMicros = strtoul(field, &field, 10);
+  for(int c = 0; c < CHANNEL_COUNT; c++)
+    values[c] = strtoul(field + (*field == ',' ? 1 : 0), &field, 10);  //Missing columns read as 0
+  return true;
+}
+
+
+/**
+ * @brief SampleSource that reads the trace and stamps it with the simulated clock
+ *
+ * @param sample Filled with the next reading
+ * @return false once the trace is exhausted
+ */
+static bool replaySource(Sample& sample)
+{
+  uint32_t ioStart = micros();
+  uint32_t traceMicros;
+  bool available = readTraceRecord(traceMicros, sample.values);
+  replayIOMicros += micros() - ioStart;
+
+  if(!available)
+    return false;
+
+  if(replaySamples > 0)
+    replayElapsedMicros += traceMicros - replayLastMicros;
+  replayLastMicros = traceMicros;
+
+  uint32_t seconds = REPLAY_EPOCH + replayElapsedMicros / 1000000;
+  replayCounter = (replaySamples > 0 && seconds == replayPreviousSecond) ? replayCounter + 1 : 0;
+  replayPreviousSecond = seconds;
+
+  sample.seconds = seconds;
+  sample.micros = replayElapsedMicros;
+  sample.fraction = replayElapsedMicros % 1000000;
+  sample.counter = replayCounter;
+
+  replaySamples++;
+  return true;
+}
+
+
+/**
+ * @brief EventSink that keeps what would have been published
+ *
+ */
+static void replaySink()
+{
+  static EventBuffer event;
+  static EncodedEvent encoded;
+
+  dataSet.copyTo(event);  //Same hand-over copy as live capture
+  event.setSequence(replayEvents++);  //Replayed events are numbered on their own, they never enter the store
+
+  //Same encoder and format as the Data topic, so the output is what the broker would have received
+  encodeEvent("SITE01", "EQ1", event, ENCODE_ALL, globalPublishFormat, encoded);
+
+  uint32_t ioStart = micros();
+  replayOutput.push_back("{\"EVENT\":" + std::to_string(event.sequence()) + "}");
+
+  //One line per message line, INFLUX batches hold several
+  size_t offset = 0;
+  for(int m = 0; m < encoded.messages; m++)
+  {
+    std::string message(encoded.data + offset, encoded.lengths[m]);
+    offset += encoded.lengths[m];
+
+    for(size_t start = 0; start < message.size();)
+    {
+      size_t end = message.find('\n', start);
+      end = end == std::string::npos ? message.size() : end;
+      if(end > start)
+        replayOutput.push_back(replayLine(message.substr(start, end - start)));
+      start = end + 1;
+    }
+  }
+  replayIOMicros += micros() - ioStart;
+}
+
+
+/**
+ * @brief Replays one trace and prints the pipeline cost
+ *
+ * @param name Trace file next to this suite
+ * @param format Data topic encoding of the run
+ */
+static void runReplay(const char* name, PublishFormat format)
+{
+  traceBinary = strstr(name, ".bin") != NULL;
+  traceFile = fopen(replayPath(name).c_str(), traceBinary ? "rb" : "r");
+  TEST_ASSERT_NOT_NULL_MESSAGE(traceFile, name);
+
+  globalPublishFormat = format;
+  replayElapsedMicros = 0;
+  replaySamples = 0;
+  replayEvents = 0;
+  replayIOMicros = 0;
+  replayOutput.clear();
+  dataSet.clear();
+  baselineInit();  //The trace seeds its own baseline
+  contextReset();  //And its own context, on the simulated clock
+
+  PerfTimer eventCost;
+  perfReset(eventCost);
+  uint32_t pipelineMicros = 0;
+  bool more = true;
+
+  while(more)
+  {
+    uint32_t eventsBefore = replayEvents;
+    uint32_t ioBefore = replayIOMicros;
+    uint32_t stepStart = micros();
+
+    more = captureStep(replaySource, replaySink);
+
+    uint32_t stepMicros = (micros() - stepStart) - (replayIOMicros - ioBefore);
+    pipelineMicros += stepMicros;
+    if(replayEvents != eventsBefore)
+      perfRecord(eventCost, stepMicros);
+  }
+  fclose(traceFile);
+
+  //Host figures, for comparing builds with each other rather than with the device
+  printf("{\"REPLAY\":{\"TRACE\":\"%s\",\"SAMPLES\":%lu,\"EVENTS\":%lu,\"EVENT_US\":[%lu,%lu,%lu],\"MAX_RATE\":%.1f}}\n",
+         name, (unsigned long)replaySamples, (unsigned long)replayEvents,
+         (unsigned long)(eventCost.count ? eventCost.min : 0),
+         (unsigned long)(eventCost.count ? eventCost.sum / eventCost.count : 0),
+         (unsigned long)eventCost.max,
+         pipelineMicros > 0 ? replaySamples * 1000000.0f / pipelineMicros : 0);
+}
+
+
+/**
+ * @brief Compares the output of the last run with a golden file, line by line
+ *
+ * @param name Golden file next to this suite
+ */
+static void checkGolden(const char* name)
+{
+  std::string path = replayPath(name);
+
+  if(getenv("NARC_GOLDEN_UPDATE"))
+  {
+    std::ofstream golden(path);
+    for(const std::string& line : replayOutput)
+      golden << line << '\n';
+    golden.close();  //Unity leaves the test with a longjmp, no destructor runs
+    TEST_IGNORE_MESSAGE("Golden output rewritten");
+  }
+
+  std::ifstream golden(path);
+  TEST_ASSERT_TRUE_MESSAGE(golden.good(), name);
+
+  std::string expected;
+  size_t line = 0;
+  char message[64];
+  for(; std::getline(golden, expected); line++)
+  {
+    snprintf(message, sizeof(message), "%s line %lu", name, (unsigned long)line + 1);
+    TEST_ASSERT_TRUE_MESSAGE(line < replayOutput.size(), message);
+    TEST_ASSERT_EQUAL_STRING_MESSAGE(expected.c_str(), replayOutput[line].c_str(), message);
+  }
+  TEST_ASSERT_EQUAL_UINT32_MESSAGE(line, replayOutput.size(), name);
+}
+
+
+/**
+ * @brief Output lines of the last run that start with prefix
+ *
+ * @param prefix Start of the line
+ * @return int
+ */
+static int countLines(const char* prefix)
+{
+  int count = 0;
+  for(const std::string& line : replayOutput)
+    count += line.compare(0, strlen(prefix), prefix) == 0;
+  return count;
+}
+
+
+
+////////////////////Tests////////////////////
+
+void setUp()
+{
+  globalTriggerMode = TRIGGER_ABSOLUTE;
+  globalThresholds[0] = REPLAY_THRESHOLD;
+  captureFrozen = false;
+}
+
+void tearDown() {}
+
+
+//A surge that decays within the override window is one event, a swell still above the threshold when it ends triggers again
+void test_events_of_the_trace()
+{
+  runReplay("trace.csv", FORMAT_JSON);
+
+  TEST_ASSERT_EQUAL_UINT32(3000, replaySamples);
+  TEST_ASSERT_EQUAL_UINT32(3, replayEvents);
+  TEST_ASSERT_EQUAL_INT(3, countLines("{\"EVENT\":{"));
+  TEST_ASSERT_EQUAL_INT(3, countLines("{\"CONTEXT\":"));
+  TEST_ASSERT_EQUAL_INT(3 * QUEUE_RANGE, countLines("{\"Time\":"));
+  TEST_ASSERT_FALSE(captureActive);
+}
+
+
+void test_json_matches_golden()
+{
+  runReplay("trace.csv", FORMAT_JSON);
+  checkGolden("golden_json.txt");
+}
+
+
+void test_influx_matches_golden()
+{
+  runReplay("trace.csv", FORMAT_INFLUX);
+  checkGolden("golden_influx.txt");
+}
+
+
+//Same readings in the binary format give the same events
+void test_binary_trace_matches_csv()
+{
+  runReplay("trace.bin", FORMAT_JSON);
+  checkGolden("golden_json.txt");
+}
+
+
+int main(int argc, char** argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_events_of_the_trace);
+  RUN_TEST(test_json_matches_golden);
+  RUN_TEST(test_influx_matches_golden);
+  RUN_TEST(test_binary_trace_matches_csv);
+  return UNITY_END();
+}
@@ -0,0 +1,143 @@
+#!/usr/bin/env python3
+"""Host side of raw sample streaming (src/.README, Raw streaming).
+
+Reads the binary frames a device sends on Serial when the STREAM config key holds a baud rate, checks each one and
+writes the good ones to a CSV file: sequence, micros (unwrapped to 64 bits), then the raw count of every channel in
+CHANNEL_DESCRIPTORS order. Frames lost on the way show as jumps in sequence and are reported as dropped.
+
+Frame layout (include/stream.h, StreamFrame), little-endian and unpadded:
+    A5 5A | uint32 sequence | uint32 micros | uint16 count x channels | uint8 sum of the bytes from sequence to the last count
+
+Library use:
+    reader = FrameReader(channels=2)
+    for frame in reader.feed(data):                 # bytes as they come off the port
+        write(frame.sequence, frame.micros, frame.values)
+    reader.dropped, reader.resyncs                  # frames lost, bytes skipped to find the next frame
+
+Command line (needs pyserial):
+    narc_capture.py --port /dev/ttyUSB0 --baud 2000000 --out capture.csv [--channels 2] [--seconds 60]
+prints the frames received and dropped every --report seconds and a summary line at the end.
+"""
+
+import argparse
+import struct
+import sys
+import time
+
+SYNC = b"\xa5\x5a"  # STREAM_SYNC on the wire
+HEADER = struct.Struct("<2sII")  # sync, sequence, micros
+CHANNELS = 2  # Entries of CHANNEL_DESCRIPTORS in config.h
+
+
+class Frame:
+    """One good frame, micros unwrapped to 64 bits."""
+
+    __slots__ = ("sequence", "micros", "values")
+
+    def __init__(self, sequence, micros, values):
+        self.sequence = sequence
+        self.micros = micros
+        self.values = values
+
+    def __repr__(self):
+        return "Frame(seq=%d micros=%d values=%r)" % (self.sequence, self.micros, self.values)
+
+
+class FrameReader:
+    """Finds, checks and decodes frames in a byte stream, counting what was lost."""
+
+    def __init__(self, channels=CHANNELS):
+        self.channels = channels
+        self.size = HEADER.size + 2 * channels + 1
+        self._values = struct.Struct("<%dH" % channels)
+        self._buffer = bytearray()
+        self._last_sequence = None
+        self._last_micros = None
+        self._micros_high = 0
+        self.frames = 0
+        self.dropped = 0  # Sequence numbers never received
+        self.resyncs = 0  # Bytes skipped: status text, a bad sum, a partial frame
+        self.bad = 0  # Frames whose sum did not match
+
+    def feed(self, data):
+        """Good frames completed by data, in order."""
+        self._buffer.extend(data)
+        frames = []
+        position = 0
+        while True:
+            start = self._buffer.find(SYNC, position)
+            if start < 0:
+                # Keep a trailing A5, it may be the first half of the next sync
+                keep = 1 if self._buffer[-1:] == SYNC[:1] else 0
+                self.resyncs += len(self._buffer) - position - keep
+                del self._buffer[:len(self._buffer) - keep]
+                return frames
+            self.resyncs += start - position
+            if len(self._buffer) - start < self.size:
+                del self._buffer[:start]
+                return frames
+
+            raw = bytes(self._buffer[start:start + self.size])
+            if sum(raw[2:-1]) & 0xFF != raw[-1]:
+                self.bad += 1
+                self.resyncs += 1
+                position = start + 1  # Skip one byte and search again
+                continue
+
+            frames.append(self._decode(raw))
+            position = start + self.size
+
+    def _decode(self, raw):
+        _sync, sequence, micros = HEADER.unpack_from(raw)
+        values = self._values.unpack_from(raw, HEADER.size)
+
+        if self._last_sequence is not None:
+            self.dropped += (sequence - self._last_sequence - 1) & 0xFFFFFFFF
+        if self._last_micros is not None and micros < self._last_micros:
+            self._micros_high += 1 << 32
+        self._last_sequence = sequence
+        self._last_micros = micros
+        self.frames += 1
+        return Frame(sequence, self._micros_high + micros, values)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("--port", required=True)
+    parser.add_argument("--baud", type=int, required=True, help="STREAM config value of the device")
+    parser.add_argument("--out", required=True, help="CSV file the frames are written to")
+    parser.add_argument("--channels", type=int, default=CHANNELS)
+    parser.add_argument("--seconds", type=float, default=0, help="capture length, 0 until interrupted")
+    parser.add_argument("--report", type=float, default=5.0, help="seconds between progress lines")
+    args = parser.parse_args()
+
+    import serial
+
+    reader = FrameReader(args.channels)
+    port = serial.Serial(args.port, args.baud, timeout=0.1)
+    start = time.monotonic()
+    next_report = start + args.report
+
+    with open(args.out, "w") as out:
+        out.write("sequence,micros," + ",".join("ch%d" % c for c in range(args.channels)) + "\n")
+        try:
+            while not args.seconds or time.monotonic() - start < args.seconds:
+                for frame in reader.feed(port.read(max(port.in_waiting, 1))):
+                    out.write("%d,%d,%s\n" % (frame.sequence, frame.micros, ",".join(map(str, frame.values))))
+                if time.monotonic() >= next_report:
+                    next_report += args.report
+                    print("frames=%d dropped=%d bad=%d" % (reader.frames, reader.dropped, reader.bad), file=sys.stderr)
+        except KeyboardInterrupt:
+            pass
+        finally:
+            port.close()
+
+    seconds = time.monotonic() - start
+    total = reader.frames + reader.dropped
+    print("%d frames in %.1f s (%.0f/s), %d dropped (%.3f%%), %d bad, %d bytes skipped" %
+          (reader.frames, seconds, reader.frames / seconds if seconds else 0, reader.dropped,
+           100.0 * reader.dropped / total if total else 0, reader.bad, reader.resyncs))
+
+
+if __name__ == "__main__":
+    main()
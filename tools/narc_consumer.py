@@ -0,0 +1,320 @@
+#!/usr/bin/env python3
+"""Consumer side of sequenced delivery (src/.README, Sequenced delivery).
+
+Parses what a device publishes on its Data topic, in either FORMAT, and per device (site, equipment ID):
+  - drops duplicates: entries on (SEQ, I), EVENT/SPECTRUM on SEQ, context on (SEQ, bucket)
+  - tracks the highest SEQ and its BOOT from the EVENT metadata. A jump within the same BOOT is a gap, a jump that comes
+    with a higher BOOT is the unused reservation of the previous boot. A gap is closed again if the event turns up later
+    (resent under DELIVERY ACK, HISTORY replay, power-fail recovery)
+  - collects the SEQ of every complete event (EVENT plus all SAMPLES entries) for {"CMD":"ACK","SEQ":[..]}
+
+Library use:
+    consumer = Consumer()
+    for record in consumer.feed(topic, payload):   # only records seen for the first time
+        store(record)
+    consumer.device(site, equipment).gaps           # [(first, last), ..] missing SEQ ranges
+    consumer.device(site, equipment).take_acks()    # SEQ numbers to acknowledge
+
+Command line (needs paho-mqtt):
+    narc_consumer.py --broker 192.168.100.2 [--ack-topic 'NARCCCCC!/SITE01/<client ID>']
+prints new gaps, duplicates and a summary line per device every --report seconds, and acknowledges complete events
+when --ack-topic is given.
+"""
+
+import argparse
+import json
+import sys
+import time
+from collections import OrderedDict
+
+ROOT_TOPIC = "NARCCCCC!"  # ROOT_TOPIC in config.h
+DEDUP_WINDOW = 4096  # Sequence numbers whose parts are remembered for deduplication, per device
+ACK_BATCH = 16  # Most sequence numbers per ACK command, keeps the device's command queue short
+
+INFLUX_MEASUREMENTS = {
+    "narc": "ENTRY",
+    "narc_event": "EVENT",
+    "narc_context": "CONTEXT",
+    "narc_spectrum": "SPECTRUM",
+}
+
+
+class Record:
+    """One message part: kind is ENTRY, EVENT, CONTEXT or SPECTRUM, part tells parts of the same kind and SEQ apart."""
+
+    __slots__ = ("site", "equipment", "kind", "seq", "part", "boot", "samples", "fields")
+
+    def __init__(self, site, equipment, kind, seq, part=None, boot=None, samples=None, fields=None):
+        self.site = site
+        self.equipment = equipment
+        self.kind = kind
+        self.seq = seq
+        self.part = part
+        self.boot = boot
+        self.samples = samples
+        self.fields = fields or {}
+
+    def key(self):
+        return (self.kind, self.seq, self.part)
+
+    def __repr__(self):
+        return "Record(%s/%s %s seq=%d part=%r)" % (self.site, self.equipment, self.kind, self.seq, self.part)
+
+
+def topic_device(topic):
+    """(site, equipment ID) of a Data topic, ROOT/site/equipment/Data."""
+    parts = topic.split("/")
+    if len(parts) < 4 or parts[-1] != "Data":
+        return None
+    return parts[-3], parts[-2]
+
+
+def _influx_value(text):
+    if text.endswith("i"):
+        return int(text[:-1])
+    if text.startswith('"'):
+        return text.strip('"')
+    try:
+        return float(text)
+    except ValueError:
+        return text
+
+
+def _split_unescaped(text, separator):
+    parts, current, escaped = [], [], False
+    for char in text:
+        if escaped:
+            current.append(char)
+            escaped = False
+        elif char == "\\":
+            current.append(char)
+            escaped = True
+        elif char == separator:
+            parts.append("".join(current))
+            current = []
+        else:
+            current.append(char)
+    parts.append("".join(current))
+    return parts
+
+
+def _unescape(text):
+    return text.replace("\\ ", " ").replace("\\,", ",").replace("\\=", "=")
+
+
+def parse_influx_line(line):
+    """Record of one line protocol line, None for anything that is not a device measurement."""
+    head, _, rest = line.partition(" ")
+    while head.endswith("\\") and rest:  # Escaped space inside the tags
+        more, _, rest = rest.partition(" ")
+        head += " " + more
+    fields_text, _, _timestamp = rest.rpartition(" ")
+    tags = _split_unescaped(head, ",")
+    kind = INFLUX_MEASUREMENTS.get(tags[0])
+    if kind is None:
+        return None
+
+    tag_values = dict(_unescape(tag).split("=", 1) for tag in tags[1:] if "=" in tag)
+    fields = {}
+    for field in _split_unescaped(fields_text, ","):
+        name, _, value = field.partition("=")
+        fields[name] = _influx_value(value)
+
+    if "seq" not in fields:
+        return None
+    part = {"ENTRY": fields.get("i"), "CONTEXT": fields.get("bucket")}.get(kind)
+    return Record(tag_values.get("site"), tag_values.get("equipmentID"), kind, fields["seq"], part,
+                  fields.get("boot"), fields.get("samples"), fields)
+
+
+def parse_payload(topic, payload):
+    """Records of one Data topic message: a JSON object, or one or more line protocol lines."""
+    if isinstance(payload, bytes):
+        payload = payload.decode("utf-8", "replace")
+    device = topic_device(topic) if topic else None
+    site, equipment = device if device else (None, None)
+
+    text = payload.strip()
+    if text.startswith("{"):
+        message = json.loads(text)
+        for kind in ("EVENT", "CONTEXT", "SPECTRUM"):
+            if kind in message:
+                body = message[kind]
+                return [Record(site, equipment, kind, body["SEQ"], None, body.get("BOOT"), body.get("SAMPLES"), body)]
+        if "SEQ" in message:
+            return [Record(site, equipment, "ENTRY", message["SEQ"], message.get("I"), fields=message)]
+        return []
+
+    records = []
+    for line in text.splitlines():
+        record = parse_influx_line(line) if line else None
+        if record:
+            record.site = record.site or site
+            record.equipment = record.equipment or equipment
+            records.append(record)
+    return records
+
+
+class Device:
+    """Delivery state of one device."""
+
+    def __init__(self, site, equipment):
+        self.site = site
+        self.equipment = equipment
+        self.boot = None
+        self.highest = None  # Highest SEQ seen in EVENT metadata during self.boot
+        self.gaps = []  # Missing [first, last] SEQ ranges within the current boot, oldest first
+        self.duplicates = 0
+        self.records = 0
+        self.events = 0
+        self._seen = OrderedDict()  # seq -> set of part keys, oldest first, at most DEDUP_WINDOW seqs
+        self._expected = {}  # seq -> SAMPLES from EVENT, until the event is complete
+        self._entries = {}  # seq -> entry indices seen
+        self._acks = []
+
+    def accept(self, record):
+        """True the first time a part is seen, False for a duplicate."""
+        parts = self._seen.get(record.seq)
+        if parts is None:
+            parts = self._seen[record.seq] = set()
+            while len(self._seen) > DEDUP_WINDOW:
+                old, _ = self._seen.popitem(last=False)
+                self._expected.pop(old, None)
+                self._entries.pop(old, None)
+        key = (record.kind, record.part)
+        if key in parts:
+            self.duplicates += 1
+            return False
+        parts.add(key)
+        self.records += 1
+
+        if record.kind == "EVENT":
+            self.events += 1
+            self._track(record.seq, record.boot)
+            self._expected[record.seq] = record.samples
+        elif record.kind == "ENTRY":
+            self._entries.setdefault(record.seq, set()).add(record.part)
+        self._check_complete(record.seq)
+        return True
+
+    def _track(self, seq, boot):
+        if boot is not None and boot != self.boot:
+            if self.boot is None or boot > self.boot:
+                # New boot: whatever was left of the previous reservation is not a loss
+                self.boot, self.highest, self.gaps = boot, seq, []
+                return
+            return  # Late event of an older boot, outside gap tracking
+        if self.highest is None or seq == self.highest + 1:
+            self.highest = seq
+        elif seq > self.highest + 1:
+            self.gaps.append((self.highest + 1, seq - 1))
+            self.highest = seq
+        else:
+            self._fill(seq)
+
+    def _fill(self, seq):
+        for index, (first, last) in enumerate(self.gaps):
+            if first <= seq <= last:
+                replacement = []
+                if first < seq:
+                    replacement.append((first, seq - 1))
+                if seq < last:
+                    replacement.append((seq + 1, last))
+                self.gaps[index:index + 1] = replacement
+                return
+
+    def _check_complete(self, seq):
+        samples = self._expected.get(seq)
+        if samples is None or len(self._entries.get(seq, ())) < samples:
+            return
+        del self._expected[seq]
+        self._entries.pop(seq, None)
+        self._acks.append(seq)
+
+    def missing(self):
+        return sum(last - first + 1 for first, last in self.gaps)
+
+    def take_acks(self):
+        """SEQ numbers of events completed since the last call."""
+        acks, self._acks = self._acks, []
+        return acks
+
+
+class Consumer:
+    """Deduplication and gap tracking for every device seen."""
+
+    def __init__(self):
+        self.devices = {}
+
+    def device(self, site, equipment):
+        key = (site, equipment)
+        if key not in self.devices:
+            self.devices[key] = Device(site, equipment)
+        return self.devices[key]
+
+    def feed(self, topic, payload):
+        """Records of one message seen for the first time."""
+        fresh = []
+        for record in parse_payload(topic, payload):
+            if self.device(record.site, record.equipment).accept(record):
+                fresh.append(record)
+        return fresh
+
+
+def ack_commands(seqs):
+    """{"CMD":"ACK","SEQ":[..]} payloads for a list of sequence numbers."""
+    return [json.dumps({"CMD": "ACK", "SEQ": seqs[i:i + ACK_BATCH]}) for i in range(0, len(seqs), ACK_BATCH)]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("--broker", required=True)
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--username")
+    parser.add_argument("--password")
+    parser.add_argument("--topic", default=ROOT_TOPIC + "/+/+/Data")
+    parser.add_argument("--ack-topic", help="command topic of the device (ROOT/site/client ID) to acknowledge on")
+    parser.add_argument("--report", type=float, default=10.0, help="seconds between summary lines")
+    args = parser.parse_args()
+
+    import paho.mqtt.client as mqtt
+
+    consumer = Consumer()
+    client = mqtt.Client()
+    if args.username:
+        client.username_pw_set(args.username, args.password)
+
+    def on_message(_client, _userdata, message):
+        try:
+            records = consumer.feed(message.topic, message.payload)
+        except (ValueError, KeyError) as error:
+            print("unparsed message on %s: %s" % (message.topic, error), file=sys.stderr)
+            return
+        for record in records:
+            device = consumer.device(record.site, record.equipment)
+            if record.kind == "EVENT" and device.gaps and device.gaps[-1][1] == record.seq - 1:
+                first, last = device.gaps[-1]
+                print("%s/%s gap: SEQ %d..%d missing (boot %s)" % (record.site, record.equipment, first, last, device.boot))
+            if args.ack_topic:
+                for command in ack_commands(device.take_acks()):
+                    client.publish(args.ack_topic, command)
+
+    client.on_message = on_message
+    client.on_connect = lambda _client, _userdata, _flags, _rc: client.subscribe(args.topic)
+    client.connect(args.broker, args.port)
+    client.loop_start()
+
+    try:
+        while True:
+            time.sleep(args.report)
+            for (site, equipment), device in sorted(consumer.devices.items(), key=lambda item: str(item[0])):
+                print("%s/%s boot=%s highest=%s events=%d missing=%d duplicates=%d" %
+                      (site, equipment, device.boot, device.highest, device.events, device.missing(), device.duplicates))
+    except KeyboardInterrupt:
+        pass
+    finally:
+        client.loop_stop()
+
+
+if __name__ == "__main__":
+    main()
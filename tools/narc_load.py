@@ -0,0 +1,219 @@
+#!/usr/bin/env python3
+"""Broker load test (src/.README, Load testing).
+
+Simulates a fleet of devices, each with its own MQTT connection, publishing synthetic excursions on the device topic
+scheme (ROOT/site/<equipment>-<n>/Data) with the device's payloads in either FORMAT: one message per entry plus the
+EVENT metadata (JSON), or the whole event as one line protocol batch (INFLUX). A monitor connection subscribes to the
+same topics and times each event from the publish of its last message to its arrival back from the broker. At the end
+it prints
+  {"LOAD":{"DEVICES","FORMAT","SECONDS","EVENTS","MSGS","MSGS_S","BYTES_S","RECEIVED","LATENCY_US":{"P50","P90","P99","MAX"}}}
+Events are never queued when publishing falls behind, so the achieved rate shows where the broker saturates.
+
+Library use:
+    values = synthesize_event(rng, base, peak, spread, noise)     # QUEUE_RANGE readings, one tuple per reading
+    payloads = encode_event(site, equipment, seq, when, values, fmt)   # Data topic messages of one event
+    percentiles(latencies)                                         # [P50, P90, P99, MAX] as the device reports them
+
+Command line (needs paho-mqtt and, with --start-broker, mosquitto on the PATH):
+    narc_load.py --site SITE01 --equipment LOAD [--broker 127.0.0.1] [--start-broker] [--devices 10] [--rate 10]
+                 [--seconds 60] [--format JSON|INFLUX] [--base 2000] [--peak 1500] [--spread 300] [--noise 20]
+"""
+
+import argparse
+import json
+import random
+import subprocess
+import sys
+import threading
+import time
+
+from narc_consumer import ROOT_TOPIC, parse_payload
+
+QUEUE_RANGE = 40  # QUEUE_RANGE in config.h, readings per event
+OVERRIDE_RANGE = 35  # OVERRIDE_RANGE in config.h, readings after the trigger
+CHANNELS = ("Voltage", "Current")  # CHANNEL_DESCRIPTORS in config.h
+ADC_FULL_SCALE = 4095  # 12-bit ADC
+SAMPLE_MICROS = 50  # Simulated spacing between readings
+MAX_DEVICES = 500
+SETTLE_S = 2.0  # Wait for the last events to come back before reporting
+
+
+def synthesize_event(rng, base=2000, peak=1500, spread=300, noise=20):
+    """QUEUE_RANGE readings (one value per channel): a noisy baseline with one excursion on the first channel at the
+    trigger position, halving every 4 readings after it. The other channels sit at half the baseline."""
+    trigger = QUEUE_RANGE - OVERRIDE_RANGE - 1
+    height = peak + rng.randint(-spread, spread)
+    values = []
+    for i in range(QUEUE_RANGE):
+        value = base + rng.randint(-noise, noise)
+        if i >= trigger:
+            value += height >> ((i - trigger) // 4)
+        reading = [min(max(value, 0), ADC_FULL_SCALE)]
+        reading += [min(max(base // 2 + rng.randint(-noise, noise), 0), ADC_FULL_SCALE) for _ in CHANNELS[1:]]
+        values.append(tuple(reading))
+    return values
+
+
+def _influx_field(channel):
+    return channel[0].lower() + channel[1:]
+
+
+def encode_event(site, equipment, seq, when, values, fmt="JSON"):
+    """Data topic messages of one event starting at Unix time when: the entries and EVENT metadata as separate JSON
+    messages, or one INFLUX batch. Entries carry the reading's index as the time counter, like the device's counter."""
+    seconds = int(when)
+    time_string = time.strftime("%Y-%m-%d %H:%M:%S", time.localtime(seconds))
+    rate = 1000000.0 / SAMPLE_MICROS
+
+    if fmt == "INFLUX":
+        tags = "site=%s,equipmentID=%s" % (site, equipment)
+        start_ns = int(when * 1000000) * 1000
+        lines = []
+        for i, reading in enumerate(values):
+            fields = ",".join("%s=%.1f" % (_influx_field(channel), value) for channel, value in zip(CHANNELS, reading))
+            lines.append("narc,%s %s,seq=%di,i=%di %d" % (tags, fields, seq, i, start_ns + i * SAMPLE_MICROS * 1000))
+        lines.append("narc_event,%s seq=%di,boot=0i,block=0i,samples=%di,rate=%.1f,preRate=%.1f,jitterUs=0i %d" %
+                     (tags, seq, len(values), rate, rate, start_ns))
+        return ["\n".join(lines)]
+
+    payloads = []
+    for i, reading in enumerate(values):
+        fields = "".join(',"%s":%.1f' % (channel, value) for channel, value in zip(CHANNELS, reading))
+        payloads.append('{"Time":"%s %d","SEQ":%d,"I":%d%s}' % (time_string, i, seq, i, fields))
+    payloads.append('{"EVENT":{"TIME":"%s 0","SEQ":%d,"BOOT":0,"BLOCK":0,"SAMPLES":%d,"RATE":%.1f,"PRE_RATE":%.1f,'
+                    '"JITTER_US":0}}' % (time_string, seq, len(values), rate, rate))
+    return payloads
+
+
+def percentiles(latencies):
+    """[P50, P90, P99, MAX] of a list of latencies, picked the way the device's reports pick them."""
+    ordered = sorted(latencies)
+    if not ordered:
+        return [0, 0, 0, 0]
+    return [ordered[len(ordered) * 50 // 100], ordered[len(ordered) * 90 // 100], ordered[len(ordered) * 99 // 100],
+            ordered[-1]]
+
+
+def load_report(devices, fmt, seconds, events, messages, sent_bytes, latencies):
+    """{"LOAD":{...}} body of a run, latencies in seconds, one per event that came back."""
+    p50, p90, p99, top = percentiles([int(latency * 1000000) for latency in latencies])
+    return {"DEVICES": devices, "FORMAT": fmt, "SECONDS": round(seconds, 1), "EVENTS": events, "MSGS": messages,
+            "MSGS_S": round(messages / seconds, 1) if seconds > 0 else 0,
+            "BYTES_S": round(sent_bytes / seconds, 1) if seconds > 0 else 0,
+            "RECEIVED": len(latencies), "LATENCY_US": {"P50": p50, "P90": p90, "P99": p99, "MAX": top}}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("--broker", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--start-broker", action="store_true", help="run mosquitto on --port for the length of the run")
+    parser.add_argument("--site", required=True)
+    parser.add_argument("--equipment", default="LOAD", help="simulated devices are <equipment>-0..n-1")
+    parser.add_argument("--devices", type=int, default=10)
+    parser.add_argument("--rate", type=float, default=10.0, help="events per second across all devices")
+    parser.add_argument("--seconds", type=float, default=60.0)
+    parser.add_argument("--format", choices=("JSON", "INFLUX"), default="JSON")
+    parser.add_argument("--base", type=int, default=2000, help="baseline reading in raw counts")
+    parser.add_argument("--peak", type=int, default=1500, help="mean excursion height above the baseline")
+    parser.add_argument("--spread", type=int, default=300, help="excursion heights are uniform in peak +/- spread")
+    parser.add_argument("--noise", type=int, default=20, help="uniform +/- noise on every reading")
+    parser.add_argument("--seed", type=int)
+    args = parser.parse_args()
+
+    import paho.mqtt.client as mqtt
+
+    devices = max(1, min(args.devices, MAX_DEVICES))
+    rng = random.Random(args.seed)
+    broker = None
+    if args.start_broker:
+        broker = subprocess.Popen(["mosquitto", "-p", str(args.port)])
+        time.sleep(1)
+
+    names = ["%s-%d" % (args.equipment, n) for n in range(devices)]
+    sent = {}  # (equipment, SEQ) -> time the last message of the event was published
+    latencies = []
+    lock = threading.Lock()
+
+    def on_message(_client, _userdata, message):
+        received = time.monotonic()
+        try:
+            records = parse_payload(message.topic, message.payload)
+        except (ValueError, KeyError):
+            return
+        for record in records:
+            if record.kind == "EVENT":
+                with lock:
+                    published = sent.pop((record.equipment, record.seq), None)
+                    if published is not None:
+                        latencies.append(received - published)
+
+    subscribed = threading.Event()
+    monitor = mqtt.Client()
+    monitor.on_message = on_message
+    monitor.on_connect = lambda _client, _userdata, _flags, _rc: monitor.subscribe("%s/%s/+/Data" % (ROOT_TOPIC, args.site))
+    monitor.on_subscribe = lambda *_args: subscribed.set()
+
+    clients = []
+    try:
+        monitor.connect(args.broker, args.port)
+        monitor.loop_start()
+        if not subscribed.wait(10):
+            print("FAIL: no subscription on %s:%d" % (args.broker, args.port))
+            return 1
+
+        # Each simulated device comes online with its own connection and says so on its Info topic
+        for name in names:
+            client = mqtt.Client(client_id="narc-load-%s" % name)
+            client.connect(args.broker, args.port)
+            client.loop_start()
+            client.publish("%s/%s/%s/Info" % (ROOT_TOPIC, args.site, name),
+                           json.dumps({"VERSION": "LOAD", "SITE": args.site, "EQUIPMENTID": name}))
+            clients.append(client)
+
+        interval = 1.0 / max(args.rate, 0.001)
+        sequences = [0] * devices
+        events = messages = sent_bytes = 0
+        start = time.monotonic()
+        next_time = start
+
+        while time.monotonic() - start < args.seconds:
+            delay = next_time - time.monotonic()
+            if delay > 0:
+                time.sleep(delay)
+
+            device = events % devices
+            topic = "%s/%s/%s/Data" % (ROOT_TOPIC, args.site, names[device])
+            payloads = encode_event(args.site, names[device], sequences[device], time.time(),
+                                    synthesize_event(rng, args.base, args.peak, args.spread, args.noise), args.format)
+            for payload in payloads[:-1]:
+                clients[device].publish(topic, payload)
+            with lock:
+                sent[(names[device], sequences[device])] = time.monotonic()
+            clients[device].publish(topic, payloads[-1])
+
+            sequences[device] += 1
+            events += 1
+            messages += len(payloads)
+            sent_bytes += sum(len(payload) for payload in payloads)
+            next_time = max(next_time + interval, time.monotonic())  # Behind schedule: drop the backlog, never burst
+
+        elapsed = time.monotonic() - start
+        time.sleep(SETTLE_S)
+        with lock:
+            report = load_report(devices, args.format, elapsed, events, messages, sent_bytes, list(latencies))
+        print(json.dumps({"LOAD": report}))
+        return 0
+    finally:
+        for client in clients:
+            client.loop_stop()
+            client.disconnect()
+        monitor.loop_stop()
+        monitor.disconnect()
+        if broker:
+            broker.terminate()
+            broker.wait()
+
+
+if __name__ == "__main__":
+    sys.exit(main())
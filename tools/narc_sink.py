@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+"""Host file sink: the event messages of the SERIAL or SPOOL output sink (src/.README, Output sinks) written to a file,
+one message per line, in the order the device wrote them.
+
+  serial: reads the SERIAL sink off the port. Each JSON message is one line, status text in between is left out
+  spool:  reads a dump of the "spool" partition (esptool.py read_flash 0x2A0000 0x100000 spool.bin) and unpacks its
+          records, INFLUX line protocol. Sectors are taken in sequence order from the first record of the oldest; a record
+          torn by a reset (erased or partly programmed bytes) is skipped up to the next record start
+
+Library use:
+    for message in spool_records(open("spool.bin", "rb").read()):
+        ...
+    serial_message(line)                            # the message of a SERIAL line, None for status text
+
+Command line:
+    narc_sink.py serial --port /dev/ttyUSB0 --out events.jsonl [--baud 115200] [--seconds 60]   (needs pyserial)
+    narc_sink.py spool --image spool.bin --out events.lp
+"""
+
+import argparse
+import json
+import struct
+import sys
+import time
+
+SPOOL_MAGIC = 0x53504C31  # SPOOL_MAGIC in spool.h
+SPOOL_SECTOR_SIZE = 4096
+SPOOL_NO_RECORD = 0xFFFF
+SECTOR_HEADER = struct.Struct("<IIHH")  # magic, sequence, firstRecord, reserved
+RECORD_LENGTH = struct.Struct("<H")
+SERIAL_BAUD = 115200  # Serial.begin in setup()
+
+
+def _runs(image):
+    """Sectors in use, oldest first, split where the sequence jumps."""
+    sectors = []
+    for base in range(0, len(image) - SPOOL_SECTOR_SIZE + 1, SPOOL_SECTOR_SIZE):
+        magic, sequence, first, _reserved = SECTOR_HEADER.unpack_from(image, base)
+        if magic == SPOOL_MAGIC:
+            sectors.append((sequence, base, first))
+    sectors.sort()
+
+    runs, run = [], []
+    for sector in sectors:
+        if run and sector[0] != run[-1][0] + 1:
+            runs.append(run)
+            run = []
+        run.append(sector)
+    if run:
+        runs.append(run)
+    return runs
+
+
+def spool_records(image):
+    """Messages of a spool partition image, oldest first."""
+    messages = []
+    for run in _runs(image):
+        data = bytearray()
+        starts = []  # Position in data of the first record starting in each sector
+        for _sequence, base, first in run:
+            if first != SPOOL_NO_RECORD:
+                starts.append(len(data) + first - SECTOR_HEADER.size)
+            data += image[base + SECTOR_HEADER.size:base + SPOOL_SECTOR_SIZE]
+
+        position = starts[0] if starts else None
+        while position is not None and position + RECORD_LENGTH.size <= len(data):
+            length, = RECORD_LENGTH.unpack_from(data, position)
+            end = position + RECORD_LENGTH.size + length
+            body = bytes(data[position + RECORD_LENGTH.size:end])
+            if length == 0xFFFF or end > len(data) or b"\xff" in body:
+                # Erased or torn, carry on at the next record start
+                position = next((start for start in starts if start > position), None)
+                continue
+            messages.append(body.decode("utf-8", "replace"))
+            position = end
+    return messages
+
+
+def serial_message(line):
+    """The message of one SERIAL sink line, None for anything else printed on Serial."""
+    if isinstance(line, bytes):
+        line = line.decode("utf-8", "replace")
+    line = line.strip()
+    if not line.startswith("{"):
+        return None
+    try:
+        json.loads(line)
+    except ValueError:
+        return None
+    return line
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    sources = parser.add_subparsers(dest="source", required=True)
+    serial_parser = sources.add_parser("serial", help="SERIAL sink on a port")
+    serial_parser.add_argument("--port", required=True)
+    serial_parser.add_argument("--baud", type=int, default=SERIAL_BAUD)
+    serial_parser.add_argument("--seconds", type=float, default=0, help="capture length, 0 until interrupted")
+    serial_parser.add_argument("--out", required=True)
+    spool_parser = sources.add_parser("spool", help="dump of the spool partition")
+    spool_parser.add_argument("--image", required=True)
+    spool_parser.add_argument("--out", required=True)
+    args = parser.parse_args()
+
+    written = 0
+    with open(args.out, "w") as out:
+        if args.source == "spool":
+            with open(args.image, "rb") as image:
+                for message in spool_records(image.read()):
+                    out.write(message + "\n")
+                    written += 1
+        else:
+            import serial
+
+            port = serial.Serial(args.port, args.baud, timeout=0.5)
+            start = time.monotonic()
+            try:
+                while not args.seconds or time.monotonic() - start < args.seconds:
+                    message = serial_message(port.readline())
+                    if message:
+                        out.write(message + "\n")
+                        out.flush()
+                        written += 1
+            except KeyboardInterrupt:
+                pass
+            finally:
+                port.close()
+
+    print("%d messages written to %s" % (written, args.out), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
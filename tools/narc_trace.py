@@ -0,0 +1,177 @@
+#!/usr/bin/env python3
+"""Broker integration check of a device (src/.README, Latency tracing).
+
+Sends the TRACE command to a device through a local broker, waits for its report on the Info topic and counts the events
+that reach the Data topic in the meantime. Exits 0 when the run passes:
+  - RESULT is PASS: no injected transient lost, TOTAL P99 within BUDGET_MS, EVENTS_S at least MIN_RATE
+  - INJECTED is the COUNT asked for and TRACED equals it (the run counts its own injections only)
+  - the subscriber saw at least TRACED events marked INJECTED with the report's RUN, so the device did not report a
+    delivery the broker never got
+
+Library use:
+    trace_command(count, ms, budget_ms, min_rate)   # payload of the TRACE command
+    injected_run(record)                            # TRACE run an EVENT record was injected by, None for a real event
+    report = trace_report(payload)                  # the TRACE body of an Info message, None for anything else
+    failures = check_report(report, count, budget_ms, min_rate, events_seen)   # empty when the run passed
+
+Command line (needs paho-mqtt and, with --start-broker, mosquitto on the PATH):
+    narc_trace.py --site SITE01 --equipment <equipment ID> --client <client ID> [--broker 127.0.0.1] [--start-broker]
+                  [--count 200] [--ms 100] [--budget-ms 250] [--min-rate 9]
+The device's "MQTT" config must point at this machine.
+"""
+
+import argparse
+import json
+import subprocess
+import sys
+import threading
+import time
+
+from narc_consumer import ROOT_TOPIC, parse_payload
+
+TRACE_BUDGET_MS = 1000  # TRACE_BUDGET_MS in trace.h
+TRACE_INJECT_MAX = 1000  # TRACE_INJECT_MAX in trace.h
+TRACE_INJECT_MIN_MS = 100  # TRACE_INJECT_MIN_MS in trace.h
+TRACE_SETTLE_MS = 5000  # TRACE_SETTLE_MS in trace.h
+TRACE_STAGES = ("CAPTURE", "HANDOVER", "ENCODE", "TRANSMIT", "TOTAL")
+REPORT_MARGIN_S = 10.0  # Extra wait for the report on top of the run and its settle time
+
+
+def trace_command(count, ms, budget_ms=TRACE_BUDGET_MS, min_rate=0.0):
+    """{"CMD":"TRACE",..} payload of a run."""
+    return json.dumps({"CMD": "TRACE", "COUNT": count, "MS": ms, "BUDGET_MS": budget_ms, "MIN_RATE": min_rate})
+
+
+def trace_report(payload):
+    """The TRACE body of an Info topic message, None for any other Info message."""
+    if isinstance(payload, bytes):
+        payload = payload.decode("utf-8", "replace")
+    try:
+        message = json.loads(payload)
+    except ValueError:
+        return None
+    report = message.get("TRACE") if isinstance(message, dict) else None
+    # STATS carries a "TRACE" object too, only the run report has a RESULT
+    return report if isinstance(report, dict) and "RESULT" in report else None
+
+
+def injected_run(record):
+    """TRACE run number of an injected transient's EVENT record (narc_consumer.Record), None for a real event."""
+    if record.kind != "EVENT":
+        return None
+    return record.fields.get("INJECTED", record.fields.get("injected"))
+
+
+def check_report(report, count, budget_ms=TRACE_BUDGET_MS, min_rate=0.0, events_seen=None):
+    """Reasons the run failed, empty when it passed. events_seen is the count of injected EVENT records the subscriber saw,
+    None to skip."""
+    failures = []
+    expected = max(1, min(count, TRACE_INJECT_MAX))  # Clamped the same way as traceStart
+    injected = report.get("INJECTED", 0)
+    traced = report.get("TRACED", 0)
+    total = report.get("TOTAL") or [0, 0, 0, 0]
+
+    if report.get("RESULT") != "PASS":
+        failures.append("RESULT is %s" % report.get("RESULT"))
+    if injected != expected:
+        failures.append("INJECTED %d, expected %d" % (injected, expected))
+    if traced != injected:
+        failures.append("TRACED %d of %d injected, LOST %d" % (traced, injected, report.get("LOST", 0)))
+    for stage in TRACE_STAGES:
+        if len(report.get(stage) or ()) != 4:
+            failures.append("%s percentiles missing" % stage)
+    if total[2] > budget_ms * 1000:
+        failures.append("TOTAL P99 %d us over the %d ms budget" % (total[2], budget_ms))
+    if report.get("EVENTS_S", 0) < min_rate:
+        failures.append("EVENTS_S %.2f under MIN_RATE %.2f" % (report.get("EVENTS_S", 0), min_rate))
+    if events_seen is not None and events_seen < traced:
+        failures.append("subscriber saw %d events, the device reported %d" % (events_seen, traced))
+    return failures
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("--broker", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--start-broker", action="store_true", help="run mosquitto on --port for the length of the check")
+    parser.add_argument("--site", required=True)
+    parser.add_argument("--equipment", required=True, help="equipment ID, names the Data and Info topics")
+    parser.add_argument("--client", required=True, help="client ID, names the command topic")
+    parser.add_argument("--count", type=int, default=200)
+    parser.add_argument("--ms", type=int, default=100)
+    parser.add_argument("--budget-ms", type=int, default=250)
+    parser.add_argument("--min-rate", type=float, default=0.0)
+    parser.add_argument("--connect-timeout", type=float, default=60.0, help="seconds to wait for the device to come online")
+    args = parser.parse_args()
+
+    import paho.mqtt.client as mqtt
+
+    broker = None
+    if args.start_broker:
+        broker = subprocess.Popen(["mosquitto", "-p", str(args.port)])
+        time.sleep(1)
+
+    base = "%s/%s/%s" % (ROOT_TOPIC, args.site, args.equipment)
+    command_topic = "%s/%s/%s" % (ROOT_TOPIC, args.site, args.client)
+    state = {"online": threading.Event(), "done": threading.Event(), "report": None, "runs": {}, "running": False}
+
+    def on_message(_client, _userdata, message):
+        if message.topic == base + "/Info":
+            state["online"].set()  # Ping or any other Info message: the device is connected
+            report = trace_report(message.payload)
+            if report is not None and state["running"]:
+                state["report"] = report
+                state["done"].set()
+        elif message.topic == base + "/Data" and state["running"]:
+            try:
+                records = parse_payload(message.topic, message.payload)
+            except (ValueError, KeyError):
+                return
+            for record in records:
+                run = injected_run(record)
+                # Only the block holding the trigger is traced, later blocks of the same transient are not counted
+                if run is not None and record.part is None and record.fields.get("BLOCK", record.fields.get("block", 0)) == 0:
+                    state["runs"][run] = state["runs"].get(run, 0) + 1
+
+    client = mqtt.Client()
+    client.on_message = on_message
+    client.on_connect = lambda _client, _userdata, _flags, _rc: client.subscribe([(base + "/Info", 0), (base + "/Data", 0)])
+
+    try:
+        client.connect(args.broker, args.port)
+        client.loop_start()
+
+        # The device pings on Info every PING_INTERVAL, a PNG command gets an answer sooner
+        client.publish(command_topic, json.dumps({"CMD": "PNG"}))
+        if not state["online"].wait(args.connect_timeout):
+            print("FAIL: no message from %s within %.0f s" % (base, args.connect_timeout))
+            return 1
+
+        ms = max(args.ms, TRACE_INJECT_MIN_MS)
+        timeout = args.count * ms / 1000.0 + TRACE_SETTLE_MS / 1000.0 + REPORT_MARGIN_S
+        state["running"] = True
+        client.publish(command_topic, trace_command(args.count, args.ms, args.budget_ms, args.min_rate))
+        if not state["done"].wait(timeout):
+            print("FAIL: no TRACE report within %.0f s" % timeout)
+            return 1
+        time.sleep(1)  # Data messages published just before the report
+
+        report = state["report"]
+        print(json.dumps(report))
+        events = state["runs"].get(report.get("RUN"), 0)
+        failures = check_report(report, args.count, args.budget_ms, args.min_rate, events)
+        for failure in failures:
+            print("FAIL: " + failure)
+        if not failures:
+            print("PASS: %d events, TOTAL P99 %d us" % (report["TRACED"], report["TOTAL"][2]))
+        return 1 if failures else 0
+    finally:
+        client.loop_stop()
+        client.disconnect()
+        if broker:
+            broker.terminate()
+            broker.wait()
+
+
+if __name__ == "__main__":
+    sys.exit(main())
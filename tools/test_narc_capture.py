@@ -0,0 +1,57 @@
+#!/usr/bin/env python3
+"""Host tests of narc_capture.py: python3 -m unittest discover tools"""
+
+import os
+import struct
+import sys
+import unittest
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+from narc_capture import FrameReader  # noqa: E402
+
+
+def frame(sequence, micros, values=(2048, 100)):
+    body = struct.pack("<II%dH" % len(values), sequence, micros, *values)
+    return b"\xa5\x5a" + body + bytes([sum(body) & 0xFF])
+
+
+class FrameReaderTest(unittest.TestCase):
+    def test_frames_in_order(self):
+        reader = FrameReader(2)
+        frames = reader.feed(frame(0, 10) + frame(1, 20, (1, 2)))
+        self.assertEqual([0, 1], [f.sequence for f in frames])
+        self.assertEqual((1, 2), frames[1].values)
+        self.assertEqual(0, reader.dropped)
+
+    def test_split_across_reads(self):
+        reader = FrameReader(2)
+        data = frame(5, 10) + frame(6, 20)
+        frames = []
+        for i in range(len(data)):
+            frames += reader.feed(data[i:i + 1])
+        self.assertEqual([5, 6], [f.sequence for f in frames])
+        self.assertEqual(0, reader.resyncs)
+
+    def test_sequence_jump_is_dropped(self):
+        reader = FrameReader(2)
+        reader.feed(frame(10, 0) + frame(11, 1) + frame(15, 2))
+        self.assertEqual(3, reader.dropped)
+
+    def test_text_and_bad_sum_skipped(self):
+        reader = FrameReader(2)
+        broken = bytearray(frame(1, 10))
+        broken[-1] ^= 0xFF
+        frames = reader.feed(b"Connected to 10.0.0.2\n" + frame(0, 5) + bytes(broken) + frame(2, 15))
+        self.assertEqual([0, 2], [f.sequence for f in frames])
+        self.assertEqual(1, reader.bad)
+        self.assertEqual(1, reader.dropped)
+
+    def test_micros_unwrapped(self):
+        reader = FrameReader(2)
+        frames = reader.feed(frame(0, 0xFFFFFFF0) + frame(1, 0x10))
+        self.assertEqual(0x100000010, frames[1].micros)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,102 @@
+#!/usr/bin/env python3
+"""Host tests of narc_consumer.py: python3 -m unittest discover tools"""
+
+import json
+import os
+import sys
+import unittest
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+from narc_consumer import Consumer, ack_commands, parse_payload  # noqa: E402
+
+TOPIC = "NARCCCCC!/SITE01/EC20-1/Data"
+
+
+def entry(seq, index):
+    return json.dumps({"Time": "2024-05-01 10:00:00 %d" % index, "SEQ": seq, "I": index, "Voltage": 2051.0})
+
+
+def event(seq, boot=1, samples=2):
+    return json.dumps({"EVENT": {"TIME": "2024-05-01 10:00:00 0", "SEQ": seq, "BOOT": boot, "BLOCK": 0,
+                                 "SAMPLES": samples, "RATE": 2000.0}})
+
+
+def deliver(consumer, seq, boot=1, samples=2):
+    fresh = []
+    for index in range(samples):
+        fresh += consumer.feed(TOPIC, entry(seq, index))
+    fresh += consumer.feed(TOPIC, event(seq, boot, samples))
+    return fresh
+
+
+class ParseTest(unittest.TestCase):
+    def test_json_parts(self):
+        record, = parse_payload(TOPIC, entry(7, 3))
+        self.assertEqual(("ENTRY", 7, 3), record.key())
+        self.assertEqual(("SITE01", "EC20-1"), (record.site, record.equipment))
+
+        record, = parse_payload(TOPIC, event(7, boot=4, samples=40))
+        self.assertEqual(("EVENT", 7, None), record.key())
+        self.assertEqual((4, 40), (record.boot, record.samples))
+
+    def test_influx_batch(self):
+        batch = "\n".join([
+            "narc,site=SITE01,equipmentID=EC20-1 voltage=2051.0,current=1880.0,seq=1042i,i=0i 1681234567123456000",
+            "narc,site=SITE01,equipmentID=EC20-1 voltage=2052.0,current=1881.0,seq=1042i,i=1i 1681234567123956000",
+            "narc_context,site=SITE01,equipmentID=EC20-1 seq=1042i,bucket=0i,voltageMin=2040.0 1681234537711456000",
+            "narc_event,site=SITE01,equipmentID=EC20-1 seq=1042i,boot=3i,block=0i,samples=2i,rate=2000.0 1681234567123456000",
+        ])
+        records = parse_payload(TOPIC, batch)
+        self.assertEqual([("ENTRY", 1042, 0), ("ENTRY", 1042, 1), ("CONTEXT", 1042, 0), ("EVENT", 1042, None)],
+                         [record.key() for record in records])
+        self.assertEqual((3, 2), (records[3].boot, records[3].samples))
+
+    def test_escaped_tags(self):
+        record, = parse_payload(None, r"narc,site=North\ Pit,equipmentID=EC\,20 seq=5i,i=0i 1")
+        self.assertEqual(("North Pit", "EC,20"), (record.site, record.equipment))
+
+
+class ConsumerTest(unittest.TestCase):
+    def setUp(self):
+        self.consumer = Consumer()
+        self.device = self.consumer.device("SITE01", "EC20-1")
+
+    def test_resend_is_deduplicated(self):
+        self.assertEqual(3, len(deliver(self.consumer, 10)))
+        self.assertEqual([], deliver(self.consumer, 10))
+        self.assertEqual(3, self.device.duplicates)
+
+    def test_gap_within_boot(self):
+        for seq in (10, 11, 14):
+            deliver(self.consumer, seq)
+        self.assertEqual([(12, 13)], self.device.gaps)
+        self.assertEqual(2, self.device.missing())
+
+    def test_late_event_closes_gap(self):
+        for seq in (10, 11, 15, 13):
+            deliver(self.consumer, seq)
+        self.assertEqual([(12, 12), (14, 14)], self.device.gaps)
+
+    def test_reboot_jump_is_not_a_gap(self):
+        deliver(self.consumer, 10, boot=1)
+        deliver(self.consumer, 1024, boot=2)
+        self.assertEqual([], self.device.gaps)
+        self.assertEqual((2, 1024), (self.device.boot, self.device.highest))
+
+    def test_acks_once_complete(self):
+        self.consumer.feed(TOPIC, event(20, samples=2))  # Summary ahead of the waveform
+        self.consumer.feed(TOPIC, entry(20, 0))
+        self.assertEqual([], self.device.take_acks())
+        self.consumer.feed(TOPIC, entry(20, 1))
+        self.assertEqual([20], self.device.take_acks())
+        self.assertEqual([], self.device.take_acks())
+
+    def test_ack_batches(self):
+        commands = [json.loads(command) for command in ack_commands(list(range(40)))]
+        self.assertEqual([16, 16, 8], [len(command["SEQ"]) for command in commands])
+        self.assertEqual("ACK", commands[0]["CMD"])
+
+
+if __name__ == "__main__":
+    unittest.main()
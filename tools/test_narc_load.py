@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+"""Host tests of narc_load.py: python3 -m unittest discover tools"""
+
+import os
+import random
+import sys
+import unittest
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+from narc_consumer import Consumer, parse_payload  # noqa: E402
+from narc_load import (ADC_FULL_SCALE, OVERRIDE_RANGE, QUEUE_RANGE, encode_event, load_report, percentiles,  # noqa: E402
+                       synthesize_event)
+
+TOPIC = "NARCCCCC!/SITE01/LOAD-3/Data"
+WHEN = 1681234567.25
+
+
+class LoadTest(unittest.TestCase):
+    def test_synthetic_event(self):
+        values = synthesize_event(random.Random(1), base=2000, peak=1500, spread=0, noise=0)
+        trigger = QUEUE_RANGE - OVERRIDE_RANGE - 1
+        self.assertEqual(QUEUE_RANGE, len(values))
+        self.assertEqual((2000, 1000), values[0])
+        self.assertEqual((3500, 1000), values[trigger])
+        self.assertEqual((2750, 1000), values[trigger + 4])  # Halves every 4 readings
+        self.assertEqual(2000 + (1500 >> 8), values[-1][0])
+
+    def test_synthetic_event_stays_in_adc_range(self):
+        for reading in synthesize_event(random.Random(2), base=4000, peak=3000, spread=500, noise=200):
+            self.assertTrue(all(0 <= value <= ADC_FULL_SCALE for value in reading))
+
+    def test_json_is_what_a_device_sends(self):
+        values = synthesize_event(random.Random(3))
+        payloads = encode_event("SITE01", "LOAD-3", 7, WHEN, values, "JSON")
+        self.assertEqual(QUEUE_RANGE + 1, len(payloads))
+
+        records = [record for payload in payloads for record in parse_payload(TOPIC, payload)]
+        entries = [record for record in records if record.kind == "ENTRY"]
+        self.assertEqual(list(range(QUEUE_RANGE)), [record.part for record in entries])
+        self.assertEqual(float(values[0][0]), entries[0].fields["Voltage"])
+        self.assertEqual(("EVENT", 7, QUEUE_RANGE), (records[-1].kind, records[-1].seq, records[-1].samples))
+        self.assertEqual(("SITE01", "LOAD-3"), (records[-1].site, records[-1].equipment))
+
+    def test_influx_is_one_batch(self):
+        values = synthesize_event(random.Random(4))
+        payloads = encode_event("SITE01", "LOAD-3", 7, WHEN, values, "INFLUX")
+        self.assertEqual(1, len(payloads))
+
+        records = parse_payload(TOPIC, payloads[0])
+        self.assertEqual(QUEUE_RANGE + 1, len(records))
+        self.assertEqual(float(values[5][1]), records[5].fields["current"])
+        self.assertTrue(payloads[0].split("\n")[1].endswith(" 1681234567250050000"))
+        self.assertEqual(("EVENT", 7, QUEUE_RANGE, "LOAD-3"),
+                         (records[-1].kind, records[-1].seq, records[-1].samples, records[-1].equipment))
+
+    def test_consumer_sees_complete_events(self):
+        consumer = Consumer()
+        for seq in range(3):
+            for payload in encode_event("SITE01", "LOAD-3", seq, WHEN + seq, synthesize_event(random.Random(seq))):
+                consumer.feed(TOPIC, payload)
+        device = consumer.device("SITE01", "LOAD-3")
+        self.assertEqual([0, 1, 2], sorted(device.take_acks()))
+        self.assertEqual([], device.gaps)
+
+    def test_percentiles(self):
+        self.assertEqual([0, 0, 0, 0], percentiles([]))
+        self.assertEqual([50, 90, 99, 99], percentiles(list(range(100))[::-1]))
+
+    def test_report(self):
+        report = load_report(10, "JSON", 2.0, 20, 820, 41000, [0.001, 0.002, 0.004])
+        self.assertEqual(410.0, report["MSGS_S"])
+        self.assertEqual(20500.0, report["BYTES_S"])
+        self.assertEqual(3, report["RECEIVED"])
+        self.assertEqual({"P50": 2000, "P90": 4000, "P99": 4000, "MAX": 4000}, report["LATENCY_US"])
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,113 @@
+#!/usr/bin/env python3
+"""Host tests of narc_sink.py: python3 -m unittest discover tools"""
+
+import os
+import struct
+import sys
+import unittest
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+from narc_sink import SPOOL_MAGIC, SPOOL_SECTOR_SIZE, serial_message, spool_records  # noqa: E402
+
+HEADER_SIZE = 12
+
+
+class SpoolImage:
+    """Writes records the way spool.cpp does: header on opening a sector, firstRecord when a record starts in it."""
+
+    def __init__(self, sectors=4, sequence=0, sector=0):
+        self.image = bytearray(b"\xff" * (sectors * SPOOL_SECTOR_SIZE))
+        self.sectors = sectors
+        self.sector = sector
+        self.used = 0
+        self.sequence = sequence
+        self.started = False
+
+    def _append(self, data, record_start):
+        for byte in data:
+            if self.used == 0:
+                base = self.sector * SPOOL_SECTOR_SIZE
+                self.image[base:base + SPOOL_SECTOR_SIZE] = b"\xff" * SPOOL_SECTOR_SIZE
+                struct.pack_into("<II", self.image, base, SPOOL_MAGIC, self.sequence)
+                self.sequence += 1
+                self.used = HEADER_SIZE
+                self.started = False
+            if record_start and not self.started:
+                struct.pack_into("<H", self.image, self.sector * SPOOL_SECTOR_SIZE + 8, self.used)
+                self.started = True
+            record_start = False
+            self.image[self.sector * SPOOL_SECTOR_SIZE + self.used] = byte
+            self.used += 1
+            if self.used == SPOOL_SECTOR_SIZE:
+                self.sector = (self.sector + 1) % self.sectors
+                self.used = 0
+
+    def write(self, message):
+        data = message.encode()
+        self._append(struct.pack("<H", len(data)), True)
+        self._append(data, False)
+
+    def reboot(self):
+        """spoolBegin: carry on in the sector after the newest."""
+        self.sector = (self.sector + 1) % self.sectors
+        self.used = 0
+
+
+def lines(count, start=0, width=300):
+    return ["narc,site=S,equipmentID=E voltage=%di,seq=%di %s" % (i, i, "x" * width) for i in range(start, start + count)]
+
+
+class SpoolTest(unittest.TestCase):
+    def test_records_across_sectors(self):
+        spool = SpoolImage()
+        messages = lines(30)
+        for message in messages:
+            spool.write(message)
+        self.assertEqual(messages, spool_records(bytes(spool.image)))
+
+    def test_ring_wrap_starts_at_oldest_record(self):
+        spool = SpoolImage(sectors=3)
+        messages = lines(60)
+        for message in messages:
+            spool.write(message)
+        records = spool_records(bytes(spool.image))
+        self.assertTrue(records)
+        self.assertEqual(messages[-len(records):], records)
+
+    def test_reboot_skips_unfinished_sector_tail(self):
+        spool = SpoolImage()
+        first, second = lines(5), lines(5, start=5)
+        for message in first:
+            spool.write(message)
+        spool.reboot()
+        for message in second:
+            spool.write(message)
+        self.assertEqual(first + second, spool_records(bytes(spool.image)))
+
+    def test_torn_record_skipped(self):
+        spool = SpoolImage()
+        first, second = lines(5), lines(20, start=5)
+        for message in first:
+            spool.write(message)
+        torn = spool.sector * SPOOL_SECTOR_SIZE + spool.used
+        spool.write("y" * 200)
+        spool.image[torn + 100:torn + 202] = b"\xff" * 102  # Last page never programmed
+        spool.reboot()
+        for message in second:
+            spool.write(message)
+        self.assertEqual(first + second, spool_records(bytes(spool.image)))
+
+    def test_empty_partition(self):
+        self.assertEqual([], spool_records(b"\xff" * (2 * SPOOL_SECTOR_SIZE)))
+
+
+class SerialTest(unittest.TestCase):
+    def test_messages_only(self):
+        self.assertEqual('{"SEQ":1,"I":0}', serial_message(b'{"SEQ":1,"I":0}\r\n'))
+        self.assertIsNone(serial_message(b"Connected to 10.0.0.2\n"))
+        self.assertIsNone(serial_message(b'{"SEQ":1,"I\n'))
+
+
+if __name__ == "__main__":
+    unittest.main()
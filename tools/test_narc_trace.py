@@ -0,0 +1,67 @@
+#!/usr/bin/env python3
+"""Host tests of narc_trace.py: python3 -m unittest discover tools"""
+
+import json
+import os
+import sys
+import unittest
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+from narc_consumer import parse_payload  # noqa: E402
+from narc_trace import check_report, injected_run, trace_command, trace_report  # noqa: E402
+
+
+def report(**fields):
+    """A passing run of 20 transients, fields overridden."""
+    body = {"RUN": 3, "INJECTED": 20, "TRACED": 20, "LOST": 0, "SECONDS": 10.4, "EVENTS_S": 1.92, "BYTES_S": 310.5,
+            "CAPTURE": [40, 60, 90, 95], "HANDOVER": [5, 8, 12, 12], "ENCODE": [900, 1200, 1500, 1600],
+            "TRANSMIT": [3000, 5000, 9000, 9500], "TOTAL": [4000, 6300, 10600, 11200],
+            "BUDGET_MS": 250, "MIN_RATE": 1.0, "RESULT": "PASS"}
+    body.update(fields)
+    return body
+
+
+class TraceTest(unittest.TestCase):
+    def test_command(self):
+        command = json.loads(trace_command(20, 500, 250, 1.5))
+        self.assertEqual({"CMD": "TRACE", "COUNT": 20, "MS": 500, "BUDGET_MS": 250, "MIN_RATE": 1.5}, command)
+
+    def test_report_only_from_run(self):
+        self.assertEqual(20, trace_report(json.dumps({"TRACE": report()}).encode())["TRACED"])
+        # The TRACE object of a STATS reply has no RESULT
+        self.assertIsNone(trace_report('{"HEAP":1000,"TRACE":{"N":3,"TOTAL":[1,2,3,4]}}'))
+        self.assertIsNone(trace_report('{"REPLY":{"ID":null,"STATUS":"OK"}}'))
+        self.assertIsNone(trace_report("not json"))
+
+    def test_pass(self):
+        self.assertEqual([], check_report(report(), 20, 250, 1.0, events_seen=20))
+
+    def test_failures(self):
+        self.assertTrue(check_report(report(RESULT="FAIL"), 20, 250))
+        self.assertTrue(check_report(report(TRACED=19, LOST=1), 20, 250))
+        self.assertTrue(check_report(report(INJECTED=10, TRACED=10), 20, 250))
+        self.assertTrue(check_report(report(TOTAL=[4000, 6300, 260000, 270000]), 20, 250))
+        self.assertTrue(check_report(report(EVENTS_S=0.5), 20, 250, 1.0))
+        self.assertTrue(check_report(report(), 20, 250, events_seen=18))
+        self.assertTrue(check_report(report(ENCODE=None), 20, 250))
+
+    def test_injected_marker(self):
+        topic = "NARCCCCC!/SITE01/EQ1/Data"
+        marked = parse_payload(topic, '{"EVENT":{"TIME":"2023-04-11 17:02:47 12","SEQ":7,"BOOT":1,"BLOCK":0,"SAMPLES":40,'
+                                      '"INJECTED":3}}')
+        real = parse_payload(topic, '{"EVENT":{"TIME":"2023-04-11 17:02:47 12","SEQ":8,"BOOT":1,"BLOCK":0,"SAMPLES":40}}')
+        line = parse_payload(topic, "narc_event,site=SITE01,equipmentID=EQ1 seq=9i,boot=1i,block=0i,samples=40i,"
+                                    "injected=3i 1681234567123456000")
+        entry = parse_payload(topic, '{"Time":"2023-04-11 17:02:47 12","SEQ":7,"I":0,"Voltage":4095.0}')
+        self.assertEqual(3, injected_run(marked[0]))
+        self.assertIsNone(injected_run(real[0]))
+        self.assertEqual(3, injected_run(line[0]))
+        self.assertIsNone(injected_run(entry[0]))
+
+    def test_count_clamped_like_the_device(self):
+        self.assertEqual([], check_report(report(INJECTED=1000, TRACED=1000), 5000, 250))
+
+
+if __name__ == "__main__":
+    unittest.main()